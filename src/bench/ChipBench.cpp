@@ -0,0 +1,643 @@
+#include <string.h>
+#include <cmath>
+#include <algorithm>
+#include "ChipBench.hpp"
+#include "core/time.hpp"
+#include "famitracker-core/APU/APU.h"
+#include "famitracker-core/APU/Mixer.h"
+#include "famitracker-core/APU/Square.h"
+#include "famitracker-core/APU/Triangle.h"
+#include "famitracker-core/APU/Noise.h"
+#include "famitracker-core/APU/DPCM.h"
+#include "famitracker-core/APU/VRC6.h"
+#include "famitracker-core/APU/MMC5.h"
+#include "famitracker-core/APU/FDS.h"
+#include "famitracker-core/APU/N106.h"
+#include "famitracker-core/APU/VRC7.h"
+
+static const char * const CHIP_NAMES[ChipBench::CHIPS] = {
+	"square", "triangle", "noise", "dpcm", "vrc6", "mmc5", "fds", "n106", "vrc7", "mixer"
+};
+
+static const char * const STREAM_NAMES[ChipBench::STREAMS] = {
+	"steady", "arpeggio", "sweep", "silence"
+};
+
+static const uint8 CHIP_FLAGS[ChipBench::CHIPS] = {
+	SNDCHIP_NONE, SNDCHIP_NONE, SNDCHIP_NONE, SNDCHIP_NONE,
+	SNDCHIP_VRC6, SNDCHIP_MMC5, SNDCHIP_FDS, SNDCHIP_N106, SNDCHIP_VRC7, SNDCHIP_NONE
+};
+
+// An A major chord, chips with fewer voices play the lower notes
+static const double CHORD[] = { 440.0, 554.37, 659.26, 880.0 };
+
+// A major arpeggio, as frequency factors
+static const double ARPEGGIO[] = { 1.0, 1.25992, 1.49831 };
+
+static const unsigned int SWEEP_FRAMES = 30;
+
+static const unsigned int DPCM_SAMPLE_SIZE = 0xFF1;
+
+// Cycles between frame sequencer steps, as in the APU
+static const uint32 SEQUENCER_PERIOD = 7458;
+
+// Output rate of the OPLL in the VRC7
+static const double VRC7_RATE = 3579545 / 72.0;
+
+// How much higher than its note a voice plays on a frame
+static double pitchAt(int stream, unsigned int frame)
+{
+	switch (stream)
+	{
+	case ChipBench::STREAM_ARPEGGIO:
+		return ARPEGGIO[frame % 3];
+	case ChipBench::STREAM_SWEEP:
+		// Up a fifth, then over again
+		return pow(1.5, double(frame % SWEEP_FRAMES) / SWEEP_FRAMES);
+	default:
+		return 1.0;
+	}
+}
+
+// Period register of a 2A03 style divider
+static uint32 periodOf(double freq, int steps)
+{
+	return uint32(CAPU::BASE_FREQ_NTSC / (steps * freq) - 1);
+}
+
+// One chip fed with register writes at the start of each frame
+struct _chipbench_driver_t
+{
+	virtual ~_chipbench_driver_t(){}
+
+	virtual void write(int stream, unsigned int frame)
+	{
+		if (frame == 0)
+			setup(stream == ChipBench::STREAM_SILENCE ? 0 : 15);
+		if (frame == 0 || stream == ChipBench::STREAM_ARPEGGIO || stream == ChipBench::STREAM_SWEEP)
+			tune(pitchAt(stream, frame));
+	}
+	// Turns the voices on at volume, 0 to 15
+	virtual void setup(int volume) = 0;
+	virtual void tune(double pitch) = 0;
+
+	virtual void process(uint32 time) = 0;
+	// Frame sequencer clocks, for the chips that have units run by it
+	virtual void quarterFrame(){}
+	virtual void halfFrame(){}
+	virtual void endFrame() = 0;
+};
+
+// Runs a 2A03 channel the way CAPU::Process does, a period at a time
+template <class T>
+static inline void processSteps(T *chan, uint32 time)
+{
+	while (time > 0)
+	{
+		uint32 step = std::min(std::max<uint32>(chan->GetPeriod(), 7), time);
+		chan->Process(step);
+		time -= step;
+	}
+}
+
+struct _chipbench_square_t : public _chipbench_driver_t
+{
+	CSquare square;
+	uint8 high;
+
+	_chipbench_square_t(CMixer *mixer)
+		: square(mixer, CHANID_SQUARE1, SNDCHIP_NONE), high(0xFF)
+	{
+		square.Reset();
+	}
+
+	void write(int stream, unsigned int frame)
+	{
+		if (stream != ChipBench::STREAM_SWEEP)
+		{
+			_chipbench_driver_t::write(stream, frame);
+			return;
+		}
+
+		// The sweep unit does the sliding, a new note restarts it
+		if (frame == 0)
+			setup(15);
+		if (frame % SWEEP_FRAMES == 0)
+		{
+			square.Write(0x01, 0x9B);
+			high = 0xFF;
+			tune(1.0);
+		}
+	}
+	void setup(int volume)
+	{
+		square.WriteControl(0x01);
+		square.Write(0x00, 0xB0 | volume);
+		square.Write(0x01, 0x08);
+	}
+	void tune(double pitch)
+	{
+		uint32 period = periodOf(CHORD[0] * pitch, 16);
+		square.Write(0x02, period & 0xFF);
+		// Writing the high byte restarts the waveform
+		if ((period >> 8) != high)
+		{
+			high = period >> 8;
+			square.Write(0x03, high);
+		}
+	}
+	void process(uint32 time){ processSteps(&square, time); }
+	void quarterFrame(){ square.EnvelopeUpdate(); }
+	void halfFrame()
+	{
+		square.SweepUpdate(1);
+		square.LengthCounterUpdate();
+	}
+	void endFrame(){ square.EndFrame(); }
+};
+
+struct _chipbench_triangle_t : public _chipbench_driver_t
+{
+	CTriangle triangle;
+
+	_chipbench_triangle_t(CMixer *mixer)
+		: triangle(mixer, CHANID_TRIANGLE)
+	{
+		triangle.Reset();
+	}
+
+	void setup(int volume)
+	{
+		// No volume, silence is a stopped linear counter
+		triangle.WriteControl(0x01);
+		triangle.Write(0x00, volume > 0 ? 0xFF : 0x80);
+	}
+	void tune(double pitch)
+	{
+		uint32 period = periodOf(CHORD[0] * pitch, 32);
+		triangle.Write(0x02, period & 0xFF);
+		triangle.Write(0x03, period >> 8);
+	}
+	void process(uint32 time){ processSteps(&triangle, time); }
+	void quarterFrame(){ triangle.LinearCounterUpdate(); }
+	void halfFrame(){ triangle.LengthCounterUpdate(); }
+	void endFrame(){ triangle.EndFrame(); }
+};
+
+struct _chipbench_noise_t : public _chipbench_driver_t
+{
+	CNoise noise;
+
+	_chipbench_noise_t(CMixer *mixer)
+		: noise(mixer, CHANID_NOISE)
+	{
+		noise.Reset();
+	}
+
+	void setup(int volume)
+	{
+		noise.WriteControl(0x01);
+		noise.Write(0x00, 0x30 | volume);
+		noise.Write(0x03, 0x00);
+	}
+	void tune(double pitch)
+	{
+		// Higher pitches are lower period indices
+		int index = 8 - int(log(pitch) / log(1.5) * 8 + 0.5);
+		noise.Write(0x02, index);
+	}
+	void process(uint32 time){ processSteps(&noise, time); }
+	void quarterFrame(){ noise.EnvelopeUpdate(); }
+	void halfFrame(){ noise.LengthCounterUpdate(); }
+	void endFrame(){ noise.EndFrame(); }
+};
+
+struct _chipbench_dpcm_t : public _chipbench_driver_t
+{
+	CDPCM dpcm;
+
+	_chipbench_dpcm_t(CMixer *mixer, CSampleMem *mem)
+		: dpcm(mixer, mem, CHANID_DPCM)
+	{
+		dpcm.Reset();
+	}
+
+	void setup(int volume)
+	{
+		// Silence leaves the sample stopped
+		dpcm.Write(0x00, 0x4F);
+		dpcm.Write(0x01, volume > 0 ? 0x40 : 0x00);
+		dpcm.Write(0x02, 0x00);
+		dpcm.Write(0x03, (DPCM_SAMPLE_SIZE - 1) / 16);
+		dpcm.WriteControl(volume > 0 ? 0x01 : 0x00);
+	}
+	void tune(double pitch)
+	{
+		// The rate goes up with the pitch, looping
+		int rate = 15 - int(log(pitch) / log(1.5) * 8 + 0.5);
+		dpcm.Write(0x00, 0x40 | rate);
+	}
+	void process(uint32 time){ processSteps(&dpcm, time); }
+	void endFrame(){ dpcm.EndFrame(); }
+};
+
+// CExternal chips, through their memory mapped registers
+struct _chipbench_external_t : public _chipbench_driver_t
+{
+	CExternal *chip;
+
+	_chipbench_external_t(CExternal *c)
+		: chip(c)
+	{
+		chip->Reset();
+	}
+	~_chipbench_external_t()
+	{
+		delete chip;
+	}
+
+	void process(uint32 time){ chip->Process(time); }
+	void endFrame(){ chip->EndFrame(); }
+};
+
+struct _chipbench_vrc6_t : public _chipbench_external_t
+{
+	_chipbench_vrc6_t(CMixer *mixer)
+		: _chipbench_external_t(new CVRC6(mixer))
+	{
+	}
+
+	void setup(int volume)
+	{
+		chip->Write(0x9000, 0x70 | volume);
+		chip->Write(0xA000, 0x30 | volume);
+		chip->Write(0xB000, volume * 2);
+	}
+	void tune(double pitch)
+	{
+		for (int i = 0; i < 2; i++)
+		{
+			uint32 period = periodOf(CHORD[i + 1] * pitch, 16);
+			chip->Write(0x9001 + i * 0x1000, period & 0xFF);
+			chip->Write(0x9002 + i * 0x1000, 0x80 | (period >> 8));
+		}
+		uint32 period = periodOf(CHORD[0] * pitch / 2, 14);
+		chip->Write(0xB001, period & 0xFF);
+		chip->Write(0xB002, 0x80 | (period >> 8));
+	}
+};
+
+struct _chipbench_mmc5_t : public _chipbench_external_t
+{
+	uint8 high[2];
+
+	_chipbench_mmc5_t(CMixer *mixer)
+		: _chipbench_external_t(new CMMC5(mixer))
+	{
+		high[0] = high[1] = 0xFF;
+	}
+
+	void setup(int volume)
+	{
+		chip->Write(0x5015, 0x03);
+		chip->Write(0x5000, 0xB0 | volume);
+		chip->Write(0x5004, 0x70 | volume);
+	}
+	void tune(double pitch)
+	{
+		for (int i = 0; i < 2; i++)
+		{
+			uint32 period = periodOf(CHORD[i * 2] * pitch, 16);
+			chip->Write(0x5002 + i * 4, period & 0xFF);
+			if ((period >> 8) != high[i])
+			{
+				high[i] = period >> 8;
+				chip->Write(0x5003 + i * 4, high[i]);
+			}
+		}
+	}
+};
+
+struct _chipbench_fds_t : public _chipbench_external_t
+{
+	_chipbench_fds_t(CMixer *mixer)
+		: _chipbench_external_t(new CFDS(mixer))
+	{
+	}
+
+	void write(int stream, unsigned int frame)
+	{
+		_chipbench_driver_t::write(stream, frame);
+
+		// The modulator is part of what a sweep costs on the FDS
+		if (stream == ChipBench::STREAM_SWEEP && frame == 0)
+		{
+			chip->Write(0x4087, 0x80);
+			chip->Write(0x4085, 0x00);
+			for (int i = 0; i < 32; i++)
+			{
+				chip->Write(0x4088, (i & 8) ? 7 : 1);
+			}
+			chip->Write(0x4084, 0x80 | 0x10);
+			chip->Write(0x4086, 0x40);
+			chip->Write(0x4087, 0x00);
+		}
+	}
+	void setup(int volume)
+	{
+		// A triangle wave
+		chip->Write(0x4089, 0x80);
+		for (int i = 0; i < 64; i++)
+		{
+			chip->Write(0x4040 + i, i < 32 ? i * 2 : 127 - i * 2);
+		}
+		chip->Write(0x4089, 0x00);
+		chip->Write(0x4080, 0x80 | (volume * 2));
+		chip->Write(0x4087, 0x80);
+	}
+	void tune(double pitch)
+	{
+		uint32 freq = uint32(CHORD[0] * pitch * 64 * 65536 / CAPU::BASE_FREQ_NTSC);
+		chip->Write(0x4082, freq & 0xFF);
+		chip->Write(0x4083, (freq >> 8) & 0x0F);
+	}
+};
+
+struct _chipbench_n106_t : public _chipbench_external_t
+{
+	static const int VOICES = 4;
+
+	_chipbench_n106_t(CMixer *mixer)
+		: _chipbench_external_t(new CN106(mixer))
+	{
+	}
+
+	void writeReg(int voice, int reg, uint8 value)
+	{
+		// The last voices are the ones played
+		chip->Write(0xF800, 0x40 + (8 - VOICES + voice) * 8 + reg);
+		chip->Write(0x4800, value);
+	}
+	void setup(int volume)
+	{
+		// A triangle wave of 32 samples at the start of the wave RAM
+		chip->Write(0xF800, 0x80);
+		for (int i = 0; i < 16; i++)
+		{
+			int a = i * 2 < 16 ? i * 2 : 31 - i * 2;
+			int b = i * 2 + 1 < 16 ? i * 2 + 1 : 30 - i * 2;
+			chip->Write(0x4800, a | (b << 4));
+		}
+
+		for (int i = 0; i < VOICES; i++)
+		{
+			writeReg(i, 6, 0x00);
+			// The volume of the last voice also sets how many are played
+			writeReg(i, 7, (i == VOICES - 1 ? (VOICES - 1) << 4 : 0) | volume);
+		}
+	}
+	void tune(double pitch)
+	{
+		for (int i = 0; i < VOICES; i++)
+		{
+			uint32 freq = uint32(CHORD[i] * pitch * 32 * VOICES * 45 * 0x40000 / 21477270.0);
+			writeReg(i, 0, freq & 0xFF);
+			writeReg(i, 2, (freq >> 8) & 0xFF);
+			writeReg(i, 4, (freq >> 16) & 0x03);
+		}
+	}
+};
+
+struct _chipbench_vrc7_t : public _chipbench_external_t
+{
+	static const int VOICES = 3;
+
+	uint8 keys;
+
+	_chipbench_vrc7_t(CMixer *mixer, unsigned int sampleRate)
+		: _chipbench_external_t(new CVRC7(mixer)), keys(0)
+	{
+		CVRC7 *vrc7 = (CVRC7*)chip;
+		vrc7->SetSampleSpeed(sampleRate, CAPU::BASE_FREQ_NTSC, CAPU::FRAME_RATE_NTSC);
+		vrc7->SetVolume(1.0f);
+		vrc7->Reset();
+	}
+
+	void writeReg(uint8 reg, uint8 value)
+	{
+		chip->Write(0x9010, reg);
+		chip->Write(0x9030, value);
+	}
+	void setup(int volume)
+	{
+		// Silence is the keys held up
+		for (int i = 0; i < VOICES; i++)
+		{
+			writeReg(0x30 + i, 0x10 | (15 - volume));
+		}
+		keys = volume > 0 ? 0x10 : 0x00;
+	}
+	void tune(double pitch)
+	{
+		for (int i = 0; i < VOICES; i++)
+		{
+			// The lowest block that fits the frequency in 9 bits
+			double fnum = CHORD[i] * pitch * (1 << 19) / VRC7_RATE;
+			int block = 1;
+			while (fnum >= 512 && block < 7)
+			{
+				fnum /= 2;
+				block++;
+			}
+			int f = int(fnum);
+			writeReg(0x10 + i, f & 0xFF);
+			writeReg(0x20 + i, keys | (block << 1) | (f >> 8));
+		}
+	}
+};
+
+// The mixer and blip buffer alone, given a square wave
+struct _chipbench_mixer_t : public _chipbench_driver_t
+{
+	CMixer *mixer;
+	int32 volume;
+	bool high;
+	uint32 period;
+	uint32 counter;
+	uint32 time;
+
+	_chipbench_mixer_t(CMixer *m)
+		: mixer(m), volume(0), high(false), period(0), counter(0), time(0)
+	{
+	}
+
+	void setup(int v)
+	{
+		volume = v;
+	}
+	void tune(double pitch)
+	{
+		// Half a period of a square wave
+		period = uint32(CAPU::BASE_FREQ_NTSC / (CHORD[0] * pitch) / 2);
+	}
+	void process(uint32 t)
+	{
+		if (volume == 0)
+		{
+			time += t;
+			return;
+		}
+
+		while (t >= counter)
+		{
+			t -= counter;
+			time += counter;
+			counter = period;
+			high = !high;
+			int32 value = high ? volume : 0;
+			mixer->AddValue(CHANID_SQUARE1, SNDCHIP_NONE, value, value, time);
+		}
+		counter -= t;
+		time += t;
+	}
+	void endFrame()
+	{
+		time = 0;
+	}
+};
+
+ChipBench::ChipBench(unsigned int sampleRate)
+	: m_sampleRate(sampleRate)
+{
+	// Some noise for the DPCM channel to play
+	m_samples = new char[DPCM_SAMPLE_SIZE];
+	uint32 seed = 1;
+	for (unsigned int i = 0; i < DPCM_SAMPLE_SIZE; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		m_samples[i] = char(seed >> 24);
+	}
+
+	m_sampleMem = new CSampleMem;
+	m_sampleMem->SetMem(m_samples, DPCM_SAMPLE_SIZE);
+}
+
+ChipBench::~ChipBench()
+{
+	delete m_sampleMem;
+	delete[] m_samples;
+}
+
+ChipBench::result_t ChipBench::run(int chip, int stream, unsigned int frames)
+{
+	const uint32 frameCycles = CAPU::BASE_FREQ_NTSC / CAPU::FRAME_RATE_NTSC;
+
+	CMixer *mixer = new CMixer;
+	unsigned int bufferSamples = m_sampleRate / CAPU::FRAME_RATE_PAL;
+	mixer->AllocateBuffer(bufferSamples, m_sampleRate, 1);
+	mixer->SetClockRate(CAPU::BASE_FREQ_NTSC);
+	mixer->UpdateSettings(16, 12000, 24, 100);
+	mixer->ExternalSound(CHIP_FLAGS[chip]);
+	mixer->ClearBuffer();
+
+	_chipbench_driver_t *driver = NULL;
+	switch (chip)
+	{
+	case CHIP_SQUARE: driver = new _chipbench_square_t(mixer); break;
+	case CHIP_TRIANGLE: driver = new _chipbench_triangle_t(mixer); break;
+	case CHIP_NOISE: driver = new _chipbench_noise_t(mixer); break;
+	case CHIP_DPCM: driver = new _chipbench_dpcm_t(mixer, m_sampleMem); break;
+	case CHIP_VRC6: driver = new _chipbench_vrc6_t(mixer); break;
+	case CHIP_MMC5: driver = new _chipbench_mmc5_t(mixer); break;
+	case CHIP_FDS: driver = new _chipbench_fds_t(mixer); break;
+	case CHIP_N106: driver = new _chipbench_n106_t(mixer); break;
+	case CHIP_VRC7: driver = new _chipbench_vrc7_t(mixer, m_sampleRate); break;
+	case CHIP_MIXER: driver = new _chipbench_mixer_t(mixer); break;
+	}
+
+	blip_sample_t *buffer = new blip_sample_t[bufferSamples * 2];
+
+	result_t r;
+	r.chip = chip;
+	r.stream = stream;
+	r.frames = frames;
+	r.cycles = core::u64(frames) * frameCycles;
+	r.samples = 0;
+	r.ns = 0;
+
+	uint32 sequencerClock = SEQUENCER_PERIOD;
+	int sequence = 0;
+
+	for (unsigned int f = 0; f < frames; f++)
+	{
+		driver->write(stream, f);
+
+		core::u64 start = core::monotonic_ns();
+
+		// Stop at the frame sequencer steps, as the APU does
+		uint32 left = frameCycles;
+		while (left > 0)
+		{
+			uint32 time = std::min(left, sequencerClock);
+			driver->process(time);
+			left -= time;
+			sequencerClock -= time;
+
+			if (sequencerClock == 0)
+			{
+				sequencerClock = SEQUENCER_PERIOD;
+				sequence = (sequence + 1) % 4;
+				driver->quarterFrame();
+				if (sequence & 1)
+					driver->halfFrame();
+			}
+		}
+		driver->endFrame();
+
+		core::u64 chipEnd = core::monotonic_ns();
+
+		int avail = mixer->FinishBuffer(frameCycles);
+		r.samples += mixer->ReadBuffer(avail, buffer, false);
+
+		if (chip == CHIP_MIXER)
+			r.ns += core::monotonic_ns() - start;
+		else
+			r.ns += chipEnd - start;
+	}
+
+	delete[] buffer;
+	delete driver;
+	delete mixer;
+
+	return r;
+}
+
+const char * ChipBench::chipName(int chip)
+{
+	return CHIP_NAMES[chip];
+}
+
+const char * ChipBench::streamName(int stream)
+{
+	return STREAM_NAMES[stream];
+}
+
+int ChipBench::findChip(const char *name)
+{
+	for (int i = 0; i < CHIPS; i++)
+	{
+		if (strcmp(CHIP_NAMES[i], name) == 0)
+			return i;
+	}
+	return -1;
+}
+
+int ChipBench::findStream(const char *name)
+{
+	for (int i = 0; i < STREAMS; i++)
+	{
+		if (strcmp(STREAM_NAMES[i], name) == 0)
+			return i;
+	}
+	return -1;
+}
@@ -0,0 +1,69 @@
+#ifndef _CHIPBENCH_HPP_
+#define _CHIPBENCH_HPP_
+
+#include "core/types.hpp"
+
+class CSampleMem;
+
+// Runs one sound chip at a time, outside of the APU and the tracker, on a
+// made up register stream and measures how fast it is emulated. The chips
+// mix into a mixer of their own, which is only timed for CHIP_MIXER. There
+// the mixer and blip buffer are fed a square wave directly
+class ChipBench
+{
+public:
+	enum
+	{
+		CHIP_SQUARE,
+		CHIP_TRIANGLE,
+		CHIP_NOISE,
+		CHIP_DPCM,
+		CHIP_VRC6,
+		CHIP_MMC5,
+		CHIP_FDS,
+		CHIP_N106,
+		CHIP_VRC7,
+		CHIP_MIXER,
+		CHIPS
+	};
+
+	enum
+	{
+		STREAM_STEADY,								// Set up once, then left alone
+		STREAM_ARPEGGIO,							// A new note every frame
+		STREAM_SWEEP,								// Pitch sliding up, by the sweep unit where there is one
+		STREAM_SILENCE,								// Set up with no volume
+		STREAMS
+	};
+
+	struct result_t
+	{
+		int chip;
+		int stream;
+		core::u64 frames;
+		core::u64 cycles;							// Emulated CPU cycles
+		core::u64 samples;							// Samples read out of the mixer
+		core::u64 ns;								// Time spent in the chip, or the mixer for CHIP_MIXER
+
+		double cyclesPerSecond() const{ return ns > 0 ? cycles * 1e9 / ns : 0; }
+		double nsPerSample() const{ return samples > 0 ? double(ns) / samples : 0; }
+	};
+
+	ChipBench(unsigned int sampleRate=48000);
+	~ChipBench();
+
+	// Emulates frames NTSC frames, a frame is timed as a whole
+	result_t run(int chip, int stream, unsigned int frames);
+
+	static const char * chipName(int chip);
+	static const char * streamName(int stream);
+	// -1 for an unknown name
+	static int findChip(const char *name);
+	static int findStream(const char *name);
+private:
+	unsigned int m_sampleRate;
+	CSampleMem * m_sampleMem;
+	char * m_samples;								// DPCM sample played from m_sampleMem
+};
+
+#endif
@@ -0,0 +1,271 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "core/common/platform.hpp"
+#include "ChipBench.hpp"
+#include "../parse_arguments.hpp"
+#include "../version.hpp"
+
+#ifdef POSIX
+#include <unistd.h>
+#include <sys/utsname.h>
+#endif
+
+#ifndef BENCH_BUILD_TYPE
+#define BENCH_BUILD_TYPE "default"
+#endif
+
+struct arguments_t
+{
+	bool help;
+	bool json;
+	int frames;
+	int repeat;
+	int sampleRate;
+	std::string chip;
+	std::string stream;
+};
+
+static void parse_arguments(int argc, char *argv[], arguments_t &a)
+{
+	ParseArguments pa;
+	const char *flagfields[] = {"-help", "-json"};
+	pa.setFlagFields(flagfields, 2);
+	pa.parse(argv, argc);
+
+	a.help = pa.flag("-help");
+
+	if (a.help)
+		return;
+
+	a.json = pa.flag("-json");
+	a.frames = pa.integer("frames", 600);
+	a.repeat = pa.integer("repeat", 5);
+	a.sampleRate = pa.integer("sr", 48000);
+	a.chip = pa.string("chip", "");
+	a.stream = pa.string("stream", "");
+}
+
+// What was run where, printed with the results so they can be compared
+// between builds and machines
+struct bench_info_t
+{
+	std::string version;
+	std::string build;							// Compiler and build type
+	std::string host;
+	std::string os;
+	std::string cpu;
+};
+
+static void get_bench_info(bench_info_t &info)
+{
+	info.version = VERSION_STRING VERSION_STRING_MISC;
+
+#if defined(__clang__)
+	info.build = "clang " __clang_version__;
+#elif defined(__GNUC__)
+	info.build = "gcc " __VERSION__;
+#elif defined(_MSC_VER)
+	char msc[32];
+	sprintf(msc, "msvc %d", _MSC_VER);
+	info.build = msc;
+#else
+	info.build = "unknown compiler";
+#endif
+	info.build += " " BENCH_BUILD_TYPE;
+#ifndef NDEBUG
+	info.build += " assertions";
+#endif
+
+	info.host = "unknown";
+	info.os = "unknown";
+	info.cpu = "unknown";
+#ifdef POSIX
+	char host[256];
+	if (gethostname(host, sizeof(host)) == 0)
+	{
+		host[sizeof(host)-1] = 0;
+		info.host = host;
+	}
+
+	struct utsname uts;
+	if (uname(&uts) == 0)
+	{
+		info.os = std::string(uts.sysname) + " " + uts.release + " " + uts.machine;
+	}
+#endif
+#ifdef LINUX
+	FILE *f = fopen("/proc/cpuinfo", "r");
+	if (f != NULL)
+	{
+		char line[256];
+		while (fgets(line, sizeof(line), f) != NULL)
+		{
+			if (strncmp(line, "model name", 10) != 0)
+				continue;
+			const char *value = strchr(line, ':');
+			if (value == NULL)
+				continue;
+			value += strspn(value + 1, " \t") + 1;
+			info.cpu.assign(value, strcspn(value, "\r\n"));
+			break;
+		}
+		fclose(f);
+	}
+#endif
+#ifdef WINDOWS
+	const char *host = getenv("COMPUTERNAME");
+	if (host != NULL)
+		info.host = host;
+	info.os = "Windows";
+	const char *cpu = getenv("PROCESSOR_IDENTIFIER");
+	if (cpu != NULL)
+		info.cpu = cpu;
+#endif
+}
+
+// Quoted for JSON, or for CSV when csv is set
+static std::string quote(const std::string &s, bool csv)
+{
+	std::string q = "\"";
+	for (unsigned int i = 0; i < s.size(); i++)
+	{
+		char c = s[i];
+		if (c == '"')
+			q += csv ? "\"\"" : "\\\"";
+		else if (c == '\\' && !csv)
+			q += "\\\\";
+		else if ((unsigned char)c >= 0x20)
+			q += c;
+	}
+	return q + "\"";
+}
+
+static void print_help()
+{
+	printf(
+"Usage: famicx-bench [-chip CHIP] [-stream STREAM] [-frames FRAMES] [-repeat COUNT] [-sr SAMPLERATE] [--json] [--help]\n\n"
+"Emulates each sound chip on its own and prints how fast it runs, one\n"
+"line per chip and register stream as CSV, or as JSON with --json.\n"
+"cycles_per_sec is emulated CPU cycles per second, ns_per_sample is the\n"
+"time spent for each sample of output. Every CSV line and the JSON header\n"
+"also name the version, the compiler and build type, the host, the OS and\n"
+"the CPU, so results of different builds and machines can be put together.\n\n"
+"    -chip CHIP\n"
+"        Only run CHIP: square, triangle, noise, dpcm, vrc6, mmc5, fds,\n"
+"        n106, vrc7 or mixer. mixer times the mixer and blip buffer alone\n"
+"    -stream STREAM\n"
+"        Only play STREAM: steady, arpeggio, sweep or silence\n"
+"    -frames FRAMES\n"
+"        Emulate FRAMES NTSC frames per run. Default is 600\n"
+"    -repeat COUNT\n"
+"        Run each COUNT times and keep the fastest. Default is 5\n"
+"    -sr SAMPLERATE\n"
+"        Sample rate of the output. Default is 48000\n"
+"    --json\n"
+"        Print JSON instead of CSV\n"
+"    --help\n"
+"        Print this message\n"
+	);
+}
+
+int main(int argc, char *argv[])
+{
+	arguments_t args;
+	parse_arguments(argc-1, argv+1, args);
+
+	if (args.help)
+	{
+		print_help();
+		return 0;
+	}
+
+	int onlyChip = -1;
+	if (!args.chip.empty())
+	{
+		onlyChip = ChipBench::findChip(args.chip.c_str());
+		if (onlyChip < 0)
+		{
+			fprintf(stderr, "Unknown chip %s\n", args.chip.c_str());
+			return 1;
+		}
+	}
+	int onlyStream = -1;
+	if (!args.stream.empty())
+	{
+		onlyStream = ChipBench::findStream(args.stream.c_str());
+		if (onlyStream < 0)
+		{
+			fprintf(stderr, "Unknown stream %s\n", args.stream.c_str());
+			return 1;
+		}
+	}
+	if (args.frames <= 0 || args.repeat <= 0 || args.sampleRate <= 0)
+	{
+		fprintf(stderr, "-frames, -repeat and -sr must be positive\n");
+		return 1;
+	}
+
+	ChipBench bench(args.sampleRate);
+
+	std::vector<ChipBench::result_t> results;
+	for (int c = 0; c < ChipBench::CHIPS; c++)
+	{
+		if (onlyChip >= 0 && c != onlyChip)
+			continue;
+		for (int s = 0; s < ChipBench::STREAMS; s++)
+		{
+			if (onlyStream >= 0 && s != onlyStream)
+				continue;
+
+			ChipBench::result_t best = bench.run(c, s, args.frames);
+			for (int i = 1; i < args.repeat; i++)
+			{
+				ChipBench::result_t r = bench.run(c, s, args.frames);
+				if (r.ns < best.ns)
+					best = r;
+			}
+			results.push_back(best);
+		}
+	}
+
+	bench_info_t info;
+	get_bench_info(info);
+
+	std::string meta;
+	if (args.json)
+	{
+		printf("{\"version\":%s,\"build\":%s,\"host\":%s,\"os\":%s,\"cpu\":%s,"
+				"\"sample_rate\":%d,\"frames\":%d,\"repeat\":%d,\"results\":[",
+				quote(info.version, false).c_str(), quote(info.build, false).c_str(),
+				quote(info.host, false).c_str(), quote(info.os, false).c_str(),
+				quote(info.cpu, false).c_str(), args.sampleRate, args.frames, args.repeat);
+	}
+	else
+	{
+		printf("chip,stream,frames,cycles,samples,ns,cycles_per_sec,ns_per_sample,version,build,host,os,cpu\n");
+		meta = quote(info.version, true) + "," + quote(info.build, true) + "," + quote(info.host, true)
+				+ "," + quote(info.os, true) + "," + quote(info.cpu, true);
+	}
+
+	for (unsigned int i = 0; i < results.size(); i++)
+	{
+		const ChipBench::result_t &r = results[i];
+		const char *format = args.json
+				? "%s\n{\"chip\":\"%s\",\"stream\":\"%s\",\"frames\":%llu,\"cycles\":%llu,\"samples\":%llu,\"ns\":%llu,\"cycles_per_sec\":%.0f,\"ns_per_sample\":%.2f}"
+				: "%s%s,%s,%llu,%llu,%llu,%llu,%.0f,%.2f,%s\n";
+		printf(format, args.json && i > 0 ? "," : "",
+				ChipBench::chipName(r.chip), ChipBench::streamName(r.stream),
+				(unsigned long long)r.frames, (unsigned long long)r.cycles,
+				(unsigned long long)r.samples, (unsigned long long)r.ns,
+				r.cyclesPerSecond(), r.nsPerSample(), meta.c_str());
+	}
+
+	if (args.json)
+	{
+		printf("\n]}\n");
+	}
+
+	return 0;
+}
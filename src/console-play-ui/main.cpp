@@ -3,7 +3,9 @@
 #include "famitracker-core/Document.hpp"
 #include "famitracker-core/FtmDocument.hpp"
 #include "famitracker-core/SoundGen.hpp"
+#include "famitracker-core/Profiler.hpp"
 #include "famitracker-core/TrackerController.hpp"
+#include "core/trace.hpp"
 #include "../parse_arguments.hpp"
 #include "../defaults.hpp"
 
@@ -12,18 +14,25 @@ const char *default_sound=DEFAULT_SOUND;
 struct arguments_t
 {
 	bool help;
+	bool splitChips;
+	bool realtime;
+	bool profile;
 
 	int track;
 	int sampleRate;
+	int period;
+	int buffer;
 	std::string sound;
 	std::string file;
+	std::string profileCsv;
+	std::string trace;
 };
 
 static void parse_arguments(int argc, char *argv[], arguments_t &a)
 {
 	ParseArguments pa;
-	const char *flagfields[] = {"-help"};
-	pa.setFlagFields(flagfields, 1);
+	const char *flagfields[] = {"-help", "-split-chips", "-realtime", "-profile"};
+	pa.setFlagFields(flagfields, 4);
 	pa.parse(argv, argc);
 
 	a.help = pa.flag("-help");
@@ -31,16 +40,23 @@ static void parse_arguments(int argc, char *argv[], arguments_t &a)
 	if (a.help)
 		return;
 
+	a.splitChips = pa.flag("-split-chips");
+	a.realtime = pa.flag("-realtime");
+	a.profile = pa.flag("-profile");
 	a.track = pa.integer("t", 1);
 	a.sampleRate = pa.integer("sr", 48000);
+	a.period = pa.integer("period", 0);
+	a.buffer = pa.integer("buffer", 0);
 	a.sound = pa.string("sound", default_sound);
+	a.profileCsv = pa.string("profile-csv", "");
+	a.trace = pa.string("trace", "");
 	a.file = pa.string(0);
 }
 
 static void print_help()
 {
 	printf(
-"Usage: app FILE [-t TRACK] [-sr SAMPLERATE] [-sound ENGINE] [--help]\n\n"
+"Usage: app FILE [-t TRACK] [-sr SAMPLERATE] [-sound ENGINE] [-period FRAMES] [-buffer FRAMES] [--split-chips] [--realtime] [--profile] [-profile-csv FILE] [-trace FILE] [--help]\n\n"
 "    -t TRACK\n"
 "        Select the track number to play. 1 is the first song.\n"
 "    -sr SAMPLERATE\n"
@@ -49,6 +65,26 @@ static void print_help()
 "        Specify which sound engine to use. This will load a module\n"
 "        in your PATH named " SOUNDSINKLIB_FORMAT ". Default is " DEFAULT_SOUND ".\n"
 "        (eg. -sound jack)\n"
+"    -period FRAMES\n"
+"    -buffer FRAMES\n"
+"        Request the sound engine's period and buffer sizes in frames.\n"
+"        Default is to derive them from a 150ms latency.\n"
+"    --split-chips\n"
+"        Output each sound chip separately, if the sound engine supports\n"
+"        it (eg. one port per chip with -sound jack)\n"
+"    --realtime\n"
+"        Render sound with realtime priority and locked memory, if\n"
+"        permitted\n"
+"    --profile\n"
+"        Time each part of the emulation and print where the time went\n"
+"        when playback ends\n"
+"    -profile-csv FILE\n"
+"        Write the time of each part for every frame to FILE, in\n"
+"        nanoseconds. Implies --profile\n"
+"    -trace FILE\n"
+"        Record what the audio threads spend their time on and write it\n"
+"        to FILE when playback ends, in the Chrome trace format. Open it\n"
+"        in chrome://tracing or ui.perfetto.dev\n"
 "    --help\n"
 "        Print this message\n",
 
@@ -101,7 +137,7 @@ int main(int argc, char *argv[])
 
 	FtmDocument doc;
 	{
-		core::FileIO ftm_io(song, core::IO_READ);
+		core::MappedIO ftm_io(song);
 		if (!ftm_io.isReadable())
 		{
 			printf("Cannot open file\n");
@@ -132,6 +168,9 @@ int main(int argc, char *argv[])
 		{
 			return 1;
 		}
+		sink->setBufferSize(args.period, args.buffer);
+		sink->setSplitOutputs(args.splitChips);
+		sink->setRealtime(args.realtime);
 		sink->initialize(rate, 1, 150);
 
 		SoundGen *sg = new SoundGen;
@@ -139,16 +178,58 @@ int main(int argc, char *argv[])
 		sg->setDocument(&doc);
 		sg->setTrackerUpdate(tracker_update);
 
+		Profiler *profiler = NULL;
+		FILE *profileCsv = NULL;
+		if (args.profile || !args.profileCsv.empty())
+		{
+			profiler = new Profiler;
+			if (!args.profileCsv.empty())
+			{
+				profileCsv = fopen(args.profileCsv.c_str(), "w");
+				if (profileCsv == NULL)
+				{
+					fprintf(stderr, "Cannot open %s\n", args.profileCsv.c_str());
+				}
+				profiler->setCsv(profileCsv);
+			}
+			sg->setProfiler(profiler);
+		}
+
+		if (!args.trace.empty())
+		{
+			core::Trace::setThreadName("main");
+			core::Trace::start();
+		}
+
 		sg->trackerController()->startAt(0, 0);
 		sg->startTracker();
 		sink->blockUntilStopped();
 		sink->blockUntilTimerEmpty();
 
+		if (!args.trace.empty())
+		{
+			core::Trace::stop();
+			if (!core::Trace::write(args.trace.c_str()))
+			{
+				fprintf(stderr, "Cannot write %s\n", args.trace.c_str());
+			}
+		}
+
 		delete sink;
 		delete sg;
 
 		fflush(stdout);
 		printf("\n");
+
+		if (profiler != NULL)
+		{
+			profiler->printSummary(stdout);
+			delete profiler;
+		}
+		if (profileCsv != NULL)
+		{
+			fclose(profileCsv);
+		}
 	}
 
 	return 0;
@@ -106,6 +106,12 @@
 #		define LIBEXPORT __declspec(dllexport)
 #	endif
 
+#	if defined(__GNUC__)
+#		define THREADLOCAL __thread
+#	elif defined(_MSC_VER)
+#		define THREADLOCAL __declspec(thread)
+#	endif
+
 #	if GCC_VERSION >= 40500
 		// only gcc 4.5 and above supports this
 #		define ASSUME(truth) if (!(truth)) __builtin_unreachable()
@@ -1,14 +1,27 @@
 #include <stdio.h>
+#include <string.h>
 #include "io.hpp"
 
+#ifdef UNIX
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <fcntl.h>
+#	include <unistd.h>
+#else
+#	include <io.h>
+#endif
+
 namespace core
 {
 	FileIO::FileIO(const char *filename, int flags)
+		: m_append((flags & IO_WRITE) && (flags & IO_APPEND))
 	{
 		const char *mode;
 
 		if ( (flags & IO_READ) && !(flags & IO_WRITE) )
 			mode = "rb";
+		else if ( (flags & IO_WRITE) && (flags & IO_APPEND) )
+			mode = (flags & IO_READ) ? "a+b" : "ab";
 		else if ( (flags & IO_READ) && (flags & IO_WRITE) )
 			mode = "r+b";
 		else if ( !(flags & IO_READ) && (flags & IO_WRITE) )
@@ -62,8 +75,7 @@ namespace core
 		case IO_SEEK_END: o = SEEK_END; break;
 		}
 
-		fseek(f, offset, o);
-		return true;
+		return fseek(f, offset, o) == 0;
 	}
 	bool FileIO::isReadable()
 	{
@@ -80,6 +92,38 @@ namespace core
 		return true;
 	}
 
+	bool FileIO::isSeekable()
+	{
+		// pipes and terminals have no position
+		FILE *f = (FILE*)m_handle;
+		if (f == NULL)
+			return false;
+		// in append mode every write goes to the end wherever we seek
+		if (m_append)
+			return false;
+		return ftell(f) >= 0;
+	}
+
+	bool FileIO::flush()
+	{
+		FILE *f = (FILE*)m_handle;
+		if (f == NULL)
+			return false;
+		return fflush(f) == 0;
+	}
+
+	bool FileIO::truncate(Quantity sz)
+	{
+		FILE *f = (FILE*)m_handle;
+		if (f == NULL || fflush(f) != 0)
+			return false;
+#ifdef UNIX
+		return ftruncate(fileno(f), sz) == 0;
+#else
+		return _chsize(_fileno(f), sz) == 0;
+#endif
+	}
+
 	FileIO::~FileIO()
 	{
 		FILE *f = (FILE*)m_handle;
@@ -88,4 +132,124 @@ namespace core
 			fclose(f);
 		}
 	}
+
+	MappedIO::MappedIO(const char *filename)
+		: m_data(NULL), m_size(0), m_pos(0), m_mapped(false)
+	{
+#ifdef UNIX
+		int fd = open(filename, O_RDONLY);
+		if (fd < 0)
+			return;
+
+		struct stat st;
+		if (fstat(fd, &st) == 0 && st.st_size > 0)
+		{
+			void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (p != MAP_FAILED)
+			{
+				madvise(p, st.st_size, MADV_SEQUENTIAL);
+				m_data = (const u8*)p;
+				m_size = st.st_size;
+				m_mapped = true;
+			}
+		}
+		::close(fd);
+#else
+		// no mapping available; slurp the file so map() still works
+		FILE *f = fopen(filename, "rb");
+		if (f == NULL)
+			return;
+
+		fseek(f, 0, SEEK_END);
+		long sz = ftell(f);
+		fseek(f, 0, SEEK_SET);
+		if (sz > 0)
+		{
+			u8 *buf = new u8[sz];
+			if (fread(buf, 1, sz, f) == (size_t)sz)
+			{
+				m_data = buf;
+				m_size = sz;
+			}
+			else
+			{
+				delete[] buf;
+			}
+		}
+		fclose(f);
+#endif
+	}
+
+	Quantity MappedIO::read(void *buf, Quantity sz)
+	{
+		Quantity left = m_size - m_pos;
+		if (sz > left)
+			sz = left;
+		memcpy(buf, m_data + m_pos, sz);
+		m_pos += sz;
+		return sz;
+	}
+
+	Quantity MappedIO::write(const void *, Quantity)
+	{
+		return 0;
+	}
+
+	Quantity MappedIO::size()
+	{
+		return m_size;
+	}
+
+	bool MappedIO::seek(int offset, SeekOrigin origin)
+	{
+		long base;
+		switch (origin)
+		{
+		case IO_SEEK_SET: base = 0; break;
+		case IO_SEEK_CUR: base = m_pos; break;
+		case IO_SEEK_END: base = m_size; break;
+		default: return false;
+		}
+
+		long p = base + offset;
+		if (p < 0 || p > (long)m_size)
+			return false;
+
+		m_pos = p;
+		return true;
+	}
+
+	bool MappedIO::isReadable()
+	{
+		return m_data != NULL;
+	}
+
+	bool MappedIO::isWritable()
+	{
+		return false;
+	}
+
+	const void * MappedIO::map(Quantity sz)
+	{
+		if (sz > m_size - m_pos)
+			return NULL;
+
+		const void *p = m_data + m_pos;
+		m_pos += sz;
+		return p;
+	}
+
+	MappedIO::~MappedIO()
+	{
+		if (m_data == NULL)
+			return;
+#ifdef UNIX
+		if (m_mapped)
+		{
+			munmap((void*)m_data, m_size);
+			return;
+		}
+#endif
+		delete[] m_data;
+	}
 }
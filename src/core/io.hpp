@@ -16,7 +16,8 @@ namespace core
 	{
 		IO_READ=1,
 		IO_WRITE=2,
-		IO_READWRITE=3
+		IO_READWRITE=3,
+		IO_APPEND=4		// with IO_WRITE, every write goes to the end
 	};
 
 	class COREAPI IO
@@ -28,8 +29,18 @@ namespace core
 		virtual bool seek(int offset, SeekOrigin o) = 0;
 		virtual bool isReadable() = 0;
 		virtual bool isWritable() = 0;
+		// whether seek() can move back over data already written
+		virtual bool isSeekable(){ return false; }
 		virtual ~IO(){ }
 
+		// returns a pointer to the next sz bytes and advances past them,
+		// or NULL if the IO is not memory-backed or fewer bytes remain.
+		// the pointer stays valid for the lifetime of the IO
+		virtual const void * map(Quantity /*sz*/){ return NULL; }
+
+		// pushes buffered writes out to the underlying file
+		virtual bool flush(){ return true; }
+
 		bool read_e(void *buf, Quantity sz)
 		{
 			return read(buf, sz) == sz;
@@ -87,9 +98,34 @@ namespace core
 		bool seek(int offset, SeekOrigin o);
 		bool isReadable();
 		bool isWritable();
+		bool isSeekable();
+		bool flush();
+		// Cuts the file down to sz bytes, flushing first
+		bool truncate(Quantity sz);
 		~FileIO();
 	private:
 		void *m_handle;
+		bool m_append;
+	};
+
+	// read-only file IO backed by a memory mapping of the whole file
+	class LIBEXPORT MappedIO : public IO
+	{
+	public:
+		MappedIO(const char *filename);
+		Quantity read(void *buf, Quantity sz);
+		Quantity write(const void *buf, Quantity sz);
+		Quantity size();
+		bool seek(int offset, SeekOrigin o);
+		bool isReadable();
+		bool isWritable();
+		const void * map(Quantity sz);
+		~MappedIO();
+	private:
+		const u8 *m_data;
+		Quantity m_size;
+		Quantity m_pos;
+		bool m_mapped;
 	};
 }
 
@@ -44,6 +44,10 @@ namespace core
 		{
 			return m_elementcount - availRead();
 		}
+		Quantity elementSize() const
+		{
+			return m_elementsize;
+		}
 		bool isFull() const
 		{
 			return availWrite() == 0;
@@ -14,6 +14,7 @@
 #include "ringbuffer.hpp"
 #include "soundsink.hpp"
 #include "time.hpp"
+#include "trace.hpp"
 
 namespace core
 {
@@ -36,7 +37,8 @@ namespace core
 	};
 
 	SoundSink::SoundSink()
-		: m_timeidxsz(0), m_playing(false)
+		: m_soundCallback(NULL), m_soundCallbackFloat(NULL),
+		  m_timeidxsz(0), m_playing(false)
 	{
 		m_timeidx_ringbuffer = new RingBuffer(sizeof(core::timestamp_t));
 		// give the ring buffer a generous amount of memory
@@ -170,6 +172,8 @@ namespace core
 
 	void SoundSink::_timeloop()
 	{
+		Trace::setThreadName("sink timer");
+
 		timestamp_t tgt;
 		core::u32 skip = 0;
 
@@ -193,11 +197,20 @@ namespace core
 
 	void SoundSink::performSoundCallback(s16 *buf, u32 sz)
 	{
+		TraceScope scope("sink callback");
 		core::u32 timec = (*m_soundCallback)(buf, sz, m_callbackData, m_timeidx);
 
 		m_timeidxsz = timec;
 	}
 
+	void SoundSink::performSoundCallbackFloat(float *buf, u32 sz)
+	{
+		TraceScope scope("sink callback");
+		core::u32 timec = (*m_soundCallbackFloat)(buf, sz, m_callbackData, m_timeidx);
+
+		m_timeidxsz = timec;
+	}
+
 	void SoundSink::applyTime(core::s32 delay_us)
 	{
 		if (m_timeidxsz == 0)
@@ -372,6 +385,18 @@ namespace core
 	{
 	}
 
+	void SoundSinkPlayback::setBufferSize(unsigned int, unsigned int)
+	{
+	}
+
+	void SoundSinkPlayback::setSplitOutputs(bool)
+	{
+	}
+
+	void SoundSinkPlayback::setRealtime(bool)
+	{
+	}
+
 	void SoundSinkExport::render()
 	{
 
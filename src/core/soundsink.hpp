@@ -13,6 +13,7 @@ namespace core
 	{
 	public:
 		typedef core::u32 (*sound_callback_t)(core::s16 *buffer, core::u32 size, void *data, core::u32 *timeidx);
+		typedef core::u32 (*sound_callback_float_t)(float *buffer, core::u32 size, void *data, core::u32 *timeidx);
 		typedef void (*time_callback_t)(core::u32 skip, void *data);
 
 		SoundSink();
@@ -21,12 +22,21 @@ namespace core
 
 		virtual void setPlaying(bool playing);
 
+		// sinks that pull float samples (performSoundCallbackFloat) return true.
+		// each frame then holds outputCount() interleaved samples: with one
+		// output it's the full mix, with more the sound is split per chip,
+		// in the order 2A03, VRC6, VRC7, FDS, MMC5, N163
+		virtual bool isFloat() const{ return false; }
+		virtual core::u32 outputCount() const{ return 1; }
+
 		bool isPlaying() const{ return m_playing; }
 		void setSoundCallback(sound_callback_t c){ m_soundCallback = c; }
+		void setSoundCallbackFloat(sound_callback_float_t c){ m_soundCallbackFloat = c; }
 		void setTimeCallback(time_callback_t c){ m_timeCallback = c; }
 		void setCallbackData(void *data){ m_callbackData = data; }
 
 		void performSoundCallback(core::s16 *buf, core::u32 sz);
+		void performSoundCallbackFloat(float *buf, core::u32 sz);
 		void applyTime(core::s32 delay_us);
 
 		void blockUntilStopped();
@@ -39,6 +49,7 @@ namespace core
 		void _timeloop();
 		static void _timeloop_bootstrap(SoundSink *);
 		sound_callback_t m_soundCallback;
+		sound_callback_float_t m_soundCallbackFloat;
 		time_callback_t m_timeCallback;
 		void *m_callbackData;
 		volatile bool m_playing;
@@ -58,6 +69,18 @@ namespace core
 		virtual ~SoundSinkPlayback();
 		virtual void initialize(unsigned int sampleRate, unsigned int channels, unsigned int latency_ms) = 0;
 		virtual void close() = 0;
+
+		// request explicit period and buffer sizes (in frames) for the next
+		// initialize(). 0 derives the size from latency_ms. sinks that
+		// cannot honour the request ignore it
+		virtual void setBufferSize(unsigned int period_frames, unsigned int buffer_frames);
+
+		// request one output per sound chip (see outputCount()). sinks
+		// without separate outputs ignore it
+		virtual void setSplitOutputs(bool split);
+
+		// render with realtime scheduling where the sink and system allow it
+		virtual void setRealtime(bool realtime);
 	};
 
 	class COREAPI SoundSinkExport : public SoundSink
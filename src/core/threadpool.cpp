@@ -1,8 +1,12 @@
 #include "threadpool.hpp"
 #include <queue>
+#include <list>
+#include <vector>
+#include <boost/atomic.hpp>
 #include <boost/thread.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/condition.hpp>
+#include "trace.hpp"
 
 namespace core
 {
@@ -200,6 +204,160 @@ namespace core
 			h->block();
 		}
 
+		// One parallelFor call. Lives on the caller's stack, workers join it
+		// while it is queued and the caller waits for them to leave
+		struct _parallelFor
+		{
+			boost::atomic<unsigned int> next;
+			unsigned int count;
+			ForJob job;
+			void *data;
+
+			unsigned int helpers;		// Workers that may still join
+			unsigned int inside;		// Workers running jobs of this call
+			boost::condition left;
+		};
+
+		static void _parallelFor_run(_parallelFor *p)
+		{
+			for (;;)
+			{
+				unsigned int i = p->next.fetch_add(1, boost::memory_order_relaxed);
+				if (i >= p->count)
+					break;
+
+				p->job(i, p->data);
+			}
+		}
+
+		// Worker threads kept for every parallelFor call, so a call doesn't
+		// create and join threads. There are as many as the largest call
+		// asked for, they are only stopped when the program ends
+		class _parallelFor_pool
+		{
+		public:
+			_parallelFor_pool()
+				: m_quit(false)
+			{
+			}
+			~_parallelFor_pool()
+			{
+				m_mtx.lock();
+				m_quit = true;
+				m_work.notify_all();
+				m_mtx.unlock();
+
+				for (unsigned int i = 0; i < m_workers.size(); i++)
+				{
+					m_workers[i]->join();
+					delete m_workers[i];
+				}
+			}
+
+			void run(_parallelFor *p)
+			{
+				boost::mutex::scoped_lock lock(m_mtx);
+
+				while (m_workers.size() < p->helpers)
+				{
+					m_workers.push_back(new boost::thread(worker_bootstrap, this));
+				}
+
+				m_calls.push_back(p);
+				m_work.notify_all();
+				lock.unlock();
+
+				_parallelFor_run(p);
+
+				// Every job is taken, workers that didn't join by now needn't
+				lock.lock();
+				if (p->helpers > 0)
+				{
+					m_calls.remove(p);
+				}
+				while (p->inside > 0)
+				{
+					p->left.wait(lock);
+				}
+			}
+		private:
+			boost::mutex m_mtx;
+			boost::condition m_work;
+			std::list<_parallelFor*> m_calls;	// Calls workers may still join, oldest first
+			std::vector<boost::thread*> m_workers;
+			bool m_quit;
+
+			static void worker_bootstrap(_parallelFor_pool *pool)
+			{
+				pool->worker();
+			}
+
+			void worker()
+			{
+				Trace::setThreadName("worker");
+
+				boost::mutex::scoped_lock lock(m_mtx);
+				for (;;)
+				{
+					while (!m_quit && m_calls.empty())
+					{
+						m_work.wait(lock);
+					}
+					if (m_quit)
+						break;
+
+					_parallelFor *p = m_calls.front();
+					p->helpers--;
+					if (p->helpers == 0)
+					{
+						m_calls.pop_front();
+					}
+					p->inside++;
+					lock.unlock();
+
+					_parallelFor_run(p);
+
+					lock.lock();
+					p->inside--;
+					if (p->inside == 0)
+					{
+						p->left.notify_all();
+					}
+				}
+			}
+		};
+
+		static _parallelFor_pool & parallelForPool()
+		{
+			static _parallelFor_pool pool;
+			return pool;
+		}
+
+		void parallelFor(unsigned int count, ForJob job, void *data, unsigned int maxThreads)
+		{
+			if (maxThreads == 0)
+				maxThreads = boost::thread::hardware_concurrency();
+			if (maxThreads > count)
+				maxThreads = count;
+
+			if (maxThreads <= 1)
+			{
+				for (unsigned int i = 0; i < count; i++)
+					job(i, data);
+				return;
+			}
+
+			_parallelFor p;
+			p.next = 0;
+			p.count = count;
+			p.job = job;
+			p.data = data;
+			p.helpers = maxThreads - 1;
+			p.inside = 0;
+
+			parallelForPool().run(&p);
+		}
+
 		Event::Event()
 		{
 			m_pimpl = new _impl_Event;
@@ -19,6 +19,13 @@ namespace core
 		// Blocks the thread until the event associated with the handle is finished
 		void blockOnHandle(BlockHandle *h);
 
+		// Runs job(i, data) for every i below count on up to maxThreads
+		// threads (0 = one per core). The calling thread takes part and
+		// returns once every job is done. The other threads are workers
+		// kept between calls. Jobs must not throw.
+		typedef void (*ForJob)(unsigned int i, void *data);
+		void parallelFor(unsigned int count, ForJob job, void *data, unsigned int maxThreads = 0);
+
 		class Event
 		{
 		public:
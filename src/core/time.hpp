@@ -7,6 +7,7 @@
 
 #if defined(UNIX)
 #include <sys/time.h>
+#include <time.h>
 
 namespace core
 {
@@ -66,6 +67,14 @@ namespace core
 	{
 		usleep(us);
 	}
+
+	// Nanoseconds from an arbitrary start, for timing short spans
+	static inline u64 monotonic_ns()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	}
 }
 #elif defined(WINDOWS)
 #include <Windows.h>
@@ -117,6 +126,16 @@ namespace core
 	{
 		Sleep(us/1000);
 	}
+
+	// Nanoseconds from an arbitrary start, for timing short spans
+	static inline u64 monotonic_ns()
+	{
+		LARGE_INTEGER count, freq;
+		QueryPerformanceCounter(&count);
+		QueryPerformanceFrequency(&freq);
+		return (u64)(count.QuadPart / freq.QuadPart) * 1000000000 +
+			(u64)(count.QuadPart % freq.QuadPart) * 1000000000 / freq.QuadPart;
+	}
 }
 
 #endif
@@ -0,0 +1,279 @@
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+#include "trace.hpp"
+#include "time.hpp"
+
+namespace core
+{
+	static const u32 EVENT_MASK = Trace::EVENTS_PER_THREAD - 1;
+
+	struct _trace_event_t
+	{
+		u64 ns;
+		const char *name;
+		char phase;
+	};
+
+	// Written by its own thread only. Everything but the events is changed
+	// under the registry lock, the events are published through head
+	struct _trace_thread_t
+	{
+		unsigned int id;
+		const char *name;
+		_trace_event_t *events;
+		boost::atomic<u32> head;		// Events written since the thread was registered
+		u32 first;						// The first event of this recording
+		bool finished;					// The thread has ended, freed once written out
+	};
+
+	struct _trace_registry_t
+	{
+		boost::mutex mtx;
+		std::vector<_trace_thread_t*> threads;
+		unsigned int lastId;
+		u64 startNs;
+	};
+
+	static _trace_registry_t registry;
+	static THREADLOCAL _trace_thread_t *currentThread = NULL;
+
+	static void threadFinished(_trace_thread_t *t)
+	{
+		boost::mutex::scoped_lock lock(registry.mtx);
+		t->finished = true;
+	}
+
+	// Only there to learn when a thread ends, lookups go through currentThread
+	static boost::thread_specific_ptr<_trace_thread_t> threadExit(threadFinished);
+
+	volatile bool Trace::s_recording = false;
+
+	static void allocateEvents(_trace_thread_t *t)
+	{
+		// Not under the registry lock, only the thread itself sets events
+		_trace_event_t *events = new _trace_event_t[Trace::EVENTS_PER_THREAD];
+
+		boost::mutex::scoped_lock lock(registry.mtx);
+		t->events = events;
+	}
+
+	static void freeThread(_trace_thread_t *t)
+	{
+		delete[] t->events;
+		delete t;
+	}
+
+	// Frees the threads that ended, under the registry lock
+	static void reclaimThreads()
+	{
+		unsigned int kept = 0;
+		for (unsigned int i = 0; i < registry.threads.size(); i++)
+		{
+			_trace_thread_t *t = registry.threads[i];
+			if (t->finished)
+				freeThread(t);
+			else
+				registry.threads[kept++] = t;
+		}
+		registry.threads.resize(kept);
+	}
+
+	static _trace_thread_t * traceThread()
+	{
+		_trace_thread_t *t = currentThread;
+		if (t != NULL)
+			return t;
+
+		// Threads are kept after they end until their events are written out
+		t = new _trace_thread_t;
+		t->name = NULL;
+		t->events = NULL;
+		t->head = 0;
+		t->first = 0;
+		t->finished = false;
+
+		{
+			boost::mutex::scoped_lock lock(registry.mtx);
+			t->id = ++registry.lastId;
+			registry.threads.push_back(t);
+		}
+		currentThread = t;
+		threadExit.reset(t);
+
+		return t;
+	}
+
+	static void record(const char *name, char phase)
+	{
+		_trace_thread_t *t = traceThread();
+		if (UNLIKELY(t->events == NULL))
+		{
+			// Only threads that were never named get here, on their first event
+			allocateEvents(t);
+		}
+
+		u32 head = t->head.load(boost::memory_order_relaxed);
+		_trace_event_t &e = t->events[head & EVENT_MASK];
+		e.ns = monotonic_ns();
+		e.name = name;
+		e.phase = phase;
+		t->head.store(head + 1, boost::memory_order_release);
+	}
+
+	void Trace::start()
+	{
+		boost::mutex::scoped_lock lock(registry.mtx);
+
+		// What the ended threads recorded is dropped with the rest
+		reclaimThreads();
+
+		for (unsigned int i = 0; i < registry.threads.size(); i++)
+		{
+			_trace_thread_t *t = registry.threads[i];
+			t->first = t->head.load(boost::memory_order_acquire);
+		}
+		registry.startNs = monotonic_ns();
+
+		s_recording = true;
+	}
+
+	void Trace::stop()
+	{
+		s_recording = false;
+	}
+
+	void Trace::setThreadName(const char *name)
+	{
+		_trace_thread_t *t = traceThread();
+
+		// Named threads record into a buffer made now, not on the first event,
+		// which may be on a thread that must not allocate
+		if (t->events == NULL)
+			allocateEvents(t);
+
+		boost::mutex::scoped_lock lock(registry.mtx);
+		t->name = name;
+	}
+
+	void Trace::begin(const char *name)
+	{
+		record(name, 'B');
+	}
+
+	void Trace::end()
+	{
+		record(NULL, 'E');
+	}
+
+	void Trace::instant(const char *name)
+	{
+		if (s_recording)
+			record(name, 'i');
+	}
+
+	static void writeString(FILE *out, const char *s)
+	{
+		fputc('"', out);
+		for (; *s != 0; s++)
+		{
+			if (*s == '"' || *s == '\\')
+				fputc('\\', out);
+			fputc(*s, out);
+		}
+		fputc('"', out);
+	}
+
+	bool Trace::write(const char *path)
+	{
+		FILE *out = fopen(path, "w");
+		if (out == NULL)
+			return false;
+
+		write(out);
+
+		return fclose(out) == 0;
+	}
+
+	void Trace::write(FILE *out)
+	{
+		boost::mutex::scoped_lock lock(registry.mtx);
+
+		fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n", out);
+		bool comma = false;
+
+		std::vector<_trace_event_t> events;
+		events.reserve(EVENTS_PER_THREAD);
+
+		for (unsigned int i = 0; i < registry.threads.size(); i++)
+		{
+			_trace_thread_t *t = registry.threads[i];
+
+			if (t->name != NULL)
+			{
+				fprintf(out, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":",
+						comma ? ",\n" : "", t->id);
+				writeString(out, t->name);
+				fputs("}}", out);
+				comma = true;
+			}
+
+			if (t->events == NULL)
+				continue;
+
+			// Copy what is in the buffer, then drop whatever the thread
+			// overwrote meanwhile. The event after head may be half written
+			u32 head = t->head.load(boost::memory_order_acquire);
+			u32 from = head - t->first > EVENTS_PER_THREAD ? head - EVENTS_PER_THREAD : t->first;
+			events.clear();
+			for (u32 j = from; j != head; j++)
+			{
+				events.push_back(t->events[j & EVENT_MASK]);
+			}
+			u32 written = t->head.load(boost::memory_order_acquire);
+			u32 skip = 0;
+			if (written - from + 1 > EVENTS_PER_THREAD)
+			{
+				skip = written - from + 1 - EVENTS_PER_THREAD;
+			}
+
+			// Spans that began before the kept events can't be closed
+			int depth = 0;
+			for (unsigned int j = skip; j < events.size(); j++)
+			{
+				const _trace_event_t &e = events[j];
+				if (e.phase == 'E')
+				{
+					if (depth == 0)
+						continue;
+					depth--;
+				}
+				else if (e.phase == 'B')
+				{
+					depth++;
+				}
+
+				s64 ns = (s64)(e.ns - registry.startNs);
+				fprintf(out, "%s{\"ph\":\"%c\",\"pid\":1,\"tid\":%u,\"ts\":%lld.%03d",
+						comma ? ",\n" : "", e.phase, t->id,
+						(long long)(ns / 1000), (int)(ns < 0 ? -ns : ns) % 1000);
+				if (e.name != NULL)
+				{
+					fputs(",\"name\":", out);
+					writeString(out, e.name);
+				}
+				if (e.phase == 'i')
+				{
+					fputs(",\"s\":\"t\"", out);
+				}
+				fputc('}', out);
+				comma = true;
+			}
+		}
+
+		fputs("\n]}\n", out);
+
+		reclaimThreads();
+	}
+}
@@ -0,0 +1,63 @@
+#ifndef CORE_TRACE_HPP
+#define CORE_TRACE_HPP
+
+#include <stdio.h>
+#include "common.hpp"
+
+namespace core
+{
+	// Spans of time on every thread, written out as Chrome trace JSON for
+	// chrome://tracing or ui.perfetto.dev. Each thread records into a
+	// buffer of its own without locking. A buffer keeps the latest
+	// EVENTS_PER_THREAD events, older ones are overwritten.
+	// Names are kept by pointer and must be string literals
+	class COREAPI Trace
+	{
+	public:
+		static const unsigned int EVENTS_PER_THREAD = 1 << 16;
+
+		// Starts recording afresh, what was recorded before is dropped
+		static void start();
+		static void stop();
+		static bool isRecording(){ return s_recording; }
+
+		// Names the calling thread in the output and makes its buffer, so
+		// threads that must not allocate should call it before recording.
+		// The buffers of threads that ended are freed once written out
+		static void setThreadName(const char *name);
+
+		// Record whether recording or not, so a span begun while recording
+		// is always ended. TraceScope checks isRecording first
+		static void begin(const char *name);
+		static void end();
+		// Something that happened at one point in time, if recording
+		static void instant(const char *name);
+
+		// The events kept so far, also while still recording
+		static bool write(const char *path);
+		static void write(FILE *out);
+	private:
+		static volatile bool s_recording;
+	};
+
+	// Records a span until the end of the block, if recording
+	class TraceScope
+	{
+	public:
+		TraceScope(const char *name)
+			: m_recording(Trace::isRecording())
+		{
+			if (m_recording)
+				Trace::begin(name);
+		}
+		~TraceScope()
+		{
+			if (m_recording)
+				Trace::end();
+		}
+	private:
+		bool m_recording;
+	};
+}
+
+#endif
@@ -43,6 +43,7 @@
 #include <cmath>
 #include "APU.h"
 #include "core/soundsink.hpp"
+#include "../Profiler.hpp"
 
 #include "Square.h"
 #include "Triangle.h"
@@ -73,15 +74,21 @@ const uint8 CAPU::LENGTH_TABLE[] = {
 	0xC0, 0x18, 0x48, 0x1A, 0x10, 0x1C, 0x20, 0x1E
 };
 
-static std::vector<CExternal*> ExChips;
-
 CAPU::CAPU(CSampleMem *pSampleMem) :
+	m_pMixer(new CMixer()),
 	m_pParent(NULL),
+	m_pParentFloat(NULL),
+	m_pProfiler(NULL),
+	m_iExternalSoundChip(0),
 	m_iFrameCycles(0),
+	m_iCyclesToRun(0),
+	m_iSoundBufferSamples(0),
 	m_pSoundBuffer(NULL),
-	m_pMixer(new CMixer()),
-	m_iExternalSoundChip(0),
-	m_iCyclesToRun(0)
+	m_pSoundBufferFloat(NULL),
+	m_iFloatBufferSize(0),
+	m_iFloatOutputs(1),
+	m_iVRC7Address(0),
+	m_iVRC7ChipAddress(-1)
 {
 	m_pSquare1 = new CSquare(m_pMixer, CHANID_SQUARE1, SNDCHIP_NONE);
 	m_pSquare2 = new CSquare(m_pMixer, CHANID_SQUARE2, SNDCHIP_NONE);
@@ -122,6 +129,7 @@ CAPU::~CAPU()
 	SAFE_RELEASE(m_pMixer);
 
 	SAFE_RELEASE_ARRAY(m_pSoundBuffer);
+	SAFE_RELEASE_ARRAY(m_pSoundBufferFloat);
 
 #ifdef LOGGING
 	m_pLog->Close();
@@ -200,10 +208,12 @@ void CAPU::Process()
 	// The amount of cycles that will be emulated is added by CAPU::AddCycles
 	//
 	
-	static uint32 Time, i;
+	uint32 Time, i;
 
 	while (m_iCyclesToRun > 0)
 	{
+		ProfileScope ProcessScope(m_pProfiler, Profiler::APU);
+
 		Time = m_iCyclesToRun;
 
 		if (Time > m_iSequencerClock)
@@ -212,31 +222,40 @@ void CAPU::Process()
 			Time = m_iFrameClock;
 		
 		// Fixes the problem with distortion due to volume modulation
-		i = Time;
-		while (i > 0)
+		// The channels are run in steps of a few cycles, too short to time
+		// one by one, so each pass is timed as a whole
 		{
-			uint32 Period = min(m_pSquare1->GetPeriod(), m_pSquare2->GetPeriod());
-			Period = min(max<uint32>(Period, 7), i);
-			m_pSquare1->Process(Period);
-			m_pSquare2->Process(Period);
-			i -= Period;
+			ProfileScope Scope(m_pProfiler, Profiler::APU_PULSE);
+			i = Time;
+			while (i > 0)
+			{
+				uint32 Period = min(m_pSquare1->GetPeriod(), m_pSquare2->GetPeriod());
+				Period = min(max<uint32>(Period, 7), i);
+				m_pSquare1->Process(Period);
+				m_pSquare2->Process(Period);
+				i -= Period;
+			}
 		}
 
-		i = Time;
-		while (i > 0)
 		{
-			uint32 Period = min(m_pTriangle->GetPeriod(), m_pNoise->GetPeriod());
-			Period = min<uint32>(Period, m_pDPCM->GetPeriod());
-			Period = min(max<uint32>(Period, 7), i);
-			m_pTriangle->Process(Period);
-			m_pNoise->Process(Period);
-			m_pDPCM->Process(Period);
-			i -= Period;
+			ProfileScope Scope(m_pProfiler, Profiler::APU_TND);
+			i = Time;
+			while (i > 0)
+			{
+				uint32 Period = min(m_pTriangle->GetPeriod(), m_pNoise->GetPeriod());
+				Period = min<uint32>(Period, m_pDPCM->GetPeriod());
+				Period = min(max<uint32>(Period, 7), i);
+				m_pTriangle->Process(Period);
+				m_pNoise->Process(Period);
+				m_pDPCM->Process(Period);
+				i -= Period;
+			}
 		}
 
-		for (std::vector<CExternal*>::iterator iter = ExChips.begin(); iter != ExChips.end(); ++iter)
+		for (unsigned int j = 0; j < m_ExChips.size(); j++)
 		{
-			(*iter)->Process(Time);
+			ProfileScope Scope(m_pProfiler, m_ExChipSections[j]);
+			m_ExChips[j]->Process(Time);
 		}
 
 		m_iFrameCycles		+= Time;
@@ -257,20 +276,39 @@ void CAPU::EndFrame()
 {
 	// The APU will always output audio in 32 bit signed format
 	
-	m_pSquare1->EndFrame();
-	m_pSquare2->EndFrame();
-	m_pTriangle->EndFrame();
-	m_pNoise->EndFrame();
-	m_pDPCM->EndFrame();
+	{
+		ProfileScope Scope(m_pProfiler, Profiler::END_FRAME);
 
-	for (std::vector<CExternal*>::iterator iter = ExChips.begin(); iter != ExChips.end(); ++iter)
+		m_pSquare1->EndFrame();
+		m_pSquare2->EndFrame();
+		m_pTriangle->EndFrame();
+		m_pNoise->EndFrame();
+		m_pDPCM->EndFrame();
+
+		for (std::vector<CExternal*>::iterator iter = m_ExChips.begin(); iter != m_ExChips.end(); ++iter)
+		{
+			(*iter)->EndFrame();
+		}
+	}
+
+	int SamplesAvail;
 	{
-		(*iter)->EndFrame();
+		ProfileScope Scope(m_pProfiler, Profiler::MIXER);
+		SamplesAvail = m_pMixer->FinishBuffer(m_iFrameCycles);
 	}
 
-	int SamplesAvail = m_pMixer->FinishBuffer(m_iFrameCycles);
-	int ReadSamples	= m_pMixer->ReadBuffer(SamplesAvail, m_pSoundBuffer, m_bStereoEnabled);
-	(*m_pParent)(m_pSoundBuffer, ReadSamples, m_pParentData);
+	ProfileScope Scope(m_pProfiler, Profiler::READOUT);
+
+	if (m_pParentFloat != NULL)
+	{
+		int ReadSamples	= m_pMixer->ReadBufferFloat(SamplesAvail, m_pSoundBufferFloat, m_iFloatOutputs);
+		(*m_pParentFloat)(m_pSoundBufferFloat, ReadSamples, m_pParentData);
+	}
+	else
+	{
+		int ReadSamples	= m_pMixer->ReadBuffer(SamplesAvail, m_pSoundBuffer, m_bStereoEnabled);
+		(*m_pParent)(m_pSoundBuffer, ReadSamples, m_pParentData);
+	}
 	
 	m_iFrameClock /*+*/= m_iFrameCycleCount;
 	m_iFrameCycles = 0;
@@ -300,11 +338,13 @@ void CAPU::Reset()
 	m_pNoise->Reset();
 	m_pDPCM->Reset();
 
-	for (std::vector<CExternal*>::iterator iter = ExChips.begin(); iter != ExChips.end(); ++iter)
+	for (std::vector<CExternal*>::iterator iter = m_ExChips.begin(); iter != m_ExChips.end(); ++iter)
 	{
 		(*iter)->Reset();
 	}
 
+	InvalidateShadowRegs();
+
 #ifdef LOGGING
 	m_iFrame = 0;
 #endif
@@ -323,20 +363,39 @@ void CAPU::SetExternalSound(uint8 Chip)
 	m_iExternalSoundChip = Chip;
 	m_pMixer->ExternalSound(Chip);
 
-	ExChips.clear();
+	m_ExChips.clear();
+	m_ExChipSections.clear();
 
 	if (Chip & SNDCHIP_VRC6)
-		ExChips.push_back(m_pVRC6);
+	{
+		m_ExChips.push_back(m_pVRC6);
+		m_ExChipSections.push_back(Profiler::APU_VRC6);
+	}
 	if (Chip & SNDCHIP_VRC7)
-		ExChips.push_back(m_pVRC7);
+	{
+		m_ExChips.push_back(m_pVRC7);
+		m_ExChipSections.push_back(Profiler::APU_VRC7);
+	}
 	if (Chip & SNDCHIP_FDS)
-		ExChips.push_back(m_pFDS);
+	{
+		m_ExChips.push_back(m_pFDS);
+		m_ExChipSections.push_back(Profiler::APU_FDS);
+	}
 	if (Chip & SNDCHIP_MMC5)
-		ExChips.push_back(m_pMMC5);
+	{
+		m_ExChips.push_back(m_pMMC5);
+		m_ExChipSections.push_back(Profiler::APU_MMC5);
+	}
 	if (Chip & SNDCHIP_N106)
-		ExChips.push_back(m_pN106);
+	{
+		m_ExChips.push_back(m_pN106);
+		m_ExChipSections.push_back(Profiler::APU_N106);
+	}
 //	if (Chip & SNDCHIP_S5B)
-//		ExChips.push_back(m_pS5B);
+//	{
+//		m_ExChips.push_back(m_pS5B);
+//		m_ExChipSections.push_back(Profiler::APU_S5B);
+//	}
 
 	Reset();
 }
@@ -359,6 +418,9 @@ void CAPU::ChangeMachine(int Machine)
 			m_pMixer->SetClockRate(BASE_FREQ_PAL);
 			break;
 	}
+
+	// Noise and DPCM periods were looked up in the old tables
+	InvalidateShadowRegs();
 }
 
 bool CAPU::SetupSound(int SampleRate, int NrChannels, int Machine)
@@ -389,6 +451,8 @@ bool CAPU::SetupSound(int SampleRate, int NrChannels, int Machine)
 	if (m_pSoundBuffer == NULL)
 		return false;
 
+	AllocateFloatBuffer();
+
 	ChangeMachine(Machine);
 
 	// VRC7 generates samples on it's own
@@ -403,6 +467,33 @@ bool CAPU::SetupSound(int SampleRate, int NrChannels, int Machine)
 	return true;
 }
 
+void CAPU::SetFloatCallback(callback_float_t callback, void *data, int Outputs)
+{
+	m_pParentFloat = callback;
+	m_pParentData = data;
+	m_iFloatOutputs = (callback != NULL && Outputs > 1) ? Outputs : 1;
+
+	m_pMixer->SetSplitOutput(m_iFloatOutputs > 1);
+	AllocateFloatBuffer();
+}
+
+void CAPU::AllocateFloatBuffer()
+{
+	uint32 Size = 0;
+	if (m_pParentFloat != NULL)
+		Size = (m_iSoundBufferSamples * m_iFloatOutputs) << 1;
+
+	// Keep the buffer when the sink is set up the same way again
+	if (Size == m_iFloatBufferSize)
+		return;
+
+	SAFE_RELEASE_ARRAY(m_pSoundBufferFloat);
+	m_iFloatBufferSize = Size;
+
+	if (Size > 0)
+		m_pSoundBufferFloat = new float[Size];
+}
+
 void CAPU::AddTime(int32 Cycles)
 {
 	if (Cycles < 0)
@@ -415,6 +506,9 @@ void CAPU::Write(uint16 Address, uint8 Value)
 	// Data was written to an APU register
 	//
 
+	if (ElideWrite(Address, Value))
+		return;
+
 	Process();
 
 	if (Address == 0x4015)
@@ -509,9 +603,17 @@ void CAPU::ExternalWrite(uint16 Address, uint8 Value)
 	// (this doesn't really belong in the APU but are here for convenience)
 	//
 
+	if (ElideExternalWrite(Address, Value))
+		return;
+
+	ApplyExternalWrite(Address, Value);
+}
+
+void CAPU::ApplyExternalWrite(uint16 Address, uint8 Value)
+{
 	Process();
 
-	for (std::vector<CExternal*>::iterator iter = ExChips.begin(); iter != ExChips.end(); ++iter)
+	for (std::vector<CExternal*>::iterator iter = m_ExChips.begin(); iter != m_ExChips.end(); ++iter)
 	{
 		(*iter)->Write(Address, Value);
 	}
@@ -529,7 +631,7 @@ uint8 CAPU::ExternalRead(uint16 Address)
 
 	Process();
 
-	for (std::vector<CExternal*>::iterator iter = ExChips.begin(); iter != ExChips.end(); ++iter)
+	for (std::vector<CExternal*>::iterator iter = m_ExChips.begin(); iter != m_ExChips.end(); ++iter)
 	{
 		if (!Mapped)
 			Value = (*iter)->Read(Address, Mapped);
@@ -620,3 +722,166 @@ uint8 CAPU::GetReg(int Chip, int Reg) const
 		return 0;
 	}
 }
+
+// Shadow registers
+//
+// Channel handlers rewrite every register each frame. Writes that store
+// what a register already holds are dropped here, which saves the catch-up
+// call to Process() and the trip through the chip. Registers with side
+// effects on write always go through.
+
+bool CAPU::ElideWrite(uint16 Address, uint8 Value)
+{
+	int Reg = Address & 0x1F;
+	bool Pure;
+
+	switch (Reg)
+	{
+		case 0x01:
+		case 0x05:
+			// An enabled sweep reloads on every write, and moves the period
+			// away from what was written to the low byte
+			Pure = !(Value & 0x80);
+			if ((Value & 0x80) || !m_Shadow2A03.IsValid(Reg) || (m_Shadow2A03.Get(Reg) & 0x80))
+				m_Shadow2A03.Invalidate(Reg + 1);
+			break;
+		case 0x02:
+		case 0x06:
+			Pure = m_Shadow2A03.IsValid(Reg - 1) && !(m_Shadow2A03.Get(Reg - 1) & 0x80);
+			break;
+		case 0x03:		// length counter, phase and envelope restart
+		case 0x07:
+		case 0x0B:
+		case 0x0F:
+		case 0x11:		// DAC load
+		case 0x15:		// channel enable, DPCM restart
+		case 0x17:		// frame sequencer reset
+			Pure = false;
+			break;
+		default:
+			Pure = true;
+			break;
+	}
+
+	return m_Shadow2A03.Write(Reg, Value, Pure);
+}
+
+bool CAPU::ElideExternalWrite(uint16 Address, uint8 Value)
+{
+	if ((m_iExternalSoundChip & SNDCHIP_VRC6) && Address >= 0x9000 && Address <= 0xB002 && (Address & 0x0FFF) <= 2)
+	{
+		int Reg = ((Address >> 12) - 9) * 3 + (Address & 3);
+		return m_ShadowVRC6.Write(Reg, Value, true);
+	}
+
+	if (m_iExternalSoundChip & SNDCHIP_VRC7)
+	{
+		if (Address == 0x9010)
+		{
+			// The address only matters to the next data write, which sends
+			// it along unless the data is dropped as well
+			m_iVRC7Address = Value;
+			m_ShadowVRC7.CountElided();
+			return true;
+		}
+		if (Address == 0x9030)
+		{
+			if (m_ShadowVRC7.Write(m_iVRC7Address & 0x3F, Value, true))
+				return true;
+
+			if (m_iVRC7ChipAddress != m_iVRC7Address)
+			{
+				m_iVRC7ChipAddress = m_iVRC7Address;
+				m_ShadowVRC7.Unelide();
+				ApplyExternalWrite(0x9010, m_iVRC7Address);
+			}
+			return false;
+		}
+	}
+
+	if ((m_iExternalSoundChip & SNDCHIP_FDS) && Address >= 0x4040 && Address <= 0x408F)
+	{
+		bool Pure;
+		switch (Address)
+		{
+			case 0x4083:	// wave and modulator halt reset the phase
+			case 0x4087:
+				Pure = !(Value & 0x80);
+				break;
+			case 0x4085:	// modulator counter
+			case 0x4088:	// modulation table
+				Pure = false;
+				break;
+			default:
+				Pure = true;
+				break;
+		}
+		return m_ShadowFDS.Write(Address - 0x4040, Value, Pure);
+	}
+
+	if ((m_iExternalSoundChip & SNDCHIP_MMC5) && Address >= 0x5000 && Address <= 0x5015)
+	{
+		bool Pure = Address != 0x5003 && Address != 0x5007;
+		return m_ShadowMMC5.Write(Address - 0x5000, Value, Pure);
+	}
+
+	// Not shadowed: N163, MMC5 RAM and multiplier
+	return false;
+}
+
+void CAPU::InvalidateShadowRegs()
+{
+	m_Shadow2A03.Invalidate();
+	m_ShadowVRC6.Invalidate();
+	m_ShadowVRC7.Invalidate();
+	m_ShadowFDS.Invalidate();
+	m_ShadowMMC5.Invalidate();
+	m_iVRC7ChipAddress = -1;
+}
+
+uint32 CAPU::GetAppliedWrites(int Chip) const
+{
+	switch (Chip)
+	{
+	case SNDCHIP_NONE:
+		return m_Shadow2A03.GetApplied();
+	case SNDCHIP_VRC6:
+		return m_ShadowVRC6.GetApplied();
+	case SNDCHIP_VRC7:
+		return m_ShadowVRC7.GetApplied();
+	case SNDCHIP_FDS:
+		return m_ShadowFDS.GetApplied();
+	case SNDCHIP_MMC5:
+		return m_ShadowMMC5.GetApplied();
+	default:
+		return 0;
+	}
+}
+
+uint32 CAPU::GetElidedWrites(int Chip) const
+{
+	switch (Chip)
+	{
+	case SNDCHIP_NONE:
+		return m_Shadow2A03.GetElided();
+	case SNDCHIP_VRC6:
+		return m_ShadowVRC6.GetElided();
+	case SNDCHIP_VRC7:
+		return m_ShadowVRC7.GetElided();
+	case SNDCHIP_FDS:
+		return m_ShadowFDS.GetElided();
+	case SNDCHIP_MMC5:
+		return m_ShadowMMC5.GetElided();
+	default:
+		return 0;
+	}
+}
+
+void CAPU::ResetWriteCounters()
+{
+	m_Shadow2A03.ResetCounters();
+	m_ShadowVRC6.ResetCounters();
+	m_ShadowVRC7.ResetCounters();
+	m_ShadowFDS.ResetCounters();
+	m_ShadowMMC5.ResetCounters();
+}
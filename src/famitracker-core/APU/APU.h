@@ -23,8 +23,10 @@
 
 //#define LOGGING
 
+#include <vector>
 #include "../Common.h"
 #include "Mixer.h"
+#include "ShadowRegs.h"
 
 namespace core
 {
@@ -56,12 +58,15 @@ class CS5B;
 
 class CExternal;
 
+class Profiler;
+
 class CAPU {
 public:
 	CAPU(CSampleMem *pSampleMem);
 	~CAPU();
 
 	typedef void (*callback_t)(const int16 *buf, uint32 sz, void *data);
+	typedef void (*callback_float_t)(const float *buf, uint32 sz, void *data);
 
 	void	SetCallback(callback_t callback, void *data)
 	{
@@ -69,6 +74,10 @@ public:
 		m_pParentData = data;
 	}
 
+	// Deliver float samples to callback instead, with Outputs interleaved samples per frame.
+	// More than one output splits the sound per chip. NULL returns to int16 output.
+	void	SetFloatCallback(callback_float_t callback, void *data, int Outputs);
+
 	void	Reset();
 	void	Process();
 	void	AddTime(int32 Cycles);
@@ -94,6 +103,16 @@ public:
 
 	void	SetChipLevel(int Chip, int Level);
 
+	// Marks the emulation of each chip and the mixing in pProfiler, NULL stops
+	void	SetProfiler(Profiler *pProfiler) { m_pProfiler = pProfiler; }
+
+	// Register writes that reached the emulation, and those dropped for
+	// storing what the register already held. Chip is SNDCHIP_NONE for
+	// the 2A03, N163 writes are not counted
+	uint32	GetAppliedWrites(int Chip) const;
+	uint32	GetElidedWrites(int Chip) const;
+	void	ResetWriteCounters();
+
 #ifdef LOGGING
 	void	Log();
 #endif
@@ -117,10 +136,18 @@ private:
 	void EndFrame();
 
 	void LogExternalWrite(uint16 Address, uint8 Value);
+
+	bool ElideWrite(uint16 Address, uint8 Value);
+	bool ElideExternalWrite(uint16 Address, uint8 Value);
+	void ApplyExternalWrite(uint16 Address, uint8 Value);
+	void InvalidateShadowRegs();
+
+	void AllocateFloatBuffer();
 		
 private:
 	CMixer		*m_pMixer;
 	callback_t	m_pParent;
+	callback_float_t m_pParentFloat;
 	void		*m_pParentData;
 
 	// Internal channels
@@ -138,6 +165,11 @@ private:
 	CVRC7		*m_pVRC7;
 	CS5B		*m_pS5B;
 
+	std::vector<CExternal*> m_ExChips;				// The enabled expansion chips
+	std::vector<int> m_ExChipSections;				// Profiler part of each enabled chip
+
+	Profiler	*m_pProfiler;
+
 	uint8		m_iExternalSoundChip;				// External sound chip, if used
 
 	uint32		m_iFramePeriod;						// Cycles per frame
@@ -157,11 +189,23 @@ private:
 	uint32		m_iSoundBufferSize;					// Size of buffer, in samples
 	uint32		m_iBufferPointer;					// Fill pos in buffer
 	int16		*m_pSoundBuffer;					// Sound transfer buffer
+	float		*m_pSoundBufferFloat;				// Sound transfer buffer for float output
+	uint32		m_iFloatBufferSize;					// Size of the float buffer, in samples
+	int			m_iFloatOutputs;					// Samples per frame in float output
 
 	uint8		m_iRegs[0x20];
 	uint8		m_iRegsVRC6[0x10];
 	uint8		m_iRegsFDS[0x10];
 
+	// Shadow registers, see ElideWrite
+	CShadowRegs<0x20>	m_Shadow2A03;
+	CShadowRegs<9>		m_ShadowVRC6;
+	CShadowRegs<0x40>	m_ShadowVRC7;
+	CShadowRegs<0x50>	m_ShadowFDS;				// $4040-$408F
+	CShadowRegs<0x16>	m_ShadowMMC5;				// $5000-$5015
+	uint8		m_iVRC7Address;						// Last address written to $9010
+	int			m_iVRC7ChipAddress;					// Address the chip has, -1 if unknown
+
 	float		m_fLevelVRC7;
 	float		m_fLevelS5B;
 
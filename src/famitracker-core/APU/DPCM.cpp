@@ -52,6 +52,8 @@ void CDPCM::Reset()
 
 	// loaded with 0 on power-up.
 	m_iDeltaCounter = 0;
+	m_iLastValue = 0;
+	m_iTime = 0;
 
 	EndFrame();
 }
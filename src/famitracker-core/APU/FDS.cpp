@@ -37,19 +37,21 @@ CFDS::~CFDS()
 
 void CFDS::Reset()
 {
-	FDSSoundReset();
-	FDSSoundVolume(0);
+	FDSSoundReset(m_Sound);
+	FDSSoundVolume(m_Sound, 0);
+	m_iLastValue = 0;
+	m_iTime = 0;
 }
 
 void CFDS::Write(uint16 Address, uint8 Value)
 {
-	FDSSoundWrite(Address, Value);
+	FDSSoundWrite(m_Sound, Address, Value);
 }
 
 uint8 CFDS::Read(uint16 Address, bool &Mapped)
 {
 	Mapped = ((0x4040 <= Address && Address <= 0x407f) || (0x4090 == Address) || (0x4092 == Address));
-	return FDSSoundRead(Address);
+	return FDSSoundRead(m_Sound, Address);
 }
 
 void CFDS::EndFrame()
@@ -64,7 +66,7 @@ void CFDS::Process(uint32 Time)
 
 	while (Time--)
 	{
-		Mix(FDSSoundRender() >> 12);
+		Mix(FDSSoundRender(m_Sound) >> 12);
 		m_iTime++;
 	}
 }
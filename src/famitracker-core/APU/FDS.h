@@ -23,6 +23,7 @@
 
 #include "External.h"
 #include "Channel.h"
+#include "FDSSound.h"
 
 class CFDS : public CExternal, CExChannel {
 public:
@@ -35,6 +36,8 @@ public:
 	void	EndFrame();
 	void	Process(uint32 Time);
 private:
+	FDSSOUND	m_Sound;					// The emulated sound unit
+
 	// Volume envelope variables
 	uint8	m_iVolumeEnvDisable;			// Volume envelope, 1 = disabled
 	uint8	m_iVolumeEnvMode;				// Envelope mode, 1 = increase
@@ -65,51 +65,6 @@ void FDSSelect(unsigned type);
 #define EGCPS_BITS (12)
 #define VOL_BITS 12
 
-typedef struct {
-	uint8 spd;
-	uint8 cnt;
-	uint8 mode;
-	uint8 volume;
-} FDS_EG;
-typedef struct {
-	uint32 spdbase;
-	uint32 spd;
-	uint32 freq;
-} FDS_PG;
-typedef struct {
-	uint32 phase;
-	int8 wave[0x40];
-	uint8 wavptr;
-	int8 output;
-	uint8 disable;
-	uint8 disable2;
-} FDS_WG;
-typedef struct {
-	FDS_EG eg;
-	FDS_PG pg;
-	FDS_WG wg;
-	int32 bias;
-	uint8 wavebase;
-	uint8 d[2];
-} FDS_OP;
-
-typedef struct FDSSOUND_tag {
-	FDS_OP op[2];
-	uint32 phasecps;
-	uint32 envcnt;
-	uint32 envspd;
-	uint32 envcps;
-	uint8 envdisable;
-	uint8 d[3];
-	uint32 lvl;
-	int32 mastervolumel[4];
-	uint32 mastervolume;
-	uint32 srate;
-	uint8 reg[0x10];
-} FDSSOUND;
-
-static FDSSOUND fdssound;
-
 static void FDSSoundWGStep(FDS_WG *pwg)
 {
 #if 0
@@ -135,7 +90,7 @@ static void FDSSoundEGStep(FDS_EG *peg)
 }
 
 
-int32 FDSCALL FDSSoundRender(void)
+int32 FDSCALL FDSSoundRender(FDSSOUND &fdssound)
 {
 	int32 output;
 	/* Wave Generator */
@@ -222,7 +177,7 @@ int32 FDSCALL FDSSoundRender(void)
 	return (fdssound.op[0].pg.freq != 0) ? output : 0;
 }
 
-void FDSCALL FDSSoundVolume(unsigned int volume)
+void FDSCALL FDSSoundVolume(FDSSOUND &fdssound, unsigned int volume)
 {
 	volume += 196;
 	fdssound.mastervolume = (volume << (LOG_BITS - 8)) << 1;
@@ -237,7 +192,7 @@ static const uint8 wave_delta_table[8] = {
 	0,256 - (4 << FM_DEPTH),256 - (2 << FM_DEPTH),256 - (1 << FM_DEPTH),
 };
 
-void FDSCALL FDSSoundWrite(uint16 address, uint8 value)
+void FDSCALL FDSSoundWrite(FDSSOUND &fdssound, uint16 address, uint8 value)
 {
 	if (0x4040 <= address && address <= 0x407F)
 	{
@@ -316,7 +271,7 @@ void FDSCALL FDSSoundWrite(uint16 address, uint8 value)
 	}
 }
 
-uint8 FDSCALL FDSSoundRead(uint16 address)
+uint8 FDSCALL FDSSoundRead(FDSSOUND &fdssound, uint16 address)
 {
 	if (0x4040 <= address && address <= 0x407f)
 	{
@@ -347,7 +302,7 @@ static uint32 DivFix(uint32 p1, uint32 p2, uint32 fix)
 	return ret;
 }
 
-void FDSCALL FDSSoundReset(void)
+void FDSCALL FDSSoundReset(FDSSOUND &fdssound)
 {
 	memset(&fdssound, 0, sizeof(FDSSOUND));
 	// TODO: Fix srate
@@ -11,11 +11,55 @@
 #define FDSCALL
 #endif
 
-void FDSCALL FDSSoundReset(void);
-uint8 FDSCALL FDSSoundRead(uint16 address);
-void FDSCALL FDSSoundWrite(uint16 address, uint8 value);
-int32 FDSCALL FDSSoundRender(void);
-void FDSCALL FDSSoundVolume(unsigned int volume);
+// The state of one FDS sound unit, each CFDS has its own
+typedef struct {
+	uint8 spd;
+	uint8 cnt;
+	uint8 mode;
+	uint8 volume;
+} FDS_EG;
+typedef struct {
+	uint32 spdbase;
+	uint32 spd;
+	uint32 freq;
+} FDS_PG;
+typedef struct {
+	uint32 phase;
+	int8 wave[0x40];
+	uint8 wavptr;
+	int8 output;
+	uint8 disable;
+	uint8 disable2;
+} FDS_WG;
+typedef struct {
+	FDS_EG eg;
+	FDS_PG pg;
+	FDS_WG wg;
+	int32 bias;
+	uint8 wavebase;
+	uint8 d[2];
+} FDS_OP;
+
+typedef struct FDSSOUND_tag {
+	FDS_OP op[2];
+	uint32 phasecps;
+	uint32 envcnt;
+	uint32 envspd;
+	uint32 envcps;
+	uint8 envdisable;
+	uint8 d[3];
+	uint32 lvl;
+	int32 mastervolumel[4];
+	uint32 mastervolume;
+	uint32 srate;
+	uint8 reg[0x10];
+} FDSSOUND;
+
+void FDSCALL FDSSoundReset(FDSSOUND &fdssound);
+uint8 FDSCALL FDSSoundRead(FDSSOUND &fdssound, uint16 address);
+void FDSCALL FDSSoundWrite(FDSSOUND &fdssound, uint16 address, uint8 value);
+int32 FDSCALL FDSSoundRender(FDSSOUND &fdssound);
+void FDSCALL FDSSoundVolume(FDSSOUND &fdssound, unsigned int volume);
 void FDSSoundInstall3(void);
 
 #endif /* _FDSSOUND_H_ */
@@ -56,7 +56,6 @@
 #include <cmath>
 #include "Mixer.h"
 #include "APU.h"
-#include "emu2413.h"
 // TODO - dan
 //#include "emu2149.h"
 
@@ -69,10 +68,25 @@ static const int   LEVEL_FALL_OFF_DELAY = 3;
 
 CMixer::CMixer()
 {
+	m_bSplitOutput = false;
+	m_iSampleRate = 0;
+	m_iBufferLength = 0;
+	m_iClockRate = 0;
+	m_iLowCut = 0;
+
+	m_bSynthsDirty = true;
+	m_fSynthVolume = 0;
+
+	for (int i = 0; i < MIXOUTS; i++)
+		m_pOutputs[i] = &BlipBuffer;
+
 	memset(m_iChannels, 0, sizeof(int32) * CHANNELS);
 	memset(m_fChannelLevels, 0, sizeof(float) * CHANNELS);
 	memset(m_iChanLevelFallOff, 0, sizeof(uint32) * CHANNELS);
 
+	m_dSumSS = 0;
+	m_dSumTND = 0;
+
 	m_fLevel2A03 = 1.0f;
 	m_fLevelVRC6 = 1.0f;
 	m_fLevelMMC5 = 1.0f;
@@ -127,6 +141,8 @@ void CMixer::SetChipLevel(int Chip, float Level)
 			m_fLevelFDS = Level;
 			break;
 	}
+
+	m_bSynthsDirty = true;
 }
 
 void CMixer::UpdateSettings(int LowCut,	int HighCut, int HighDamp, int OverallVol)
@@ -147,9 +163,24 @@ void CMixer::UpdateSettings(int LowCut,	int HighCut, int HighDamp, int OverallVo
 
 	fVolume *= m_fDamping;
 
+	// Setting up the synth kernels is slow, skip it when nothing they
+	// depend on changed since the last time
+	if (!m_bSynthsDirty && LowCut == m_iLowCut && HighCut == m_iHighCut &&
+		HighDamp == m_iHighDamp && fVolume == m_fSynthVolume)
+	{
+		m_iOverallVol = OverallVol;
+		return;
+	}
+
 	// Blip-buffer filtering
 	BlipBuffer.bass_freq(LowCut);
 
+	if (m_bSplitOutput)
+	{
+		for (int i = MIXOUT_2A03 + 1; i < MIXOUTS; i++)
+			ChipBuffers[i].bass_freq(LowCut);
+	}
+
 	blip_eq_t eq(-HighDamp, HighCut, m_iSampleRate);
 
 	Synth2A03SS.treble_eq(eq);
@@ -175,35 +206,95 @@ void CMixer::UpdateSettings(int LowCut,	int HighCut, int HighDamp, int OverallVo
 	m_iHighCut = HighCut;
 	m_iHighDamp = HighDamp;
 	m_iOverallVol = OverallVol;
+
+	m_fSynthVolume = fVolume;
+	m_bSynthsDirty = false;
 }
 
 void CMixer::MixSamples(blip_sample_t *pBuffer, uint32 Count)
 {
 	// For VRC7
-	BlipBuffer.mix_samples(pBuffer, Count);
+	m_pOutputs[MIXOUT_VRC7]->mix_samples(pBuffer, Count);
 }
 
 uint32 CMixer::GetMixSampleCount(int t) const
 {
-	return BlipBuffer.count_samples(t);
+	return m_pOutputs[MIXOUT_VRC7]->count_samples(t);
 }
 
 bool CMixer::AllocateBuffer(unsigned int BufferLength, uint32 SampleRate, uint8 NrChannels)
 {
 	m_iSampleRate = SampleRate;
-	BlipBuffer.sample_rate(SampleRate, (BufferLength * 1000 * 2) / SampleRate);
+	m_iBufferLength = (BufferLength * 1000 * 2) / SampleRate;
+	BlipBuffer.sample_rate(SampleRate, m_iBufferLength);
+	SetupChipBuffers();
+	m_bSynthsDirty = true;
 	return true;
 }
 
 void CMixer::SetClockRate(uint32 Rate)
 {
 	// Change the clockrate
+	m_iClockRate = Rate;
 	BlipBuffer.clock_rate(Rate);
+
+	if (m_bSplitOutput)
+	{
+		for (int i = MIXOUT_2A03 + 1; i < MIXOUTS; i++)
+			ChipBuffers[i].clock_rate(Rate);
+	}
 }
 
 void CMixer::ClearBuffer()
 {
 	BlipBuffer.clear();
+
+	// The buffer starts over from silence, forget the channel levels
+	memset(m_iChannels, 0, sizeof(int32) * CHANNELS);
+	memset(m_fChannelLevels, 0, sizeof(float) * CHANNELS);
+	memset(m_iChanLevelFallOff, 0, sizeof(uint32) * CHANNELS);
+
+	m_dSumSS = 0;
+	m_dSumTND = 0;
+
+	if (m_bSplitOutput)
+	{
+		for (int i = MIXOUT_2A03 + 1; i < MIXOUTS; i++)
+			ChipBuffers[i].clear();
+	}
+}
+
+void CMixer::SetSplitOutput(bool Split)
+{
+	// Render each sound chip into a buffer of its own instead of the common mix
+	//
+
+	if (Split == m_bSplitOutput)
+		return;
+
+	m_bSplitOutput = Split;
+	m_bSynthsDirty = true;
+
+	for (int i = MIXOUT_2A03 + 1; i < MIXOUTS; i++)
+		m_pOutputs[i] = Split ? &ChipBuffers[i] : &BlipBuffer;
+
+	SetupChipBuffers();
+	ClearBuffer();
+}
+
+void CMixer::SetupChipBuffers()
+{
+	// Chip buffers follow the settings of the main buffer
+	if (!m_bSplitOutput || m_iSampleRate == 0)
+		return;
+
+	for (int i = MIXOUT_2A03 + 1; i < MIXOUTS; i++)
+	{
+		ChipBuffers[i].sample_rate(m_iSampleRate, m_iBufferLength);
+		if (m_iClockRate != 0)
+			ChipBuffers[i].clock_rate(m_iClockRate);
+		ChipBuffers[i].bass_freq(m_iLowCut);
+	}
 }
 
 int CMixer::SamplesAvail() const
@@ -215,9 +306,12 @@ int CMixer::FinishBuffer(int t)
 {
 	BlipBuffer.end_frame(t);
 
-	// Get channel levels for VRC7
-	for (int i = 0; i < 6; i++)
-		StoreChannelLevel(CHANID_VRC7_CH1 + i, OPLL_getchanvol(i));
+	if (m_bSplitOutput)
+	{
+		for (int i = MIXOUT_2A03 + 1; i < MIXOUTS; i++)
+			ChipBuffers[i].end_frame(t);
+	}
+
 /*
 	// Get channel levels for Sunsoft
 	for (int i = 0; i < 3; i++)
@@ -247,7 +341,6 @@ int CMixer::FinishBuffer(int t)
 
 void CMixer::MixInternal1(int Time)
 {
-	static double LastSum;
 	double Sum, Delta;
 
 #ifdef LINEAR_MIXING
@@ -257,14 +350,13 @@ void CMixer::MixInternal1(int Time)
 	Sum = CalcPin1(m_iChannels[CHANID_SQUARE1], m_iChannels[CHANID_SQUARE2]);
 #endif
 
-	Delta = (Sum - LastSum) * AMP_2A03;
+	Delta = (Sum - m_dSumSS) * AMP_2A03;
 	Synth2A03SS.offset(Time, (int)Delta, &BlipBuffer);
-	LastSum = Sum;
+	m_dSumSS = Sum;
 }
 
 void CMixer::MixInternal2(int Time)
 {
-	static double LastSum;
 	double Sum, Delta;
 
 #ifdef LINEAR_MIXING
@@ -274,29 +366,29 @@ void CMixer::MixInternal2(int Time)
 	Sum = CalcPin2(m_iChannels[CHANID_TRIANGLE], m_iChannels[CHANID_NOISE], m_iChannels[CHANID_DPCM]);
 #endif
 
-	Delta = (Sum - LastSum) * AMP_2A03;
+	Delta = (Sum - m_dSumTND) * AMP_2A03;
 	Synth2A03TND.offset(Time, (int)Delta, &BlipBuffer);
-	LastSum = Sum;
+	m_dSumTND = Sum;
 }
 
 void CMixer::MixN106(int Value, int Time)
 {
-	SynthN106.offset(Time, Value, &BlipBuffer);
+	SynthN106.offset(Time, Value, m_pOutputs[MIXOUT_N106]);
 }
 
 void CMixer::MixFDS(int Value, int Time)
 {
-	SynthFDS.offset(Time, Value, &BlipBuffer);
+	SynthFDS.offset(Time, Value, m_pOutputs[MIXOUT_FDS]);
 }
 
 void CMixer::MixVRC6(int Value, int Time)
 {
-	SynthVRC6.offset(Time, Value, &BlipBuffer);
+	SynthVRC6.offset(Time, Value, m_pOutputs[MIXOUT_VRC6]);
 }
 
 void CMixer::MixMMC5(int Value, int Time)
 {
-	SynthMMC5.offset(Time, Value, &BlipBuffer);
+	SynthMMC5.offset(Time, Value, m_pOutputs[MIXOUT_MMC5]);
 }
 
 void CMixer::MixS5B(int Value, int Time)
@@ -346,9 +438,57 @@ void CMixer::AddValue(int ChanID, int Chip, int Value, int AbsValue, int FrameCy
 
 int CMixer::ReadBuffer(int Size, void *Buffer, bool Stereo)
 {
+	// Only reads the 2A03 part when the output is split, use ReadBufferFloat
 	return BlipBuffer.read_samples((blip_sample_t*)Buffer, Size);
 }
 
+int CMixer::ReadBufferFloat(int Size, float *Buffer, int Outputs)
+{
+	// Read samples as floats, interleaved with Outputs samples per frame.
+	// The full scale of the int16 output maps to [-1, 1], and samples are not clipped.
+	// When split, output n is chip MIXOUT_n, otherwise output 0 is the mix.
+	// Outputs without a chip are silenced.
+	//
+
+	static const float SAMPLE_SCALE = 1.0f / float(1L << (blip_sample_bits - 1));
+
+	long Count = BlipBuffer.samples_avail();
+	if (Count > Size)
+		Count = Size;
+
+	int Buffers = m_bSplitOutput ? MIXOUTS : 1;
+
+	for (int i = 0; i < Buffers || i < Outputs; i++)
+	{
+		if (i >= Buffers)
+		{
+			float *pOut = Buffer + i;
+			for (long n = 0; n < Count; n++, pOut += Outputs)
+				*pOut = 0.0f;
+			continue;
+		}
+
+		Blip_Buffer &Buf = *m_pOutputs[i];
+
+		if (i < Outputs)
+		{
+			float *pOut = Buffer + i;
+			Blip_Reader Reader;
+			int BassShift = Reader.begin(Buf);
+			for (long n = 0; n < Count; n++, pOut += Outputs)
+			{
+				*pOut = float(Reader.read_raw()) * SAMPLE_SCALE;
+				Reader.next(BassShift);
+			}
+			Reader.end(Buf);
+		}
+
+		Buf.remove_samples(Count);
+	}
+
+	return Count;
+}
+
 int32 CMixer::GetChanOutput(uint8 Chan) const
 {
 	return (int32)m_fChannelLevels[Chan];
@@ -64,6 +64,18 @@ enum CHAN_IDS {
 	CHANNELS		/* Total number of channels */
 };
 
+// Separate outputs when the mixer is split by sound chip
+enum MIX_OUTPUTS {
+	MIXOUT_2A03,
+	MIXOUT_VRC6,
+	MIXOUT_VRC7,
+	MIXOUT_FDS,
+	MIXOUT_MMC5,
+	MIXOUT_N106,
+
+	MIXOUTS			/* Total number of chip outputs */
+};
+
 class CMixer
 {
 	public:
@@ -86,6 +98,10 @@ class CMixer
 		void	AddSample(int ChanID, int Value);
 
 		int		ReadBuffer(int Size, void *Buffer, bool Stereo);
+		int		ReadBufferFloat(int Size, float *Buffer, int Outputs);
+
+		void	SetSplitOutput(bool Split);
+		bool	IsSplitOutput() const { return m_bSplitOutput; }
 
 		int32	GetChanOutput(uint8 Chan) const;
 
@@ -93,6 +109,9 @@ class CMixer
 
 		uint32	getFramesToFalloff() const;
 
+		// Called by chips that measure their own channel levels, like the VRC7
+		void	StoreChannelLevel(int Channel, int Value);
+
 	private:
 		inline double CalcPin1(double Val1, double Val2);
 		inline double CalcPin2(double Val1, double Val2, double Val3);
@@ -105,7 +124,7 @@ class CMixer
 		void MixMMC5(int Value, int Time);
 		void MixS5B(int Value, int Time);
 
-		void StoreChannelLevel(int Channel, int Value);
+		void SetupChipBuffers();
 
 		// Blip buffer synths
 		Blip_Synth<blip_good_quality, -500>		Synth2A03SS;
@@ -120,12 +139,20 @@ class CMixer
 		// Blip buffer object
 		Blip_Buffer	BlipBuffer;
 
+		// Per chip blip buffers, only used when the output is split.
+		// MIXOUT_2A03 always goes to BlipBuffer
+		Blip_Buffer	ChipBuffers[MIXOUTS];
+		Blip_Buffer	*m_pOutputs[MIXOUTS];
+		bool		m_bSplitOutput;
+
 		// Random variables
 		int32		*m_pSampleBuffer;
 
 		int32		m_iChannels[CHANNELS];
 		uint8		m_iExternalChip;
 		uint32		m_iSampleRate;
+		uint32		m_iBufferLength;
+		uint32		m_iClockRate;
 
 		float		m_fChannelLevels[CHANNELS];
 		uint32		m_iChanLevelFallOff[CHANNELS];
@@ -135,8 +162,16 @@ class CMixer
 		int			m_iHighDamp;
 		int			m_iOverallVol;
 
+		// What the synths were last set up with, see UpdateSettings
+		bool		m_bSynthsDirty;
+		float		m_fSynthVolume;
+
 		float		m_fDamping;
 
+		// Last output of the 2A03 pins, the synths are fed the differences
+		double		m_dSumSS;
+		double		m_dSumTND;
+
 		float		m_fLevel2A03;
 		float		m_fLevelVRC6;
 		float		m_fLevelMMC5;
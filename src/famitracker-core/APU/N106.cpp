@@ -141,6 +141,7 @@ void CN106Chan::Reset()
 	m_iFreqs[2] = 0;
 
 	m_iVolume = 0;
+	m_iLastValue = 0;
 
 	EndFrame();
 }
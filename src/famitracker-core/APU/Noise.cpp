@@ -42,6 +42,8 @@ void CNoise::Reset()
 {
 	m_iEnabled = m_iControlReg = 0;
 	m_iCounter = m_iLengthCounter = 0;
+	m_iLastValue = 0;
+	m_iTime = 0;
 	
 	m_iShiftReg = 1;
 
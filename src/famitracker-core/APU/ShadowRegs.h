@@ -0,0 +1,65 @@
+#ifndef _SHADOWREGS_H_
+#define _SHADOWREGS_H_
+
+#include <cstring>
+#include "../Common.h"
+
+//
+// The last value written to each register of a chip. A write storing the
+// value its register already holds changes nothing if the register has no
+// side effects, such writes are dropped before they reach the emulation
+//
+
+template <int Size>
+class CShadowRegs {
+public:
+	CShadowRegs() : m_iApplied(0), m_iElided(0) {
+		Invalidate();
+	}
+
+	// Forget the register contents, for when the chip changed behind our back
+	void Invalidate() {
+		memset(m_bValid, 0, sizeof(m_bValid));
+	}
+	void Invalidate(int Reg) {
+		m_bValid[Reg] = false;
+	}
+
+	bool IsValid(int Reg) const { return m_bValid[Reg]; }
+	uint8 Get(int Reg) const { return m_iValue[Reg]; }
+
+	// Counts a write and returns true if it can be dropped. Writes to
+	// registers that are not Pure always go through
+	bool Write(int Reg, uint8 Value, bool Pure) {
+		if (Pure && m_bValid[Reg] && m_iValue[Reg] == Value) {
+			++m_iElided;
+			return true;
+		}
+		m_iValue[Reg] = Value;
+		m_bValid[Reg] = true;
+		++m_iApplied;
+		return false;
+	}
+
+	// For writes held back by the caller
+	void CountElided() { ++m_iElided; }
+
+	// A write counted as dropped was sent after all
+	void Unelide() {
+		if (m_iElided > 0)
+			--m_iElided;
+		++m_iApplied;
+	}
+
+	uint32 GetApplied() const { return m_iApplied; }
+	uint32 GetElided() const { return m_iElided; }
+	void ResetCounters() { m_iApplied = m_iElided = 0; }
+
+private:
+	uint8	m_iValue[Size];
+	bool	m_bValid[Size];
+	uint32	m_iApplied;
+	uint32	m_iElided;
+};
+
+#endif /* _SHADOWREGS_H_ */
@@ -43,6 +43,8 @@ void CSquare::Reset()
 {
 	m_iEnabled = m_iControlReg = 0;
 	m_iCounter = 0;
+	m_iLastValue = 0;
+	m_iTime = 0;
 
 	m_iSweepCounter = 1;
 	m_iSweepPeriod = 1;
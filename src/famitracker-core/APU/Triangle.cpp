@@ -40,6 +40,8 @@ void CTriangle::Reset()
 	m_iStepGen = m_iLinearCounter = 0;
 	m_iEnabled = m_iControlReg = 0;
 	m_iCounter = m_iLengthCounter = 0;
+	m_iLastValue = 0;
+	m_iTime = 0;
 
 	Write(0, 0);
 	Write(1, 0);
@@ -30,6 +30,8 @@ void CVRC6_Pulse::Reset()
 	Frequency = FreqLow = FreqHigh = 0;
 	Counter = 0;
 	DutyCycleCounter = 0;
+	m_iLastValue = 0;
+	m_iTime = 0;
 }
 
 void CVRC6_Pulse::Write(uint16 Address, uint8 Value)
@@ -83,6 +85,8 @@ void CVRC6_Sawtooth::Reset()
 	Frequency = 0;
 	FreqLow = FreqHigh = 0;
 	Counter = 0;
+	m_iLastValue = 0;
+	m_iTime = 0;
 }
 
 void CVRC6_Sawtooth::Write(uint16 Address, uint8 Value)
@@ -49,6 +49,13 @@ void CVRC7::Reset()
 {
 	m_iBufferPtr = 0;
 	m_iTime = 0;
+	m_iLastSample = 0;
+
+	if (m_pOPLLInt != NULL)
+	{
+		OPLL_reset(m_pOPLLInt);
+		OPLL_reset_patch(m_pOPLLInt, 1);
+	}
 }
 
 void CVRC7::SetSampleSpeed(uint32 SampleRate, double ClockRate, uint32 FrameRate)
@@ -100,17 +107,19 @@ void CVRC7::EndFrame()
 {
 	uint32 WantSamples = m_pMixer->GetMixSampleCount(m_iTime);
 
-	static int32 LastSample = 0;
-
 	// Generate VRC7 samples
 	while (m_iBufferPtr < WantSamples) {
 		int32 Sample = int(float(OPLL_calc(m_pOPLLInt)) * m_fVolume);
-		m_pBuffer[m_iBufferPtr++] = int16((Sample + LastSample) >> 1);
-		LastSample = Sample;
+		m_pBuffer[m_iBufferPtr++] = int16((Sample + m_iLastSample) >> 1);
+		m_iLastSample = Sample;
 	}
 
 	m_pMixer->MixSamples((blip_sample_t*)m_pBuffer, WantSamples);
 
+	// Channel levels
+	for (int i = 0; i < 6; i++)
+		m_pMixer->StoreChannelLevel(CHANID_VRC7_CH1 + i, OPLL_getchanvol(m_pOPLLInt, i));
+
 	m_iBufferPtr -= WantSamples;
 	m_iTime = 0;
 }
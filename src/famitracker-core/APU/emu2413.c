@@ -225,9 +225,6 @@ static int32 rksTable[2][8][2];
 /* Phase incr table for PG */
 static uint32 dphaseTable[512][8][16];
 
-// Added by jsr
-int32 opll_volumes[10];
-
 /***************************************************
  
                   Create tables
@@ -1062,6 +1059,7 @@ OPLL_reset (OPLL * opll)
   for (i = 0; i < 9; i++)
   {
     opll->key_status[i] = 0;
+    opll->chan_volume[i] = 0;
     setPatch (opll, i, 0);
   }
 
@@ -1424,8 +1422,8 @@ calc (OPLL * opll)
 		int32 absval, val = calc_slot_car (CAR(opll,i), calc_slot_mod(MOD(opll,i)));
 		inst += val;
 		absval = abs(val);
-		if (absval > opll_volumes[i])
-			opll_volumes[i] = val;
+		if (absval > opll->chan_volume[i])
+			opll->chan_volume[i] = val;
 	  }
 
   /* CH6 */
@@ -1878,9 +1876,9 @@ OPLL_calc_stereo (OPLL * opll, int32 out[2])
 #endif /* EMU2413_COMPACTION */
 
 
-int32 OPLL_getchanvol(int i)
+int32 OPLL_getchanvol(OPLL *opll, int i)
 {
-	int retval = opll_volumes[i];
-	opll_volumes[i] = 0;
+	int retval = opll->chan_volume[i];
+	opll->chan_volume[i] = 0;
 	return retval;
 }
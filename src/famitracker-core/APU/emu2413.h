@@ -116,6 +116,9 @@ typedef struct __OPLL {
 
   uint32 mask ;
 
+  /* Peak output of each channel since the last OPLL_getchanvol */
+  int32 chan_volume[9] ;
+
 } OPLL ;
 
 /* Create Object */
@@ -152,7 +155,7 @@ EMU2413_API uint32 OPLL_toggleMask(OPLL *, uint32 mask) ;
 
 #define dump2patch OPLL_dump2patch
 
-int32 OPLL_getchanvol(int i);
+int32 OPLL_getchanvol(OPLL *, int i);
 
 #ifdef __cplusplus
 }
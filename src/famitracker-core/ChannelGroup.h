@@ -0,0 +1,103 @@
+#pragma once
+
+#include <vector>
+#include "APU/APU.h"
+#include "Profiler.hpp"
+
+//
+// The channel handlers of one chip, updated once per frame. The handlers are
+// kept in one array per class, and the template calls the handler functions
+// qualified, so they are bound at compile time instead of costing two
+// virtual calls per channel
+//
+class CChannelGroup {
+public:
+	CChannelGroup(int Chip) : m_iChip(Chip), m_iIdleChannels(0) {}
+	virtual ~CChannelGroup() {}
+
+	int GetChip() const { return m_iChip; }
+
+	// Time slots of the channels of chips the document does not use, that
+	// come after this group. The APU is still advanced for them, so the timing
+	// of the other chips does not depend on which expansion chip is enabled
+	void SetIdleChannels(int Count) { m_iIdleChannels = Count; }
+
+	// Runs and refreshes every channel, advancing the APU by Delay cycles after
+	// each one and each idle slot. Returns the cycles added. pProfiler may be NULL
+	virtual int Update(CAPU *pAPU, int Delay, Profiler *pProfiler) = 0;
+
+protected:
+	int Idle(CAPU *pAPU, int Delay) const {
+		for (int i = 0; i < m_iIdleChannels; ++i) {
+			pAPU->Process();
+			if (Delay > 0)
+				pAPU->AddTime(Delay);
+		}
+		return m_iIdleChannels * Delay;
+	}
+
+private:
+	int		m_iChip;
+	int		m_iIdleChannels;
+};
+
+// Fills the unused class slots of CChannelGroupT
+template <int N>
+struct CNoChannel {};
+
+// Up to five handler classes, updated in this order. Add the handlers of one
+// class in channel order
+template <class H1, class H2 = CNoChannel<2>, class H3 = CNoChannel<3>, class H4 = CNoChannel<4>, class H5 = CNoChannel<5> >
+class CChannelGroupT : public CChannelGroup {
+public:
+	CChannelGroupT(int Chip) : CChannelGroup(Chip) {}
+
+	void Add(H1 *pHandler) { m_pHandlers1.push_back(pHandler); }
+	void Add(H2 *pHandler) { m_pHandlers2.push_back(pHandler); }
+	void Add(H3 *pHandler) { m_pHandlers3.push_back(pHandler); }
+	void Add(H4 *pHandler) { m_pHandlers4.push_back(pHandler); }
+	void Add(H5 *pHandler) { m_pHandlers5.push_back(pHandler); }
+
+	int Update(CAPU *pAPU, int Delay, Profiler *pProfiler) {
+		int Cycles = UpdateHandlers(m_pHandlers1, pAPU, Delay, pProfiler);
+		Cycles += UpdateHandlers(m_pHandlers2, pAPU, Delay, pProfiler);
+		Cycles += UpdateHandlers(m_pHandlers3, pAPU, Delay, pProfiler);
+		Cycles += UpdateHandlers(m_pHandlers4, pAPU, Delay, pProfiler);
+		Cycles += UpdateHandlers(m_pHandlers5, pAPU, Delay, pProfiler);
+		return Cycles + Idle(pAPU, Delay);
+	}
+
+private:
+	template <class Handler>
+	static int UpdateHandlers(const std::vector<Handler*> &Handlers, CAPU *pAPU, int Delay, Profiler *pProfiler) {
+		const int Count = (int)Handlers.size();
+		for (int i = 0; i < Count; ++i) {
+			Handler *pHandler = Handlers[i];
+			const int ID = pHandler->GetChannelID();
+			{
+				ProfileScope Scope(pProfiler, Profiler::PROCESS + ID);
+				pHandler->Handler::ProcessChannel();
+			}
+			{
+				ProfileScope Scope(pProfiler, Profiler::REFRESH + ID);
+				pHandler->Handler::RefreshChannel();
+			}
+			pAPU->Process();
+			// Add some delay between each channel update
+			if (Delay > 0)
+				pAPU->AddTime(Delay);
+		}
+		return Count * Delay;
+	}
+
+	template <int N>
+	static int UpdateHandlers(const std::vector<CNoChannel<N>*> &, CAPU *, int, Profiler *) {
+		return 0;
+	}
+
+	std::vector<H1*> m_pHandlers1;
+	std::vector<H2*> m_pHandlers2;
+	std::vector<H3*> m_pHandlers3;
+	std::vector<H4*> m_pHandlers4;
+	std::vector<H5*> m_pHandlers5;
+};
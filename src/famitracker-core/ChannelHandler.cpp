@@ -26,32 +26,59 @@
 #include "FtmDocument.hpp"
 #include "SoundGen.hpp"
 #include "ChannelHandler.h"
+#include "ChannelState.h"
 #include "Sequence.h"
 
 // Range for the pitch wheel command in notes
 int PITCH_RANGE = 6;
 
 CChannelHandler::CChannelHandler(SoundGen *gen) :
-	m_pSoundGen(gen),
+	m_pState(gen->channelState()),
+	m_iSlot(m_pState->AddChannel()),
 	m_iChannelID(0), 
-	m_bEnabled(false), 
+	m_bEnabled(m_pState->Enabled[m_iSlot]),
 	m_iInstrument(0), 
 	m_iLastInstrument(MAX_INSTRUMENTS),
+	m_iNote(0),
+	m_iPeriod(m_pState->Period[m_iSlot]),
+	m_iVolume(m_pState->Volume[m_iSlot]),
+	m_iDutyPeriod(0),
+	m_iPeriodPart(m_pState->PeriodPart[m_iSlot]),
+	m_bDelayEnabled(m_pState->DelayEnabled[m_iSlot]),
+	m_cDelayCounter(m_pState->DelayCounter[m_iSlot]),
+	m_iVibratoDepth(m_pState->VibratoDepth[m_iSlot]),
+	m_iVibratoSpeed(m_pState->VibratoSpeed[m_iSlot]),
+	m_iVibratoPhase(m_pState->VibratoPhase[m_iSlot]),
+	m_iTremoloDepth(m_pState->TremoloDepth[m_iSlot]),
+	m_iTremoloSpeed(m_pState->TremoloSpeed[m_iSlot]),
+	m_iTremoloPhase(m_pState->TremoloPhase[m_iSlot]),
+	m_iEffect(m_pState->Effect[m_iSlot]),
+	m_iPortaTo(m_pState->PortaTo[m_iSlot]),
+	m_iPortaSpeed(m_pState->PortaSpeed[m_iSlot]),
+	m_iNoteCut(m_pState->NoteCut[m_iSlot]),
+	m_iDefaultDuty(0),
+	m_iVolSlide(m_pState->VolSlide[m_iSlot]),
+	m_iSeqPointer(m_pState->SeqPointer[m_iSlot]),
+	m_pAPU(NULL),
+	m_pDocument(NULL),
 	m_pNoteLookupTable(NULL),
 	m_pVibratoTable(NULL),
-	m_pDocument(NULL),
-	m_pAPU(NULL),
 	m_iPitch(0),
-	m_iNote(0),
-	m_iDefaultDuty(0),
-	m_iDutyPeriod(0),
-	m_iMaxPeriod(0x7FF),		// Default for 2A03 regs
-	m_bGate(false)
+	m_bGate(false),
+	m_iMaxPeriod(m_pState->MaxPeriod[m_iSlot]),
+	m_pSoundGen(gen)
 {
 	m_iSeqVolume = 0;
+
+	for (int i = 0; i < SEQ_COUNT; i++)
+	{
+		m_pSequence[i] = NULL;
+		m_iSeqResolved[i] = -1;
+	}
+	m_iSeqVersion = 0;
 }
 
-void CChannelHandler::InitChannel(CAPU *pAPU, int *pVibTable, FtmDocument *pDoc)
+void CChannelHandler::InitChannel(CAPU *pAPU, const int *pVibTable, FtmDocument *pDoc)
 {
 	// Called from main thread
 
@@ -59,16 +86,46 @@ void CChannelHandler::InitChannel(CAPU *pAPU, int *pVibTable, FtmDocument *pDoc)
 	m_pVibratoTable = pVibTable;
 	m_pDocument = pDoc;
 
+	// Sequence pointers are only valid for the document they were looked up in
+	for (int i = 0; i < SEQ_COUNT; i++)
+	{
+		m_pSequence[i] = NULL;
+		m_iSeqResolved[i] = -1;
+	}
+
 //	m_pDelayedNote = NULL;
-	m_bDelayEnabled = false;
 
-	m_iEffect = 0;
+	ResetPlayState();
 
 	//KillChannel();
 
 	m_iVibratoStyle = VIBRATO_NEW;
 }
 
+void CChannelHandler::ResetPlayState()
+{
+	// Called from main thread when playback starts, MakeSilent() does not
+	// touch the effect and sequence positions of the last session
+
+	m_bDelayEnabled = false;
+	m_cDelayCounter = 0;
+
+	m_iEffect = 0;
+	m_cArpeggio = 0;
+	m_cArpVar = 0;
+
+	m_bRelease = false;
+	m_bGate = false;
+	m_iSeqVolume = 0;
+
+	for (int i = 0; i < SEQ_COUNT; i++)
+	{
+		m_iSeqEnabled[i] = 0;
+		m_iSeqIndex[i] = 0;
+		m_iSeqPointer[i] = 0;
+	}
+}
+
 int CChannelHandler::LimitPeriod(int Period) const
 {
 	if (Period > m_iMaxPeriod)
@@ -223,7 +280,7 @@ void CChannelHandler::PlayNote(stChanNote *noteData, int effColumns)
 	PlayChannelNote(noteData, effColumns);
 }
 
-void CChannelHandler::SetNoteTable(unsigned int *pNoteLookupTable)
+void CChannelHandler::SetNoteTable(const unsigned int *pNoteLookupTable)
 {
 	// Installs the note lookup table
 	m_pNoteLookupTable = pNoteLookupTable;
@@ -422,59 +479,22 @@ void CChannelHandler::UpdateDelay()
 
 void CChannelHandler::UpdateVolumeSlide()
 {
-	// Volume slide (Axx)
-	m_iVolume -= (m_iVolSlide & 0x0F);
-	if (m_iVolume < 0)
-		m_iVolume = 0;
-
-	m_iVolume += (m_iVolSlide & 0xF0) >> 4;
-	if (m_iVolume < 0)
-		m_iVolume = MAX_VOL;
+	m_pState->SlideVolume(m_iSlot);
 }
 
 void CChannelHandler::UpdateVibratoTremolo()
 {
-	// Vibrato and tremolo
-	m_iVibratoPhase = (m_iVibratoPhase + m_iVibratoSpeed) & 63;
-	m_iTremoloPhase = (m_iTremoloPhase + m_iTremoloSpeed) & 63;
-}
-
-void CChannelHandler::LinearAdd(int Step)
-{
-	m_iPeriod = (m_iPeriod << 5) | m_iPeriodPart;
-	int value = (m_iPeriod * Step) / 512;
-	if (value == 0)
-		value = 1;
-	m_iPeriod += value;
-	m_iPeriodPart = m_iPeriod & 0x1F;
-	m_iPeriod >>= 5;
-}
-
-void CChannelHandler::LinearRemove(int Step)
-{
-	m_iPeriod = (m_iPeriod << 5) | m_iPeriodPart;
-	int value = (m_iPeriod * Step) / 512;
-	if (value == 0)
-		value = 1;
-	m_iPeriod -= value;
-	m_iPeriodPart = m_iPeriod & 0x1F;
-	m_iPeriod >>= 5;
+	m_pState->AdvancePhases(m_iSlot);
 }
 
 void CChannelHandler::PeriodAdd(int Step)
 {
-	if (m_pDocument->GetLinearPitch())
-		LinearAdd(Step);
-	else
-		m_iPeriod += Step;
+	m_pState->PeriodAdd(m_iSlot, Step, m_pDocument->GetLinearPitch());
 }
 
 void CChannelHandler::PeriodRemove(int Step)
 {
-	if (m_pDocument->GetLinearPitch())
-		LinearRemove(Step);
-	else
-		m_iPeriod -= Step;
+	m_pState->PeriodRemove(m_iSlot, Step, m_pDocument->GetLinearPitch());
 }
 
 void CChannelHandler::UpdateEffects()
@@ -506,33 +526,9 @@ void CChannelHandler::UpdateEffects()
 		case EF_PORTAMENTO:
 		case EF_SLIDE_UP:
 		case EF_SLIDE_DOWN:
-			// Automatic portamento
-			if (m_iPortaSpeed > 0 && m_iPortaTo > 0)
-			{
-				if (m_iPeriod > m_iPortaTo)
-				{
-					PeriodRemove(m_iPortaSpeed);
-					// TODO: check this
-//					if (m_iPeriod > 0x1000)	// it was negative
-//						m_iPeriod = 0x00;
-					if (m_iPeriod < m_iPortaTo)
-						m_iPeriod = m_iPortaTo;
-				}
-				else if (m_iPeriod < m_iPortaTo)
-				{
-					PeriodAdd(m_iPortaSpeed);
-					if (m_iPeriod > m_iPortaTo)
-						m_iPeriod = m_iPortaTo;
-				}
-			}
-			break;
 		case EF_PORTA_DOWN:
-			PeriodAdd(m_iPortaSpeed);
-			m_iPeriod = LimitPeriod(m_iPeriod);
-			break;
 		case EF_PORTA_UP:
-			PeriodRemove(m_iPortaSpeed);
-			m_iPeriod = LimitPeriod(m_iPeriod);
+			m_pState->Portamento(m_iSlot, m_pDocument->GetLinearPitch());
 			break;
 	}
 }
@@ -549,6 +545,15 @@ void CChannelHandler::ProcessChannel()
 	if (!m_bEnabled)
 		return;
 
+	// SoundGen already ran the effects of this channel, all but arpeggios
+	if (m_pState->Batched[m_iSlot])
+	{
+		m_pState->Batched[m_iSlot] = false;
+		if (m_iEffect == EF_ARPEGGIO)
+			UpdateEffects();
+		return;
+	}
+
 	UpdateVolumeSlide();
 	UpdateVibratoTremolo();
 	UpdateEffects();
@@ -646,9 +651,18 @@ int CChannelHandler::GetFinePitch() const
 
 void CChannelHandler::RunSequence(int Index, CSequence *pSequence)
 {
+	if (pSequence == NULL)
+	{
+		// Does not exist, same as empty
+		if (m_iSeqEnabled[Index] == 2)
+			m_iSeqEnabled[Index] = 0;
+		return;
+	}
+
 	if (m_iSeqEnabled[Index] == 1 && pSequence->GetItemCount() > 0)
 	{
-		int Value = pSequence->GetItem(m_iSeqPointer[Index]);
+		bool End;
+		int Value = pSequence->Run(m_iSeqPointer[Index], m_bRelease, End);
 
 		switch (Index)
 		{
@@ -692,42 +706,8 @@ void CChannelHandler::RunSequence(int Index, CSequence *pSequence)
 				break;
 		}
 
-		m_iSeqPointer[Index]++;
-
-		int Release = pSequence->GetReleasePoint();
-		int Items = pSequence->GetItemCount();
-		int Loop = pSequence->GetLoopPoint();
-
-		/*
-		if (m_bRelease)
-		{
-			if (m_iSeqPointer[Index] == Items)
-			{
-				// End of sequence 
-				m_iSeqEnabled[Index] = 0;
-			}
-		}
-		else {
-		*/
-			if (m_iSeqPointer[Index] == (Release + 1) || m_iSeqPointer[Index] == Items)
-			{
-				// End point reached
-				if (Loop != -1 && !(m_bRelease && Release != -1))
-				{
-					m_iSeqPointer[Index] = Loop;
-				}
-				else {
-					if (m_iSeqPointer[Index] == Items)
-					{
-						// End of sequence 
-						m_iSeqEnabled[Index] = 2;
-					}
-					else if (!m_bRelease)
-						// Waiting for release
-						m_iSeqPointer[Index]--;
-				}
-			}
-//		}
+		if (End)
+			m_iSeqEnabled[Index] = 2;
 
 		pSequence->SetPlayPos(m_iSeqPointer[Index]);
 
@@ -774,23 +754,47 @@ CSequence *CChannelHandler::GetSequence(int Index, int Type)
 	return NULL;
 }
 
+void CChannelHandler::UpdateSequences(int Chip)
+{
+	// Looks up the sequences again only if the indices changed since the last
+	// call, or sequences were created or removed in the document. Nothing is
+	// allocated, sequences that do not exist are left NULL
+
+	unsigned int Version = m_pDocument->GetSequenceVersion();
+
+	for (int i = 0; i < SEQ_COUNT; i++)
+	{
+		if (m_iSeqResolved[i] != m_iSeqIndex[i] || m_iSeqVersion != Version)
+		{
+			m_pSequence[i] = m_pDocument->GetSequence_readonly(Chip, m_iSeqIndex[i], i);
+			m_iSeqResolved[i] = m_iSeqIndex[i];
+		}
+	}
+
+	m_iSeqVersion = Version;
+}
+
 void CChannelHandler::ReleaseSequences(int Chip)
 {
 	if (!m_bEnabled)
 		return;
 
+	UpdateSequences(Chip);
+
 	for (int i = 0; i < SEQ_COUNT; i++)
 	{
 		if (m_iSeqEnabled[i] == 1)
 		{
-			CSequence *pSeq = m_pDocument->GetSequence(Chip, m_iSeqIndex[i], i);
-			ReleaseSequence(i, pSeq);
+			ReleaseSequence(i, m_pSequence[i]);
 		}
 	}
 }
 
 void CChannelHandler::ReleaseSequence(int Index, CSequence *pSeq)
 {
+	if (pSeq == NULL)
+		return;
+
 	int releasePoint = pSeq->GetReleasePoint();
 
 	if (releasePoint != -1)
@@ -31,6 +31,7 @@ const int VOL_SHIFT = 3;
 class CAPU;
 class FtmDocument;
 class CSequence;
+class CChannelState;
 
 // TODO: A lot of cleanup is needed in these files!
 
@@ -51,7 +52,8 @@ public:
 	void ReleaseNote();												// Called on note release commands
 
 	// Public functions
-	void InitChannel(CAPU *pAPU, int *pVibTable, FtmDocument *pDoc);
+	void InitChannel(CAPU *pAPU, const int *pVibTable, FtmDocument *pDoc);
+	void ResetPlayState();											// Clears effects and sequences left by the last session
 	void KillChannel();
 	void MakeSilent();
 	void Arpeggiate(unsigned int Note);
@@ -66,11 +68,12 @@ public:
 	virtual void RefreshChannel() = 0;							// Update channel registers
 	virtual void ResetChannel();								// Resets all default state variables
 
-	virtual void SetNoteTable(unsigned int *NoteLookupTable);
+	virtual void SetNoteTable(const unsigned int *NoteLookupTable);
 	virtual void UpdateSequencePlayPos() {}
 	virtual void SetPitch(int Pitch);
 
 	virtual void SetChannelID(int ID) { m_iChannelID = ID; }
+	int GetChannelID() const { return m_iChannelID; }
 
 	// 
 	// Internal virtual functions
@@ -90,6 +93,7 @@ protected:
 	int LimitVolume(int Volume) const;
 	void SetMaxPeriod(int Period);
 
+	void UpdateSequences(int Chip);
 	void ReleaseSequences(int Chip);
 	void ReleaseSequence(int Index, CSequence *pSeq);
 
@@ -118,9 +122,6 @@ protected:
 	void PeriodAdd(int Step);
 	void PeriodRemove(int Step);
 
-	void LinearAdd(int Step);
-	void LinearRemove(int Step);
-
 private:
 	void UpdateNoteCut();
 	void UpdateDelay();
@@ -131,53 +132,64 @@ private:
 
 	// Shared variables
 protected:
+	// The per-frame variables live in the channel state of the sound
+	// generator, the references below point into this handler's slot
+	CChannelState		*m_pState;
+	int					m_iSlot;
+
 	// Channel variables
 	int					m_iChannelID;				// Channel ID
 	int					m_iVibratoStyle;
 
 	// General
-	bool				m_bEnabled;
+	bool				&m_bEnabled;
 	bool				m_bRelease;							// Note released
 	unsigned int		m_iInstrument, m_iLastInstrument;	// Instrument
 	int					m_iNote;							// Active note
-	int					m_iPeriod, m_iLastPeriod;			// Channel period
-	char				m_iVolume;							// Volume
+	int					&m_iPeriod;							// Channel period
+	int					m_iLastPeriod;
+	char				&m_iVolume;							// Volume
 	char				m_iDutyPeriod;
 
-	int					m_iPeriodPart;
+	int					&m_iPeriodPart;
 
 	// Delay effect variables
-	bool				m_bDelayEnabled;
-	unsigned char		m_cDelayCounter;
+	bool				&m_bDelayEnabled;
+	unsigned char		&m_cDelayCounter;
 	unsigned int		m_iDelayEffColumns;		
 	stChanNote			m_cnDelayed;
 
 	// Vibrato & tremolo
-	unsigned int		m_iVibratoDepth, m_iVibratoSpeed, m_iVibratoPhase;
-	unsigned int		m_iTremoloDepth, m_iTremoloSpeed, m_iTremoloPhase;
+	unsigned int		&m_iVibratoDepth, &m_iVibratoSpeed, &m_iVibratoPhase;
+	unsigned int		&m_iTremoloDepth, &m_iTremoloSpeed, &m_iTremoloPhase;
 
-	unsigned char		m_iEffect;		// arpeggio & portamento
+	unsigned char		&m_iEffect;		// arpeggio & portamento
 	unsigned char		m_cArpeggio, m_cArpVar;
-	int					m_iPortaTo, m_iPortaSpeed;
+	int					&m_iPortaTo, &m_iPortaSpeed;
 
-	unsigned char		m_iNoteCut;					// Note cut effect
+	unsigned char		&m_iNoteCut;				// Note cut effect
 	unsigned int		m_iFinePitch;				// Fine pitch effect
 	unsigned char		m_iDefaultDuty;				// Duty effect
-	unsigned char		m_iVolSlide;				// Volume slide effect
+	unsigned char		&m_iVolSlide;				// Volume slide effect
 
 	// Sequences
 	int					m_iSeqEnabled[SEQ_COUNT];
-	int					m_iSeqPointer[SEQ_COUNT];
+	int					(&m_iSeqPointer)[SEQ_COUNT];
 	int					m_iSeqIndex[SEQ_COUNT];
 
+	// The sequences of m_iSeqIndex, looked up when the index or the document changes
+	CSequence			*m_pSequence[SEQ_COUNT];	// NULL if the sequence does not exist
+	int					m_iSeqResolved[SEQ_COUNT];	// m_iSeqIndex the pointers are for
+	unsigned int		m_iSeqVersion;				// Document sequence version of the pointers
+
 	unsigned int		m_iSeqVolume;				// Current sequence volume
 
 	// Misc 
 	CAPU				*m_pAPU;
 	FtmDocument		*m_pDocument;
 
-	unsigned int		*m_pNoteLookupTable;		// Note->period table
-	int					*m_pVibratoTable;			// Vibrato table
+	const unsigned int	*m_pNoteLookupTable;		// Note->period table
+	const int			*m_pVibratoTable;			// Vibrato table
 
 	int					m_iPitch;					// Used by the pitch wheel
 
@@ -189,7 +201,7 @@ protected:
 
 	// Private variables
 private:
-	int m_iMaxPeriod;				// Used to limit period register
+	int &m_iMaxPeriod;				// Used to limit period register
 
 	// Sound generator
 	SoundGen			*m_pSoundGen;
@@ -0,0 +1,71 @@
+#include <string.h>
+#include "exceptions.hpp"
+#include "ChannelState.h"
+
+CChannelState::CChannelState() : m_iCount(0)
+{
+	Reset();
+
+	for (int i = 0; i < CHANNELS; i++)
+		MaxPeriod[i] = 0x7FF;		// Default for 2A03 regs
+}
+
+void CChannelState::Reset()
+{
+	memset(Enabled, 0, sizeof(Enabled));
+	memset(Batched, 0, sizeof(Batched));
+	memset(Period, 0, sizeof(Period));
+	memset(PeriodPart, 0, sizeof(PeriodPart));
+	memset(Volume, 0, sizeof(Volume));
+	memset(VolSlide, 0, sizeof(VolSlide));
+	memset(VibratoDepth, 0, sizeof(VibratoDepth));
+	memset(VibratoSpeed, 0, sizeof(VibratoSpeed));
+	memset(VibratoPhase, 0, sizeof(VibratoPhase));
+	memset(TremoloDepth, 0, sizeof(TremoloDepth));
+	memset(TremoloSpeed, 0, sizeof(TremoloSpeed));
+	memset(TremoloPhase, 0, sizeof(TremoloPhase));
+	memset(Effect, 0, sizeof(Effect));
+	memset(PortaTo, 0, sizeof(PortaTo));
+	memset(PortaSpeed, 0, sizeof(PortaSpeed));
+	memset(NoteCut, 0, sizeof(NoteCut));
+	memset(DelayEnabled, 0, sizeof(DelayEnabled));
+	memset(DelayCounter, 0, sizeof(DelayCounter));
+	memset(SeqPointer, 0, sizeof(SeqPointer));
+}
+
+int CChannelState::AddChannel()
+{
+	ftkr_Assert(m_iCount < CHANNELS);
+	return m_iCount++;
+}
+
+void CChannelState::UpdateEffects(bool LinearPitch)
+{
+	const int Count = m_iCount;
+
+	// Channels where a delayed note plays or a note is cut this frame are
+	// left to ProcessChannel, the effects have to run after those
+	for (int i = 0; i < Count; i++)
+	{
+		bool Delayed = DelayEnabled[i] && DelayCounter[i] == 0;
+		Batched[i] = Enabled[i] && !Delayed && NoteCut[i] != 1;
+	}
+
+	for (int i = 0; i < Count; i++)
+	{
+		if (Batched[i])
+			SlideVolume(i);
+	}
+
+	for (int i = 0; i < Count; i++)
+	{
+		if (Batched[i])
+			AdvancePhases(i);
+	}
+
+	for (int i = 0; i < Count; i++)
+	{
+		if (Batched[i])
+			Portamento(i, LinearPitch);
+	}
+}
@@ -0,0 +1,167 @@
+#pragma once
+
+#include "ChannelHandler.h"
+
+//
+// The per-frame state of all channel handlers, kept as one array per field
+// instead of inside each handler. Handlers refer to their slot through
+// reference members, while the volume slide, vibrato, tremolo and portamento
+// updates run for every channel at once in plain loops over the arrays
+//
+class CChannelState {
+public:
+	CChannelState();
+
+	// Hands out the next free slot, one per channel handler
+	int AddChannel();
+
+	// Back to the state at construction. The slots stay handed out and
+	// MaxPeriod, which the handlers set up once, is kept
+	void Reset();
+
+	// Runs the volume slide, vibrato, tremolo and portamento of every enabled
+	// channel whose note delay and cut leave it unchanged this frame. Those
+	// channels are marked in Batched, the rest update in ProcessChannel
+	void UpdateEffects(bool LinearPitch);
+
+	// The updates for a single slot, shared with the channel handlers
+	inline void SlideVolume(int i);
+	inline void AdvancePhases(int i);
+	inline void Portamento(int i, bool LinearPitch);
+	inline void PeriodAdd(int i, int Step, bool LinearPitch);
+	inline void PeriodRemove(int i, int Step, bool LinearPitch);
+	inline int LimitPeriod(int i, int Period) const;
+
+public:
+	// General
+	bool			Enabled[CHANNELS];
+	bool			Batched[CHANNELS];			// Effects already run this frame
+	int				Period[CHANNELS];
+	int				PeriodPart[CHANNELS];		// Fraction for linear pitch slides
+	int				MaxPeriod[CHANNELS];
+	char			Volume[CHANNELS];
+	unsigned char	VolSlide[CHANNELS];
+
+	// Vibrato & tremolo
+	unsigned int	VibratoDepth[CHANNELS], VibratoSpeed[CHANNELS], VibratoPhase[CHANNELS];
+	unsigned int	TremoloDepth[CHANNELS], TremoloSpeed[CHANNELS], TremoloPhase[CHANNELS];
+
+	// Arpeggio & portamento
+	unsigned char	Effect[CHANNELS];
+	int				PortaTo[CHANNELS], PortaSpeed[CHANNELS];
+
+	// Timers
+	unsigned char	NoteCut[CHANNELS];
+	bool			DelayEnabled[CHANNELS];
+	unsigned char	DelayCounter[CHANNELS];
+
+	// Sequences
+	int				SeqPointer[CHANNELS][SEQ_COUNT];
+
+private:
+	int				m_iCount;
+};
+
+inline void CChannelState::SlideVolume(int i)
+{
+	// Volume slide (Axx)
+	char Vol = Volume[i];
+
+	Vol -= (VolSlide[i] & 0x0F);
+	if (Vol < 0)
+		Vol = 0;
+
+	Vol += (VolSlide[i] & 0xF0) >> 4;
+	if (Vol < 0)
+		Vol = MAX_VOL;
+
+	Volume[i] = Vol;
+}
+
+inline void CChannelState::AdvancePhases(int i)
+{
+	// Vibrato and tremolo
+	VibratoPhase[i] = (VibratoPhase[i] + VibratoSpeed[i]) & 63;
+	TremoloPhase[i] = (TremoloPhase[i] + TremoloSpeed[i]) & 63;
+}
+
+inline int CChannelState::LimitPeriod(int i, int Period) const
+{
+	if (Period > MaxPeriod[i])
+		Period = MaxPeriod[i];
+
+	if (Period < 0)
+		Period = 0;
+
+	return Period;
+}
+
+inline void CChannelState::PeriodAdd(int i, int Step, bool LinearPitch)
+{
+	if (LinearPitch)
+	{
+		int P = (Period[i] << 5) | PeriodPart[i];
+		int Value = (P * Step) / 512;
+		if (Value == 0)
+			Value = 1;
+		P += Value;
+		PeriodPart[i] = P & 0x1F;
+		Period[i] = P >> 5;
+	}
+	else
+		Period[i] += Step;
+}
+
+inline void CChannelState::PeriodRemove(int i, int Step, bool LinearPitch)
+{
+	if (LinearPitch)
+	{
+		int P = (Period[i] << 5) | PeriodPart[i];
+		int Value = (P * Step) / 512;
+		if (Value == 0)
+			Value = 1;
+		P -= Value;
+		PeriodPart[i] = P & 0x1F;
+		Period[i] = P >> 5;
+	}
+	else
+		Period[i] -= Step;
+}
+
+inline void CChannelState::Portamento(int i, bool LinearPitch)
+{
+	switch (Effect[i])
+	{
+		case EF_PORTAMENTO:
+		case EF_SLIDE_UP:
+		case EF_SLIDE_DOWN:
+			// Automatic portamento
+			if (PortaSpeed[i] > 0 && PortaTo[i] > 0)
+			{
+				if (Period[i] > PortaTo[i])
+				{
+					PeriodRemove(i, PortaSpeed[i], LinearPitch);
+					// TODO: check this
+//					if (m_iPeriod > 0x1000)	// it was negative
+//						m_iPeriod = 0x00;
+					if (Period[i] < PortaTo[i])
+						Period[i] = PortaTo[i];
+				}
+				else if (Period[i] < PortaTo[i])
+				{
+					PeriodAdd(i, PortaSpeed[i], LinearPitch);
+					if (Period[i] > PortaTo[i])
+						Period[i] = PortaTo[i];
+				}
+			}
+			break;
+		case EF_PORTA_DOWN:
+			PeriodAdd(i, PortaSpeed[i], LinearPitch);
+			Period[i] = LimitPeriod(i, Period[i]);
+			break;
+		case EF_PORTA_UP:
+			PeriodRemove(i, PortaSpeed[i], LinearPitch);
+			Period[i] = LimitPeriod(i, Period[i]);
+			break;
+	}
+}
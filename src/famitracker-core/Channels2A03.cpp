@@ -227,8 +227,10 @@ void CChannelHandler2A03::ProcessChannel()
 		return;
 
 	// Sequences
+	UpdateSequences(SNDCHIP_NONE);
+
 	for (int i = 0; i < CInstrument2A03::SEQUENCE_COUNT; i++)
-		CChannelHandler::RunSequence(i, m_pDocument->GetSequence2A03(m_iSeqIndex[i], CInstrument2A03::SEQUENCE_TYPES[i]));
+		CChannelHandler::RunSequence(i, m_pSequence[i]);
 
 	if (m_bGate && m_iSeqEnabled[SEQ_VOLUME] != 0)
 		m_bGate = !(m_iSeqEnabled[SEQ_VOLUME] == 0);
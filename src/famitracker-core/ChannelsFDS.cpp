@@ -61,8 +61,10 @@ void CChannelHandlerFDS::PlayChannelNote(stChanNote *pNoteData, int EffColumns)
 
 	if (m_iInstrument != MAX_INSTRUMENTS)
 	{
-		// Get instrument
-		pInstrument = dynamic_cast<CInstrumentFDS*>(m_pDocument->GetInstrument(m_iInstrument));
+		// Get instrument, the type is all that needs checking
+		CInstrument *pInst = m_pDocument->GetInstrument(m_iInstrument);
+		if (pInst != NULL && pInst->GetType() == INST_FDS)
+			pInstrument = static_cast<CInstrumentFDS*>(pInst);
 	}
 
 	if (pNoteData->Note == RELEASE)
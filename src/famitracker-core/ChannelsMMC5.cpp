@@ -180,8 +180,10 @@ void CChannelHandlerMMC5::ProcessChannel()
 		return;
 
 	// Sequences
+	UpdateSequences(SNDCHIP_NONE);
+
 	for (int i = 0; i < SEQUENCES; i++)
-		RunSequence(i, m_pDocument->GetSequence2A03(m_iSeqIndex[i], SEQ_TYPES[i]));
+		RunSequence(i, m_pSequence[i]);
 }
 
 void CChannelHandlerMMC5::ResetChannel()
@@ -147,8 +147,10 @@ void CChannelHandlerVRC6::ProcessChannel()
 		return;
 
 	// Sequences
+	UpdateSequences(SNDCHIP_VRC6);
+
 	for (int i = 0; i < CInstrumentVRC6::SEQUENCE_COUNT; ++i)
-		CChannelHandler::RunSequence(i, m_pDocument->GetSequence(SNDCHIP_VRC6, m_iSeqIndex[i], CInstrumentVRC6::SEQUENCE_TYPES[i]));
+		CChannelHandler::RunSequence(i, m_pSequence[i]);
 }
 
 void CChannelHandlerVRC6::ResetChannel()
@@ -1,4 +1,5 @@
 #include <string.h>
+#include <boost/crc.hpp>
 #include "Document.hpp"
 #include "common.hpp"
 
@@ -8,7 +9,9 @@ const char FILE_HEADER_ID[] = "FamiTracker Module";
 const char FILE_END_ID[] = "END";
 
 Document::Document()
-	: m_pBlockData(NULL), m_bFileDone(false), m_io(NULL)
+	: m_io(NULL), m_pBlockData(NULL), m_pReadData(NULL), m_iMaxBlockSize(0),
+	  m_bFileDone(false), m_bOverrun(false), m_bChecksums(false),
+	  m_bStreaming(false), m_bWriteFailed(false), m_iBlockWritten(0), m_iFilePos(0)
 {
 }
 
@@ -36,6 +39,8 @@ bool Document::checkValidity()
 	{
 		return false;
 	}
+
+	m_iFilePos = sizeof(FILE_HEADER_ID)-1 + 4;
 	return true;
 }
 
@@ -66,48 +71,195 @@ bool Document::readBlock()
 		return false;
 	}
 
-	init_pBlockData(m_iBlockSize);
-	if (!m_io->read_e(m_pBlockData, m_iBlockSize))
+	if (!readBlockData())
 	{
 		return false;
 	}
 
+	if (m_bChecksums)
+	{
+		unsigned int crc;
+		if (!m_io->readInt(&crc) || crc != blockChecksum(m_pReadData))
+			return false;
+	}
+
 	if (bytesRead == 0)
 		m_bFileDone = true;
 
 	return true;
 }
 
+bool Document::readBlockData()
+{
+	// parse straight out of the mapping when the IO is memory-backed
+	m_pReadData = (const char*)m_io->map(m_iBlockSize);
+	if (m_pReadData == NULL)
+	{
+		if (m_pBlockData == NULL || m_iBlockSize > m_iMaxBlockSize)
+		{
+			init_pBlockData(m_iBlockSize);
+			m_iMaxBlockSize = m_iBlockSize;
+		}
+		if (!m_io->read_e(m_pBlockData, m_iBlockSize))
+		{
+			return false;
+		}
+		m_pReadData = m_pBlockData;
+	}
+	return true;
+}
+
+unsigned int Document::blockChecksum(const char *data) const
+{
+	unsigned char header[8];
+	for (int i = 0; i < 4; i++)
+	{
+		header[i] = (m_iBlockVersion >> (i*8)) & 0xFF;
+		header[i+4] = (m_iBlockSize >> (i*8)) & 0xFF;
+	}
+
+	boost::crc_32_type crc;
+	crc.process_bytes(m_cBlockID, 16);
+	crc.process_bytes(header, 8);
+	crc.process_bytes(data, m_iBlockSize);
+	return crc.checksum();
+}
+
+bool Document::scanBlocks()
+{
+	Quantity fileSize = m_io->size();
+	m_blocks.clear();
+
+	for (;;)
+	{
+		BlockInfo info;
+		memset(info.id, 0, 16);
+
+		Quantity bytesRead = m_io->read(info.id, 16);
+		if (bytesRead == 0 || strcmp(info.id, FILE_END_ID) == 0)
+			break;
+
+		if (!m_io->readInt(&info.version) || !m_io->readInt(&info.size))
+			return false;
+
+		info.offset = m_iFilePos + 16 + 8;
+		if (info.size > 50000000 || info.offset > fileSize || info.size > fileSize - info.offset)
+		{
+			// File is probably corrupt
+			return false;
+		}
+
+		m_blocks.push_back(info);
+		m_iFilePos = info.offset + info.size;
+		m_io->seek(info.size, core::IO_SEEK_CUR);
+	}
+
+	m_bFileDone = true;
+	return true;
+}
+
+bool Document::openBlock(unsigned int i)
+{
+	const BlockInfo &info = m_blocks[i];
+
+	memcpy(m_cBlockID, info.id, 16);
+	m_iBlockVersion = info.version;
+	m_iBlockSize = info.size;
+	m_iBlockPointer = 0;
+
+	if (!m_io->seek(info.offset, core::IO_SEEK_SET))
+		return false;
+
+	return readBlockData();
+}
+
+void Document::openBlock(const char *id, unsigned int version, const char *data, unsigned int size)
+{
+	memset(m_cBlockID, 0, 16);
+	safe_strcpy(m_cBlockID, id, sizeof(m_cBlockID));
+	m_iBlockVersion = version;
+	m_iBlockSize = size;
+	m_iBlockPointer = 0;
+	m_pReadData = data;
+}
+
 void Document::getBlock(void *buf, unsigned int size)
 {
-	memcpy(buf, m_pBlockData + m_iBlockPointer, size);
+	const char *p = getBlockData(size);
+	if (p == NULL)
+	{
+		memset(buf, 0, size);
+		return;
+	}
+	memcpy(buf, p, size);
+}
+
+const char * Document::getBlockData(unsigned int size)
+{
+	if (size > m_iBlockSize - m_iBlockPointer || m_iBlockPointer > m_iBlockSize)
+	{
+		m_iBlockPointer = m_iBlockSize;
+		m_bOverrun = true;
+		return NULL;
+	}
+	const char *p = m_pReadData + m_iBlockPointer;
 	m_iBlockPointer += size;
+	return p;
 }
 
 void Document::writeBlock(const void *data, unsigned int size)
 {
 	ftkr_Assert(m_pBlockData != NULL);
 
-	unsigned int writeSize, writePtr = 0;
-
 	const char *d = (const char*)data;
 
-	// Allow block to grow in size
-	while (size > 0)
+	if (m_bStreaming)
 	{
-		if (size > BLOCK_SIZE)
-			writeSize = BLOCK_SIZE;
-		else
-			writeSize = size;
+		if (size >= m_iMaxBlockSize)
+		{
+			// Too big to be worth copying, send it as it is
+			writeStaged();
+			if (m_io->write(d, size) != size)
+				m_bWriteFailed = true;
+			m_iBlockWritten += size;
+			return;
+		}
+
+		while (size > 0)
+		{
+			if (m_iBlockPointer == m_iMaxBlockSize)
+				writeStaged();
+
+			unsigned int writeSize = m_iMaxBlockSize - m_iBlockPointer;
+			if (writeSize > size)
+				writeSize = size;
+
+			memcpy(m_pBlockData + m_iBlockPointer, d, writeSize);
+			m_iBlockPointer += writeSize;
+			size -= writeSize;
+			d += writeSize;
+		}
+		return;
+	}
 
-		if ((m_iBlockPointer + writeSize) >= m_iMaxBlockSize)
-			reallocateBlock();
+	// Allow block to grow in size
+	while (m_iBlockPointer + size > m_iMaxBlockSize)
+		reallocateBlock();
 
-		memcpy(m_pBlockData + m_iBlockPointer, d + writePtr, writeSize);
-		m_iBlockPointer += writeSize;
-		size -= writeSize;
-		writePtr += writeSize;
-	}
+	memcpy(m_pBlockData + m_iBlockPointer, d, size);
+	m_iBlockPointer += size;
+}
+
+void Document::writeStaged()
+{
+	if (m_iBlockPointer == 0)
+		return;
+
+	if (m_io->write(m_pBlockData, m_iBlockPointer) != m_iBlockPointer)
+		m_bWriteFailed = true;
+
+	m_iBlockWritten += m_iBlockPointer;
+	m_iBlockPointer = 0;
 }
 
 bool Document::flushBlock()
@@ -115,10 +267,31 @@ bool Document::flushBlock()
 	if (m_pBlockData == NULL)
 		return false;
 
+	if (m_bStreaming)
+	{
+		writeStaged();
+		m_bStreaming = false;
+
+		// Patch the size into the header and come back
+		unsigned int size = m_iBlockWritten;
+		if (!m_io->seek(-(int)(size + 4), core::IO_SEEK_CUR)
+			|| !m_io->writeInt(size)
+			|| !m_io->seek(size, core::IO_SEEK_CUR))
+			return false;
+
+		return !m_bWriteFailed;
+	}
+
 	m_io->write(m_cBlockID, 16);
 	m_io->writeInt(m_iBlockVersion);
 	m_io->writeInt(m_iBlockPointer);
 	m_io->write(m_pBlockData, m_iBlockPointer);
+
+	if (m_bChecksums)
+	{
+		m_iBlockSize = m_iBlockPointer;
+		m_io->writeInt(blockChecksum(m_pBlockData));
+	}
 	return true;
 }
 
@@ -157,20 +330,40 @@ void Document::createBlock(const char *id, int version)
 	m_iBlockPointer = 0;
 	m_iBlockSize = 0;
 	m_iBlockVersion = version & 0xFFFF;
-	m_iMaxBlockSize = BLOCK_SIZE;
+	m_iBlockWritten = 0;
+	m_bWriteFailed = false;
 
-	init_pBlockData(m_iMaxBlockSize);
+	// The buffer is kept from block to block
+	if (m_pBlockData == NULL || m_iMaxBlockSize < BLOCK_SIZE)
+	{
+		m_iMaxBlockSize = BLOCK_SIZE;
+		init_pBlockData(m_iMaxBlockSize);
+	}
+
+	// Checksums cover the size, those blocks are buffered
+	m_bStreaming = m_io != NULL && !m_bChecksums && m_io->isSeekable();
+	if (m_bStreaming)
+	{
+		// Header with the size left open
+		if (m_io->write(m_cBlockID, 16) != 16 || !m_io->writeInt(m_iBlockVersion) || !m_io->writeInt(0))
+			m_bWriteFailed = true;
+	}
 }
 
 std::string Document::readString()
 {
-	std::string s;
-	char c;
-
-	while ((c = getBlockChar()) != 0)
-		s.push_back(c);
+	unsigned int left = m_iBlockPointer < m_iBlockSize ? m_iBlockSize - m_iBlockPointer : 0;
+	const char *p = m_pReadData + m_iBlockPointer;
+	const char *end = left > 0 ? (const char*)memchr(p, 0, left) : NULL;
+	if (end == NULL)
+	{
+		m_iBlockPointer = m_iBlockSize;
+		m_bOverrun = true;
+		return std::string();
+	}
 
-	return s;
+	m_iBlockPointer += end - p + 1;
+	return std::string(p, end - p);
 }
 
 void Document::writeString(const char *s)
@@ -189,6 +382,8 @@ void Document::writeString(const std::string &s)
 
 void Document::rollbackPointer(int count)
 {
+	if ((unsigned int)count > m_iBlockPointer)
+		count = m_iBlockPointer;
 	m_iBlockPointer -= count;
 }
 
@@ -203,10 +398,10 @@ void Document::reallocateBlock()
 {
 	ftkr_Assert(m_pBlockData != NULL);
 
-	unsigned int oldSize = m_iMaxBlockSize;
-	m_iMaxBlockSize += BLOCK_SIZE;
+	// Double, growing in steps copies large blocks over and over
+	m_iMaxBlockSize *= 2;
 	char *p = new char[m_iMaxBlockSize];
-	memcpy(p, m_pBlockData, oldSize);
+	memcpy(p, m_pBlockData, m_iBlockPointer);
 
 	delete[] m_pBlockData;
 	m_pBlockData = p;
@@ -214,16 +409,16 @@ void Document::reallocateBlock()
 
 int Document::getBlockInt()
 {
-	const unsigned char *buf = (const unsigned char*)m_pBlockData + m_iBlockPointer;
-	int Value = (buf[3] << 24) | (buf[2] << 16) | (buf[1] << 8) | buf[0];
-	m_iBlockPointer += 4;
-	return Value;
+	const unsigned char *buf = (const unsigned char*)getBlockData(4);
+	if (buf == NULL)
+		return 0;
+	return (buf[3] << 24) | (buf[2] << 16) | (buf[1] << 8) | buf[0];
 }
 
 char Document::getBlockChar()
 {
-	const char *buf = m_pBlockData + m_iBlockPointer;
-	char Value = buf[0];
-	m_iBlockPointer += 1;
-	return Value;
+	const char *buf = getBlockData(1);
+	if (buf == NULL)
+		return 0;
+	return buf[0];
 }
@@ -2,16 +2,29 @@
 #define _DOCUMENT_HPP_
 
 #include <string>
+#include <vector>
 #include "types.hpp"
 #include "core/io.hpp"
 
 class Document
 {
 public:
+	// where a block lies in the file, as found by scanBlocks()
+	struct BlockInfo
+	{
+		char id[16];
+		unsigned int version;
+		unsigned int offset;	// of the block data, from the start of the file
+		unsigned int size;
+	};
+
 	Document();
 	~Document();
 
 	void setIO(core::IO *io){ m_io = io; }
+	// every block is followed by a CRC-32 of its header and data, a block
+	// failing the check does not read. Not part of the module format
+	void setChecksums(bool enable){ m_bChecksums = enable; }
 
 	bool checkValidity();
 
@@ -21,6 +34,8 @@ public:
 	int getBlockInt();
 	char getBlockChar();
 	bool blockDone() const{ return (m_iBlockPointer >= m_iBlockSize); }
+	// set once any read ran past the end of its block
+	bool blockOverrun() const{ return m_bOverrun; }
 
 	bool isFileDone() const{ return m_bFileDone; }
 
@@ -31,8 +46,33 @@ public:
 
 	const char *blockID() const{ return m_cBlockID; }
 	bool readBlock();
+
+	// walks the block headers up to END without reading block data,
+	// then blocks can be opened in any order with openBlock()
+	bool scanBlocks();
+	unsigned int blockCount() const{ return m_blocks.size(); }
+	const BlockInfo & blockInfo(unsigned int i) const{ return m_blocks[i]; }
+	bool openBlock(unsigned int i);
+	// parse a block held in memory by the caller; data must outlive the reads
+	void openBlock(const char *id, unsigned int version, const char *data, unsigned int size);
+
+	const char *blockData() const{ return m_pReadData; }
+	// false when the block data lives in our own buffer and is gone on the next read
+	bool isBlockMapped() const{ return m_pReadData != m_pBlockData; }
+
+	unsigned int blockPointer() const{ return m_iBlockPointer; }
+	void setBlockPointer(unsigned int p){ m_iBlockPointer = p; }
 	void getBlock(void *buf, unsigned int size);
+	// returns a pointer to the next size bytes of the block without copying,
+	// or NULL if the block is too short
+	const char * getBlockData(unsigned int size);
+	// Blocks go out to a seekable IO as they are written, through a fixed
+	// buffer, and the size in the header is patched in by flushBlock().
+	// Otherwise the whole block is buffered until flushBlock()
 	void writeBlock(const void *data, unsigned int size);
+	// what was written to the current block so far, blockPointer() bytes.
+	// Only while buffering, as without an IO
+	const char *writtenData() const{ return m_pBlockData; }
 	bool flushBlock();
 	void createBlock(const char *id, int version);
 
@@ -50,11 +90,27 @@ private:
 	unsigned int m_iBlockSize;
 	unsigned int m_iBlockVersion;
 	char *m_pBlockData;
+	// points into the IO's mapping when it has one, otherwise at m_pBlockData
+	const char *m_pReadData;
 
 	unsigned int m_iMaxBlockSize;
 
 	unsigned int m_iBlockPointer;
 	bool m_bFileDone;
+	bool m_bOverrun;
+	bool m_bChecksums;
+
+	// Set while the current block streams to the IO
+	bool m_bStreaming;
+	bool m_bWriteFailed;
+	unsigned int m_iBlockWritten;		// Bytes of the block already sent to the IO
+
+	unsigned int m_iFilePos;
+	std::vector<BlockInfo> m_blocks;
+
+	bool readBlockData();
+	unsigned int blockChecksum(const char *data) const;
+	void writeStaged();
 
 	void init_pBlockData(Quantity size);
 	void reallocateBlock();
@@ -1,9 +1,11 @@
 #include <string.h>
 #include <stdio.h>
 #include <boost/thread/mutex.hpp>
+#include <boost/detail/atomic_count.hpp>
 #include "App.hpp"
 #include "FtmDocument.hpp"
 #include "Document.hpp"
+#include "core/threadpool.hpp"
 #include "PatternData.h"
 #include "Instrument.h"
 #include "TrackerChannel.h"
@@ -46,6 +48,13 @@ const char *FILE_BLOCK_SEQUENCES_VRC6 = "SEQUENCES_VRC6";
 // N163
 const char *FILE_BLOCK_SEQUENCES_N163 = "SEQUENCES_N163";
 
+// Edit journal records, see FtmJournal
+const char JOURNAL_BLOCK_TRACK[]		= "JTRACK";
+const char JOURNAL_BLOCK_PATTERN[]		= "JPATTERN";
+const char JOURNAL_BLOCK_INSTRUMENT[]	= "JINSTRUMENT";
+const char JOURNAL_BLOCK_SEQUENCE[]		= "JSEQUENCE";
+const char JOURNAL_BLOCK_DSAMPLE[]		= "JDSAMPLE";
+
 // Sunsoft
 const char *FILE_BLOCK_SEQUENCES_S5B = "SEQUENCES_S5B";
 
@@ -106,6 +115,14 @@ FtmDocumentExceptionAssert::FtmDocumentExceptionAssert(const char *file, int lin
 	snprintf(m_msg, 1024, fmt, file, line, func, asrt);
 }
 
+FtmDocumentExceptionAssert::FtmDocumentExceptionAssert(const FtmDocumentExceptionAssert &other)
+	: FtmDocumentException(other),
+	  m_file(other.m_file), m_line(other.m_line), m_func(other.m_func), m_asrt(other.m_asrt)
+{
+	m_msg = new char[1024];
+	memcpy(m_msg, other.m_msg, 1024);
+}
+
 FtmDocumentExceptionAssert::~FtmDocumentExceptionAssert() throw()
 {
 	delete[] m_msg;
@@ -171,15 +188,36 @@ void CDSample::Allocate(int iSize, char *pData)
 }
 
 
+// Sequences of old files, until they are converted
+struct _ftmdocument_oldsequences
+{
+	stSequence Sequences[MAX_SEQUENCES][SEQ_COUNT];		// One sequence-list for each effect
+	stSequence TmpSequences[MAX_SEQUENCES];
+};
+
 FtmDocument::FtmDocument()
 {
 	m_modifyLock = new boost::mutex;
+	m_patternLock = new boost::mutex;
+	for (unsigned int i = 0; i < MAX_TRACKS; i++)
+		m_trackPending[i].store(false, boost::memory_order_relaxed);
 
 	for (int i = 0; i < MAX_DSAMPLES; i++)
 	{
 		m_DSamples[i].SampleSize = 0;
 		m_DSamples[i].SampleData = NULL;
 	}
+	memset(m_pSharedSamples, 0, sizeof(m_pSharedSamples));
+	memset(m_pSharedInstruments, 0, sizeof(m_pSharedInstruments));
+	memset(m_pSharedSequences, 0, sizeof(m_pSharedSequences));
+	m_pOldSequences = NULL;
+
+	m_iFileVersion = FILE_VER;
+	m_iTrack = 0;
+	m_iTracks = 0;
+	m_pSelectedTune = NULL;
+	m_bSummaryRead = false;
+	m_iSequenceVersion = 1;
 
 	// Clear pointer arrays
 	memset(m_pTunes, 0, sizeof(CPatternData*) * MAX_TRACKS);
@@ -196,49 +234,343 @@ FtmDocument::FtmDocument()
 FtmDocument::~FtmDocument()
 {
 	// Clean up
+	clearContents();
+	delete m_pOldSequences;
+
+	delete m_modifyLock;
+	delete m_patternLock;
+}
+
+// Reference count of an instrument or sequence shared between snapshots
+struct _ftmdocument_shared
+{
+	_ftmdocument_shared()
+		: refs(1)
+	{
+	}
+	boost::detail::atomic_count refs;
+};
+
+// Adds a reference for a new holder, the first sharing counts the owner
+static _ftmdocument_shared * shareObject(_ftmdocument_shared *&shared)
+{
+	if (shared == NULL)
+		shared = new _ftmdocument_shared;
+	++shared->refs;
+	return shared;
+}
+
+// True if the holder had the last reference and must delete the object
+static bool releaseObject(_ftmdocument_shared *shared)
+{
+	if (shared == NULL)
+		return true;
+	if (--shared->refs != 0)
+		return false;
+	delete shared;
+	return true;
+}
+
+// Copies keep the edit version of the original, equal versions mean
+// equal contents
+static bool sameSequence(const CSequence *a, const CSequence *b)
+{
+	if (a == b)
+		return true;
+	if (a == NULL || b == NULL)
+		return false;
 
-	// DPCM samples
+	return a->GetEditVersion() == b->GetEditVersion();
+}
+
+static bool sameInstrument(const CInstrument *a, const CInstrument *b)
+{
+	if (a == b)
+		return true;
+	if (a == NULL || b == NULL)
+		return false;
+
+	return a->GetType() == b->GetType() && a->GetEditVersion() == b->GetEditVersion();
+}
+
+void FtmDocument::clearContents()
+{
 	for (int i = 0; i < MAX_DSAMPLES; i++)
+		releaseSample(i);
+
+	releaseTunes();
+
+	for (int i = 0; i < MAX_INSTRUMENTS; i++)
+		releaseInstrument(i);
+
+	for (int c = 0; c < 3; c++)
+	{
+		for (int i = 0; i < MAX_SEQUENCES; i++)
+		{
+			for (int j = 0; j < SEQ_COUNT; j++)
+				releaseSequence(c, i, j);
+		}
+	}
+	m_iSequenceVersion++;
+}
+
+void FtmDocument::releaseTunes()
+{
+	for (int i = 0; i < MAX_TRACKS; i++)
+	{
+		if (m_pTunes[i] != NULL)
+			m_pTunes[i]->Release();
+	}
+	memset(m_pTunes, 0, sizeof(CPatternData*) * MAX_TRACKS);
+	m_pSelectedTune = NULL;
+}
+
+void FtmDocument::releaseInstrument(unsigned int Index)
+{
+	if (m_pInstruments[Index] != NULL && releaseObject(m_pSharedInstruments[Index]))
+		delete m_pInstruments[Index];
+	m_pInstruments[Index] = NULL;
+	m_pSharedInstruments[Index] = NULL;
+}
+
+CSequence *& FtmDocument::sequenceSlot(unsigned int List, unsigned int Index, unsigned int Type)
+{
+	CSequence *(*pSeqs[3])[SEQ_COUNT] = { m_pSequences2A03, m_pSequencesVRC6, m_pSequencesN106 };
+	return pSeqs[List][Index][Type];
+}
+
+void FtmDocument::releaseSequence(unsigned int List, unsigned int Index, unsigned int Type)
+{
+	CSequence *&pSeq = sequenceSlot(List, Index, Type);
+	if (pSeq != NULL && releaseObject(m_pSharedSequences[List][Index][Type]))
+		delete pSeq;
+	pSeq = NULL;
+	m_pSharedSequences[List][Index][Type] = NULL;
+}
+
+// Sample data shared between a document and its snapshots
+struct _ftmdocument_sample
+{
+	_ftmdocument_sample(char *data)
+		: refs(1), data(data)
 	{
-		if (m_DSamples[i].SampleData != NULL)
+	}
+	boost::detail::atomic_count refs;
+	char *data;
+};
+
+void FtmDocument::releaseSample(unsigned int Index)
+{
+	CDSample &sample = m_DSamples[Index];
+	_ftmdocument_sample *shared = m_pSharedSamples[Index];
+
+	if (shared != NULL)
+	{
+		// Only the last document holding the data frees it
+		if (shared->data == sample.SampleData)
+			sample.SampleData = NULL;
+
+		if (--shared->refs == 0)
 		{
-			delete[] m_DSamples[i].SampleData;
-			m_DSamples[i].SampleData = NULL;
-			m_DSamples[i].SampleSize = 0;
+			delete[] shared->data;
+			delete shared;
 		}
+		m_pSharedSamples[Index] = NULL;
 	}
 
-	// Patterns
+	if (sample.SampleData != NULL)
+		delete[] sample.SampleData;
+
+	sample.SampleData = NULL;
+	sample.SampleSize = 0;
+}
+
+FtmDocument * FtmDocument::snapshot(FtmDocument *base)
+{
+	FtmDocument_lock_guard lock(this);
+
+	// Shared tunes are never decoded into
+	decodeAllPatterns();
+
+	FtmDocument *snap = new FtmDocument;
+	snap->assignFrom(this, base);
+	return snap;
+}
+
+void FtmDocument::restore(FtmDocument *snap)
+{
+	if (snap == this)
+		return;
+
+	FtmDocument_lock_guard lock(this);
+	snap->decodeAllPatterns();
+	assignFrom(snap, NULL);
+}
+
+void FtmDocument::assignFrom(FtmDocument *other, FtmDocument *base)
+{
+	discardPendingPatterns();
+
+	// Instruments and sequences are assigned slot by slot further down
+	for (int i = 0; i < MAX_DSAMPLES; i++)
+		releaseSample(i);
+	releaseTunes();
+
+	bForceBackup = other->bForceBackup;
+	m_iFileVersion = other->m_iFileVersion;
+	m_iTrack = other->m_iTrack;
+	m_iTracks = other->m_iTracks;
+	m_iChannelsAvailable = other->m_iChannelsAvailable;
+	m_iExpansionChip = other->m_iExpansionChip;
+	m_iVibratoStyle = other->m_iVibratoStyle;
+	m_bLinearPitch = other->m_bLinearPitch;
+	m_iMachine = other->m_iMachine;
+	m_iEngineSpeed = other->m_iEngineSpeed;
+	m_iSpeedSplitPoint = other->m_iSpeedSplitPoint;
+	m_strComment = other->m_strComment;
+	m_bModified = other->m_bModified;
+	m_highlight = other->m_highlight;
+	m_secondHighlight = other->m_secondHighlight;
+	m_channelsFromChip = other->m_channelsFromChip;
+
+	memcpy(m_strName, other->m_strName, sizeof(m_strName));
+	memcpy(m_strArtist, other->m_strArtist, sizeof(m_strArtist));
+	memcpy(m_strCopyright, other->m_strCopyright, sizeof(m_strCopyright));
+
+	// Tracks are shared until written
 	for (int i = 0; i < MAX_TRACKS; i++)
 	{
+		m_sTrackNames[i] = other->m_sTrackNames[i];
+		m_pTunes[i] = other->m_pTunes[i];
 		if (m_pTunes[i] != NULL)
-			delete m_pTunes[i];
+			m_pTunes[i]->AddRef();
 	}
+	m_pSelectedTune = m_pTunes[m_iTrack];
 
-	// Instruments
+	// Snapshots never write instruments and sequences, unchanged ones
+	// are shared with the base snapshot. Otherwise they are copied into
+	// the ones the document has, which editors may be holding on to
 	for (int i = 0; i < MAX_INSTRUMENTS; i++)
 	{
-		if (m_pInstruments[i] != NULL)
-			delete m_pInstruments[i];
+		const CInstrument *pInst = other->m_pInstruments[i];
+		CInstrument *pOwn = m_pInstruments[i];
+		if (pInst == NULL)
+		{
+			releaseInstrument(i);
+			continue;
+		}
+		if (sameInstrument(pOwn, pInst))
+			continue;
+
+		if (base != NULL && sameInstrument(pInst, base->m_pInstruments[i]))
+		{
+			releaseInstrument(i);
+			m_pInstruments[i] = base->m_pInstruments[i];
+			m_pSharedInstruments[i] = shareObject(base->m_pSharedInstruments[i]);
+			continue;
+		}
+
+		if (pOwn == NULL || m_pSharedInstruments[i] != NULL || pOwn->GetType() != pInst->GetType())
+		{
+			releaseInstrument(i);
+			m_pInstruments[i] = pInst->CreateNew();
+		}
+		m_pInstruments[i]->Copy(pInst);
 	}
 
-	// Sequences
-	for (int i = 0; i < MAX_SEQUENCES; i++)
+	for (int c = 0; c < 3; c++)
 	{
-		for (int j = 0; j < SEQ_COUNT; j++)
+		for (int i = 0; i < MAX_SEQUENCES; i++)
 		{
-			if (m_pSequences2A03[i][j] != NULL)
-				delete m_pSequences2A03[i][j];
+			for (int j = 0; j < SEQ_COUNT; j++)
+			{
+				const CSequence *pSeq = other->sequenceSlot(c, i, j);
+				CSequence *&pOwn = sequenceSlot(c, i, j);
+				if (pSeq == NULL)
+				{
+					releaseSequence(c, i, j);
+					continue;
+				}
+				if (sameSequence(pOwn, pSeq))
+					continue;
 
-			if (m_pSequencesVRC6[i][j] != NULL)
-				delete m_pSequencesVRC6[i][j];
+				if (base != NULL && sameSequence(pSeq, base->sequenceSlot(c, i, j)))
+				{
+					releaseSequence(c, i, j);
+					pOwn = base->sequenceSlot(c, i, j);
+					m_pSharedSequences[c][i][j] = shareObject(base->m_pSharedSequences[c][i][j]);
+					continue;
+				}
 
-			if (m_pSequencesN106[i][j] != NULL)
-				delete m_pSequencesN106[i][j];
+				if (pOwn == NULL || m_pSharedSequences[c][i][j] != NULL)
+				{
+					releaseSequence(c, i, j);
+					pOwn = new CSequence;
+				}
+				pOwn->Copy(pSeq);
+			}
 		}
 	}
+	m_iSequenceVersion++;
 
-	delete m_modifyLock;
+	// Sample data is never written in place, share it
+	for (int i = 0; i < MAX_DSAMPLES; i++)
+	{
+		const CDSample &sample = other->m_DSamples[i];
+		memcpy(m_DSamples[i].Name, sample.Name, sizeof(sample.Name));
+
+		if (sample.SampleData == NULL)
+			continue;
+
+		_ftmdocument_sample *&shared = other->m_pSharedSamples[i];
+		if (shared == NULL || shared->data != sample.SampleData)
+		{
+			if (shared != NULL && --shared->refs == 0)
+			{
+				delete[] shared->data;
+				delete shared;
+			}
+			shared = new _ftmdocument_sample(sample.SampleData);
+			++shared->refs;		// The other document's own reference
+		}
+		else
+		{
+			++shared->refs;
+		}
+
+		m_pSharedSamples[i] = shared;
+		m_DSamples[i].SampleData = sample.SampleData;
+		m_DSamples[i].SampleSize = sample.SampleSize;
+	}
+}
+
+CPatternData * FtmDocument::writableTune(unsigned int Track)
+{
+	// Copy a tune shared with a snapshot before the first write
+	CPatternData *pTune = m_pTunes[Track];
+	if (pTune->IsShared())
+	{
+		CPatternData *pCopy = new CPatternData(*pTune);
+		pTune->Release();
+		m_pTunes[Track] = pCopy;
+		if (m_pSelectedTune == pTune)
+			m_pSelectedTune = pCopy;
+	}
+	return m_pTunes[Track];
+}
+
+CPatternData * FtmDocument::writableTune()
+{
+	if (!m_pSelectedTune->IsShared())
+		return m_pSelectedTune;
+
+	// Moving tracks does not reselect, find where the selected tune went
+	for (unsigned int i = 0; i < MAX_TRACKS; i++)
+	{
+		if (m_pTunes[i] == m_pSelectedTune)
+			return writableTune(i);
+	}
+	return m_pSelectedTune;
 }
 
 void FtmDocument::lock() const
@@ -253,6 +585,7 @@ void FtmDocument::unlock() const
 
 void FtmDocument::createEmpty()
 {
+	discardPendingPatterns();
 	m_iMachine = DEFAULT_MACHINE_TYPE;
 	m_iEngineSpeed = 0;
 	// Allocate first song
@@ -282,6 +615,14 @@ void FtmDocument::read(core::IO *io)
 		Document doc;
 		doc.setIO(io);
 		bForceBackup = false;
+		discardPendingPatterns();
+
+		// Loading writes into existing tracks
+		for (unsigned int i = 0; i < MAX_TRACKS; i++)
+		{
+			if (m_pTunes[i] != NULL)
+				writableTune(i);
+		}
 
 		if (!doc.checkValidity())
 		{
@@ -337,6 +678,21 @@ void FtmDocument::read(core::IO *io)
 	}
 }
 
+void FtmDocument::readSummary(core::IO *io)
+{
+	m_bSummaryRead = true;
+	try
+	{
+		read(io);
+	}
+	catch (...)
+	{
+		m_bSummaryRead = false;
+		throw;
+	}
+	m_bSummaryRead = false;
+}
+
 bool FtmDocument::readOld(Document *doc)
 {
 	// TODO
@@ -344,77 +700,244 @@ bool FtmDocument::readOld(Document *doc)
 	return false;
 }
 
-bool FtmDocument::readNew(Document *doc)
+// One block of the file and the outcome of parsing it. Errors are kept so
+// that blocks parsed out of order still report the first failure in file
+// order, like a sequential read would
+struct _ftmdocument_blockjob
 {
-	while (!doc->isFileDone())
+	FtmDocument *doc;
+	const Document::BlockInfo *info;
+	const char *data;
+	std::vector<char> copy;
+	bool ok;
+	FtmDocumentException *error;
+};
+
+// Blocks that only touch state no other block reads or writes
+static bool isSelfContainedBlock(const char *id)
+{
+	return strcmp(id, FILE_BLOCK_INSTRUMENTS) == 0
+		|| strcmp(id, FILE_BLOCK_SEQUENCES) == 0
+		|| strcmp(id, FILE_BLOCK_SEQUENCES_VRC6) == 0
+		|| strcmp(id, FILE_BLOCK_DSAMPLES) == 0
+		|| strcmp(id, FILE_BLOCK_PATTERNS) == 0;
+}
+
+// Blocks a summary read leaves out
+static bool isBulkBlock(const char *id)
+{
+	return strcmp(id, FILE_BLOCK_SEQUENCES) == 0
+		|| strcmp(id, FILE_BLOCK_SEQUENCES_VRC6) == 0
+		|| strcmp(id, FILE_BLOCK_DSAMPLES) == 0
+		|| strcmp(id, FILE_BLOCK_PATTERNS) == 0;
+}
+
+static unsigned int countBlocks(const Document *doc, const char *id)
+{
+	unsigned int n = 0;
+	for (unsigned int i = 0; i < doc->blockCount(); i++)
 	{
-		if (!doc->readBlock())
-			return false;
+		if (strcmp(doc->blockInfo(i).id, id) == 0)
+			n++;
+	}
+	return n;
+}
 
-		if (doc->isFileDone())
-			break;
+static void rethrowBlockError(FtmDocumentException *e)
+{
+	FtmDocumentExceptionAssert *a = dynamic_cast<FtmDocumentExceptionAssert*>(e);
+	if (a != NULL)
+	{
+		FtmDocumentExceptionAssert copy(*a);
+		delete e;
+		throw copy;
+	}
 
-		const char *id = doc->blockID();
+	FtmDocumentException copy(*e);
+	delete e;
+	throw copy;
+}
 
-#define CMP(token) (strcmp(id, token) == 0)
+bool FtmDocument::readNew(Document *doc)
+{
+	if (!doc->scanBlocks())
+		return false;
 
-		if (CMP(FILE_BLOCK_INFO))
-		{
-			doc->getBlock(m_strName, 32);
-			doc->getBlock(m_strArtist, 32);
-			doc->getBlock(m_strCopyright, 32);
-		}
-		else if (CMP(FILE_BLOCK_PARAMS))
-		{
-			if (!readNew_params(doc)) return false;
-		}
-		else if (CMP(FILE_BLOCK_HEADER))
-		{
-			if (!readNew_header(doc)) return false;
-		}
-		else if (CMP(FILE_BLOCK_INSTRUMENTS))
-		{
-			if (!readNew_instruments(doc)) return false;
-		}
-		else if (CMP(FILE_BLOCK_SEQUENCES))
-		{
-			if (!readNew_sequences(doc)) return false;
-		}
-		else if (CMP(FILE_BLOCK_FRAMES))
-		{
-			if (!readNew_frames(doc)) return false;
-		}
-		else if (CMP(FILE_BLOCK_PATTERNS))
+	unsigned int count = doc->blockCount();
+	std::vector<_ftmdocument_blockjob> jobs(count);
+	std::vector<_ftmdocument_blockjob*> deferred;
+	bool seenHeader = false;
+	unsigned int i;
+
+	// Structural blocks are read in file order on this thread. Self-contained
+	// ones are put aside and parsed in parallel once those are done
+	for (i = 0; i < count; i++)
+	{
+		_ftmdocument_blockjob &job = jobs[i];
+		job.doc = this;
+		job.info = &doc->blockInfo(i);
+		job.data = NULL;
+		job.ok = false;
+		job.error = NULL;
+
+		if (m_bSummaryRead && isBulkBlock(job.info->id))
 		{
-			if (!readNew_patterns(doc)) return false;
+			job.ok = true;
+			continue;
 		}
-		else if (CMP(FILE_BLOCK_DSAMPLES))
+
+		if (!doc->openBlock(i))
+			break;
+
+		const char *id = doc->blockID();
+		job.data = doc->blockData();
+
+		bool patterns = strcmp(id, FILE_BLOCK_PATTERNS) == 0;
+		if (isSelfContainedBlock(id) && countBlocks(doc, id) == 1 && (seenHeader || !patterns))
 		{
-			if (!readNew_dsamples(doc)) return false;
+			if (!doc->isBlockMapped())
+			{
+				job.copy.assign(job.data, job.data + job.info->size);
+				job.data = job.copy.empty() ? NULL : &job.copy[0];
+			}
+			deferred.push_back(&job);
+			continue;
 		}
-		else if (CMP(FILE_BLOCK_SEQUENCES_VRC6))
+
+		if (strcmp(id, FILE_BLOCK_HEADER) == 0)
+			seenHeader = true;
+
+		_ftmdocument_blockjob *p = &job;
+		readNew_job(0, &p);
+		if (!job.ok)
+			break;
+	}
+
+	// Everything deferred lies before the block that stopped the loop
+	if (!deferred.empty())
+		core::threadpool::parallelFor(deferred.size(), readNew_job, &deferred[0]);
+
+	if (i < count)
+		count = i + 1;
+
+	_ftmdocument_blockjob *failed = NULL;
+	for (i = 0; i < count; i++)
+	{
+		if (!jobs[i].ok && failed == NULL)
+			failed = &jobs[i];
+		else
+			delete jobs[i].error;
+	}
+
+	if (failed != NULL)
+	{
+		if (failed->error != NULL)
+			rethrowBlockError(failed->error);
+		return false;
+	}
+
+	// Old sequences are converted from the sequence blocks
+	if (!m_bSummaryRead)
+	{
+		if (m_iFileVersion <= 0x0201)
 		{
-			if (!readNew_sequences_vrc6(doc)) return false;
+			reorderSequences();
 		}
-		else
+
+		if (m_iFileVersion < 0x0300)
 		{
-			return false;
+			convertSequences();
 		}
 	}
 
-#undef CMP
+	delete m_pOldSequences;
+	m_pOldSequences = NULL;
+
+	return true;
+}
 
-	if (m_iFileVersion <= 0x0201)
+bool FtmDocument::readNew_block(Document *doc)
+{
+	const char *id = doc->blockID();
+
+#define CMP(token) (strcmp(id, token) == 0)
+
+	if (CMP(FILE_BLOCK_INFO))
 	{
-		reorderSequences();
+		doc->getBlock(m_strName, 32);
+		doc->getBlock(m_strArtist, 32);
+		doc->getBlock(m_strCopyright, 32);
 	}
-
-	if (m_iFileVersion < 0x0300)
+	else if (CMP(FILE_BLOCK_PARAMS))
+	{
+		if (!readNew_params(doc)) return false;
+	}
+	else if (CMP(FILE_BLOCK_HEADER))
 	{
-		convertSequences();
+		if (!readNew_header(doc)) return false;
+	}
+	else if (CMP(FILE_BLOCK_INSTRUMENTS))
+	{
+		if (!readNew_instruments(doc)) return false;
+	}
+	else if (CMP(FILE_BLOCK_SEQUENCES))
+	{
+		if (!readNew_sequences(doc)) return false;
+	}
+	else if (CMP(FILE_BLOCK_FRAMES))
+	{
+		if (!readNew_frames(doc)) return false;
+	}
+	else if (CMP(FILE_BLOCK_PATTERNS))
+	{
+		if (!readNew_patterns(doc)) return false;
+	}
+	else if (CMP(FILE_BLOCK_DSAMPLES))
+	{
+		if (!readNew_dsamples(doc)) return false;
+	}
+	else if (CMP(FILE_BLOCK_SEQUENCES_VRC6))
+	{
+		if (!readNew_sequences_vrc6(doc)) return false;
+	}
+	else
+	{
+		return false;
 	}
 
-	return true;
+#undef CMP
+
+	return !doc->blockOverrun();
+}
+
+void FtmDocument::readNew_job(unsigned int i, void *data)
+{
+	_ftmdocument_blockjob *job = ((_ftmdocument_blockjob**)data)[i];
+	const Document::BlockInfo *info = job->info;
+
+	Document doc;
+	doc.openBlock(info->id, info->version, job->data, info->size);
+
+	try
+	{
+		job->ok = job->doc->readNew_block(&doc);
+	}
+	catch (const FtmDocumentExceptionAssert &e)
+	{
+		job->error = new FtmDocumentExceptionAssert(e);
+	}
+	catch (const FtmDocumentException &e)
+	{
+		job->error = new FtmDocumentException(e);
+	}
+	catch (FtmDocumentException::Type t)
+	{
+		job->error = new FtmDocumentException(t);
+	}
+	catch (...)
+	{
+		// job->ok stays false, reported as a general read failure
+	}
 }
 
 bool FtmDocument::readNew_params(Document *doc)
@@ -475,7 +998,7 @@ bool FtmDocument::readNew_params(Document *doc)
 	if (m_iChannelsAvailable == 5)
 		SelectExpansionChip(SNDCHIP_NONE);
 
-	if (doc->getFileVersion() == 0x0200)
+	if (m_iFileVersion == 0x0200)
 	{
 		int speed = m_pSelectedTune->GetSongSpeed();
 		if (speed < 20)
@@ -609,22 +1132,24 @@ bool FtmDocument::readNew_sequences(Document *doc)
 
 	if (block_ver == 1)
 	{
+		stSequence *pTmpSequences = oldSequences()->TmpSequences;
 		for (unsigned int i = 0; i < count; i++)
 		{
 			index = doc->getBlockInt();
 			seqCount = doc->getBlockChar();
 			ftm_Assert(index < MAX_SEQUENCES);
 			ftm_Assert(seqCount < MAX_SEQUENCE_ITEMS);
-			m_TmpSequences[index].Count = seqCount;
+			pTmpSequences[index].Count = seqCount;
 			for (unsigned int x = 0; x < seqCount; x++)
 			{
-				m_TmpSequences[index].Value[x] = doc->getBlockChar();
-				m_TmpSequences[index].Length[x] = doc->getBlockChar();
+				pTmpSequences[index].Value[x] = doc->getBlockChar();
+				pTmpSequences[index].Length[x] = doc->getBlockChar();
 			}
 		}
 	}
 	else if (block_ver == 2)
 	{
+		stSequence (*pSequences)[SEQ_COUNT] = oldSequences()->Sequences;
 		for (unsigned int i = 0; i < count; i++)
 		{
 			index = doc->getBlockInt();
@@ -633,13 +1158,13 @@ bool FtmDocument::readNew_sequences(Document *doc)
 			ftm_Assert(index < MAX_SEQUENCES);
 			ftm_Assert(type < SEQ_COUNT);
 			ftm_Assert(seqCount < MAX_SEQUENCE_ITEMS);
-			m_Sequences[index][type].Count = seqCount;
+			pSequences[index][type].Count = seqCount;
 			for (unsigned int x = 0; x < seqCount; x++)
 			{
 				value = doc->getBlockChar();
 				length = doc->getBlockChar();
-				m_Sequences[index][type].Value[x] = value;
-				m_Sequences[index][type].Length[x] = length;
+				pSequences[index][type].Value[x] = value;
+				pSequences[index][type].Length[x] = length;
 			}
 		}
 	}
@@ -816,8 +1341,15 @@ bool FtmDocument::readNew_patterns(Document *doc)
 		m_pSelectedTune->SetPatternLength(patternLen);
 	}
 
+	// Only index the records here; each track is decoded from a copy of
+	// the block the first time it is used, see decodePatterns()
+	unsigned int start = doc->blockPointer();
+	unsigned int end = start;
+
 	while (!doc->blockDone())
 	{
+		unsigned int offset = doc->blockPointer();
+
 		unsigned int track;
 		if (block_ver > 1)
 			track = doc->getBlockInt();
@@ -829,15 +1361,22 @@ bool FtmDocument::readNew_patterns(Document *doc)
 		unsigned int items	= doc->getBlockInt();
 
 		if (channel > MAX_CHANNELS)
-			return true;
+			break;
 
 		ftm_Assert(track < MAX_TRACKS);
 		ftm_Assert(channel < MAX_CHANNELS);
 		ftm_Assert(pattern < MAX_PATTERN);
 		ftm_Assert((items - 1) < MAX_PATTERN_LENGTH);
 
-		SwitchToTrack(track);
+		AllocateSong(track);
 
+		unsigned int effSize;
+		if (m_iFileVersion == 0x0200)
+			effSize = 2;
+		else
+			effSize = 2 * (m_pTunes[track]->GetEffectColumnCount(channel) + 1);
+
+		// Validate rows now so that decoding later cannot fail
 		for (unsigned int i = 0; i < items; i++)
 		{
 			unsigned row;
@@ -848,19 +1387,97 @@ bool FtmDocument::readNew_patterns(Document *doc)
 
 			ftm_Assert(row < MAX_PATTERN_LENGTH);
 
-			stChanNote note;
-			memset(&note, 0, sizeof(stChanNote));
+			doc->setBlockPointer(doc->blockPointer() + 4);
+			if (doc->getBlockData(effSize) == NULL)
+				return false;
+		}
 
-			note.Note		 = doc->getBlockChar();
-			note.Octave	 = doc->getBlockChar();
-			note.Instrument = doc->getBlockChar();
-			note.Vol		 = doc->getBlockChar();
+		if (doc->blockOverrun())
+			return false;
+
+		m_pendingPatterns[track].push_back(offset - start);
+		end = doc->blockPointer();
+	}
+
+	doc->setBlockPointer(start);
+	const char *data = doc->getBlockData(end - start);
+	m_patternBlock.assign(data, data + (end - start));
+	m_iPatternBlockVer = block_ver;
+	m_iPatternFileVer = m_iFileVersion;
+
+	for (unsigned int i = 0; i < MAX_TRACKS; i++)
+	{
+		if (!m_pendingPatterns[i].empty())
+			m_trackPending[i].store(true, boost::memory_order_release);
+	}
+
+	decodePatterns(m_iTrack);
+
+	return true;
+}
+
+void FtmDocument::readPatternRecord(Document *doc, unsigned int block_ver, unsigned int file_ver) const
+{
+	unsigned int track;
+	if (block_ver > 1)
+		track = doc->getBlockInt();
+	else
+		track = 0;
+
+	unsigned int channel = doc->getBlockInt();
+	unsigned int pattern = doc->getBlockInt();
+	unsigned int items	= doc->getBlockInt();
+
+	CPatternData *pTune = m_pTunes[track];
+
+	for (unsigned int i = 0; i < items; i++)
+	{
+		unsigned row;
+		if (file_ver == 0x0200)
+			row = doc->getBlockChar();
+		else
+			row = doc->getBlockInt();
+
+		ftm_Assert(row < MAX_PATTERN_LENGTH);
+
+		stChanNote note;
+		memset(&note, 0, sizeof(stChanNote));
+
+		note.Note		 = doc->getBlockChar();
+		note.Octave	 = doc->getBlockChar();
+		note.Instrument = doc->getBlockChar();
+		note.Vol		 = doc->getBlockChar();
+
+		if (file_ver == 0x0200)
+		{
+			unsigned char EffectNumber, EffectParam;
+			EffectNumber = doc->getBlockChar();
+			EffectParam = doc->getBlockChar();
+			if (block_ver < 3)
+			{
+				if (EffectNumber == EF_PORTAOFF)
+				{
+					EffectNumber = EF_PORTAMENTO;
+					EffectParam = 0;
+				}
+				else if (EffectNumber == EF_PORTAMENTO)
+				{
+					if (EffectParam < 0xFF)
+						EffectParam++;
+				}
+			}
 
-			if (m_iFileVersion == 0x0200)
+			note.EffNumber[0]	= EffectNumber;
+			note.EffParam[0]	= EffectParam;
+		}
+		else
+		{
+			for (int n = 0; n < (pTune->GetEffectColumnCount(channel) + 1); n++)
 			{
 				unsigned char EffectNumber, EffectParam;
 				EffectNumber = doc->getBlockChar();
 				EffectParam = doc->getBlockChar();
+
 				if (block_ver < 3)
 				{
 					if (EffectNumber == EF_PORTAOFF)
@@ -875,109 +1492,167 @@ bool FtmDocument::readNew_patterns(Document *doc)
 					}
 				}
 
-				note.EffNumber[0]	= EffectNumber;
-				note.EffParam[0]	= EffectParam;
+				note.EffNumber[n]	= EffectNumber;
+				note.EffParam[n] 	= EffectParam;
 			}
-			else
-			{
-				for (int n = 0; n < (m_pSelectedTune->GetEffectColumnCount(channel) + 1); n++)
-				{
-					unsigned char EffectNumber, EffectParam;
-					EffectNumber = doc->getBlockChar();
-					EffectParam = doc->getBlockChar();
+		}
 
-					if (block_ver < 3)
-					{
-						if (EffectNumber == EF_PORTAOFF)
-						{
-							EffectNumber = EF_PORTAMENTO;
-							EffectParam = 0;
-						}
-						else if (EffectNumber == EF_PORTAMENTO)
-						{
-							if (EffectParam < 0xFF)
-								EffectParam++;
-						}
-					}
+		if (note.Vol > 0x10)
+			note.Vol &= 0x0F;
 
-					note.EffNumber[n]	= EffectNumber;
-					note.EffParam[n] 	= EffectParam;
-				}
-			}
+		// Specific for version 2.0
+		if (file_ver == 0x0200)
+		{
 
-			if (note.Vol > 0x10)
-				note.Vol &= 0x0F;
+			if (note.EffNumber[0] == EF_SPEED && note.EffParam[0] < 20)
+				note.EffParam[0]++;
 
-			// Specific for version 2.0
-			if (m_iFileVersion == 0x0200)
+			if (note.Vol == 0)
 			{
-
-				if (note.EffNumber[0] == EF_SPEED && note.EffParam[0] < 20)
-					note.EffParam[0]++;
-
-				if (note.Vol == 0)
-				{
-					note.Vol = 0x10;
-				}
-				else
-				{
-					note.Vol--;
-					note.Vol &= 0x0F;
-				}
-
-				if (note.Note == 0)
-					note.Instrument = MAX_INSTRUMENTS;
+				note.Vol = 0x10;
+			}
+			else
+			{
+				note.Vol--;
+				note.Vol &= 0x0F;
 			}
 
-			if (block_ver == 3)
+			if (note.Note == 0)
+				note.Instrument = MAX_INSTRUMENTS;
+		}
+
+		if (block_ver == 3)
+		{
+			// Fix for VRC7 portamento
+			if (GetExpansionChip() == SNDCHIP_VRC7 && channel > 4)
 			{
-				// Fix for VRC7 portamento
-				if (GetExpansionChip() == SNDCHIP_VRC7 && channel > 4)
+				for (int n = 0; n < MAX_EFFECT_COLUMNS; n++)
 				{
-					for (int n = 0; n < MAX_EFFECT_COLUMNS; n++)
+					switch (note.EffNumber[n])
 					{
-						switch (note.EffNumber[n])
-						{
-							case EF_PORTA_DOWN:
-								note.EffNumber[n] = EF_PORTA_UP;
-								break;
-							case EF_PORTA_UP:
-								note.EffNumber[n] = EF_PORTA_DOWN;
-								break;
-						}
+						case EF_PORTA_DOWN:
+							note.EffNumber[n] = EF_PORTA_UP;
+							break;
+						case EF_PORTA_UP:
+							note.EffNumber[n] = EF_PORTA_DOWN;
+							break;
 					}
 				}
-				// FDS pitch effect fix
-				else if (GetExpansionChip() == SNDCHIP_FDS && channel == 5)
+			}
+			// FDS pitch effect fix
+			else if (GetExpansionChip() == SNDCHIP_FDS && channel == 5)
+			{
+				for (int n = 0; n < MAX_EFFECT_COLUMNS; n++)
 				{
-					for (int n = 0; n < MAX_EFFECT_COLUMNS; n++)
+					switch (note.EffNumber[n])
 					{
-						switch (note.EffNumber[n])
-						{
-							case EF_PITCH:
-								if (note.EffParam[n] != 0x80)
-									note.EffParam[n] = (0x100 - note.EffParam[n]) & 0xFF;
-								break;
-						}
+						case EF_PITCH:
+							if (note.EffParam[n] != 0x80)
+								note.EffParam[n] = (0x100 - note.EffParam[n]) & 0xFF;
+							break;
 					}
 				}
 			}
+		}
 #ifdef TRANSPOSE_FDS
-			if (version < 5)
+		if (version < 5)
+		{
+			// FDS octave
+			if (GetExpansionChip() == SNDCHIP_FDS && channel > 4 && note.Octave < 7)
 			{
-				// FDS octave
-				if (GetExpansionChip() == SNDCHIP_FDS && channel > 4 && note.Octave < 7)
-				{
-					note.Octave++;
-				}
+				note.Octave++;
 			}
+		}
 #endif
 
-			SetDataAtPattern(m_iTrack, pattern, channel, row, &note);
-		}
+		pTune->SetPatternData(channel, pattern, row, &note);
 	}
+}
 
-	return true;
+void FtmDocument::decodePatterns_slow(unsigned int Track) const
+{
+	boost::mutex::scoped_lock lock(*m_patternLock);
+	decodeTrack(Track);
+	dropPatternBlock();
+}
+
+// Called with m_patternLock held
+void FtmDocument::decodeTrack(unsigned int Track) const
+{
+	std::vector<unsigned int> &records = m_pendingPatterns[Track];
+	if (records.empty())
+		return;
+
+	Document doc;
+	doc.openBlock(FILE_BLOCK_PATTERNS, m_iPatternBlockVer, &m_patternBlock[0], m_patternBlock.size());
+
+	for (unsigned int i = 0; i < records.size(); i++)
+	{
+		doc.setBlockPointer(records[i]);
+		readPatternRecord(&doc, m_iPatternBlockVer, m_iPatternFileVer);
+	}
+
+	std::vector<unsigned int>().swap(records);
+
+	// Publishes the decoded patterns to the fast path
+	m_trackPending[Track].store(false, boost::memory_order_release);
+}
+
+// Drop the block once the last track is decoded, called with m_patternLock held
+void FtmDocument::dropPatternBlock() const
+{
+	for (unsigned int i = 0; i < MAX_TRACKS; i++)
+	{
+		if (!m_pendingPatterns[i].empty())
+			return;
+	}
+	std::vector<char>().swap(m_patternBlock);
+}
+
+struct _ftmdocument_decodejob
+{
+	const FtmDocument *doc;
+	const unsigned int *tracks;
+};
+
+void FtmDocument::decodeTrack_job(unsigned int i, void *data)
+{
+	_ftmdocument_decodejob *job = (_ftmdocument_decodejob*)data;
+	job->doc->decodeTrack(job->tracks[i]);
+}
+
+void FtmDocument::decodeAllPatterns() const
+{
+	boost::mutex::scoped_lock lock(*m_patternLock);
+
+	std::vector<unsigned int> tracks;
+	for (unsigned int i = 0; i < MAX_TRACKS; i++)
+	{
+		if (!m_pendingPatterns[i].empty())
+			tracks.push_back(i);
+	}
+
+	if (tracks.empty())
+		return;
+
+	// Every track decodes into its own CPatternData, so they can run in parallel
+	_ftmdocument_decodejob job;
+	job.doc = this;
+	job.tracks = &tracks[0];
+	core::threadpool::parallelFor(tracks.size(), decodeTrack_job, &job);
+
+	dropPatternBlock();
+}
+
+void FtmDocument::discardPendingPatterns()
+{
+	boost::mutex::scoped_lock lock(*m_patternLock);
+	for (unsigned int i = 0; i < MAX_TRACKS; i++)
+	{
+		m_trackPending[i].store(false, boost::memory_order_release);
+		std::vector<unsigned int>().swap(m_pendingPatterns[i]);
+	}
+	std::vector<char>().swap(m_patternBlock);
 }
 
 bool FtmDocument::readNew_dsamples(Document *doc)
@@ -987,6 +1662,8 @@ bool FtmDocument::readNew_dsamples(Document *doc)
 	int count = doc->getBlockChar();
 	ftm_Assert(count <= MAX_DSAMPLES);
 
+	for (int i = 0; i < MAX_DSAMPLES; i++)
+		releaseSample(i);
 	memset(m_DSamples, 0, sizeof(CDSample) * MAX_DSAMPLES);
 
 	for (int i = 0; i < count; i++)
@@ -1462,6 +2139,8 @@ bool FtmDocument::write_patterns(Document *doc) const
 	 *
 	 */
 
+	decodeAllPatterns();
+
 #ifdef TRANSPOSE_FDS
 	doc->createBlock(FILE_BLOCK_PATTERNS, 5);
 #else
@@ -1476,8 +2155,8 @@ bool FtmDocument::write_patterns(Document *doc) const
 			{
 				unsigned Items = 0;
 
-				// Save all rows
-				unsigned int PatternLen = MAX_PATTERN_LENGTH;
+				// Save all rows, the ones past the stored rows are empty
+				unsigned int PatternLen = m_pTunes[t]->GetStoredRows(i, x);
 				//unsigned int PatternLen = m_pTunes[t]->GetPatternLength();
 
 				// Get the number of items in this pattern
@@ -1500,20 +2179,19 @@ bool FtmDocument::write_patterns(Document *doc) const
 						{
 							doc->writeBlockInt(y);
 
-							stChanNote note;
-							m_pTunes[t]->GetPatternData(i, x, y, &note);
+							const stChanNote *note = m_pTunes[t]->GetPatternData(i, x, y);
 
-							doc->writeBlockChar(note.Note);
-							doc->writeBlockChar(note.Octave);
-							doc->writeBlockChar(note.Instrument);
-							doc->writeBlockChar(note.Vol);
+							doc->writeBlockChar(note->Note);
+							doc->writeBlockChar(note->Octave);
+							doc->writeBlockChar(note->Instrument);
+							doc->writeBlockChar(note->Vol);
 
 							int EffColumns = (m_pTunes[t]->GetEffectColumnCount(i) + 1);
 
 							for (int n = 0; n < EffColumns; n++)
 							{
-								doc->writeBlockChar(note.EffNumber[n]);
-								doc->writeBlockChar(note.EffParam[n]);
+								doc->writeBlockChar(note->EffNumber[n]);
+								doc->writeBlockChar(note->EffParam[n]);
 							}
 						}
 					}
@@ -1556,13 +2234,381 @@ bool FtmDocument::write_dsamples(Document *doc) const
 	return doc->flushBlock();
 }
 
+bool FtmDocument::sameSettings(const FtmDocument *other) const
+{
+	// Everything stored in PARAMS, INFO and HEADER
+	if (m_iExpansionChip != other->m_iExpansionChip || m_iChannelsAvailable != other->m_iChannelsAvailable
+		|| m_iMachine != other->m_iMachine || m_iEngineSpeed != other->m_iEngineSpeed
+		|| m_iVibratoStyle != other->m_iVibratoStyle || m_iSpeedSplitPoint != other->m_iSpeedSplitPoint
+		|| m_highlight != other->m_highlight || m_secondHighlight != other->m_secondHighlight
+		|| m_iTracks != other->m_iTracks)
+		return false;
+
+	if (strcmp(m_strName, other->m_strName) != 0 || strcmp(m_strArtist, other->m_strArtist) != 0
+		|| strcmp(m_strCopyright, other->m_strCopyright) != 0)
+		return false;
+
+	for (unsigned int i = 0; i <= m_iTracks; i++)
+	{
+		if (m_sTrackNames[i] != other->m_sTrackNames[i])
+			return false;
+
+		if (m_pTunes[i] == other->m_pTunes[i])
+			continue;
+
+		for (unsigned int j = 0; j < m_iChannelsAvailable; j++)
+		{
+			if (m_pTunes[i]->GetEffectColumnCount(j) != other->m_pTunes[i]->GetEffectColumnCount(j))
+				return false;
+		}
+	}
+	return true;
+}
+
+bool FtmDocument::writeChanges(Document *doc, const FtmDocument *base) const
+{
+	decodeAllPatterns();
+
+	if (!sameSettings(base))
+	{
+		// Settings, the track list and channel layout are small
+		if (!write_params(doc))
+			return false;
+		if (!write_songinfo(doc))
+			return false;
+		if (!write_header(doc))
+			return false;
+	}
+
+	// Tracks, untouched ones are still shared with the base
+	for (unsigned int t = 0; t <= m_iTracks; t++)
+	{
+		const CPatternData *pTune = m_pTunes[t];
+		const CPatternData *pBase = (t <= base->m_iTracks) ? base->m_pTunes[t] : NULL;
+
+		if (pTune == pBase)
+			continue;
+
+		unsigned int FrameCount = pTune->GetFrameCount();
+
+		doc->createBlock(JOURNAL_BLOCK_TRACK, 1);
+		doc->writeBlockInt(t);
+		doc->writeBlockInt(FrameCount);
+		doc->writeBlockInt(pTune->GetSongSpeed());
+		doc->writeBlockInt(pTune->GetSongTempo());
+		doc->writeBlockInt(pTune->GetPatternLength());
+		for (unsigned int i = 0; i < FrameCount; i++)
+		{
+			for (unsigned int j = 0; j < m_iChannelsAvailable; j++)
+				doc->writeBlockChar(pTune->GetFramePattern(i, j));
+		}
+		if (!doc->flushBlock())
+			return false;
+
+		for (unsigned int i = 0; i < m_iChannelsAvailable; i++)
+		{
+			for (unsigned int j = 0; j < MAX_PATTERN; j++)
+			{
+				if (pBase == NULL ? pTune->GetStoredRows(i, j) == 0 : pTune->SharesPattern(pBase, i, j))
+					continue;
+
+				unsigned int Rows = pTune->GetStoredRows(i, j);
+				unsigned int Items = 0;
+				for (unsigned int y = 0; y < Rows; y++)
+				{
+					if (!pTune->IsCellFree(i, j, y))
+						Items++;
+				}
+
+				doc->createBlock(JOURNAL_BLOCK_PATTERN, 1);
+				doc->writeBlockInt(t);
+				doc->writeBlockInt(i);
+				doc->writeBlockInt(j);
+				doc->writeBlockInt(Items);
+				for (unsigned int y = 0; y < Rows; y++)
+				{
+					if (pTune->IsCellFree(i, j, y))
+						continue;
+
+					const stChanNote *note = pTune->GetPatternData(i, j, y);
+					doc->writeBlockChar(y);
+					doc->writeBlockChar(note->Note);
+					doc->writeBlockChar(note->Octave);
+					doc->writeBlockChar(note->Instrument);
+					doc->writeBlockChar(note->Vol);
+					doc->writeBlock(note->EffNumber, MAX_EFFECT_COLUMNS);
+					doc->writeBlock(note->EffParam, MAX_EFFECT_COLUMNS);
+				}
+				if (!doc->flushBlock())
+					return false;
+			}
+		}
+	}
+
+	for (int i = 0; i < MAX_INSTRUMENTS; i++)
+	{
+		CInstrument *pInst = m_pInstruments[i];
+		if (sameInstrument(pInst, base->m_pInstruments[i]))
+			continue;
+
+		// Instruments load according to the INSTRUMENTS block version
+		doc->createBlock(JOURNAL_BLOCK_INSTRUMENT, 5);
+		doc->writeBlockInt(i);
+		doc->writeBlockChar(pInst == NULL ? INST_NONE : pInst->GetType());
+		if (pInst != NULL)
+		{
+			pInst->Store(doc);
+
+			const char *name = pInst->GetName();
+			int namelen = strlen(name);
+			doc->writeBlockInt(namelen);
+			doc->writeBlock(name, namelen);
+		}
+		if (!doc->flushBlock())
+			return false;
+	}
+
+	for (int c = 0; c < 2; c++)
+	{
+		CSequence * const (*pSeqs)[SEQ_COUNT] = c == 0 ? m_pSequences2A03 : m_pSequencesVRC6;
+		CSequence * const (*pBaseSeqs)[SEQ_COUNT] = c == 0 ? base->m_pSequences2A03 : base->m_pSequencesVRC6;
+
+		for (int i = 0; i < MAX_SEQUENCES; i++)
+		{
+			for (int j = 0; j < SEQ_COUNT; j++)
+			{
+				const CSequence *pSeq = pSeqs[i][j];
+				if (sameSequence(pSeq, pBaseSeqs[i][j]))
+					continue;
+
+				doc->createBlock(JOURNAL_BLOCK_SEQUENCE, 1);
+				doc->writeBlockChar(c == 0 ? SNDCHIP_NONE : SNDCHIP_VRC6);
+				doc->writeBlockInt(i);
+				doc->writeBlockInt(j);
+				doc->writeBlockChar(pSeq != NULL);
+				if (pSeq != NULL)
+				{
+					doc->writeBlockInt(pSeq->GetItemCount());
+					doc->writeBlockInt(pSeq->GetLoopPoint());
+					doc->writeBlockInt(pSeq->GetReleasePoint());
+					doc->writeBlockInt(pSeq->GetSetting());
+					for (unsigned int k = 0; k < pSeq->GetItemCount(); k++)
+						doc->writeBlockChar(pSeq->GetItem(k));
+				}
+				if (!doc->flushBlock())
+					return false;
+			}
+		}
+	}
+
+	// Sample data is shared with the base unless it was replaced
+	for (int i = 0; i < MAX_DSAMPLES; i++)
+	{
+		const CDSample &sample = m_DSamples[i];
+		const CDSample &old = base->m_DSamples[i];
+		if (sample.SampleData == old.SampleData && sample.SampleSize == old.SampleSize
+			&& (sample.SampleSize == 0 || strcmp(sample.Name, old.Name) == 0))
+			continue;
+
+		doc->createBlock(JOURNAL_BLOCK_DSAMPLE, 1);
+		doc->writeBlockInt(i);
+		doc->writeBlockInt(sample.SampleSize);
+		if (sample.SampleSize > 0)
+		{
+			doc->writeString(sample.Name);
+			doc->writeBlock(sample.SampleData, sample.SampleSize);
+		}
+		if (!doc->flushBlock())
+			return false;
+	}
+
+	return true;
+}
+
+bool FtmDocument::readChange(Document *doc)
+{
+	const char *id = doc->blockID();
+
+#define CMP(token) (strcmp(id, token) == 0)
+
+	if (CMP(FILE_BLOCK_PARAMS) || CMP(FILE_BLOCK_INFO))
+	{
+		return readNew_block(doc);
+	}
+	else if (CMP(FILE_BLOCK_HEADER))
+	{
+		if (!readNew_block(doc))
+			return false;
+
+		// Tracks past the end were removed
+		for (unsigned int i = m_iTracks + 1; i < MAX_TRACKS; i++)
+		{
+			if (m_pTunes[i] != NULL)
+			{
+				m_pTunes[i]->Release();
+				m_pTunes[i] = NULL;
+			}
+		}
+		if (m_iTrack > m_iTracks)
+			m_iTrack = 0;
+		SwitchToTrack(m_iTrack);
+	}
+	else if (CMP(JOURNAL_BLOCK_TRACK))
+	{
+		unsigned int Track = doc->getBlockInt();
+		ftm_Assert(Track <= m_iTracks);
+
+		unsigned int FrameCount = doc->getBlockInt();
+		unsigned int Speed = doc->getBlockInt();
+		unsigned int Tempo = doc->getBlockInt();
+		unsigned int PatternLength = doc->getBlockInt();
+		ftm_Assert(FrameCount > 0 && FrameCount <= MAX_FRAMES);
+		ftm_Assert(PatternLength <= MAX_PATTERN_LENGTH);
+
+		CPatternData *pTune = writableTune(Track);
+		pTune->SetFrameCount(FrameCount);
+		pTune->SetSongSpeed(Speed);
+		pTune->SetSongTempo(Tempo);
+		pTune->SetPatternLength(PatternLength);
+		for (unsigned int i = 0; i < FrameCount; i++)
+		{
+			for (unsigned int j = 0; j < m_iChannelsAvailable; j++)
+			{
+				unsigned int Pattern = (unsigned char)doc->getBlockChar();
+				ftm_Assert(Pattern < MAX_PATTERN);
+				pTune->SetFramePattern(i, j, Pattern);
+			}
+		}
+	}
+	else if (CMP(JOURNAL_BLOCK_PATTERN))
+	{
+		unsigned int Track = doc->getBlockInt();
+		unsigned int Channel = doc->getBlockInt();
+		unsigned int Pattern = doc->getBlockInt();
+		unsigned int Items = doc->getBlockInt();
+		ftm_Assert(Track <= m_iTracks);
+		ftm_Assert(Channel < MAX_CHANNELS);
+		ftm_Assert(Pattern < MAX_PATTERN);
+		ftm_Assert(Items <= MAX_PATTERN_LENGTH);
+
+		CPatternData *pTune = writableTune(Track);
+		pTune->ClearPattern(Channel, Pattern);
+		for (unsigned int i = 0; i < Items; i++)
+		{
+			stChanNote note;
+			unsigned int Row = (unsigned char)doc->getBlockChar();
+			note.Note = doc->getBlockChar();
+			note.Octave = doc->getBlockChar();
+			note.Instrument = doc->getBlockChar();
+			note.Vol = doc->getBlockChar();
+			doc->getBlock(note.EffNumber, MAX_EFFECT_COLUMNS);
+			doc->getBlock(note.EffParam, MAX_EFFECT_COLUMNS);
+			pTune->SetPatternData(Channel, Pattern, Row, &note);
+		}
+	}
+	else if (CMP(JOURNAL_BLOCK_INSTRUMENT))
+	{
+		unsigned int Index = doc->getBlockInt();
+		ftm_Assert(Index < MAX_INSTRUMENTS);
+		int Type = doc->getBlockChar();
+
+		CInstrument *pInst = NULL;
+		if (Type != INST_NONE)
+		{
+			ftm_Assert(fami_isInstrumentImplemented(Type));
+			pInst = CreateInstrument(Type);
+			if (!pInst->Load(doc))
+			{
+				delete pInst;
+				return false;
+			}
+
+			unsigned int size = doc->getBlockInt();
+			char name[257];
+			if (size >= 256)
+			{
+				delete pInst;
+				return false;
+			}
+			doc->getBlock(name, size);
+			name[size] = 0;
+			pInst->SetName(name);
+		}
+
+		if (m_pInstruments[Index] != NULL)
+			delete m_pInstruments[Index];
+		m_pInstruments[Index] = pInst;
+	}
+	else if (CMP(JOURNAL_BLOCK_SEQUENCE))
+	{
+		int Chip = doc->getBlockChar();
+		unsigned int Index = doc->getBlockInt();
+		unsigned int Type = doc->getBlockInt();
+		bool Present = doc->getBlockChar() != 0;
+		ftm_Assert(Chip == SNDCHIP_NONE || Chip == SNDCHIP_VRC6);
+		ftm_Assert(Index < MAX_SEQUENCES && Type < SEQ_COUNT);
+
+		CSequence *&pSeq = (Chip == SNDCHIP_NONE) ? m_pSequences2A03[Index][Type] : m_pSequencesVRC6[Index][Type];
+		m_iSequenceVersion++;
+		if (!Present)
+		{
+			delete pSeq;
+			pSeq = NULL;
+		}
+		else
+		{
+			unsigned int Count = doc->getBlockInt();
+			ftm_Assert(Count <= MAX_SEQUENCE_ITEMS);
+
+			if (pSeq == NULL)
+				pSeq = new CSequence;
+			pSeq->Clear();
+			pSeq->SetItemCount(Count);
+			pSeq->SetLoopPoint(doc->getBlockInt());
+			pSeq->SetReleasePoint(doc->getBlockInt());
+			pSeq->SetSetting(doc->getBlockInt());
+			for (unsigned int i = 0; i < Count; i++)
+				pSeq->SetItem(i, doc->getBlockChar());
+		}
+	}
+	else if (CMP(JOURNAL_BLOCK_DSAMPLE))
+	{
+		unsigned int Index = doc->getBlockInt();
+		unsigned int Size = doc->getBlockInt();
+		ftm_Assert(Index < MAX_DSAMPLES);
+		ftm_Assert(Size < 0x8000);
+
+		releaseSample(Index);
+		if (Size > 0)
+		{
+			std::string Name = doc->readString();
+			safe_strcpy(m_DSamples[Index].Name, Name.c_str(), sizeof(m_DSamples[Index].Name));
+
+			const char *Data = doc->getBlockData(Size);
+			if (Data == NULL)
+				return false;
+			m_DSamples[Index].SampleData = new char[Size];
+			m_DSamples[Index].SampleSize = Size;
+			memcpy(m_DSamples[Index].SampleData, Data, Size);
+		}
+	}
+	else
+	{
+		return false;
+	}
+
+#undef CMP
+
+	return !doc->blockOverrun();
+}
+
 void FtmDocument::SetFrameCount(unsigned int Count)
 {
 	ftkr_Assert(Count <= MAX_FRAMES);
 
 	if (m_pSelectedTune->GetFrameCount() != Count)
 	{
-		m_pSelectedTune->SetFrameCount(Count);
+		writableTune()->SetFrameCount(Count);
 		SetModifiedFlag();
 		UpdateViews();
 	}
@@ -1574,7 +2620,7 @@ void FtmDocument::SetPatternLength(unsigned int Length)
 
 	if (m_pSelectedTune->GetPatternLength() != Length)
 	{
-		m_pSelectedTune->SetPatternLength(Length);
+		writableTune()->SetPatternLength(Length);
 		SetModifiedFlag();
 		UpdateViews();
 	}
@@ -1586,7 +2632,7 @@ void FtmDocument::SetSongSpeed(unsigned int Speed)
 
 	if (m_pSelectedTune->GetSongSpeed() != Speed)
 	{
-		m_pSelectedTune->SetSongSpeed(Speed);
+		writableTune()->SetSongSpeed(Speed);
 		SetModifiedFlag();
 	}
 }
@@ -1597,7 +2643,7 @@ void FtmDocument::SetSongTempo(unsigned int Tempo)
 
 	if (m_pSelectedTune->GetSongTempo() != Tempo)
 	{
-		m_pSelectedTune->SetSongTempo(Tempo);
+		writableTune()->SetSongTempo(Tempo);
 		SetModifiedFlag();
 	}
 }
@@ -1627,7 +2673,7 @@ void FtmDocument::SetEffColumns(unsigned int Channel, unsigned int Columns)
 	ftkr_Assert(Columns < MAX_EFFECT_COLUMNS);
 
 //	GetChannel(Channel)->SetColumnCount(Columns);
-	m_pSelectedTune->SetEffectColumnCount(Channel, Columns);
+	writableTune()->SetEffectColumnCount(Channel, Columns);
 
 	SetModifiedFlag();
 	UpdateViews();
@@ -1648,7 +2694,7 @@ unsigned int FtmDocument::GetPatternAtFrame(unsigned int Frame, unsigned int Cha
 void FtmDocument::SetPatternAtFrame(unsigned int Frame, unsigned int Channel, unsigned int Pattern)
 {
 	ftkr_Assert(Frame < MAX_FRAMES && Channel < MAX_CHANNELS && Pattern < MAX_PATTERN);
-	m_pSelectedTune->SetFramePattern(Frame, Channel, Pattern);
+	writableTune()->SetFramePattern(Frame, Channel, Pattern);
 //	SetModifiedFlag();
 }
 
@@ -1669,7 +2715,7 @@ int FtmDocument::GetFirstFreePattern(int Channel)
 
 void FtmDocument::ClearPatterns()
 {
-	m_pSelectedTune->ClearEverything();
+	writableTune()->ClearEverything();
 }
 
 #define GET_PATTERN(Frame, Channel) m_pSelectedTune->GetFramePattern(Frame, Channel)
@@ -1683,12 +2729,12 @@ void FtmDocument::IncreasePattern(unsigned int Frame, unsigned int Channel, int
 	// Selects the next channel pattern
 	if ((Current + Count) < (MAX_PATTERN - 1))
 	{
-		m_pSelectedTune->SetFramePattern(Frame, Channel, Current + Count);
+		writableTune()->SetFramePattern(Frame, Channel, Current + Count);
 		SetModifiedFlag();
 		UpdateViews();
 	}
 	else {
-		m_pSelectedTune->SetFramePattern(Frame, Channel, MAX_PATTERN - 1);
+		writableTune()->SetFramePattern(Frame, Channel, MAX_PATTERN - 1);
 		SetModifiedFlag();
 		UpdateViews();
 	}
@@ -1703,12 +2749,12 @@ void FtmDocument::DecreasePattern(unsigned int Frame, unsigned int Channel, int
 	// Selects the previous channel pattern
 	if (Current > Count)
 	{
-		m_pSelectedTune->SetFramePattern(Frame, Channel, Current - Count);
+		writableTune()->SetFramePattern(Frame, Channel, Current - Count);
 		SetModifiedFlag();
 		UpdateViews();
 	}
 	else {
-		m_pSelectedTune->SetFramePattern(Frame, Channel, 0);
+		writableTune()->SetFramePattern(Frame, Channel, 0);
 		SetModifiedFlag();
 		UpdateViews();
 	}
@@ -1854,7 +2900,7 @@ void FtmDocument::SetNoteData(unsigned int Frame, unsigned int Channel, unsigned
 	ftkr_Assert(Row < MAX_PATTERN_LENGTH);
 
 	// Get notes from the pattern
-	m_pSelectedTune->SetPatternData(Channel, GET_PATTERN(Frame, Channel), Row, Data);
+	writableTune()->SetPatternData(Channel, GET_PATTERN(Frame, Channel), Row, Data);
 	SetModifiedFlag();
 }
 
@@ -1876,7 +2922,8 @@ void FtmDocument::SetDataAtPattern(unsigned int Track, unsigned int Pattern, uns
 	ftkr_Assert(Row < MAX_PATTERN_LENGTH);
 
 	// Set a note to a direct pattern
-	m_pTunes[Track]->SetPatternData(Channel, Pattern, Row, Data);
+	decodePatterns(Track);
+	writableTune(Track)->SetPatternData(Channel, Pattern, Row, Data);
 	SetModifiedFlag();
 }
 
@@ -1888,6 +2935,7 @@ void FtmDocument::GetDataAtPattern(unsigned int Track, unsigned int Pattern, uns
 	ftkr_Assert(Row < MAX_PATTERN_LENGTH);
 
 	// Get note from a direct pattern
+	decodePatterns(Track);
 	m_pTunes[Track]->GetPatternData(Channel,Pattern, Row, Data);
 }
 
@@ -2172,6 +3220,9 @@ unsigned int FtmDocument::GetFrameRate(void) const
 
 void FtmDocument::SelectExpansionChip(unsigned char Chip)
 {
+	// Decoding depends on the chip
+	decodeAllPatterns();
+
 	// Store the chip
 	m_iExpansionChip = Chip;
 
@@ -2260,6 +3311,7 @@ void FtmDocument::SwitchToTrack(unsigned int Track)
 	// TODO: should this fail if track didn't exist?
 	m_iTrack = Track;
 	AllocateSong(Track);
+	decodePatterns(Track);
 	m_pSelectedTune = m_pTunes[Track];
 }
 
@@ -2286,7 +3338,10 @@ void FtmDocument::RemoveTrack(unsigned int Track)
 	ftkr_Assert(m_iTracks > 0);
 	ftkr_Assert(m_pTunes[Track] != NULL);
 
-	delete m_pTunes[Track];
+	// Pending records are indexed by track number
+	decodeAllPatterns();
+
+	m_pTunes[Track]->Release();
 
 	// Move down all other tracks
 	for (unsigned int i = Track; i < m_iTracks; i++)
@@ -2324,6 +3379,8 @@ void FtmDocument::MoveTrackUp(unsigned int Track)
 	if (Track == 0)
 		return;
 
+	decodeAllPatterns();
+
 	const std::string Temp = m_sTrackNames[Track];
 	m_sTrackNames[Track] = m_sTrackNames[Track - 1];
 	m_sTrackNames[Track - 1] = Temp;
@@ -2341,6 +3398,8 @@ void FtmDocument::MoveTrackDown(unsigned int Track)
 	if (Track >= m_iTracks)
 		return;
 
+	decodeAllPatterns();
+
 	const std::string Temp = m_sTrackNames[Track];
 	m_sTrackNames[Track] = m_sTrackNames[Track + 1];
 	m_sTrackNames[Track + 1] = Temp;
@@ -2662,7 +3721,10 @@ CSequence * FtmDocument::GetSequence2A03(int Index, int Type)
 	ftkr_Assert(Index >= 0 && Index < MAX_SEQUENCES && Type >= 0 && Type < SEQ_COUNT);
 
 	if (m_pSequences2A03[Index][Type] == NULL)
+	{
 		m_pSequences2A03[Index][Type] = new CSequence();
+		m_iSequenceVersion++;
+	}
 
 	return m_pSequences2A03[Index][Type];
 }
@@ -2723,7 +3785,10 @@ CSequence *FtmDocument::GetSequenceVRC6(int Index, int Type)
 	ftkr_Assert(Index >= 0 && Index < MAX_SEQUENCES && Type >= 0 && Type < SEQ_COUNT);
 
 	if (m_pSequencesVRC6[Index][Type] == NULL)
+	{
 		m_pSequencesVRC6[Index][Type] = new CSequence();
+		m_iSequenceVersion++;
+	}
 
 	return m_pSequencesVRC6[Index][Type];
 }
@@ -2792,13 +3857,7 @@ void FtmDocument::RemoveDSample(unsigned int Index)
 
 	if (m_DSamples[Index].SampleSize != 0)
 	{
-		if (m_DSamples[Index].SampleData != NULL)
-		{
-			delete[] m_DSamples[Index].SampleData;
-			m_DSamples[Index].SampleData = NULL;
-		}
-
-		m_DSamples[Index].SampleSize = 0;
+		releaseSample(Index);
 		SetModifiedFlag();
 	}
 }
@@ -2913,8 +3972,17 @@ void FtmDocument::ConvertSequence(stSequence *OldSequence, CSequence *NewSequenc
 
 #define LIMIT(v, max, min) v = ((v > max) ? max : ((v < min) ? min : v));//  if (v > max) v = max; else if (v < min) v = min;
 
+_ftmdocument_oldsequences * FtmDocument::oldSequences()
+{
+	if (m_pOldSequences == NULL)
+		m_pOldSequences = new _ftmdocument_oldsequences();
+	return m_pOldSequences;
+}
+
 void FtmDocument::reorderSequences()
 {
+	stSequence (*pSequences)[SEQ_COUNT] = oldSequences()->Sequences;
+	stSequence *pTmpSequences = oldSequences()->TmpSequences;
 	int Keepers[SEQ_COUNT] = {0, 0, 0, 0, 0};
 	int Indices[MAX_SEQUENCES][SEQ_COUNT];
 	int Index;
@@ -2938,13 +4006,13 @@ void FtmDocument::reorderSequences()
 						pInst->SetSeqIndex(x, Indices[Index][x]);
 					}
 					else {
-						memcpy(&m_Sequences[Keepers[x]][x], &m_TmpSequences[Index], sizeof(stSequence));
-						for (unsigned int j = 0; j < m_Sequences[Keepers[x]][x].Count; j++)
+						memcpy(&pSequences[Keepers[x]][x], &pTmpSequences[Index], sizeof(stSequence));
+						for (unsigned int j = 0; j < pSequences[Keepers[x]][x].Count; j++)
 						{
 							switch (x)
 							{
-								case SEQ_VOLUME: LIMIT(m_Sequences[Keepers[x]][x].Value[j], 15, 0); break;
-								case SEQ_DUTYCYCLE: LIMIT(m_Sequences[Keepers[x]][x].Value[j], 3, 0); break;
+								case SEQ_VOLUME: LIMIT(pSequences[Keepers[x]][x].Value[j], 15, 0); break;
+								case SEQ_DUTYCYCLE: LIMIT(pSequences[Keepers[x]][x].Value[j], 3, 0); break;
 							}
 						}
 						Indices[Index][x] = Keepers[x];
@@ -2967,6 +4035,7 @@ void FtmDocument::convertSequences()
 	int iLength, ValPtr, Count, Value, Length;
 	stSequence	*pSeq;
 	CSequence	*pNewSeq;
+	stSequence	(*pSequences)[SEQ_COUNT] = oldSequences()->Sequences;
 
 	// This function is used to convert the old type sequences to new type
 
@@ -2974,7 +4043,7 @@ void FtmDocument::convertSequences()
 	{
 		for (j = 0; j < /*MAX_SEQUENCE_ITEMS*/ SEQ_COUNT; j++)
 		{
-			pSeq = &m_Sequences[i][j];
+			pSeq = &pSequences[i][j];
 			if (pSeq->Count > 0 && pSeq->Count < MAX_SEQUENCE_ITEMS)
 			{
 				pNewSeq = GetSequence2A03(i, j);
@@ -10,14 +10,20 @@
 
 #include <string>
 #include <vector>
+#include <boost/atomic.hpp>
 
 class CPatternData;
 class Document;
+struct _ftmdocument_blockjob;
+struct _ftmdocument_sample;
+struct _ftmdocument_shared;
+struct _ftmdocument_oldsequences;
 namespace core
 {
 	class IO;
 }
 class CTrackerChannel;
+class FtmJournal;
 
 namespace boost
 {
@@ -88,6 +94,7 @@ class FtmDocumentExceptionAssert : public FtmDocumentException
 {
 public:
 	explicit FtmDocumentExceptionAssert(const char *file, int line, const char *func, const char *asrt);
+	FtmDocumentExceptionAssert(const FtmDocumentExceptionAssert &other);
 	virtual ~FtmDocumentExceptionAssert() throw();
 	const char * what() const throw();
 private:
@@ -112,9 +119,31 @@ public:
 
 	void read(core::IO *io);
 	void write(core::IO *io) const;
+	// Reads settings, song info, track list, frames and instruments only.
+	// Patterns, sequences and DPCM samples are left out, which makes it
+	// quick enough for indexing whole libraries. The document can be
+	// inspected but is not fit for playback or saving
+	void readSummary(core::IO *io);
 
 	bool doForceBackup() const{ return bForceBackup; }
 
+	// A snapshot shares patterns, frame lists and DPCM sample data with
+	// the document, whichever side writes first gets its own copy of the
+	// affected track. Instruments and sequences are copied since editors
+	// hold on to them, except that ones with the same edit version as in
+	// base, an earlier snapshot of the same document, are shared with it,
+	// so a series of snapshots only costs what changed in between.
+	// Snapshots are never written, and one can be played or exported while
+	// editing goes on. Patterns still waiting to be decoded are decoded
+	// first. The caller owns the returned document
+	FtmDocument *	snapshot(FtmDocument *base = NULL);
+	// Make the document equal to a snapshot, the snapshot stays valid.
+	// Instruments and sequences are copied into the ones the document
+	// has, so editors holding them stay valid. Ones the snapshot does not
+	// have, or has with another type, are deleted like RemoveInstrument()
+	// does
+	void			restore(FtmDocument *snap);
+
 	// TODO - dan: Deperecate from FtmDocument and move to SoundGen
 /*
 	void			ResetChannels();
@@ -170,6 +199,8 @@ public:
 	void			decreaseEffColumns(unsigned int channel);
 
 	void			SetNoteData(unsigned int Frame, unsigned int Channel, unsigned int Row, const stChanNote *Data);
+	// Rows are copied out, pattern storage moves when it is written to.
+	// Reading does not allocate and is safe from several reader threads
 	void			GetNoteData(unsigned int Frame, unsigned int Channel, unsigned int Row, stChanNote *Data) const;
 
 	void			SetDataAtPattern(unsigned int Track, unsigned int Pattern, unsigned int Channel, unsigned int Row, const stChanNote *Data);
@@ -257,6 +288,10 @@ public:
 	int				GetSequenceItemCountVRC6(int Index, int Type) const;
 	int				GetFreeSequenceVRC6(int Type) const;
 
+	// Changes whenever a sequence is created or removed, so players holding
+	// sequence pointers know to look them up again
+	unsigned int	GetSequenceVersion() const { return m_iSequenceVersion; }
+
 	// DPCM samples
 	CDSample		*GetDSample(unsigned int Index);
 	int				GetSampleCount() const;
@@ -273,11 +308,17 @@ public:
 	void			ConvertSequence(stSequence *OldSequence, CSequence *NewSequence, int Type);
 
 	void			SwitchToTrack(unsigned int Track);
+	_ftmdocument_oldsequences * oldSequences();
 	void			reorderSequences();
 	void			convertSequences();
 
 	void			AllocateSong(unsigned int Song);
 
+	// Patterns of a loaded module are decoded per track on first use
+	void			decodePatterns(unsigned int Track) const
+		{ if (m_trackPending[Track].load(boost::memory_order_acquire)) decodePatterns_slow(Track); }
+	void			decodeAllPatterns() const;
+
 	void SetModifiedFlag(bool modified=true){ m_bModified = modified; }
 	void UpdateViews(){ /* TODO - dan */ }
 
@@ -287,8 +328,29 @@ public:
 	const std::vector<int> & getChannelsFromChip() const{ return m_channelsFromChip; }
 private:
 	bool bForceBackup;
+	bool m_bSummaryRead;
+	unsigned int m_iSequenceVersion;
+	FtmDocument(const FtmDocument &);				// Use snapshot()
+	FtmDocument &operator=(const FtmDocument &);	// Use restore()
+
+	void assignFrom(FtmDocument *other, FtmDocument *base);
+	void clearContents();
+	void releaseTunes();
+	void releaseInstrument(unsigned int Index);
+	// List 0 is the 2A03 sequences, 1 VRC6 and 2 N106
+	CSequence *& sequenceSlot(unsigned int List, unsigned int Index, unsigned int Type);
+	void releaseSequence(unsigned int List, unsigned int Index, unsigned int Type);
+
+	// Tunes may be shared with snapshots, get them through these to write
+	CPatternData *	writableTune();
+	CPatternData *	writableTune(unsigned int Track);
+
+	void			releaseSample(unsigned int Index);
+
 	bool readOld(Document *doc);
 	bool readNew(Document *doc);
+	bool readNew_block(Document *doc);
+	static void readNew_job(unsigned int i, void *data);
 
 	bool readNew_params(Document *doc);
 	bool readNew_header(Document *doc);
@@ -296,9 +358,16 @@ private:
 	bool readNew_sequences(Document *doc);
 	bool readNew_frames(Document *doc);
 	bool readNew_patterns(Document *doc);
+	void readPatternRecord(Document *doc, unsigned int block_ver, unsigned int file_ver) const;
 	bool readNew_dsamples(Document *doc);
 	bool readNew_sequences_vrc6(Document *doc);
 
+	// Edit journal records, written and replayed by FtmJournal
+	friend class FtmJournal;
+	bool writeChanges(Document *doc, const FtmDocument *base) const;
+	bool sameSettings(const FtmDocument *other) const;
+	bool readChange(Document *doc);
+
 	bool writeBlocks(Document *doc) const;
 	bool write_params(Document *doc) const;
 	bool write_songinfo(Document *doc) const;
@@ -336,9 +405,14 @@ private:
 	// Instruments, samples and sequences
 	CInstrument		*m_pInstruments[MAX_INSTRUMENTS];
 	CDSample		m_DSamples[MAX_DSAMPLES];					// The DPCM sample list
+	_ftmdocument_sample *m_pSharedSamples[MAX_DSAMPLES];		// Sample data shared with snapshots
 	CSequence		*m_pSequences2A03[MAX_SEQUENCES][SEQ_COUNT];
 	CSequence		*m_pSequencesVRC6[MAX_SEQUENCES][SEQ_COUNT];
 	CSequence		*m_pSequencesN106[MAX_SEQUENCES][SEQ_COUNT];
+	// Reference counts of instruments and sequences shared between
+	// snapshots, NULL for the ones a document owns alone
+	_ftmdocument_shared *m_pSharedInstruments[MAX_INSTRUMENTS];
+	_ftmdocument_shared *m_pSharedSequences[3][MAX_SEQUENCES][SEQ_COUNT];
 
 	// NSF info
 	char			m_strName[MAX_SONGINFO_LENGTH+1];				// Song name
@@ -351,9 +425,9 @@ private:
 
 	std::string		m_strComment;
 
-	// Things below are for compability with older files
-	stSequence		m_Sequences[MAX_SEQUENCES][SEQ_COUNT];		// Allocate one sequence-list for each effect
-	stSequence		m_TmpSequences[MAX_SEQUENCES];
+	// Things below are for compability with older files, only allocated
+	// while reading one
+	_ftmdocument_oldsequences *m_pOldSequences;
 
 	bool m_bModified;
 	int m_highlight, m_secondHighlight;
@@ -361,6 +435,22 @@ private:
 	std::vector<int> m_channelsFromChip;
 
 	boost::mutex *	m_modifyLock;
+
+	// Undecoded PATTERNS block and, per track, the offsets of its records
+	mutable std::vector<char>			m_patternBlock;
+	unsigned int						m_iPatternBlockVer;
+	unsigned int						m_iPatternFileVer;
+	mutable std::vector<unsigned int>	m_pendingPatterns[MAX_TRACKS];
+	boost::mutex *	m_patternLock;
+	// Set while a track has records left, read without m_patternLock by
+	// the decodePatterns() fast path. The rest is only used under the lock
+	mutable boost::atomic<bool>			m_trackPending[MAX_TRACKS];
+
+	void			decodePatterns_slow(unsigned int Track) const;
+	void			decodeTrack(unsigned int Track) const;
+	void			dropPatternBlock() const;
+	static void		decodeTrack_job(unsigned int i, void *data);
+	void			discardPendingPatterns();
 };
 
 class FtmDocument_lock_guard
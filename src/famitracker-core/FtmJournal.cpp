@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <string.h>
+#include <boost/crc.hpp>
+#include "FtmJournal.hpp"
+#include "FtmDocument.hpp"
+#include "Document.hpp"
+#include "core/io.hpp"
+
+// First record of every journal, identifies the file it applies to
+const char JOURNAL_BLOCK_BASE[] = "JOURNAL";
+const unsigned int JOURNAL_VERSION = 2;
+
+FtmJournal::FtmJournal(FtmDocument *doc, const std::string &modulePath, Quantity compactAt)
+	: m_document(doc), m_base(NULL),
+	  m_modulePath(modulePath), m_journalPath(modulePath + ".journal"),
+	  m_autosavePath(modulePath + ".autosave"),
+	  m_journalSize(0), m_torn(false), m_compactAt(compactAt)
+{
+}
+
+FtmJournal::~FtmJournal()
+{
+	delete m_base;
+}
+
+const std::string & FtmJournal::sourcePath(int source) const
+{
+	return source == SOURCE_AUTOSAVE ? m_autosavePath : m_modulePath;
+}
+
+bool FtmJournal::fileChecksum(const std::string &path, unsigned int *size, unsigned int *crc) const
+{
+	core::MappedIO io(path.c_str());
+	*size = io.size();
+
+	const void *data = io.map(*size);
+	if (data == NULL)
+		return false;
+
+	boost::crc_32_type c;
+	c.process_bytes(data, *size);
+	*crc = c.checksum();
+	return true;
+}
+
+bool FtmJournal::start(int source)
+{
+	unsigned int size, crc;
+	if (!fileChecksum(sourcePath(source), &size, &crc))
+		return false;
+
+	core::FileIO io(m_journalPath.c_str(), core::IO_WRITE);
+	if (!io.isWritable())
+		return false;
+
+	Document doc;
+	doc.setIO(&io);
+	doc.setChecksums(true);
+	doc.createBlock(JOURNAL_BLOCK_BASE, JOURNAL_VERSION);
+	doc.writeBlockInt(source);
+	doc.writeBlockInt(size);
+	doc.writeBlockInt(crc);
+	if (!doc.flushBlock() || !io.flush())
+		return false;
+
+	m_journalSize = io.size();
+	m_torn = false;
+
+	FtmDocument *snap = m_document->snapshot(m_base);
+	delete m_base;
+	m_base = snap;
+	return true;
+}
+
+bool FtmJournal::reset()
+{
+	if (!start(SOURCE_MODULE))
+		return false;
+
+	remove(m_autosavePath.c_str());
+	return true;
+}
+
+bool FtmJournal::sync()
+{
+	if (m_base == NULL)
+		return reset();
+	if (m_torn)
+		return compact();
+
+	FtmDocument *snap = m_document->snapshot(m_base);
+
+	bool ok;
+	Quantity size;
+	{
+		core::FileIO io(m_journalPath.c_str(), core::IO_WRITE | core::IO_APPEND);
+		if (!io.isWritable())
+		{
+			delete snap;
+			return false;
+		}
+
+		Document doc;
+		doc.setIO(&io);
+		doc.setChecksums(true);
+
+		ok = snap->writeChanges(&doc, m_base) && io.flush();
+		size = io.size();
+
+		// Recovery stops at the first damaged record, so a torn one would
+		// hide everything appended after it
+		if (!ok && !io.truncate(m_journalSize))
+			m_torn = true;
+	}
+
+	if (!ok)
+	{
+		delete snap;
+		if (m_torn)
+			compact();
+		return false;
+	}
+
+	m_journalSize = size;
+
+	delete m_base;
+	m_base = snap;
+
+	if (m_compactAt > 0 && m_journalSize > m_compactAt)
+		return compact();
+
+	return true;
+}
+
+bool FtmJournal::compact()
+{
+	// Never leave a half written autosave behind
+	std::string tmp = m_autosavePath + ".tmp";
+	bool ok;
+	{
+		core::FileIO io(tmp.c_str(), core::IO_WRITE);
+		if (!io.isWritable())
+			return false;
+		m_document->write(&io);
+		ok = io.flush();
+	}
+	if (!ok)
+	{
+		remove(tmp.c_str());
+		return false;
+	}
+
+#ifdef WINDOWS
+	remove(m_autosavePath.c_str());
+#endif
+	if (rename(tmp.c_str(), m_autosavePath.c_str()) != 0)
+		return false;
+
+	return start(SOURCE_AUTOSAVE);
+}
+
+int FtmJournal::recover()
+{
+	core::MappedIO io(m_journalPath.c_str());
+	if (io.size() == 0)
+		return 0;
+
+	Document doc;
+	doc.setIO(&io);
+	doc.setChecksums(true);
+
+	if (!doc.readBlock() || strcmp(doc.blockID(), JOURNAL_BLOCK_BASE) != 0
+		|| doc.getBlockVersion() != JOURNAL_VERSION)
+		return -1;
+
+	int source = doc.getBlockInt();
+	if (source != SOURCE_MODULE && source != SOURCE_AUTOSAVE)
+		return -1;
+
+	unsigned int size, crc;
+	if (!fileChecksum(sourcePath(source), &size, &crc))
+		return -1;
+	if ((unsigned int)doc.getBlockInt() != size || (unsigned int)doc.getBlockInt() != crc)
+		return -1;
+
+	int count = 0;
+	if (source == SOURCE_AUTOSAVE)
+	{
+		// Read into a document of its own, nothing of the module may remain
+		core::MappedIO autosave(m_autosavePath.c_str());
+		FtmDocument saved;
+		try
+		{
+			saved.read(&autosave);
+		}
+		catch (const FtmDocumentException &)
+		{
+			return -1;
+		}
+		m_document->restore(&saved);
+		count++;
+	}
+
+	// A crash can leave the last record torn, it fails its checksum
+	while (doc.readBlock() && !doc.isFileDone())
+	{
+		try
+		{
+			FtmDocument_lock_guard lock(m_document);
+			if (!m_document->readChange(&doc))
+				break;
+		}
+		catch (const FtmDocumentException &)
+		{
+			break;
+		}
+		count++;
+	}
+
+	if (count > 0 && !compact())
+		return -1;
+
+	return count;
+}
@@ -0,0 +1,63 @@
+#ifndef _FTMJOURNAL_HPP_
+#define _FTMJOURNAL_HPP_
+
+#include <string>
+#include "common.hpp"
+#include "types.hpp"
+
+class FtmDocument;
+
+// Optional edit journal kept next to a module as <module>.journal. Each
+// sync() appends checksummed records of what changed since the last one,
+// so autosaving costs about as much as the edits did. compact() writes the
+// document in full to <module>.autosave and restarts the journal against
+// it, the module file is only ever written by the application when the
+// user saves. After a crash, recover() replays the journal onto the module
+// or the autosave, up to the first damaged record.
+class FAMICOREAPI FtmJournal
+{
+public:
+	// compactAt: sync() compacts once the journal grows past this many
+	// bytes, 0 leaves compaction to the caller
+	FtmJournal(FtmDocument *doc, const std::string &modulePath, Quantity compactAt = 1 << 20);
+	~FtmJournal();
+
+	const std::string & modulePath() const{ return m_modulePath; }
+	const std::string & journalPath() const{ return m_journalPath; }
+	const std::string & autosavePath() const{ return m_autosavePath; }
+	Quantity journalSize() const{ return m_journalSize; }
+
+	// Starts an empty journal for the module file as it is on disk and
+	// removes the autosave, call after loading or saving the module
+	bool reset();
+	// A failed sync leaves the journal as it was, or compacts if it cannot
+	bool sync();
+	bool compact();
+
+	// Replays a journal left by a crash onto the document, which must have
+	// just been loaded from the module, then compacts. When the journal was
+	// written against the autosave, the document is read from that first,
+	// which counts as one record. Returns the number of records replayed,
+	// 0 if there is no journal and -1 if it was written against a
+	// different file
+	int recover();
+private:
+	enum
+	{
+		SOURCE_MODULE,
+		SOURCE_AUTOSAVE
+	};
+
+	const std::string & sourcePath(int source) const;
+	bool fileChecksum(const std::string &path, unsigned int *size, unsigned int *crc) const;
+	bool start(int source);
+
+	FtmDocument * m_document;
+	FtmDocument * m_base;		// Snapshot at the last sync
+	std::string m_modulePath, m_journalPath, m_autosavePath;
+	Quantity m_journalSize;
+	bool m_torn;				// The journal ends in a record that could not be cut off
+	Quantity m_compactAt;
+};
+
+#endif
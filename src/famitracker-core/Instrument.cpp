@@ -21,13 +21,14 @@
 #include <string.h>
 #include "FtmDocument.hpp"
 #include "Instrument.h"
+#include "Sequence.h"
 
 /*
  * class CInstrument, base class for instruments
  *
  */
 
-CInstrument::CInstrument() : m_iType(0)
+CInstrument::CInstrument() : m_iType(0), m_iEditVersion(fami_nextEditVersion())
 {
 	memset(m_cName, 0, sizeof(m_cName));
 }
@@ -39,6 +40,7 @@ CInstrument::~CInstrument()
 void CInstrument::SetName(const char *Name)
 {
 	safe_strcpy(m_cName, Name, sizeof(m_cName));
+	InstrumentChanged();
 }
 
 void CInstrument::GetName(char *Name, unsigned int sz) const
@@ -51,7 +53,12 @@ const char *CInstrument::GetName() const
 	return m_cName;
 }
 
-void CInstrument::InstrumentChanged() const
+unsigned int CInstrument::GetEditVersion() const
 {
-	// TODO - dan
+	return m_iEditVersion;
+}
+
+void CInstrument::InstrumentChanged()
+{
+	m_iEditVersion = fami_nextEditVersion();
 }
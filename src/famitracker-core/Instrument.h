@@ -76,6 +76,7 @@ public:
 	virtual int GetType() const = 0;												// Returns instrument type
 	virtual CInstrument* CreateNew() const = 0;										// Creates a new object
 	virtual CInstrument* Clone() const = 0;											// Creates a copy
+	virtual void Copy(const CInstrument *pInst) = 0;								// Copies an instrument of the same type into this one
 	virtual void Store(Document *doc) = 0;											// Saves the instrument to the module
 	virtual bool Load(Document *doc) = 0;											// Loads the instrument from a module
 	virtual void SaveFile(core::IO *file, FtmDocument *pDoc) = 0;							// Saves to an FTI file
@@ -83,11 +84,14 @@ public:
 //	virtual int CompileSize(CCompiler *pCompiler) = 0;								// Gets the compiled size
 //	virtual int Compile(CCompiler *pCompiler, int Index) = 0;						// Compiles the instrument for NSF generation
 	virtual bool CanRelease(FtmDocument *doc) const = 0;
+	// Changes with every edit, a copy has the version of the original
+	virtual unsigned int GetEditVersion() const;
 protected:
-	void InstrumentChanged() const;
+	void InstrumentChanged();
 private:
 	char m_cName[MAX_INSTRUMENT_NAME_LENGTH+1];
 	int	 m_iType;
+	unsigned int m_iEditVersion;
 };
 
 class FAMICOREAPI CInstrument2A03 : public CInstrument, public CInstrument2A03Interface {
@@ -96,6 +100,7 @@ public:
 	virtual int	GetType() const { return INST_2A03; }
 	virtual CInstrument* CreateNew() const { return new CInstrument2A03; }
 	virtual CInstrument* Clone() const;
+	virtual void Copy(const CInstrument *pInst);
 	virtual void Store(Document *doc);
 	virtual bool Load(Document *doc);
 	virtual void SaveFile(core::IO *file, FtmDocument *pDoc);
@@ -146,6 +151,7 @@ public:
 	virtual int	GetType() const { return INST_VRC6; }
 	virtual CInstrument* CreateNew() const { return new CInstrumentVRC6; }
 	virtual CInstrument* Clone() const;
+	virtual void Copy(const CInstrument *pInst);
 	virtual void Store(Document *pDocFile);
 	virtual bool Load(Document *pDocFile);
 	virtual void SaveFile(core::IO *file, FtmDocument *doc);
@@ -172,6 +178,7 @@ public:
 	virtual int	GetType() const { return INST_VRC7; }
 	virtual CInstrument* CreateNew() const { return new CInstrumentVRC7; }
 	virtual CInstrument* Clone() const;
+	virtual void Copy(const CInstrument *pInst);
 	virtual void Store(Document *doc);
 	virtual bool Load(Document *doc);
 	virtual void SaveFile(core::IO *file, FtmDocument *doc);
@@ -196,6 +203,7 @@ public:
 	virtual int GetType() const { return INST_FDS; }
 	virtual CInstrument* CreateNew() const { return new CInstrumentFDS; }
 	virtual CInstrument* Clone() const;
+	virtual void Copy(const CInstrument *pInst);
 	virtual void Store(Document *pDocFile);
 	virtual bool Load(Document *pDocFile);
 	virtual void SaveFile(core::IO *file, FtmDocument *pDoc);
@@ -219,6 +227,7 @@ public:
 	CSequence* GetVolumeSeq() const;
 	CSequence* GetArpSeq() const;
 	CSequence* GetPitchSeq() const;
+	virtual unsigned int GetEditVersion() const;
 private:
 	void StoreSequence(Document *pDocFile, CSequence *pSeq);
 	bool LoadSequence(Document *pDocFile, CSequence *pSeq);
@@ -73,6 +73,12 @@ CInstrument *CInstrument2A03::Clone() const
 	return pNew;
 }
 
+void CInstrument2A03::Copy(const CInstrument *pInst)
+{
+	// Only plain values, assignment copies them all
+	*this = *static_cast<const CInstrument2A03*>(pInst);
+}
+
 void CInstrument2A03::Store(Document *doc)
 {
 	doc->writeBlockInt(SEQUENCE_COUNT);
@@ -553,6 +559,7 @@ void CInstrument2A03::SetSampleLoop(int Octave, int Note, bool Loop)
 void CInstrument2A03::SetSampleLoopOffset(int Octave, int Note, char Offset)
 {
 	m_cSampleLoopOffset[Octave][Note] = Offset;
+	InstrumentChanged();
 }
 
 bool CInstrument2A03::AssignedSamples() const
@@ -80,6 +80,26 @@ CInstrument *CInstrumentFDS::Clone() const
 	return pNewInst;
 }
 
+void CInstrumentFDS::Copy(const CInstrument *pInst)
+{
+	const CInstrumentFDS *pFDS = static_cast<const CInstrumentFDS*>(pInst);
+
+	// Name and edit version
+	CInstrument::operator=(*pFDS);
+
+	memcpy(m_iSamples, pFDS->m_iSamples, WAVE_SIZE);
+	memcpy(m_iModulation, pFDS->m_iModulation, MOD_SIZE);
+	m_iModulationSpeed = pFDS->m_iModulationSpeed;
+	m_iModulationDepth = pFDS->m_iModulationDepth;
+	m_iModulationDelay = pFDS->m_iModulationDelay;
+	m_bModulationEnable = pFDS->m_bModulationEnable;
+
+	// The sequences stay where editors can find them
+	m_pVolume->Copy(pFDS->m_pVolume);
+	m_pArpeggio->Copy(pFDS->m_pArpeggio);
+	m_pPitch->Copy(pFDS->m_pPitch);
+}
+
 void CInstrumentFDS::StoreInstSequence(core::IO *file, CSequence *pSeq)
 {
 	int i;
@@ -461,6 +481,20 @@ CSequence* CInstrumentFDS::GetPitchSeq() const
 	return m_pPitch;
 }
 
+unsigned int CInstrumentFDS::GetEditVersion() const
+{
+	// The sequences are edited directly, an edit of any of them gives a
+	// version above all earlier ones
+	unsigned int Version = CInstrument::GetEditVersion();
+	const CSequence *pSeqs[] = { m_pVolume, m_pArpeggio, m_pPitch };
+	for (int i = 0; i < 3; i++)
+	{
+		if (pSeqs[i]->GetEditVersion() > Version)
+			Version = pSeqs[i]->GetEditVersion();
+	}
+	return Version;
+}
+
 bool CInstrumentFDS::GetModulationEnable() const
 {
 	return m_bModulationEnable;
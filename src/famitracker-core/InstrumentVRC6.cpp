@@ -55,6 +55,12 @@ CInstrument *CInstrumentVRC6::Clone() const
 	return pNew;
 }
 
+void CInstrumentVRC6::Copy(const CInstrument *pInst)
+{
+	// Only plain values, assignment copies them all
+	*this = *static_cast<const CInstrumentVRC6*>(pInst);
+}
+
 void CInstrumentVRC6::Store(Document *doc)
 {
 	doc->writeBlockInt(SEQUENCE_COUNT);
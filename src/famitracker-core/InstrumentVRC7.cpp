@@ -56,6 +56,12 @@ CInstrument *CInstrumentVRC7::Clone() const
 	return pNew;
 }
 
+void CInstrumentVRC7::Copy(const CInstrument *pInst)
+{
+	// Only plain values, assignment copies them all
+	*this = *static_cast<const CInstrumentVRC7*>(pInst);
+}
+
 void CInstrumentVRC7::Store(Document *doc)
 {
 	doc->writeBlockInt(m_iPatch);
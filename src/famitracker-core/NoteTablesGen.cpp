@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <math.h>
+
+// Writes the note and vibrato tables of SoundGen.cpp as the initializer of
+// a _soundgen_tables_t, run at build time so the library does not work them
+// out with pow() and sin() every time it loads.
+// usage: note-tables-gen output
+
+static const int NOTE_COUNT = 12*8;
+static const int VIBRATO_LENGTH = 256;
+
+// Same as CAPU::BASE_FREQ_NTSC and CAPU::BASE_FREQ_PAL
+static const double BASE_FREQ_NTSC = 1789773;
+static const double BASE_FREQ_PAL = 1662607;
+
+// The depth of each vibrato level
+static const double NEW_VIBRATO_DEPTH[] = {
+	1.0, 1.5, 2.5, 4.0, 5.0, 7.0, 10.0, 12.0, 14.0, 17.0, 22.0, 30.0, 44.0, 64.0, 96.0, 128.0
+};
+
+static const double OLD_VIBRATO_DEPTH[] = {
+	1.0, 1.0, 2.0, 3.0, 4.0, 7.0, 8.0, 15.0, 16.0, 31.0, 32.0, 63.0, 64.0, 127.0, 128.0, 255.0
+};
+
+static void writeTable(FILE *f, const char *comment, const unsigned int *table, int count)
+{
+	fprintf(f, "\t// %s\n\t{", comment);
+	for (int i = 0; i < count; i++)
+	{
+		fprintf(f, "%s%u", i == 0 ? "\n\t\t" : i % 12 == 0 ? ",\n\t\t" : ", ", table[i]);
+	}
+	fprintf(f, "\n\t},\n");
+}
+
+static void writeTable(FILE *f, const char *comment, const int *table, int count)
+{
+	fprintf(f, "\t// %s\n\t{", comment);
+	for (int i = 0; i < count; i++)
+	{
+		fprintf(f, "%s%d", i == 0 ? "\n\t\t" : i % 16 == 0 ? ",\n\t\t" : ", ", table[i]);
+	}
+	fprintf(f, "\n\t},\n");
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+	{
+		fprintf(stderr, "usage: %s output\n", argv[0]);
+		return 1;
+	}
+
+	unsigned int noteNTSC[NOTE_COUNT];
+	unsigned int notePAL[NOTE_COUNT];
+	unsigned int noteSaw[NOTE_COUNT];
+	unsigned int noteFDS[NOTE_COUNT];
+	unsigned int noteN106[NOTE_COUNT];
+	unsigned int noteS5B[NOTE_COUNT];
+	int vibratoNew[VIBRATO_LENGTH];
+	int vibratoOld[VIBRATO_LENGTH];
+
+	const double BASE_FREQ = 32.7032;
+	double freq;
+	double pitch;
+
+	double clock_ntsc = BASE_FREQ_NTSC / 16.0;
+	double clock_pal = BASE_FREQ_PAL / 16.0;
+
+	for (int i = 0; i < NOTE_COUNT; i++)
+	{
+		// Frequency (in Hz)
+		freq = BASE_FREQ * pow(2.0, double(i) / 12.0);
+
+		// 2A07
+		pitch = (clock_pal / freq) - 0.5;
+		notePAL[i] = (unsigned int)pitch;
+
+		// 2A03 / MMC5 / VRC6
+		pitch = (clock_ntsc / freq) - 0.5;
+		noteNTSC[i] = (unsigned int)pitch;
+
+		// VRC6 Saw
+		pitch = ((clock_ntsc * 16.0) / (freq * 14.0)) - 0.5;
+		noteSaw[i] = (unsigned int)pitch;
+
+		// FDS
+#ifdef TRANSPOSE_FDS
+		pitch = (freq * 65536.0) / (clock_ntsc / 2.0) + 0.5;
+#else
+		pitch = (freq * 65536.0) / (clock_ntsc / 4.0) + 0.5;
+#endif
+		noteFDS[i] = (unsigned int)pitch;
+
+		// N106
+		pitch = (1509949440.0 * freq) / 21477272.7272;
+		noteN106[i] = (unsigned int)pitch;
+
+		// Sunsoft 5B
+		pitch = (clock_ntsc / freq) - 0.5;
+		noteS5B[i] = (unsigned int)pitch;
+	}
+
+	for (int i = 0; i < 16; i++)	// depth
+	{
+		for (int j = 0; j < 16; j++)	// phase
+		{
+			double angle = (double(j) / 16.0) * (3.1415 / 2.0);
+
+			vibratoNew[i * 16 + j] = int(sin(angle) * NEW_VIBRATO_DEPTH[i]);
+			vibratoOld[i * 16 + j] = (int)((double(j * OLD_VIBRATO_DEPTH[i]) / 16.0) + 1);
+		}
+	}
+
+	FILE *f = fopen(argv[1], "w");
+	if (f == NULL)
+	{
+		perror(argv[1]);
+		return 1;
+	}
+
+	fprintf(f, "// Generated by note-tables-gen from NoteTablesGen.cpp, do not edit\n\n");
+	fprintf(f, "static const _soundgen_tables_t tables = {\n");
+	writeTable(f, "2A03", noteNTSC, NOTE_COUNT);
+	writeTable(f, "2A07", notePAL, NOTE_COUNT);
+	writeTable(f, "VRC6 sawtooth", noteSaw, NOTE_COUNT);
+	writeTable(f, "FDS", noteFDS, NOTE_COUNT);
+	writeTable(f, "N106", noteN106, NOTE_COUNT);
+	writeTable(f, "Sunsoft 5B", noteS5B, NOTE_COUNT);
+	writeTable(f, "New vibrato", vibratoNew, VIBRATO_LENGTH);
+	writeTable(f, "Old vibrato", vibratoOld, VIBRATO_LENGTH);
+	fprintf(f, "};\n");
+
+	if (fclose(f) != 0)
+	{
+		perror(argv[1]);
+		return 1;
+	}
+	return 0;
+}
@@ -19,45 +19,121 @@
 */
 
 #include <string.h>
+#include <boost/detail/atomic_count.hpp>
 #include "PatternData.h"
 #include "types.hpp"
 
 // This class contains pattern data
 // A list of these objects exists inside the document one for each song
 
+// Shared by every row that has no storage behind it
+static const stChanNote EMPTY_NOTE = { NONE, 0, 0x10, MAX_INSTRUMENTS, {0}, {0} };
+
+// Allocation granularity for pattern rows
+const unsigned int ROW_CHUNK = 16;
+
+// Rows of one pattern, shared between copies of a tune until one of them
+// writes to it
+struct stPatternChunk
+{
+	stPatternChunk(unsigned int rows) : Refs(1), Rows(rows), Notes(new stChanNote[rows]) { }
+	~stPatternChunk() { delete[] Notes; }
+
+	boost::detail::atomic_count Refs;
+	unsigned int Rows;
+	stChanNote *Notes;
+};
+
+struct stPatternRefs
+{
+	stPatternRefs() : Refs(1) { }
+	boost::detail::atomic_count Refs;
+};
+
+static void ReleaseChunk(stPatternChunk *pChunk)
+{
+	if (pChunk != NULL && --pChunk->Refs == 0)
+		delete pChunk;
+}
+
 CPatternData::CPatternData(unsigned int PatternLength, unsigned int Speed, unsigned int Tempo)
 {
 	// Clear memory
 	memset(m_iFrameList, 0, sizeof(short) * MAX_FRAMES * MAX_CHANNELS);
-	memset(m_pPatternData, 0, sizeof(stChanNote*) * MAX_CHANNELS * MAX_PATTERN);
+	memset(m_pPatternData, 0, sizeof(stPatternChunk*) * MAX_CHANNELS * MAX_PATTERN);
 	memset(m_iEffectColumns, 0, sizeof(int) * MAX_CHANNELS);
 
+	for (int i = 0; i < MAX_CHANNELS; i++)
+	{
+		for (int j = 0; j < MAX_PATTERN; j++)
+			m_patternPlayLengths[i][j] = MAX_PATTERN_LENGTH;
+	}
+	ResetFrames();
+
 	m_iPatternLength = PatternLength;
 	m_iFrameCount	 = 1;
 	m_iSongSpeed	 = Speed;
 	m_iSongTempo	 = Tempo;
 
-	// Pre-allocate pattern 0 for all channels
-	for (int i = 0; i < MAX_CHANNELS; i++)
-		AllocatePattern(i, 0);
+	m_pRefs = new stPatternRefs;
 }
 
-CPatternData::~CPatternData()
+CPatternData::CPatternData(const CPatternData &other)
 {
-	// Deallocate memory
+	memcpy(m_iFrameList, other.m_iFrameList, sizeof(m_iFrameList));
+	memcpy(m_patternPlayLengths, other.m_patternPlayLengths, sizeof(m_patternPlayLengths));
+	memcpy(m_framePlayLengths, other.m_framePlayLengths, sizeof(m_framePlayLengths));
+	memcpy(m_iEffectColumns, other.m_iEffectColumns, sizeof(m_iEffectColumns));
+	memcpy(m_pPatternData, other.m_pPatternData, sizeof(m_pPatternData));
+
 	for (int i = 0; i < MAX_CHANNELS; i++)
 	{
 		for (int j = 0; j < MAX_PATTERN; j++)
 		{
 			if (m_pPatternData[i][j] != NULL)
-				delete[] m_pPatternData[i][j];
+				++m_pPatternData[i][j]->Refs;
 		}
 	}
+
+	m_iPatternLength = other.m_iPatternLength;
+	m_iFrameCount	 = other.m_iFrameCount;
+	m_iSongSpeed	 = other.m_iSongSpeed;
+	m_iSongTempo	 = other.m_iSongTempo;
+
+	m_pRefs = new stPatternRefs;
 }
 
-bool CPatternData::IsCellFree(unsigned int Channel, unsigned int Pattern, unsigned int Row)
+CPatternData::~CPatternData()
 {
-	stChanNote *Note = GetPatternData(Channel, Pattern, Row);
+	// Deallocate memory
+	for (int i = 0; i < MAX_CHANNELS; i++)
+	{
+		for (int j = 0; j < MAX_PATTERN; j++)
+			ReleaseChunk(m_pPatternData[i][j]);
+	}
+
+	delete m_pRefs;
+}
+
+void CPatternData::AddRef()
+{
+	++m_pRefs->Refs;
+}
+
+void CPatternData::Release()
+{
+	if (--m_pRefs->Refs == 0)
+		delete this;
+}
+
+bool CPatternData::IsShared() const
+{
+	return m_pRefs->Refs > 1;
+}
+
+bool CPatternData::IsCellFree(unsigned int Channel, unsigned int Pattern, unsigned int Row) const
+{
+	const stChanNote *Note = GetPatternData(Channel, Pattern, Row);
 
 	bool IsFree = Note->Note == NONE &&
 		Note->EffNumber[0] == 0 && Note->EffNumber[1] == 0 &&
@@ -67,10 +143,14 @@ bool CPatternData::IsCellFree(unsigned int Channel, unsigned int Pattern, unsign
 	return IsFree;
 }
 
-bool CPatternData::IsPatternEmpty(unsigned int Channel, unsigned int Pattern)
+bool CPatternData::IsPatternEmpty(unsigned int Channel, unsigned int Pattern) const
 {
-	// Check if pattern is empty
-	for (unsigned int i = 0; i < m_iPatternLength; i++)
+	// Check if pattern is empty, rows without storage always are
+	unsigned int Rows = GetStoredRows(Channel, Pattern);
+	if (Rows > m_iPatternLength)
+		Rows = m_iPatternLength;
+
+	for (unsigned int i = 0; i < Rows; i++)
 	{
 		if (!IsCellFree(Channel, Pattern, i))
 			return false;
@@ -78,7 +158,7 @@ bool CPatternData::IsPatternEmpty(unsigned int Channel, unsigned int Pattern)
 	return true;
 }
 
-bool CPatternData::IsPatternInUse(unsigned int Channel, unsigned int Pattern)
+bool CPatternData::IsPatternInUse(unsigned int Channel, unsigned int Pattern) const
 {
 	// Check if pattern is addressed in frame list
 	for (unsigned i = 0; i < m_iFrameCount; i++)
@@ -89,23 +169,21 @@ bool CPatternData::IsPatternInUse(unsigned int Channel, unsigned int Pattern)
 	return false;
 }
 
-stChanNote *CPatternData::GetPatternData(int Channel, int Pattern, int Row)
+const stChanNote *CPatternData::GetPatternData(int Channel, int Pattern, int Row) const
 {
-	if (!m_pPatternData[Channel][Pattern])		// Allocate pattern if accessed for the first time
-		AllocatePattern(Channel, Pattern);
+	const stPatternChunk *pChunk = m_pPatternData[Channel][Pattern];
+	if (pChunk == NULL || (unsigned int)Row >= pChunk->Rows)
+		return &EMPTY_NOTE;
 
-	return m_pPatternData[Channel][Pattern] + Row;
+	return pChunk->Notes + Row;
 }
-void CPatternData::GetPatternData(int Channel, int Pattern, int Row, stChanNote *note)
+void CPatternData::GetPatternData(int Channel, int Pattern, int Row, stChanNote *note) const
 {
-	stChanNote *n = GetPatternData(Channel, Pattern, Row);
+	const stChanNote *n = GetPatternData(Channel, Pattern, Row);
 	memcpy(note, n, sizeof(stChanNote));
 }
 void CPatternData::SetPatternData(int Channel, int Pattern, int Row, const stChanNote *note)
 {
-	if (!m_pPatternData[Channel][Pattern])		// Allocate pattern if accessed for the first time
-		AllocatePattern(Channel, Pattern);
-
 	stChanNote n = *note;
 
 	// todo: use enumerator constant
@@ -120,80 +198,177 @@ void CPatternData::SetPatternData(int Channel, int Pattern, int Row, const stCha
 		}
 	}
 
-	*(m_pPatternData[Channel][Pattern] + Row) = n;
-	m_patternPlayLengths[Channel][Pattern] = -1;
+	unsigned int Rows = GetStoredRows(Channel, Pattern);
+
+	if ((unsigned int)Row >= Rows)
+	{
+		// Clearing a row that has no storage changes nothing
+		if (memcmp(&n, &EMPTY_NOTE, sizeof(stChanNote)) == 0)
+			return;
+
+		AllocatePattern(Channel, Pattern, Row + 1);
+	}
+	else if (m_pPatternData[Channel][Pattern]->Refs > 1)
+	{
+		// Storage is shared with a copy, make a private one first
+		AllocatePattern(Channel, Pattern, Rows);
+	}
+
+	m_pPatternData[Channel][Pattern]->Notes[Row] = n;
+	UpdatePlayLength(Channel, Pattern, Row);
 }
 
 void CPatternData::SetPatternLength(unsigned int Length)
 {
+	// Play lengths are stored unclamped, they stay as they are
 	m_iPatternLength = Length;
 }
 
-unsigned int CPatternData::getPatternPlayLength(int channel, int pattern)
+void CPatternData::SetEffectColumnCount(int Channel, int Count)
+{
+	if (m_iEffectColumns[Channel] == Count)
+		return;
+
+	// Hidden columns do not end patterns
+	m_iEffectColumns[Channel] = Count;
+
+	for (int i = 0; i < MAX_PATTERN; i++)
+		m_patternPlayLengths[Channel][i] = ScanPlayLength(Channel, i, 0);
+
+	for (int i = 0; i < MAX_FRAMES; i++)
+		UpdateFrame(i, Channel);
+}
+
+bool CPatternData::RowEndsPattern(int Channel, int Pattern, unsigned int Row) const
 {
-	if (m_pPatternData[channel][pattern] == NULL)
+	const stChanNote *n = GetPatternData(Channel, Pattern, Row);
+	for (unsigned int j = 0; j <= GetEffectColumnCount(Channel); j++)
 	{
-		// pattern not used, and therefore no length
-		return MAX_PATTERN_LENGTH;
+		char en = n->EffNumber[j];
+		if (en == EF_JUMP || en == EF_SKIP || en == EF_HALT)
+			return true;
 	}
+	return false;
+}
 
-	int &l = m_patternPlayLengths[channel][pattern];
-	if (l == -1)
+int CPatternData::ScanPlayLength(int Channel, int Pattern, unsigned int StartRow) const
+{
+	// Empty rows hold no effects, only stored rows can end the pattern
+	unsigned int Rows = GetStoredRows(Channel, Pattern);
+	for (unsigned int i = StartRow; i < Rows; i++)
 	{
-		for (unsigned int i = 0; i < MAX_PATTERN_LENGTH; i++)
-		{
-			const stChanNote *n = GetPatternData(channel, pattern, i);
-			for (unsigned int j = 0; j <= GetEffectColumnCount(channel); j++)
-			{
-				char en = n->EffNumber[j];
-				if (en == EF_JUMP || en == EF_SKIP || en == EF_HALT)
-				{
-					l = i+1;
-					if (l > m_iPatternLength)
-						return m_iPatternLength;
-					return l;
-				}
-			}
-		}
-		l = MAX_PATTERN_LENGTH;
+		if (RowEndsPattern(Channel, Pattern, i))
+			return i+1;
+	}
+	return MAX_PATTERN_LENGTH;
+}
+
+int CPatternData::GetRawPlayLength(int Channel, int Pattern) const
+{
+	return m_patternPlayLengths[Channel][Pattern];
+}
+
+void CPatternData::UpdatePlayLength(int Channel, int Pattern, unsigned int Row)
+{
+	int Old = m_patternPlayLengths[Channel][Pattern];
+	int New = Old;
+	if (RowEndsPattern(Channel, Pattern, Row))
+	{
+		if ((int)Row + 1 < Old)
+			New = Row + 1;
+	}
+	else if ((int)Row + 1 == Old)
+	{
+		// The row ending the pattern was changed, nothing above it does
+		New = ScanPlayLength(Channel, Pattern, Row + 1);
+	}
+
+	if (New != Old)
+	{
+		m_patternPlayLengths[Channel][Pattern] = New;
+		UpdateFrames(Channel, Pattern);
+	}
+}
+
+void CPatternData::UpdateFrames(int Channel, int Pattern)
+{
+	for (int i = 0; i < MAX_FRAMES; i++)
+	{
+		if (m_iFrameList[i][Channel] == Pattern)
+			UpdateFrame(i, Channel);
 	}
-	if (l > m_iPatternLength)
-		return m_iPatternLength;
-	return l;
 }
 
-unsigned int CPatternData::getFramePlayLength(int frame, int channels)
+void CPatternData::UpdateFrame(int Frame, int FirstChannel)
 {
-	unsigned int l = MAX_PATTERN_LENGTH;
-	for (unsigned int i = 0; i < channels; i++)
+	// Channels before FirstChannel are unchanged
+	int l = FirstChannel > 0 ? m_framePlayLengths[Frame][FirstChannel - 1] : MAX_PATTERN_LENGTH;
+	for (int i = FirstChannel; i < MAX_CHANNELS; i++)
 	{
-		unsigned int cl = getPatternPlayLength(i, m_iFrameList[frame][i]);
+		int cl = GetRawPlayLength(i, m_iFrameList[Frame][i]);
 		if (cl < l)
 			l = cl;
+		m_framePlayLengths[Frame][i] = l;
 	}
+}
+
+void CPatternData::ResetFrames()
+{
+	for (int i = 0; i < MAX_FRAMES; i++)
+	{
+		for (int j = 0; j < MAX_CHANNELS; j++)
+			m_framePlayLengths[i][j] = MAX_PATTERN_LENGTH;
+	}
+}
+
+unsigned int CPatternData::getPatternPlayLength(int channel, int pattern) const
+{
+	unsigned int l = GetRawPlayLength(channel, pattern);
+	if (l > m_iPatternLength)
+		return m_iPatternLength;
 	return l;
 }
 
-void CPatternData::AllocatePattern(int Channel, int Pattern)
+unsigned int CPatternData::getFramePlayLength(int frame, int channels) const
 {
-	// Allocate memory
-	m_pPatternData[Channel][Pattern] = new stChanNote[MAX_PATTERN_LENGTH];
-	m_patternPlayLengths[Channel][Pattern] = MAX_PATTERN_LENGTH;
+	int l = channels > 0 ? m_framePlayLengths[frame][channels - 1] : MAX_PATTERN_LENGTH;
+	if ((unsigned int)l > m_iPatternLength)
+		return m_iPatternLength;
+	return l;
+}
 
-	// Clear memory
-	for (int i = 0; i < MAX_PATTERN_LENGTH; i++)
-	{
-		stChanNote *pNote = m_pPatternData[Channel][Pattern] + i;
-		pNote->Note		  = 0;
-		pNote->Octave	  = 0;
-		pNote->Instrument = MAX_INSTRUMENTS;
-		pNote->Vol		  = 0x10;
-		for (int n = 0; n < MAX_EFFECT_COLUMNS; n++)
-		{
-			pNote->EffNumber[n] = 0;
-			pNote->EffParam[n] = 0;
-		}
+void CPatternData::AllocatePattern(int Channel, int Pattern, unsigned int Rows)
+{
+	// Replace the pattern storage with a private copy holding at least
+	// Rows rows, growing it if needed
+	stPatternChunk *pOld = m_pPatternData[Channel][Pattern];
+	unsigned int OldRows = GetStoredRows(Channel, Pattern);
+	unsigned int NewRows = OldRows;
+
+	if (Rows > OldRows)
+	{
+		NewRows = (Rows + ROW_CHUNK - 1) / ROW_CHUNK * ROW_CHUNK;
+		if (NewRows < OldRows * 2)
+			NewRows = OldRows * 2;
+		if (NewRows > MAX_PATTERN_LENGTH)
+			NewRows = MAX_PATTERN_LENGTH;
 	}
+
+	stPatternChunk *pChunk = new stPatternChunk(NewRows);
+
+	if (OldRows > 0)
+		memcpy(pChunk->Notes, pOld->Notes, sizeof(stChanNote) * OldRows);
+	for (unsigned int i = OldRows; i < NewRows; i++)
+		pChunk->Notes[i] = EMPTY_NOTE;
+
+	ReleaseChunk(pOld);
+	m_pPatternData[Channel][Pattern] = pChunk;
+}
+
+unsigned int CPatternData::GetStoredRows(int Channel, int Pattern) const
+{
+	const stPatternChunk *pChunk = m_pPatternData[Channel][Pattern];
+	return pChunk == NULL ? 0 : pChunk->Rows;
 }
 
 void CPatternData::ClearEverything()
@@ -208,14 +383,12 @@ void CPatternData::ClearEverything()
 	{
 		for (int j = 0; j < MAX_PATTERN; j++)
 		{
-			if (m_pPatternData[i][j])
-			{
-				delete [] m_pPatternData[i][j];
-				m_pPatternData[i][j] = NULL;
-			}
-			m_patternPlayLengths[i][j] = -1;
+			ReleaseChunk(m_pPatternData[i][j]);
+			m_pPatternData[i][j] = NULL;
+			m_patternPlayLengths[i][j] = MAX_PATTERN_LENGTH;
 		}
 	}
+	ResetFrames();
 
 	m_iFrameCount = 1;
 }
@@ -223,12 +396,13 @@ void CPatternData::ClearEverything()
 void CPatternData::ClearPattern(int Channel, int Pattern)
 {
 	// Deletes a specified pattern in a channel
-	if (m_pPatternData[Channel][Pattern] != NULL)
+	ReleaseChunk(m_pPatternData[Channel][Pattern]);
+	m_pPatternData[Channel][Pattern] = NULL;
+	if (m_patternPlayLengths[Channel][Pattern] != MAX_PATTERN_LENGTH)
 	{
-		delete[] m_pPatternData[Channel][Pattern];
-		m_pPatternData[Channel][Pattern] = NULL;
+		m_patternPlayLengths[Channel][Pattern] = MAX_PATTERN_LENGTH;
+		UpdateFrames(Channel, Pattern);
 	}
-	m_patternPlayLengths[Channel][Pattern] = -1;
 }
 
 unsigned short CPatternData::GetFramePattern(int Frame, int Channel) const
@@ -238,5 +412,9 @@ unsigned short CPatternData::GetFramePattern(int Frame, int Channel) const
 
 void CPatternData::SetFramePattern(int Frame, int Channel, int Pattern)
 {
+	if (m_iFrameList[Frame][Channel] == Pattern)
+		return;
+
 	m_iFrameList[Frame][Channel] = Pattern;
+	UpdateFrame(Frame, Channel);
 }
@@ -22,6 +22,7 @@
 #pragma once
 
 #include "FamiTrackerTypes.h"
+#include "common.hpp"
 
 // Channel note struct, holds the data for each row in patterns
 struct stChanNote {
@@ -33,30 +34,50 @@ struct stChanNote {
 	unsigned char EffParam[MAX_EFFECT_COLUMNS];
 };
 
+struct stPatternChunk;
+struct stPatternRefs;
+
 // CPatternData holds all notes in the patterns
-class CPatternData {
+class FAMICOREAPI CPatternData {
 public:
 	CPatternData(unsigned int PatternLength, unsigned int Speed, unsigned int Tempo);
+	// The copy shares all pattern storage with the original, a pattern is
+	// only copied when one of them writes to it
+	CPatternData(const CPatternData &other);
 	~CPatternData();
 
-	// None of these are const because accessing an unallocated pattern will allocate it
+	// Tunes are reference counted so document snapshots can share them,
+	// a shared tune must be copied before writing to it
+	void AddRef();
+	void Release();		// Deletes the tune with the last reference
+	bool IsShared() const;
+
+	// Reads never allocate or modify the patterns, any number of threads
+	// may read at once as long as nobody writes
 
-	bool IsCellFree(unsigned int Channel, unsigned int Pattern, unsigned int Row);
-	bool IsPatternEmpty(unsigned int Channel, unsigned int Pattern);
-	bool IsPatternInUse(unsigned int Channel, unsigned int Pattern);
+	bool IsCellFree(unsigned int Channel, unsigned int Pattern, unsigned int Row) const;
+	bool IsPatternEmpty(unsigned int Channel, unsigned int Pattern) const;
+	bool IsPatternInUse(unsigned int Channel, unsigned int Pattern) const;
 
 	int GetEffectColumnCount(int Channel) const
 		{ return m_iEffectColumns[Channel]; }
 
-	void SetEffectColumnCount(int Channel, int Count)
-		{ m_iEffectColumns[Channel] = Count; }
+	void SetEffectColumnCount(int Channel, int Count);
 
 	void ClearEverything();
 	void ClearPattern(int Channel, int Pattern);
 
-	void GetPatternData(int Channel, int Pattern, int Row, stChanNote *note);
+	// Returns the row in place, or a shared empty row when nothing is stored there
+	const stChanNote *GetPatternData(int Channel, int Pattern, int Row) const;
+	void GetPatternData(int Channel, int Pattern, int Row, stChanNote *note) const;
 	void SetPatternData(int Channel, int Pattern, int Row, const stChanNote *note);
 
+	// Rows backed by storage, every row past this reads as empty
+	unsigned int GetStoredRows(int Channel, int Pattern) const;
+	// True while both tunes still use the same storage for a pattern
+	bool SharesPattern(const CPatternData *other, int Channel, int Pattern) const
+		{ return m_pPatternData[Channel][Pattern] == other->m_pPatternData[Channel][Pattern]; }
+
 	unsigned int GetPatternLength() const		{ return m_iPatternLength;	 }
 	unsigned int GetFrameCount() const			{ return m_iFrameCount;		 }
 	unsigned int GetSongSpeed() const			{ return m_iSongSpeed;		 }
@@ -67,22 +88,37 @@ public:
 	void SetSongSpeed(unsigned int Speed)		{ m_iSongSpeed = Speed;		 }
 	void SetSongTempo(unsigned int Tempo)		{ m_iSongTempo = Tempo;		 }
 
-	unsigned int getPatternPlayLength(int channel, int pattern);
-	unsigned int getFramePlayLength(int frame, int channels);
+	// Pattern and frame play lengths are kept up to date by the edits that
+	// can change them, reading one is a lookup that writes nothing
+	unsigned int getPatternPlayLength(int channel, int pattern) const;
+	unsigned int getFramePlayLength(int frame, int channels) const;
 
 	unsigned short GetFramePattern(int Frame, int Channel) const;
 	void SetFramePattern(int Frame, int Channel, int Pattern);
 
 private:
-	void AllocatePattern(int Channel, int Patterns);
-	stChanNote *GetPatternData(int Channel, int Pattern, int Row);
+	void AllocatePattern(int Channel, int Pattern, unsigned int Rows);
+
+	bool RowEndsPattern(int Channel, int Pattern, unsigned int Row) const;
+	int ScanPlayLength(int Channel, int Pattern, unsigned int StartRow) const;
+	int GetRawPlayLength(int Channel, int Pattern) const;
+	void UpdatePlayLength(int Channel, int Pattern, unsigned int Row);
+	void UpdateFrames(int Channel, int Pattern);
+	void UpdateFrame(int Frame, int FirstChannel);
+	void ResetFrames();
+	CPatternData &operator=(const CPatternData &);	// Not implemented
 
 	// Pattern data
 private:
 
 	// List of the patterns assigned to frames
 	unsigned short m_iFrameList[MAX_FRAMES][MAX_CHANNELS];
+	// Play length of every pattern, filled in by the writers. Lengths are
+	// unclamped, the pattern length is applied on lookup
 	int m_patternPlayLengths[MAX_CHANNELS][MAX_PATTERN];
+	// Shortest play length of channels 0 to the second index of every
+	// frame, so a frame lookup is the same for any channel count
+	short m_framePlayLengths[MAX_FRAMES][MAX_CHANNELS];
 
 	unsigned int m_iPatternLength;			// Amount of rows in one pattern
 	unsigned int m_iFrameCount;				// Number of frames
@@ -92,6 +128,10 @@ private:
 	// Number of visible effect columns for each channel
 	unsigned int m_iEffectColumns[MAX_CHANNELS];
 
-	// All accesses to m_pPatternData must go through GetPatternData()
-	stChanNote *m_pPatternData[MAX_CHANNELS][MAX_PATTERN];
+	// Patterns are allocated on first write and only as far down as the
+	// last row written (rounded up). Reads never allocate, unallocated rows
+	// read as a shared empty note. Storage may be shared with copies
+	stPatternChunk *m_pPatternData[MAX_CHANNELS][MAX_PATTERN];
+
+	stPatternRefs *m_pRefs;
 };
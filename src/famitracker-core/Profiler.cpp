@@ -0,0 +1,222 @@
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "Profiler.hpp"
+
+static const char * const CHANNEL_NAMES[CHANNELS] = {
+	"2A03 Pulse 1", "2A03 Pulse 2", "2A03 Triangle", "2A03 Noise", "2A03 DPCM",
+	"VRC6 Pulse 1", "VRC6 Pulse 2", "VRC6 Sawtooth",
+	"MMC5 Pulse 1", "MMC5 Pulse 2", "MMC5 Voice",
+	"N106 1", "N106 2", "N106 3", "N106 4", "N106 5", "N106 6", "N106 7", "N106 8",
+	"FDS",
+	"VRC7 FM 1", "VRC7 FM 2", "VRC7 FM 3", "VRC7 FM 4", "VRC7 FM 5", "VRC7 FM 6",
+	"5B Square 1", "5B Square 2", "5B Square 3"
+};
+
+static const char * const APU_NAMES[Profiler::END_FRAME - Profiler::APU] = {
+	"APU", "APU Pulse", "APU Tri/Noise/DPCM",
+	"APU VRC6", "APU VRC7", "APU FDS", "APU MMC5", "APU N106", "APU 5B"
+};
+
+// Orders sections by their total time, slowest first
+struct _profiler_slower_t
+{
+	const Profiler *profiler;
+	bool operator()(int a, int b) const
+	{
+		return profiler->total(a) > profiler->total(b);
+	}
+};
+
+Profiler::Profiler()
+	: m_nsPerTick(1.0), m_markCost(0), m_csv(NULL), m_csvHeader(false)
+{
+	m_names[ENGINE] = "Engine";
+	m_names[TICK] = "Tracker tick";
+	m_names[NOTES] = "Notes";
+	m_names[EFFECTS] = "Effects";
+	for (int i = 0; i < CHANNELS; i++)
+	{
+		m_names[PROCESS + i] = std::string("Process ") + CHANNEL_NAMES[i];
+		m_names[REFRESH + i] = std::string("Refresh ") + CHANNEL_NAMES[i];
+	}
+	for (int i = APU; i < END_FRAME; i++)
+	{
+		m_names[i] = APU_NAMES[i - APU];
+	}
+	m_names[END_FRAME] = "End frame";
+	m_names[MIXER] = "Mixer";
+	m_names[READOUT] = "Readout";
+
+	calibrate();
+	clear();
+}
+
+void Profiler::calibrate()
+{
+#ifdef PROFILER_TSC
+	// How long a tick is, against the system clock over a few milliseconds
+	core::u64 ns0 = core::monotonic_ns();
+	core::u64 t0 = ticks();
+	core::u64 ns1;
+	do
+	{
+		ns1 = core::monotonic_ns();
+	} while (ns1 - ns0 < 5000000);
+	core::u64 t1 = ticks();
+
+	m_nsPerTick = double(ns1 - ns0) / double(t1 - t0);
+#endif
+
+	// What a mark costs, by making some in a part of their own
+	const int count = 1000;
+	m_frame[ENGINE] = 0;
+	m_stack[0] = ENGINE;
+	m_depth = 0;
+	m_overflow = 0;
+	core::u64 start = m_stamp = ticks();
+	for (int i = 0; i < count; i++)
+	{
+		lap(ENGINE);
+	}
+	m_markCost = double(m_stamp - start) / count;
+}
+
+void Profiler::setCsv(FILE *csv)
+{
+	m_csv = csv;
+	m_csvHeader = false;
+}
+
+void Profiler::clear()
+{
+	memset(m_frame, 0, sizeof(m_frame));
+	memset(m_frameMarks, 0, sizeof(m_frameMarks));
+	memset(m_total, 0, sizeof(m_total));
+	memset(m_peak, 0, sizeof(m_peak));
+	memset(m_calls, 0, sizeof(m_calls));
+
+	m_stack[0] = ENGINE;
+	m_depth = 0;
+	m_overflow = 0;
+	m_stamp = ticks();
+	m_marks = 0;
+
+	m_frames = 0;
+	m_frameTotal = 0;
+	m_framePeak = 0;
+}
+
+void Profiler::beginFrame()
+{
+	memset(m_frame, 0, sizeof(m_frame));
+	memset(m_frameMarks, 0, sizeof(m_frameMarks));
+
+	// The engine is the part the frame starts in
+	m_calls[ENGINE]++;
+	m_stack[0] = ENGINE;
+	m_depth = 0;
+	m_overflow = 0;
+	m_stamp = ticks();
+}
+
+void Profiler::endFrame()
+{
+	core::u64 now = ticks();
+	m_frame[m_stack[m_depth]] += now - m_stamp;
+	m_frameMarks[m_stack[m_depth]]++;
+	m_stamp = now;
+
+	// The frame is the sum of its parts, so it loses the marks with them
+	core::u64 frame = 0;
+	unsigned int marks = 0;
+	for (int i = 0; i < SECTIONS; i++)
+	{
+		m_frame[i] = netTicks(i);
+		frame += m_frame[i];
+		marks += m_frameMarks[i];
+
+		m_total[i] += m_frame[i];
+		if (m_frame[i] > m_peak[i])
+			m_peak[i] = m_frame[i];
+	}
+	m_marks += marks;
+
+	m_frameTotal += frame;
+	if (frame > m_framePeak)
+		m_framePeak = frame;
+
+	if (m_csv != NULL)
+	{
+		if (!m_csvHeader)
+		{
+			writeCsvHeader();
+		}
+
+		fprintf(m_csv, "%llu,%llu", (unsigned long long)m_frames, (unsigned long long)toNs(frame));
+		for (int i = 0; i < SECTIONS; i++)
+		{
+			fprintf(m_csv, ",%llu", (unsigned long long)toNs(m_frame[i]));
+		}
+		fputc('\n', m_csv);
+	}
+
+	m_frames++;
+}
+
+core::u64 Profiler::netTicks(int section) const
+{
+	core::u64 cost = core::u64(m_frameMarks[section] * m_markCost);
+	return m_frame[section] > cost ? m_frame[section] - cost : 0;
+}
+
+void Profiler::writeCsvHeader()
+{
+	fputs("Frame,Total", m_csv);
+	for (int i = 0; i < SECTIONS; i++)
+	{
+		fprintf(m_csv, ",%s", m_names[i].c_str());
+	}
+	fputc('\n', m_csv);
+
+	m_csvHeader = true;
+}
+
+void Profiler::printSummary(FILE *out) const
+{
+	if (m_frames == 0)
+	{
+		fprintf(out, "profile: no frames\n");
+		return;
+	}
+
+	std::vector<int> used;
+	for (int i = 0; i < SECTIONS; i++)
+	{
+		if (m_total[i] > 0)
+			used.push_back(i);
+	}
+
+	_profiler_slower_t slower;
+	slower.profiler = this;
+	std::stable_sort(used.begin(), used.end(), slower);
+
+	fprintf(out, "profile: %llu frames, avg %.2f us, peak %.2f us per frame, after taking off about %.2f us of timing\n",
+			(unsigned long long)m_frames,
+			double(frameTotal()) / m_frames / 1000.0, framePeak() / 1000.0,
+			double(overhead()) / m_frames / 1000.0);
+	fprintf(out, "%-24s %10s %7s %12s %12s %10s\n",
+			"part", "total ms", "share", "avg us/frame", "peak us", "calls");
+
+	for (unsigned int i = 0; i < used.size(); i++)
+	{
+		int s = used[i];
+		fprintf(out, "%-24s %10.3f %6.2f%% %12.3f %12.3f %10llu\n",
+				m_names[s].c_str(),
+				total(s) / 1000000.0,
+				m_frameTotal > 0 ? 100.0 * m_total[s] / m_frameTotal : 0.0,
+				double(total(s)) / m_frames / 1000.0,
+				peak(s) / 1000.0,
+				(unsigned long long)m_calls[s]);
+	}
+}
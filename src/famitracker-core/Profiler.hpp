@@ -0,0 +1,189 @@
+#ifndef _PROFILER_HPP_
+#define _PROFILER_HPP_
+
+#include <stdio.h>
+#include <string>
+#include "core/time.hpp"
+#include "APU/Mixer.h"
+#include "common.hpp"
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#	include <x86intrin.h>
+#	define PROFILER_TSC
+#elif defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#	include <intrin.h>
+#	define PROFILER_TSC
+#endif
+
+// Where the time of each emulated frame goes. While a profiler is given to
+// SoundGen::setProfiler, the engine and the APU mark the parts of a frame
+// with begin and end. Parts nest, a part is only charged the time spent
+// outside the parts inside it, so the parts of a frame add up to the frame.
+// What reading the clock is estimated to cost is taken off every part it
+// was charged to. With no profiler set, marking a part costs a pointer test.
+// A profiler is meant for one engine and is not locked, read the results
+// once the engine has stopped
+class FAMICOREAPI Profiler
+{
+public:
+	enum
+	{
+		ENGINE,										// Whatever is not in another part
+		TICK,										// TrackerController::tick
+		NOTES,										// Handing new notes to the channels
+		EFFECTS,									// CChannelState::UpdateEffects
+		PROCESS,									// ProcessChannel, one per channel ID
+		REFRESH = PROCESS + CHANNELS,				// RefreshChannel, one per channel ID
+		APU = REFRESH + CHANNELS,					// CAPU::Process outside the chips
+		APU_PULSE,									// Both pulse channels, they are run together
+		APU_TND,									// Triangle, noise and DPCM, run together
+		APU_VRC6,
+		APU_VRC7,
+		APU_FDS,
+		APU_MMC5,
+		APU_N106,
+		APU_S5B,
+		END_FRAME,									// EndFrame of the chips
+		MIXER,										// Finishing the blip buffer
+		READOUT,									// Reading samples out of the mixer
+		SECTIONS
+	};
+
+	Profiler();
+
+	// Writes a row of nanoseconds per part for every frame to csv, starting
+	// with a header. NULL stops writing
+	void setCsv(FILE *csv);
+
+	void beginFrame();
+	void endFrame();
+
+	inline void begin(int section);
+	inline void end();
+	// Charges the time since the last mark to section. For parts run back
+	// to back thousands of times a frame, where begin and end would take
+	// longer than the parts themselves
+	inline void lap(int section);
+
+	// Forgets everything measured so far
+	void clear();
+
+	// The parts that were used, slowest first
+	void printSummary(FILE *out) const;
+
+	core::u64 frames() const{ return m_frames; }
+	// In nanoseconds
+	core::u64 frameTotal() const{ return toNs(m_frameTotal); }
+	core::u64 framePeak() const{ return toNs(m_framePeak); }
+	core::u64 total(int section) const{ return toNs(m_total[section]); }
+	core::u64 peak(int section) const{ return toNs(m_peak[section]); }
+	core::u64 calls(int section) const{ return m_calls[section]; }
+	const char * name(int section) const{ return m_names[section].c_str(); }
+	// What reading the clock for the marks is estimated to have added, this
+	// is already taken off the times above
+	core::u64 overhead() const{ return toNs(core::u64(m_marks * m_markCost)); }
+private:
+	static const int STACK_DEPTH = 8;
+
+	// The time stamp counter where there is one, it is much cheaper to read
+	static inline core::u64 ticks()
+	{
+#ifdef PROFILER_TSC
+		return __rdtsc();
+#else
+		return core::monotonic_ns();
+#endif
+	}
+	core::u64 toNs(core::u64 t) const{ return core::u64(t * m_nsPerTick); }
+
+	void calibrate();
+	// The ticks of section this frame, less the marks charged to it
+	core::u64 netTicks(int section) const;
+	void writeCsvHeader();
+
+	std::string m_names[SECTIONS];
+	double m_nsPerTick;
+	double m_markCost;								// In ticks
+
+	// In ticks
+	core::u64 m_frame[SECTIONS];
+	unsigned int m_frameMarks[SECTIONS];		// Clock readings charged to m_frame
+	core::u64 m_total[SECTIONS];
+	core::u64 m_peak[SECTIONS];
+	core::u64 m_calls[SECTIONS];
+
+	int m_stack[STACK_DEPTH];
+	int m_depth;
+	int m_overflow;
+	core::u64 m_stamp;
+	core::u64 m_marks;
+
+	core::u64 m_frames;
+	core::u64 m_frameTotal;
+	core::u64 m_framePeak;
+
+	FILE * m_csv;
+	bool m_csvHeader;
+};
+
+inline void Profiler::begin(int section)
+{
+	if (m_depth + 1 >= STACK_DEPTH)
+	{
+		m_overflow++;
+		return;
+	}
+
+	core::u64 now = ticks();
+	m_frame[m_stack[m_depth]] += now - m_stamp;
+	m_frameMarks[m_stack[m_depth]]++;
+	m_stack[++m_depth] = section;
+	m_calls[section]++;
+	m_stamp = now;
+}
+
+inline void Profiler::end()
+{
+	if (m_overflow > 0)
+	{
+		m_overflow--;
+		return;
+	}
+
+	core::u64 now = ticks();
+	m_frame[m_stack[m_depth]] += now - m_stamp;
+	m_frameMarks[m_stack[m_depth]]++;
+	if (m_depth > 0)
+		m_depth--;
+	m_stamp = now;
+}
+
+inline void Profiler::lap(int section)
+{
+	core::u64 now = ticks();
+	m_frame[section] += now - m_stamp;
+	m_frameMarks[section]++;
+	m_calls[section]++;
+	m_stamp = now;
+}
+
+// Marks a part of the frame until the end of the block, if profiling
+class ProfileScope
+{
+public:
+	ProfileScope(Profiler *profiler, int section)
+		: m_profiler(profiler)
+	{
+		if (m_profiler != NULL)
+			m_profiler->begin(section);
+	}
+	~ProfileScope()
+	{
+		if (m_profiler != NULL)
+			m_profiler->end();
+	}
+private:
+	Profiler * m_profiler;
+};
+
+#endif
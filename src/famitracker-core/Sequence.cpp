@@ -19,9 +19,17 @@
 */
 
 #include <string.h>
+#include <boost/detail/atomic_count.hpp>
 #include "Sequence.h"
 #include "Document.hpp"
 
+unsigned int fami_nextEditVersion()
+{
+	// Instruments and sequences are edited from any thread
+	static boost::detail::atomic_count version(0);
+	return (unsigned int)++version;
+}
+
 CSequence::CSequence()
 {
 	Clear();
@@ -37,18 +45,25 @@ void CSequence::Clear()
 	memset(m_cValues, 0, sizeof(char) * MAX_SEQUENCE_ITEMS);
 
 	m_iPlaying = -1;
+	m_bDirty = true;
+	m_bCompiled = false;
+	m_iEditVersion = fami_nextEditVersion();
 }
 
 void CSequence::SetItem(int Index, signed char Value)
 {
 	ftkr_Assert(Index <= MAX_SEQUENCE_ITEMS);
 	m_cValues[Index] = Value;
+	m_bDirty = true;
+	m_iEditVersion = fami_nextEditVersion();
 }
 
 void CSequence::SetItemCount(unsigned int Count)
 {
 	ftkr_Assert(Count <= MAX_SEQUENCE_ITEMS);
 	m_iItemCount = Count;
+	m_bDirty = true;
+	m_iEditVersion = fami_nextEditVersion();
 }
 
 void CSequence::SetLoopPoint(unsigned int Point)
@@ -57,6 +72,8 @@ void CSequence::SetLoopPoint(unsigned int Point)
 	// Loop point cannot be beyond release point (at the moment)
 	if (m_iLoopPoint >= m_iReleasePoint)
 		m_iLoopPoint = -1;
+	m_bDirty = true;
+	m_iEditVersion = fami_nextEditVersion();
 }
 
 void CSequence::SetReleasePoint(unsigned int Point)
@@ -65,11 +82,14 @@ void CSequence::SetReleasePoint(unsigned int Point)
 	// Loop point cannot be beyond release point (at the moment)
 	if (m_iLoopPoint >= m_iReleasePoint)
 		m_iLoopPoint = -1;
+	m_bDirty = true;
+	m_iEditVersion = fami_nextEditVersion();
 }
 
 void CSequence::SetSetting(unsigned int Setting)
 {
 	m_iSetting = Setting;
+	m_iEditVersion = fami_nextEditVersion();
 }
 
 signed char CSequence::GetItem(int Index) const
@@ -98,6 +118,11 @@ unsigned int CSequence::GetSetting() const
 	return m_iSetting;
 }
 
+unsigned int CSequence::GetEditVersion() const
+{
+	return m_iEditVersion;
+}
+
 void CSequence::SetPlayPos(int Position)
 {
 	m_iPlaying = Position;
@@ -120,4 +145,96 @@ void CSequence::Copy(const CSequence *pSeq)
 	m_iSetting = pSeq->m_iSetting;
 
 	memcpy(m_cValues, pSeq->m_cValues, MAX_SEQUENCE_ITEMS);
+	m_iEditVersion = pSeq->m_iEditVersion;
+
+	// Copies go into snapshots, which are shared and may be played from
+	// any thread, so nothing is left to compile on the first run
+	Compile();
+}
+
+signed char CSequence::RunInterpreted(int &Pointer, bool Released, bool &End) const
+{
+	int Value = GetItem(Pointer);
+
+	Pointer++;
+
+	int Release = GetReleasePoint();
+	int Items = GetItemCount();
+	int Loop = GetLoopPoint();
+
+	End = false;
+
+	if (Pointer == (Release + 1) || Pointer == Items)
+	{
+		// End point reached
+		if (Loop != -1 && !(Released && Release != -1))
+		{
+			Pointer = Loop;
+		}
+		else {
+			if (Pointer == Items)
+			{
+				// End of sequence
+				End = true;
+			}
+			else if (!Released)
+				// Waiting for release
+				Pointer--;
+		}
+	}
+
+	return Value;
+}
+
+signed char CSequence::Run(int &Pointer, bool Released, bool &End)
+{
+	if (m_bDirty)
+		Compile();
+
+	// Positions outside the sequence are left to the interpreter
+	if (!m_bCompiled || Pointer < 0 || Pointer >= (int)m_iItemCount)
+		return RunInterpreted(Pointer, Released, End);
+
+	const stStep &Step = m_Steps[Pointer];
+	int r = Released ? 1 : 0;
+
+	Pointer = Step.Next[r];
+	End = (Step.End & (1 << r)) != 0;
+
+	return Step.Value;
+}
+
+void CSequence::Compile()
+{
+	// Resolve where playback goes after each item, so that running the
+	// sequence is a single table lookup
+
+	m_bDirty = false;
+	m_bCompiled = false;
+
+	int Loop = GetLoopPoint();
+	int Release = GetReleasePoint();
+
+	// Points beyond the steps can only come from broken files
+	if (m_iItemCount > MAX_SEQUENCE_ITEMS || Loop < -1 || Loop > 0xFF || Release < -1 || Release > 0xFF)
+		return;
+
+	for (int i = 0; i < (int)m_iItemCount; i++)
+	{
+		stStep &Step = m_Steps[i];
+		Step.Value = m_cValues[i];
+		Step.End = 0;
+
+		for (int r = 0; r < 2; r++)
+		{
+			int Pointer = i;
+			bool End;
+			RunInterpreted(Pointer, r != 0, End);
+			Step.Next[r] = Pointer;
+			if (End)
+				Step.End |= 1 << r;
+		}
+	}
+
+	m_bCompiled = true;
 }
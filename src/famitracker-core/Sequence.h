@@ -25,6 +25,9 @@
 
 class CDocumentFile;
 
+// Every call returns a new edit version for an instrument or sequence
+FAMICOREAPI unsigned int fami_nextEditVersion();
+
 /*
 ** This class is used to store instrument sequences
 */
@@ -45,6 +48,9 @@ public:
 	void		 SetReleasePoint(unsigned int Point);
 	void		 SetSetting(unsigned int Setting);
 
+	// Changes with every edit, a copy has the version of the original
+	unsigned int GetEditVersion() const;
+
 	//void		 Store(CDocumentFile *pDocFile, int Index, int Type);
  
 	void		 Copy(const CSequence *pSeq);
@@ -53,16 +59,39 @@ public:
 	void		 SetPlayPos(int pos);
 	int			 GetPlayPos();
 
+	// Playback. Returns the item at Pointer and moves Pointer to the item
+	// played next, End is set when the sequence has finished
+	signed char	 Run(int &Pointer, bool Released, bool &End);
+	// The same without the compiled steps
+	signed char	 RunInterpreted(int &Pointer, bool Released, bool &End) const;
+
+private:
+	void		 Compile();
+
+	// An item with the position that follows it resolved, both before and
+	// after the note is released
+	struct stStep
+	{
+		signed char		Value;
+		unsigned char	Next[2];
+		unsigned char	End;			// Bit 0 or 1, the sequence ends after this item
+	};
+
 private:
 	// Sequence data
 	unsigned int m_iItemCount;
 	unsigned int m_iLoopPoint;
 	unsigned int m_iReleasePoint;
 	unsigned int m_iSetting;
+	unsigned int m_iEditVersion;
 //	unsigned int m_iItemCountRelease;
 	signed char	 m_cValues[MAX_SEQUENCE_ITEMS];
 	// Used by instrument editor
 	int			 m_iPlaying;
+	// Compiled playback steps, rebuilt after any change
+	stStep		 m_Steps[MAX_SEQUENCE_ITEMS];
+	bool		 m_bDirty;
+	bool		 m_bCompiled;				// False if the points do not fit the steps
 };
 
 // Settings
@@ -1,6 +1,5 @@
 #include <stdlib.h>
 #include <stdio.h>
-#include <cmath>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/condition.hpp>
 #include "SoundGen.hpp"
@@ -11,26 +10,54 @@
 #include "TrackerController.hpp"
 
 #include "ChannelHandler.h"
+#include "ChannelGroup.h"
+#include "ChannelState.h"
 #include "Channels2A03.h"
 #include "ChannelsFDS.h"
 #include "ChannelsMMC5.h"
 #include "ChannelsVRC6.h"
 #include "ChannelsVRC7.h"
+#include "Profiler.hpp"
 
 #include "App.hpp"
 #include "core/time.hpp"
-
-// The depth of each vibrato level
-static const double NEW_VIBRATO_DEPTH[] = {
-	1.0, 1.5, 2.5, 4.0, 5.0, 7.0, 10.0, 12.0, 14.0, 17.0, 22.0, 30.0, 44.0, 64.0, 96.0, 128.0
+#include "core/trace.hpp"
+
+// Note and vibrato tables are the same for every engine. They are worked out
+// by note-tables-gen when building and shared read-only, only the frame rate
+// dependent values are set up per document
+struct _soundgen_tables_t
+{
+	unsigned int noteNTSC[NOTE_COUNT];		// For 2A03
+	unsigned int notePAL[NOTE_COUNT];		// For 2A07
+	unsigned int noteSaw[NOTE_COUNT];		// For VRC6 sawtooth
+	unsigned int noteFDS[NOTE_COUNT];		// For FDS
+	unsigned int noteN106[NOTE_COUNT];		// For N106
+	unsigned int noteS5B[NOTE_COUNT];		// For sunsoft
+	int vibratoNew[VIBRATO_LENGTH];
+	int vibratoOld[VIBRATO_LENGTH];
 };
 
-static const double OLD_VIBRATO_DEPTH[] = {
-	1.0, 1.0, 2.0, 3.0, 4.0, 7.0, 8.0, 15.0, 16.0, 31.0, 32.0, 63.0, 64.0, 127.0, 128.0, 255.0
-};
+#include "NoteTables.inc"
 
 static const int rowframes_size = 60*8;
 
+// Cycles between the update of each channel
+static const int CHANNEL_DELAY = 250;
+
+// The chip and channel count of each channel group
+static const struct
+{
+	int chip;
+	int channels;
+} _soundgen_groups[] = {
+	{SNDCHIP_NONE, CHANID_DPCM - CHANID_SQUARE1 + 1},
+	{SNDCHIP_VRC6, CHANID_VRC6_SAWTOOTH - CHANID_VRC6_PULSE1 + 1},
+	{SNDCHIP_MMC5, CHANID_MMC5_SQUARE2 - CHANID_MMC5_SQUARE1 + 1},
+	{SNDCHIP_FDS, 1},
+	{SNDCHIP_VRC7, CHANID_VRC7_CH6 - CHANID_VRC7_CH1 + 1}
+};
+
 struct _soundgen_threading_t
 {
 	boost::mutex mtx_running;
@@ -41,32 +68,47 @@ struct _soundgen_threading_t
 };
 
 SoundGen::SoundGen()
-	: m_iConsumedCycles(0), m_pDocument(NULL),
-	  m_trackerUpdateCallback(NULL), m_sink(NULL),
-	  m_volumes_ring(NULL),
+	: m_volumes_ring(NULL), m_pDocument(NULL),
+	  m_trackerUpdateCallback(NULL), m_profiler(NULL), m_sink(NULL),
 	  m_trackerActive(false),
+	  m_sinkStopSamples(0),
 	  m_timer_trackerActive(false),
-	  m_iMachineType(NTSC)
+	  m_iConsumedCycles(0), m_iChannelDelay(0),
+	  m_pNoteLookupTable(tables.noteNTSC), m_pVibratoTable(tables.vibratoNew),
+	  m_iMachineType(NTSC),
+	  m_iSoundSampleRate(0), m_iSoundMachine(-1)
 {
 	m_samplemem = new CSampleMem;
 	m_apu = new CAPU(m_samplemem);
 	m_queued_rowframes = new core::RingBuffer(sizeof(rowframe_t));
 	m_queued_sound = new core::RingBuffer(sizeof(core::s16));
 	m_threading = new _soundgen_threading_t;
+	m_pChannelState = new CChannelState;
 	// Create all kinds of channels
 	createChannels();
+	for (int i = 0; i < CHIP_GROUPS; i++)
+	{
+		m_chipGroups[i] = NULL;
+	}
+	m_channelGroups.reserve(CHIP_GROUPS);
 
 	m_trackerctlr = new TrackerController;
 
 	m_queued_rowframes->resize(rowframes_size);
 	m_queued_sound->resize(16384);
 	m_apu->SetCallback(apuCallback, this);
+
+	// sized for any document, so starting playback never allocates
+	m_volumes_size = rowframes_size;
+	m_volumes_read_offset = 0;
+	m_volumes_write_offset = 0;
+	m_volumes_ring = new core::u8[m_volumes_size * MAX_CHANNELS];
+	memset(m_volumes_ring, 0, m_volumes_size * MAX_CHANNELS);
 }
 
 SoundGen::~SoundGen()
 {
-	if (m_volumes_ring != NULL)
-		delete[] m_volumes_ring;
+	delete[] m_volumes_ring;
 
 	delete m_trackerctlr;
 
@@ -79,6 +121,11 @@ SoundGen::~SoundGen()
 		if (m_pTrackerChannels[i] != NULL)
 			delete m_pTrackerChannels[i];
 	}
+	for (int i = 0; i < CHIP_GROUPS; i++)
+	{
+		delete m_chipGroups[i];
+	}
+	delete m_pChannelState;
 	delete m_threading;
 	delete m_queued_sound;
 	delete m_queued_rowframes;
@@ -93,24 +140,123 @@ void SoundGen::setSoundSink(core::SoundSink *s)
 		m_sink->setPlaying(false);
 		m_sink->blockUntilTimerEmpty();
 	}
-	m_queued_sound->clear();
 	m_queued_rowframes->clear();
 	m_sink = s;
+	if (m_sink == NULL)
+		return;
+
 	m_sink->setCallbackData(this);
 	m_sink->setSoundCallback(soundCallback);
+	m_sink->setSoundCallbackFloat(soundCallbackFloat);
 	m_sink->setTimeCallback(timeCallback);
+
+	// queue sound in the format the sink pulls
+	core::Quantity elementSize = sizeof(core::s16);
+	if (m_sink->isFloat())
+	{
+		int outputs = m_sink->outputCount();
+		m_apu->SetFloatCallback(apuCallbackFloat, this, outputs);
+		elementSize = sizeof(float) * outputs;
+	}
+	else
+	{
+		m_apu->SetFloatCallback(NULL, NULL, 1);
+		m_apu->SetCallback(apuCallback, this);
+	}
+
+	if (m_queued_sound->elementSize() != elementSize)
+	{
+		delete m_queued_sound;
+		m_queued_sound = new core::RingBuffer(elementSize);
+		m_queued_sound->resize(16384);
+	}
+	else
+	{
+		m_queued_sound->clear();
+	}
+}
+
+void SoundGen::setProfiler(Profiler *profiler)
+{
+	m_threading->mtx_running.lock();
+
+	m_profiler = profiler;
+	m_apu->SetProfiler(profiler);
+
+	m_threading->mtx_running.unlock();
 }
 
 void SoundGen::setDocument(FtmDocument *doc)
 {
 	m_threading->mtx_running.lock();
 
+	loadDocument(doc, false);
+
+	m_threading->mtx_running.unlock();
+}
+
+void SoundGen::reset(FtmDocument *doc)
+{
+	m_threading->mtx_running.lock();
+
+	// Drop whatever the last document was playing, nothing is faded out
+	m_trackerActive = false;
+	m_bPlayerHalted = false;
+	m_sinkStopSamples = 0;
+
+	m_queued_sound->clear();
+
+	m_threading->mtx_rowframes.lock();
+	m_queued_rowframes->clear();
+	m_threading->mtx_rowframes.unlock();
+
+	m_volumes_read_offset = 0;
+	m_volumes_write_offset = 0;
+	memset(m_volumes_ring, 0, m_volumes_size * MAX_CHANNELS);
+
+	{
+		boost::lock_guard<boost::mutex> lock(m_threading->mtx_tracker);
+		m_timer_trackerActive = false;
+		m_threading->cond_trackerhalt.notify_all();
+	}
+
+	m_pChannelState->Reset();
+
+	for (int i = 0; i < CHANNELS; i++)
+	{
+		if (m_pChannels[i] != NULL)
+		{
+			m_pChannels[i]->ResetChannel();
+			m_pTrackerChannels[i]->Reset();
+		}
+	}
+
+	m_trackerctlr->reset();
+
+	loadDocument(doc, true);
+
+	m_threading->mtx_running.unlock();
+}
+
+void SoundGen::loadDocument(FtmDocument *doc, bool reuseSound)
+{
 	m_pDocument = doc;
 
-	generateVibratoTable(doc->GetVibratoStyle());
+	selectVibratoTable(doc->GetVibratoStyle());
+
+	// A pooled engine is reset from a known state, where the sound buffers
+	// only change with the sample rate and machine and the APU reset below
+	// clears them. Otherwise they are set up afresh
+	int sampleRate = m_sink->sampleRate();
+	int machine = doc->GetMachine();
+	if (!reuseSound || sampleRate != m_iSoundSampleRate || machine != m_iSoundMachine)
+	{
+		m_apu->SetupSound(sampleRate, 1, machine);
+		m_iSoundSampleRate = sampleRate;
+		m_iSoundMachine = machine;
+	}
 
 	// TODO - dan: load settings
-	m_apu->SetupSound(m_sink->sampleRate(), 1, doc->GetMachine());
 	m_apu->SetupMixer(16, 12000, 24, 100);
 
 	loadMachineSettings(doc->GetMachine(), doc->GetEngineSpeed());
@@ -131,8 +277,6 @@ void SoundGen::setDocument(FtmDocument *doc)
 	m_trackerctlr->initialize(doc, m_pActiveTrackerChannels);
 
 	setupChannels();
-
-	m_threading->mtx_running.unlock();
 }
 
 void SoundGen::loadMachineSettings(int machine, int rate)
@@ -144,10 +288,6 @@ void SoundGen::loadMachineSettings(int machine, int rate)
 	// Rate = frame rate (0 means machine default)
 	//
 
-	const double BASE_FREQ = 32.7032;
-	double freq;
-	double pitch;
-
 	int BaseFreq	= (machine == NTSC) ? CAPU::BASE_FREQ_NTSC  : CAPU::BASE_FREQ_PAL;
 	int DefaultRate = (machine == NTSC) ? CAPU::FRAME_RATE_NTSC : CAPU::FRAME_RATE_PAL;
 
@@ -159,55 +299,13 @@ void SoundGen::loadMachineSettings(int machine, int rate)
 	if (rate == 0)
 		rate = DefaultRate;
 
-	double clock_ntsc = CAPU::BASE_FREQ_NTSC / 16.0;
-	double clock_pal = CAPU::BASE_FREQ_PAL / 16.0;
-
-	for (int i = 0; i < NOTE_COUNT; i++)
-	{
-		// Frequency (in Hz)
-		freq = BASE_FREQ * pow(2.0, double(i) / 12.0);
-
-		// 2A07
-		pitch = (clock_pal / freq) - 0.5;
-		m_iNoteLookupTablePAL[i] = (unsigned int)pitch;
-
-		// 2A03 / MMC5 / VRC6
-		pitch = (clock_ntsc / freq) - 0.5;
-		m_iNoteLookupTableNTSC[i] = (unsigned int)pitch;
-
-		// VRC6 Saw
-		pitch = ((clock_ntsc * 16.0) / (freq * 14.0)) - 0.5;
-		m_iNoteLookupTableSaw[i] = (unsigned int)pitch;
-
-		// FDS
-#ifdef TRANSPOSE_FDS
-		Pitch = (Freq * 65536.0) / (clock_ntsc / 2.0) + 0.5;
-#else
-		pitch = (freq * 65536.0) / (clock_ntsc / 4.0) + 0.5;
-#endif
-		m_iNoteLookupTableFDS[i] = (unsigned int)pitch;
-		// N106
-		int C = 7; // channels
-		int L = 0; // waveform length
-
-//		Pitch = (3019898880.0 * Freq) / 21477272.7272;
-		pitch = (1509949440.0 * freq) / 21477272.7272;
-
-		//Pitch = (double(0x40000 * 45 * (C + 1) * (8 - L) * 4) * Freq) / (21477272.7272);
-		//Pitch = (double(0x40000 * 45 * 8 * 8 * 4) * Freq) / (21477272.7272);
-
-//		Period = (uint32)(((((ChannelsActive + 1) * 45 * 0x40000) / (float)21477270) * (float)CAPU::BASE_FREQ_NTSC) / m_iFrequency);
-		//Pitch =
-		m_iNoteLookupTableN106[i] = (unsigned int)pitch;
-		// Sunsoft 5B
-		pitch = (clock_ntsc / freq) - 0.5;
-		m_iNoteLookupTableS5B[i] = (unsigned int)pitch;
-	}
+	// Channels are updated some cycles apart, except at custom rates
+	m_iChannelDelay = (rate == CAPU::FRAME_RATE_NTSC || rate == CAPU::FRAME_RATE_PAL) ? CHANNEL_DELAY : 0;
 
 	if (machine == NTSC)
-		m_pNoteLookupTable = m_iNoteLookupTableNTSC;
+		m_pNoteLookupTable = tables.noteNTSC;
 	else
-		m_pNoteLookupTable = m_iNoteLookupTablePAL;
+		m_pNoteLookupTable = tables.notePAL;
 
 	// Number of cycles between each APU update
 	m_iUpdateCycles = BaseFreq / rate;
@@ -218,48 +316,30 @@ void SoundGen::loadMachineSettings(int machine, int rate)
 	m_pChannels[CHANID_TRIANGLE]->SetNoteTable(m_pNoteLookupTable);
 
 	// TODO - dan
-	m_pChannels[CHANID_VRC6_PULSE1]->SetNoteTable(m_iNoteLookupTableNTSC);
-	m_pChannels[CHANID_VRC6_PULSE2]->SetNoteTable(m_iNoteLookupTableNTSC);
-	m_pChannels[CHANID_VRC6_SAWTOOTH]->SetNoteTable(m_iNoteLookupTableSaw);
-	m_pChannels[CHANID_MMC5_SQUARE1]->SetNoteTable(m_iNoteLookupTableNTSC);
-	m_pChannels[CHANID_MMC5_SQUARE2]->SetNoteTable(m_iNoteLookupTableNTSC);
-	m_pChannels[CHANID_FDS]->SetNoteTable(m_iNoteLookupTableFDS);
+	m_pChannels[CHANID_VRC6_PULSE1]->SetNoteTable(tables.noteNTSC);
+	m_pChannels[CHANID_VRC6_PULSE2]->SetNoteTable(tables.noteNTSC);
+	m_pChannels[CHANID_VRC6_SAWTOOTH]->SetNoteTable(tables.noteSaw);
+	m_pChannels[CHANID_MMC5_SQUARE1]->SetNoteTable(tables.noteNTSC);
+	m_pChannels[CHANID_MMC5_SQUARE2]->SetNoteTable(tables.noteNTSC);
+	m_pChannels[CHANID_FDS]->SetNoteTable(tables.noteFDS);
 
-/*	m_pChannels[CHANID_N106_CHAN1]->SetNoteTable(m_iNoteLookupTableN106);
-	m_pChannels[CHANID_N106_CHAN2]->SetNoteTable(m_iNoteLookupTableN106);
-	m_pChannels[CHANID_N106_CHAN3]->SetNoteTable(m_iNoteLookupTableN106);
-	m_pChannels[CHANID_N106_CHAN4]->SetNoteTable(m_iNoteLookupTableN106);
-	m_pChannels[CHANID_N106_CHAN5]->SetNoteTable(m_iNoteLookupTableN106);
-	m_pChannels[CHANID_N106_CHAN6]->SetNoteTable(m_iNoteLookupTableN106);
-	m_pChannels[CHANID_N106_CHAN7]->SetNoteTable(m_iNoteLookupTableN106);
-	m_pChannels[CHANID_N106_CHAN8]->SetNoteTable(m_iNoteLookupTableN106);
+/*	m_pChannels[CHANID_N106_CHAN1]->SetNoteTable(tables.noteN106);
+	m_pChannels[CHANID_N106_CHAN2]->SetNoteTable(tables.noteN106);
+	m_pChannels[CHANID_N106_CHAN3]->SetNoteTable(tables.noteN106);
+	m_pChannels[CHANID_N106_CHAN4]->SetNoteTable(tables.noteN106);
+	m_pChannels[CHANID_N106_CHAN5]->SetNoteTable(tables.noteN106);
+	m_pChannels[CHANID_N106_CHAN6]->SetNoteTable(tables.noteN106);
+	m_pChannels[CHANID_N106_CHAN7]->SetNoteTable(tables.noteN106);
+	m_pChannels[CHANID_N106_CHAN8]->SetNoteTable(tables.noteN106);
 
-	m_pChannels[CHANID_S5B_CH1]->SetNoteTable(m_iNoteLookupTableS5B);
-	m_pChannels[CHANID_S5B_CH2]->SetNoteTable(m_iNoteLookupTableS5B);
-	m_pChannels[CHANID_S5B_CH3]->SetNoteTable(m_iNoteLookupTableS5B);*/
+	m_pChannels[CHANID_S5B_CH1]->SetNoteTable(tables.noteS5B);
+	m_pChannels[CHANID_S5B_CH2]->SetNoteTable(tables.noteS5B);
+	m_pChannels[CHANID_S5B_CH3]->SetNoteTable(tables.noteS5B);*/
 }
 
-void SoundGen::generateVibratoTable(int type)
+void SoundGen::selectVibratoTable(int type)
 {
-	for (int i = 0; i < 16; i++)	// depth
-	{
-		for (int j = 0; j < 16; j++)	// phase
-		{
-			int value = 0;
-			double angle = (double(j) / 16.0) * (3.1415 / 2.0);
-
-			if (type == VIBRATO_NEW)
-			{
-				value = int(std::sin(angle) * NEW_VIBRATO_DEPTH[i] /*+ 0.5*/);
-			}
-			else
-			{
-				value = (int)((double(j * OLD_VIBRATO_DEPTH[i]) / 16.0) + 1);
-			}
-
-			m_iVibratoTable[i * 16 + j] = value;
-		}
-	}
+	m_pVibratoTable = (type == VIBRATO_NEW) ? tables.vibratoNew : tables.vibratoOld;
 }
 
 void SoundGen::resetTempo()
@@ -309,12 +389,10 @@ void SoundGen::createChannels()
 	assignChannel(CHANID_FDS, new CChannelHandlerFDS(this));
 
 	// Konami VRC7
-	assignChannel(CHANID_VRC7_CH1, new CVRC7Channel(this));
-	assignChannel(CHANID_VRC7_CH2, new CVRC7Channel(this));
-	assignChannel(CHANID_VRC7_CH3, new CVRC7Channel(this));
-	assignChannel(CHANID_VRC7_CH4, new CVRC7Channel(this));
-	assignChannel(CHANID_VRC7_CH5, new CVRC7Channel(this));
-	assignChannel(CHANID_VRC7_CH6, new CVRC7Channel(this));
+	for (int i = CHANID_VRC7_CH1; i <= CHANID_VRC7_CH6; i++)
+	{
+		assignChannel(i, new CVRC7Channel(this));
+	}
 
 	// TODO - dan
 /*
@@ -335,15 +413,124 @@ void SoundGen::createChannels()
 */
 }
 
+CChannelGroup * SoundGen::chipGroup(int group)
+{
+	// Made the first time a document uses the chip, and kept for the next
+	if (m_chipGroups[group] != NULL)
+		return m_chipGroups[group];
+
+	switch (group)
+	{
+	case GROUP_2A03:
+		{
+			CChannelGroupT<CSquare1Chan, CSquare2Chan, CTriangleChan, CNoiseChan, CDPCMChan> *g =
+				new CChannelGroupT<CSquare1Chan, CSquare2Chan, CTriangleChan, CNoiseChan, CDPCMChan>(SNDCHIP_NONE);
+			g->Add(static_cast<CSquare1Chan*>(m_pChannels[CHANID_SQUARE1]));
+			g->Add(static_cast<CSquare2Chan*>(m_pChannels[CHANID_SQUARE2]));
+			g->Add(static_cast<CTriangleChan*>(m_pChannels[CHANID_TRIANGLE]));
+			g->Add(static_cast<CNoiseChan*>(m_pChannels[CHANID_NOISE]));
+			g->Add(static_cast<CDPCMChan*>(m_pChannels[CHANID_DPCM]));
+			m_chipGroups[group] = g;
+		}
+		break;
+	case GROUP_VRC6:
+		{
+			CChannelGroupT<CVRC6Square1, CVRC6Square2, CVRC6Sawtooth> *g =
+				new CChannelGroupT<CVRC6Square1, CVRC6Square2, CVRC6Sawtooth>(SNDCHIP_VRC6);
+			g->Add(static_cast<CVRC6Square1*>(m_pChannels[CHANID_VRC6_PULSE1]));
+			g->Add(static_cast<CVRC6Square2*>(m_pChannels[CHANID_VRC6_PULSE2]));
+			g->Add(static_cast<CVRC6Sawtooth*>(m_pChannels[CHANID_VRC6_SAWTOOTH]));
+			m_chipGroups[group] = g;
+		}
+		break;
+	case GROUP_MMC5:
+		{
+			CChannelGroupT<CMMC5Square1Chan, CMMC5Square2Chan> *g =
+				new CChannelGroupT<CMMC5Square1Chan, CMMC5Square2Chan>(SNDCHIP_MMC5);
+			g->Add(static_cast<CMMC5Square1Chan*>(m_pChannels[CHANID_MMC5_SQUARE1]));
+			g->Add(static_cast<CMMC5Square2Chan*>(m_pChannels[CHANID_MMC5_SQUARE2]));
+			m_chipGroups[group] = g;
+		}
+		break;
+	case GROUP_FDS:
+		{
+			CChannelGroupT<CChannelHandlerFDS> *g = new CChannelGroupT<CChannelHandlerFDS>(SNDCHIP_FDS);
+			g->Add(static_cast<CChannelHandlerFDS*>(m_pChannels[CHANID_FDS]));
+			m_chipGroups[group] = g;
+		}
+		break;
+	case GROUP_VRC7:
+		{
+			CChannelGroupT<CVRC7Channel> *g = new CChannelGroupT<CVRC7Channel>(SNDCHIP_VRC7);
+			for (int i = CHANID_VRC7_CH1; i <= CHANID_VRC7_CH6; i++)
+			{
+				g->Add(static_cast<CVRC7Channel*>(m_pChannels[i]));
+			}
+			m_chipGroups[group] = g;
+		}
+		break;
+	}
+
+	return m_chipGroups[group];
+}
+
+void SoundGen::selectGroups()
+{
+	// One group for each chip the document uses. The channels of the other
+	// chips are left out, only their time slots are kept by the group
+	// before them. The 2A03 is always used, so there is one
+
+	unsigned char chip = m_pDocument->GetExpansionChip();
+
+	m_channelGroups.clear();
+
+	CChannelGroup *last = NULL;
+	int idle = 0;
+	for (int i = 0; i < CHIP_GROUPS; i++)
+	{
+		if (i != GROUP_2A03 && (chip & _soundgen_groups[i].chip) == 0)
+		{
+			idle += _soundgen_groups[i].channels;
+			continue;
+		}
+
+		if (last != NULL)
+			last->SetIdleChannels(idle);
+
+		last = chipGroup(i);
+		idle = 0;
+		m_channelGroups.push_back(last);
+	}
+	last->SetIdleChannels(idle);
+}
+
 void SoundGen::setupChannels()
 {
+	selectGroups();
+
 	// Initialize channels
 	for (int i = 0; i < CHANNELS; i++)
 	{
 		if (m_pChannels[i] != NULL)
 		{
-			m_pChannels[i]->InitChannel(m_apu, m_iVibratoTable, m_pDocument);
-			m_pChannels[i]->SetVibratoStyle(m_pDocument->GetVibratoStyle());
+			m_pChannels[i]->InitChannel(m_apu, m_pVibratoTable, m_pDocument);
+		}
+	}
+
+	resetChannels();
+}
+
+void SoundGen::resetChannels()
+{
+	// Silence channels before playback, channels are already initialized for the document
+	int style = m_pDocument->GetVibratoStyle();
+
+	for (int i = 0; i < CHANNELS; i++)
+	{
+		if (m_pChannels[i] != NULL)
+		{
+			m_pChannels[i]->SetVibratoStyle(style);
+			m_pChannels[i]->ResetPlayState();
 			m_pChannels[i]->MakeSilent();
 		}
 	}
@@ -387,6 +574,7 @@ void SoundGen::runFrame()
 {
 	if (m_trackerActive)
 	{
+		ProfileScope scope(m_profiler, Profiler::TICK);
 		m_trackerctlr->tick();
 	}
 }
@@ -420,6 +608,13 @@ void SoundGen::haltSounds()
 
 void SoundGen::requestFrame()
 {
+	core::TraceScope trace("requestFrame");
+
+	if (m_profiler != NULL)
+	{
+		m_profiler->beginFrame();
+	}
+
 	runFrame();
 
 	if (m_trackerActive)
@@ -427,49 +622,59 @@ void SoundGen::requestFrame()
 		m_bPlayerHalted = m_trackerctlr->isHalted();
 	}
 
-	for (int i = 0; i < CHANNELS; i++)
 	{
-		if (m_pChannels[i] == NULL)
-			continue;
+		ProfileScope scope(m_profiler, Profiler::NOTES);
 
-		if (m_pTrackerChannels[i]->NewNoteData())
+		for (int i = 0; i < CHANNELS; i++)
 		{
-			stChanNote note = m_pTrackerChannels[i]->GetNote();
+			if (m_pChannels[i] == NULL)
+				continue;
 
-			playNote(i, &note, m_pDocument->GetEffColumns(i) + 1);
-		}
+			if (m_pTrackerChannels[i]->NewNoteData())
+			{
+				stChanNote note = m_pTrackerChannels[i]->GetNote();
 
-		// Pitch wheel
-		int pitch = m_pTrackerChannels[i]->GetPitch();
-		m_pChannels[i]->SetPitch(pitch);
+				playNote(i, &note, m_pDocument->GetEffColumns(i) + 1);
+			}
 
-		// Update volume meters
-		m_pTrackerChannels[i]->SetVolumeMeter(m_apu->GetVol(i));
-	}
+			// Pitch wheel
+			int pitch = m_pTrackerChannels[i]->GetPitch();
+			m_pChannels[i]->SetPitch(pitch);
 
-	const int CHANNEL_DELAY = 250;
+			// Update volume meters
+			m_pTrackerChannels[i]->SetVolumeMeter(m_apu->GetVol(i));
+		}
+	}
 
 	m_iConsumedCycles = 0;
 
-	int frameRate = m_pDocument->GetFrameRate();
+	// Effects that only depend on the channel's own state, for all channels at once
+	{
+		ProfileScope scope(m_profiler, Profiler::EFFECTS);
+		m_pChannelState->UpdateEffects(m_pDocument->GetLinearPitch());
+	}
 
 	// Update channels and channel registers
-	for (int i = 0; i < CHANNELS; i++)
 	{
-		if (m_pChannels[i] != NULL)
+		core::TraceScope trace("update channels");
+
+		for (unsigned int i = 0; i < m_channelGroups.size(); i++)
 		{
-			m_pChannels[i]->ProcessChannel();
-			m_pChannels[i]->RefreshChannel();
-			m_apu->Process();
-			// Add some delay between each channel update
-			if (frameRate == CAPU::FRAME_RATE_NTSC || frameRate == CAPU::FRAME_RATE_PAL)
-				addCycles(CHANNEL_DELAY);
+			m_iConsumedCycles += m_channelGroups[i]->Update(m_apu, m_iChannelDelay, m_profiler);
 		}
 	}
 
 	// Finish the audio frame
-	m_apu->AddTime(m_iUpdateCycles - m_iConsumedCycles);
-	m_apu->Process();
+	{
+		core::TraceScope trace("APU");
+		m_apu->AddTime(m_iUpdateCycles - m_iConsumedCycles);
+		m_apu->Process();
+	}
+
+	if (m_profiler != NULL)
+	{
+		m_profiler->endFrame();
+	}
 }
 
 void SoundGen::apuCallback(const int16 *buf, uint32 sz, void *data)
@@ -478,22 +683,38 @@ void SoundGen::apuCallback(const int16 *buf, uint32 sz, void *data)
 	sg->m_queued_sound->write(buf, sz);
 }
 
+void SoundGen::apuCallbackFloat(const float *buf, uint32 sz, void *data)
+{
+	SoundGen *sg = (SoundGen*)data;
+	sg->m_queued_sound->write(buf, sz);
+}
+
 core::u32 SoundGen::soundCallback(core::s16 *buf, core::u32 sz, void *data, core::u32 *idx)
 {
 	SoundGen *sg = (SoundGen*)data;
 	return sg->requestSound(buf, sz, idx);
 }
 
-core::u32 SoundGen::requestSound(core::s16 *buf, core::u32 sz, core::u32 *idx)
+core::u32 SoundGen::soundCallbackFloat(float *buf, core::u32 sz, void *data, core::u32 *idx)
 {
+	SoundGen *sg = (SoundGen*)data;
+	return sg->requestSound(buf, sz, idx);
+}
+
+core::u32 SoundGen::requestSound(void *buffer, core::u32 sz, core::u32 *idx)
+{
+	core::TraceScope trace("requestSound");
+
 	const core::u32 original_sz = sz;
+	const core::Quantity stride = m_queued_sound->elementSize();
+	core::byte *buf = (core::byte*)buffer;
 	core::u32 c = 0;
 	core::u32 off = 0;
 	// read remaining sound buffer data from the last callback
 	if (!m_queued_sound->isEmpty())
 	{
 		core::Quantity read = m_queued_sound->read(buf, sz);
-		buf += read;
+		buf += read * stride;
 		sz -= read;
 		off += read;
 	}
@@ -505,7 +726,7 @@ core::u32 SoundGen::requestSound(core::s16 *buf, core::u32 sz, core::u32 *idx)
 	/*	if (!m_bRunning)
 		{
 			// silence the rest of the buffer
-			memset(buf, 0, sz*sizeof(core::s16));
+			memset(buf, 0, sz*stride);
 		}*/
 		requestFrame();
 		bool haltsignal = m_bPlayerHalted && m_trackerActive;
@@ -538,7 +759,7 @@ core::u32 SoundGen::requestSound(core::s16 *buf, core::u32 sz, core::u32 *idx)
 		}
 
 		core::Quantity read = m_queued_sound->read(buf, sz);
-		buf += read;
+		buf += read * stride;
 		sz -= read;
 		off += read;
 	}
@@ -566,7 +787,7 @@ core::u32 SoundGen::requestSound(core::s16 *buf, core::u32 sz, core::u32 *idx)
 
 const core::u8 *SoundGen::readVolume()
 {
-	const core::u8 *ptr = m_volumes_ring + m_volumes_read_offset * m_channels;
+	const core::u8 *ptr = m_volumes_ring + m_volumes_read_offset * MAX_CHANNELS;
 
 	m_volumes_read_offset++;
 	m_volumes_read_offset %= m_volumes_size;
@@ -576,7 +797,7 @@ const core::u8 *SoundGen::readVolume()
 const core::u8 * SoundGen::writeVolume(const core::u8 *arr)
 {
 	unsigned int sz = sizeof(core::u8)*m_channels;
-	core::u8 *ptr = m_volumes_ring + m_volumes_write_offset * m_channels;
+	core::u8 *ptr = m_volumes_ring + m_volumes_write_offset * MAX_CHANNELS;
 	memcpy(ptr, arr, sz);
 
 	m_volumes_write_offset++;
@@ -589,6 +810,8 @@ void SoundGen::timeCallback(core::u32 skip, void *data)
 {
 	SoundGen *sg = (SoundGen*)data;
 
+	core::TraceScope trace("timeCallback");
+
 	sg->m_threading->mtx_rowframes.lock();
 	if (skip > 1)
 	{
@@ -598,6 +821,7 @@ void SoundGen::timeCallback(core::u32 skip, void *data)
 	if (sg->m_queued_rowframes->read(&rf, 1) != 1)
 	{
 		sg->m_threading->mtx_rowframes.unlock();
+		core::Trace::instant("rowframe underrun");
 		fprintf(stderr, "SoundGen::timeCallback(): ringbuffer underrun\n");
 		// uh oh
 		return;
@@ -635,20 +859,21 @@ void SoundGen::startPlayback()
 
 	m_pDocument->lock();
 	m_channels = m_pDocument->GetAvailableChannels();
-
-	m_volumes_size = rowframes_size;
-	m_volumes_read_offset = 0;
-	m_volumes_write_offset = 0;
-	if (m_volumes_ring != NULL)
-		delete[] m_volumes_ring;
-	m_volumes_ring = new core::u8[m_volumes_size * m_channels];
-
 	m_pDocument->unlock();
 
-	setupChannels();
+	// the volumes ring keeps going across sessions. rows have a fixed
+	// stride, so volumes still queued from the last session stay valid
+
+	resetChannels();
 	resetTempo();
 
-	m_sink->blockUntilTimerEmpty();
+	// a sink still playing the tail of the last session (eg. when
+	// auditioning notes in a row) keeps its queued row updates instead
+	// of stalling the restart until the timer has caught up
+	if (!m_sink->isPlaying())
+	{
+		m_sink->blockUntilTimerEmpty();
+	}
 }
 void SoundGen::stopPlayback()
 {
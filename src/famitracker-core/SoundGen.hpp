@@ -2,6 +2,7 @@
 #define _SOUND_HPP_
 
 #include "APU/APU.h"
+#include <vector>
 #include "core/soundsink.hpp"
 #include "FamiTrackerTypes.h"
 #include "common.hpp"
@@ -17,8 +18,11 @@ class CDSample;
 struct stChanNote;
 class CTrackerChannel;
 class CChannelHandler;
+class CChannelGroup;
+class CChannelState;
 class FtmDocument;
 class TrackerController;
+class Profiler;
 
 const int VIBRATO_LENGTH = 256;
 const int TREMOLO_LENGTH = 256;
@@ -44,24 +48,35 @@ public:
 	SoundGen();
 	~SoundGen();
 
+	// NULL detaches the engine from its sink
 	void setSoundSink(core::SoundSink *s);
 
 	void setDocument(FtmDocument *doc);
+	// Back to power-on with doc loaded, as if the engine had just been
+	// created and given doc. Keeps everything allocated, playback of the
+	// last document stops at once
+	void reset(FtmDocument *doc);
 	TrackerController * trackerController() const{ return m_trackerctlr; }
+	// The emulated chips, for register contents and write counts
+	const CAPU * apu() const{ return m_apu; }
+	// Times every part of each frame into profiler from the next frame on,
+	// NULL stops. The profiler must outlive its use here
+	void setProfiler(Profiler *profiler);
 	void setTrackerUpdate(trackerupdate_f f, void *data=NULL){ m_trackerUpdateCallback = f; m_trackerUpdateData = data; }
 
 	// Multiple times initialization
 	void loadMachineSettings(int machine, int rate);
 
 	// Vibrato
-	void generateVibratoTable(int type);
-	int readVibratoTable(int index) const{ return m_iVibratoTable[index]; }
+	void selectVibratoTable(int type);
+	int readVibratoTable(int index) const{ return m_pVibratoTable[index]; }
 
 	// Player interface
 	void resetTempo();
 
 	// Used by channels
 	void addCycles(int count);
+	CChannelState * channelState() const{ return m_pChannelState; }
 
 	void startTracker();
 	void stopTracker();
@@ -74,7 +89,9 @@ public:
 
 private:
 	static void apuCallback(const int16 *buf, uint32 sz, void *data);
+	static void apuCallbackFloat(const float *buf, uint32 sz, void *data);
 	static core::u32 soundCallback(core::s16 *buf, core::u32 sz, void *data, core::u32 *idx);
+	static core::u32 soundCallbackFloat(float *buf, core::u32 sz, void *data, core::u32 *idx);
 	static void timeCallback(core::u32 skip, void *data);
 
 	void startPlayback();
@@ -83,7 +100,8 @@ private:
 	void requestFrame();
 	// requestSound is not guaranteed to be (and typically isn't) called at a constant rate.
 	// for example, just because the engine speed may be 60Hz doesn't mean this gets called at 60Hz.
-	core::u32 requestSound(core::s16 *buf, core::u32 sz, core::u32 *idx);
+	// buf holds sz frames in the sample format of m_queued_sound
+	core::u32 requestSound(void *buf, core::u32 sz, core::u32 *idx);
 
 	core::RingBuffer *m_queued_rowframes;
 	core::RingBuffer *m_queued_sound;
@@ -94,10 +112,27 @@ private:
 	const core::u8 * readVolume();
 	const core::u8 * writeVolume(const core::u8 *arr);
 
+	// Channel groups in channel order, one per chip
+	enum
+	{
+		GROUP_2A03,
+		GROUP_VRC6,
+		GROUP_MMC5,
+		GROUP_FDS,
+		GROUP_VRC7,
+		CHIP_GROUPS
+	};
+
 	// Internal initialization
+	// reuseSound keeps the sound buffers when the sample rate and machine
+	// are unchanged, for reset() only
+	void loadDocument(FtmDocument *doc, bool reuseSound);
 	void createChannels();
 	void setupChannels();
+	void resetChannels();
 	void assignChannel(int id, CChannelHandler *renderer);
+	CChannelGroup * chipGroup(int group);
+	void selectGroups();
 	void resetAPU();
 
 	// Player
@@ -116,6 +151,10 @@ private:
 	CChannelHandler * m_pChannels[CHANNELS];
 	CTrackerChannel * m_pTrackerChannels[CHANNELS];
 	CTrackerChannel * m_pActiveTrackerChannels[CHANNELS];
+	CChannelGroup * m_chipGroups[CHIP_GROUPS];		// made on first use, see GROUP_2A03
+	std::vector<CChannelGroup*> m_channelGroups;	// in channel order, for the document's chips
+	CChannelState * m_pChannelState;
+	Profiler * m_profiler;
 private:
 
 	// Sound
@@ -141,18 +180,16 @@ private:
 	int					m_iUpdateCycles;					// Number of cycles/APU update
 
 	int					m_iConsumedCycles;					// Cycles consumed by the update registers functions
+	int					m_iChannelDelay;					// Cycles between the update of each channel
 
-	unsigned int		*m_pNoteLookupTable;				// NTSC or PAL
-	unsigned int		m_iNoteLookupTableNTSC[96];			// For 2A03
-	unsigned int		m_iNoteLookupTablePAL[96];			// For 2A07
-	unsigned int		m_iNoteLookupTableSaw[96];			// For VRC6 sawtooth
-	unsigned int		m_iNoteLookupTableFDS[96];			// For FDS
-	unsigned int		m_iNoteLookupTableN106[96];			// For N106
-	unsigned int		m_iNoteLookupTableS5B[96];			// For sunsoft
-	int					m_iVibratoTable[VIBRATO_LENGTH];
+	const unsigned int	*m_pNoteLookupTable;				// NTSC or PAL, shared by all engines
+	const int			*m_pVibratoTable;					// Shared by all engines
 
 	unsigned int		m_iMachineType;						// NTSC/PAL
 
+	int					m_iSoundSampleRate;					// What the APU sound buffers were set up for
+	int					m_iSoundMachine;
+
 	// Rendering
 	RENDER_END			m_iRenderEndWhen;
 	int					m_iRenderEndParam;
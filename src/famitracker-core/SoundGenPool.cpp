@@ -0,0 +1,80 @@
+#include <boost/thread/mutex.hpp>
+#include "SoundGenPool.hpp"
+#include "SoundGen.hpp"
+
+struct _soundgenpool_threading_t
+{
+	boost::mutex mtx_idle;
+};
+
+SoundGenPool::SoundGenPool(unsigned int maxIdle)
+	: m_maxIdle(maxIdle)
+{
+	m_threading = new _soundgenpool_threading_t;
+	m_idle.reserve(maxIdle);
+}
+
+SoundGenPool::~SoundGenPool()
+{
+	for (unsigned int i = 0; i < m_idle.size(); i++)
+	{
+		delete m_idle[i];
+	}
+	delete m_threading;
+}
+
+SoundGen * SoundGenPool::acquire(FtmDocument *doc, core::SoundSink *sink)
+{
+	SoundGen *sg = NULL;
+
+	m_threading->mtx_idle.lock();
+	if (!m_idle.empty())
+	{
+		sg = m_idle.back();
+		m_idle.pop_back();
+	}
+	m_threading->mtx_idle.unlock();
+
+	if (sg == NULL)
+	{
+		sg = new SoundGen;
+		sg->setSoundSink(sink);
+		sg->setDocument(doc);
+		return sg;
+	}
+
+	sg->setSoundSink(sink);
+	sg->reset(doc);
+
+	return sg;
+}
+
+void SoundGenPool::release(SoundGen *sg)
+{
+	if (sg == NULL)
+		return;
+
+	sg->setSoundSink(NULL);
+
+	m_threading->mtx_idle.lock();
+	bool keep = m_idle.size() < m_maxIdle;
+	if (keep)
+	{
+		m_idle.push_back(sg);
+	}
+	m_threading->mtx_idle.unlock();
+
+	if (!keep)
+	{
+		delete sg;
+	}
+}
+
+unsigned int SoundGenPool::idleCount() const
+{
+	m_threading->mtx_idle.lock();
+	unsigned int count = m_idle.size();
+	m_threading->mtx_idle.unlock();
+
+	return count;
+}
@@ -0,0 +1,41 @@
+#ifndef _SOUNDGENPOOL_HPP_
+#define _SOUNDGENPOOL_HPP_
+
+#include <vector>
+#include "common.hpp"
+
+namespace core
+{
+	class SoundSink;
+}
+
+class SoundGen;
+class FtmDocument;
+
+struct _soundgenpool_threading_t;
+
+// Sound engines kept between uses. Creating a SoundGen allocates the whole
+// emulation, an engine from the pool is only reset to power-on for the next
+// document. The pool can be used from several threads at once
+class FAMICOREAPI SoundGenPool
+{
+public:
+	// At most maxIdle engines are kept while nobody uses them
+	SoundGenPool(unsigned int maxIdle=4);
+	~SoundGenPool();
+
+	// An engine attached to sink, in the same state as a new engine given
+	// doc. It belongs to the caller until it is released
+	SoundGen * acquire(FtmDocument *doc, core::SoundSink *sink);
+	// Hands an engine back. Its sink must not call it anymore, the engine
+	// is detached from the sink before this returns
+	void release(SoundGen *sg);
+
+	unsigned int idleCount() const;
+private:
+	_soundgenpool_threading_t * m_threading;
+	std::vector<SoundGen*> m_idle;
+	unsigned int m_maxIdle;
+};
+
+#endif
@@ -183,6 +183,15 @@ void TrackerController::initialize(FtmDocument *doc, CTrackerChannel * const * t
 	}
 }
 
+void TrackerController::reset()
+{
+	// Nothing of the play position carries over to the next document
+	m_frame = m_row = 0;
+	m_jumpFrame = m_jumpRow = 0;
+	m_elapsedFrames = 0;
+	m_halted = true;
+}
+
 void TrackerController::setMuted(int channel_offset, bool mute)
 {
 	if (mute && !m_muted[channel_offset])
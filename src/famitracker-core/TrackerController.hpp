@@ -22,6 +22,8 @@ public:
 	void setTempo(unsigned int tempo, unsigned int speed);
 
 	void initialize(FtmDocument *doc, CTrackerChannel * const * trackerChannels);
+	// Back to the play position of a new controller, for SoundGen::reset
+	void reset();
 
 	unsigned int frame() const{ return m_frame; }
 	unsigned int row() const{ return m_row; }
@@ -0,0 +1,67 @@
+#include "UndoHistory.hpp"
+#include "FtmDocument.hpp"
+
+UndoHistory::UndoHistory(FtmDocument *doc, unsigned int depth)
+	: m_document(doc), m_depth(depth)
+{
+}
+
+UndoHistory::~UndoHistory()
+{
+	clear();
+}
+
+void UndoHistory::clearStack(std::deque<FtmDocument*> &stack)
+{
+	for (unsigned int i = 0; i < stack.size(); i++)
+		delete stack[i];
+	stack.clear();
+}
+
+void UndoHistory::checkpoint()
+{
+	clearStack(m_redo);
+
+	if (m_depth == 0)
+		return;
+
+	FtmDocument *base = m_undo.empty() ? NULL : m_undo.back();
+	m_undo.push_back(m_document->snapshot(base));
+	if (m_undo.size() > m_depth)
+	{
+		delete m_undo.front();
+		m_undo.pop_front();
+	}
+}
+
+void UndoHistory::clear()
+{
+	clearStack(m_undo);
+	clearStack(m_redo);
+}
+
+bool UndoHistory::step(std::deque<FtmDocument*> &from, std::deque<FtmDocument*> &to)
+{
+	if (from.empty())
+		return false;
+
+	// The document is one edit away from the step it goes to
+	FtmDocument *snap = from.back();
+	to.push_back(m_document->snapshot(snap));
+	from.pop_back();
+
+	m_document->restore(snap);
+	delete snap;
+
+	return true;
+}
+
+bool UndoHistory::undo()
+{
+	return step(m_undo, m_redo);
+}
+
+bool UndoHistory::redo()
+{
+	return step(m_redo, m_undo);
+}
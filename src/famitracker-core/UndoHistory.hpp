@@ -0,0 +1,37 @@
+#ifndef _UNDOHISTORY_HPP_
+#define _UNDOHISTORY_HPP_
+
+#include <deque>
+#include "common.hpp"
+
+class FtmDocument;
+
+// Undo and redo built on document snapshots. Call checkpoint() before
+// each edit. Each step shares the tracks, instruments and sequences it
+// did not change with the step before it, and only the last depth steps
+// are kept
+class FAMICOREAPI UndoHistory
+{
+public:
+	UndoHistory(FtmDocument *doc, unsigned int depth = 64);
+	~UndoHistory();
+
+	void checkpoint();
+	// Call after the document was replaced, by loading a file for example
+	void clear();
+
+	bool canUndo() const{ return !m_undo.empty(); }
+	bool canRedo() const{ return !m_redo.empty(); }
+	bool undo();
+	bool redo();
+private:
+	static void clearStack(std::deque<FtmDocument*> &stack);
+	// Moves the document to the last step of from, saving it in to
+	bool step(std::deque<FtmDocument*> &from, std::deque<FtmDocument*> &to);
+
+	FtmDocument * m_document;
+	unsigned int m_depth;
+	std::deque<FtmDocument*> m_undo, m_redo;
+};
+
+#endif
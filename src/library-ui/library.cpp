@@ -0,0 +1,523 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <boost/crc.hpp>
+#include "library.hpp"
+#include "core/io.hpp"
+#include "core/threadpool.hpp"
+#include "famitracker-core/App.hpp"
+#include "famitracker-core/FtmDocument.hpp"
+
+#ifdef WINDOWS
+#	include <windows.h>
+#else
+#	include <sys/types.h>
+#	include <sys/stat.h>
+#	include <dirent.h>
+#	include <time.h>
+#endif
+
+static const char INDEX_MAGIC[8] = {'F', 'T', 'M', 'I', 'N', 'D', 'E', 'X'};
+static const unsigned int INDEX_VERSION = 2;
+
+// File systems with coarse time stamps (FAT keeps two seconds) can give a
+// file written after a scan started a time from before it
+#ifdef WINDOWS
+static const core::s64 MTIME_SLACK = 20000000;		// 100ns FILETIME units
+#else
+static const core::s64 MTIME_SLACK = 2000000000;	// nanoseconds
+#endif
+
+static bool entryLess(const LibraryEntry &a, const LibraryEntry &b)
+{
+	return a.path < b.path;
+}
+
+// Finding files
+
+// Now, on the clock of the file time stamps
+static core::s64 fileTimeNow()
+{
+#ifdef WINDOWS
+	FILETIME ft;
+	GetSystemTimeAsFileTime(&ft);
+	return ((core::s64)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (core::s64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+struct _library_file
+{
+	std::string path;
+	core::s64 mtime;
+	core::u64 size;
+
+	bool operator<(const _library_file &o) const{ return path < o.path; }
+};
+
+static bool isModule(const char *name)
+{
+	const char *ext = strrchr(name, '.');
+	return ext != NULL && C_strcasecmp(ext, ".ftm") == 0;
+}
+
+#ifdef WINDOWS
+static void listModules(const std::string &dir, std::vector<_library_file> &files)
+{
+	WIN32_FIND_DATAA fd;
+	HANDLE h = FindFirstFileA((dir + "/*").c_str(), &fd);
+	if (h == INVALID_HANDLE_VALUE)
+		return;
+
+	do
+	{
+		if (strcmp(fd.cFileName, ".") == 0 || strcmp(fd.cFileName, "..") == 0)
+			continue;
+
+		std::string path = dir + "/" + fd.cFileName;
+		if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+		{
+			if (!(fd.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+				listModules(path, files);
+		}
+		else if (isModule(fd.cFileName))
+		{
+			_library_file f;
+			f.path = path;
+			f.mtime = ((core::s64)fd.ftLastWriteTime.dwHighDateTime << 32) | fd.ftLastWriteTime.dwLowDateTime;
+			f.size = ((core::u64)fd.nFileSizeHigh << 32) | fd.nFileSizeLow;
+			files.push_back(f);
+		}
+	}
+	while (FindNextFileA(h, &fd));
+
+	FindClose(h);
+}
+#else
+static void listModules(const std::string &dir, std::vector<_library_file> &files)
+{
+	DIR *d = opendir(dir.c_str());
+	if (d == NULL)
+		return;
+
+	struct dirent *e;
+	while ((e = readdir(d)) != NULL)
+	{
+		if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0)
+			continue;
+
+		std::string path = dir + "/" + e->d_name;
+
+		// Linked directories are not followed, they could form a loop
+		struct stat st;
+		if (lstat(path.c_str(), &st) != 0)
+			continue;
+		if (S_ISDIR(st.st_mode))
+		{
+			listModules(path, files);
+			continue;
+		}
+		if (!isModule(e->d_name))
+			continue;
+		if (S_ISLNK(st.st_mode) && stat(path.c_str(), &st) != 0)
+			continue;
+		if (!S_ISREG(st.st_mode))
+			continue;
+
+		_library_file f;
+		f.path = path;
+#ifdef __APPLE__
+		f.mtime = (core::s64)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+		f.mtime = (core::s64)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+		f.size = st.st_size;
+		files.push_back(f);
+	}
+
+	closedir(d);
+}
+#endif
+
+// Parsing
+
+static unsigned int estimateLength(const LibraryTrack &t, unsigned int frameRate)
+{
+	core::u64 ticks = (core::u64)t.frames * t.rows * t.speed;
+
+	// A row lasts speed * 2.5 / tempo seconds, or speed ticks without tempo
+	if (t.tempo > 0)
+		return ticks * 2500 / t.tempo;
+	if (frameRate > 0)
+		return ticks * 1000 / frameRate;
+	return 0;
+}
+
+static void readEntry(LibraryEntry &e, FtmDocument &doc)
+{
+	e.title = doc.GetSongName();
+	e.artist = doc.GetSongArtist();
+	e.copyright = doc.GetSongCopyright();
+	e.chip = doc.GetExpansionChip();
+	e.machine = doc.GetMachine();
+	e.frameRate = doc.GetFrameRate();
+
+	e.tracks.resize(doc.GetTrackCount());
+	for (unsigned int i = 0; i < e.tracks.size(); i++)
+	{
+		LibraryTrack &t = e.tracks[i];
+		t.title = doc.GetTrackTitle(i);
+		t.frames = doc.GetFrameCount(i);
+		t.rows = doc.GetPatternLength(i);
+		t.speed = doc.GetSongSpeed(i);
+		t.tempo = doc.GetSongTempo(i);
+		t.lengthMs = estimateLength(t, e.frameRate);
+	}
+
+	e.instruments.clear();
+	for (int i = 0; i < MAX_INSTRUMENTS; i++)
+	{
+		if (!doc.IsInstrumentUsed(i))
+			continue;
+
+		char name[256];
+		doc.GetInstrumentName(i, name, sizeof(name));
+
+		LibraryInstrument inst;
+		inst.index = i;
+		inst.name = name;
+		e.instruments.push_back(inst);
+	}
+}
+
+struct _library_job
+{
+	LibraryEntry *entry;			// path, mtime and size are filled in
+	const LibraryEntry *previous;	// last indexed state of the file, or NULL
+	bool reused;
+};
+
+static void scanJob(unsigned int i, void *data)
+{
+	_library_job &job = ((_library_job*)data)[i];
+	LibraryEntry &e = *job.entry;
+	e.valid = false;
+	e.crc = 0;
+	job.reused = false;
+
+	core::MappedIO io(e.path.c_str());
+	if (!io.isReadable())
+		return;
+
+	const void *p = io.map(io.size());
+	if (p == NULL)
+		return;
+
+	boost::crc_32_type crc;
+	crc.process_bytes(p, io.size());
+	e.crc = crc.checksum();
+
+	// Touched but not changed
+	const LibraryEntry *prev = job.previous;
+	if (prev != NULL && prev->size == e.size && prev->crc == e.crc)
+	{
+		core::s64 mtime = e.mtime;
+		core::s64 checked = e.checked;
+		e = *prev;
+		e.mtime = mtime;
+		e.checked = checked;
+		job.reused = true;
+		return;
+	}
+
+	io.seek(0, core::IO_SEEK_SET);
+	try
+	{
+		FtmDocument doc;
+		doc.readSummary(&io);
+		readEntry(e, doc);
+		e.valid = true;
+	}
+	catch (...)
+	{
+	}
+}
+
+Library::ScanStats Library::scan(const std::string &dir, unsigned int maxThreads)
+{
+	ScanStats stats;
+	memset(&stats, 0, sizeof(stats));
+
+	std::string root = dir;
+	while (root.size() > 1 && (root[root.size()-1] == '/' || root[root.size()-1] == '\\'))
+		root.erase(root.size()-1);
+	std::string prefix = root + "/";
+
+	core::s64 start = fileTimeNow();
+	std::vector<_library_file> files;
+	listModules(root, files);
+	std::sort(files.begin(), files.end());
+	stats.files = files.size();
+
+	// Entries from other directories are kept as they are
+	std::vector<LibraryEntry> updated;
+	updated.reserve(m_entries.size() + files.size());
+	for (unsigned int i = 0; i < m_entries.size(); i++)
+	{
+		if (m_entries[i].path.compare(0, prefix.size(), prefix) != 0)
+			updated.push_back(m_entries[i]);
+		else
+			stats.removed++;
+	}
+
+	std::vector<unsigned int> jobIndex;
+	std::vector<const LibraryEntry*> jobPrevious;
+	for (unsigned int i = 0; i < files.size(); i++)
+	{
+		const _library_file &f = files[i];
+
+		LibraryEntry key;
+		key.path = f.path;
+		std::vector<LibraryEntry>::const_iterator it =
+			std::lower_bound(m_entries.begin(), m_entries.end(), key, entryLess);
+		const LibraryEntry *prev = (it != m_entries.end() && it->path == f.path) ? &*it : NULL;
+		if (prev != NULL)
+			stats.removed--;
+
+		// A file stamped after the last look could have been written again
+		// within the same tick, so its time stamp proves nothing
+		if (prev != NULL && prev->mtime == f.mtime && prev->size == f.size
+			&& f.mtime < prev->checked - MTIME_SLACK)
+		{
+			updated.push_back(*prev);
+			updated.back().checked = start;
+			stats.unchanged++;
+			continue;
+		}
+
+		LibraryEntry e;
+		e.path = f.path;
+		e.mtime = f.mtime;
+		e.size = f.size;
+		e.checked = start;
+		jobIndex.push_back(updated.size());
+		jobPrevious.push_back(prev);
+		updated.push_back(e);
+	}
+
+	std::vector<_library_job> jobs(jobIndex.size());
+	for (unsigned int i = 0; i < jobs.size(); i++)
+	{
+		jobs[i].entry = &updated[jobIndex[i]];
+		jobs[i].previous = jobPrevious[i];
+		jobs[i].reused = false;
+	}
+
+	if (!jobs.empty())
+	{
+		// Set up shared state before the workers need it
+		app::channelMap();
+		core::threadpool::parallelFor(jobs.size(), scanJob, &jobs[0], maxThreads);
+	}
+
+	for (unsigned int i = 0; i < jobs.size(); i++)
+	{
+		if (jobs[i].reused)
+			stats.unchanged++;
+		else if (jobs[i].entry->valid)
+			stats.parsed++;
+		else
+			stats.failed++;
+	}
+
+	std::sort(updated.begin(), updated.end(), entryLess);
+	m_entries.swap(updated);
+
+	return stats;
+}
+
+// Index file, all numbers little endian
+
+static void putInt(std::vector<char> &out, core::u64 v, unsigned int bytes)
+{
+	for (unsigned int i = 0; i < bytes; i++)
+		out.push_back((char)(v >> (i*8)));
+}
+
+static void putString(std::vector<char> &out, const std::string &s)
+{
+	unsigned int len = std::min<unsigned int>(s.size(), 0xFFFF);
+	putInt(out, len, 2);
+	out.insert(out.end(), s.begin(), s.begin() + len);
+}
+
+struct _library_reader
+{
+	const unsigned char *p;
+	const unsigned char *end;
+	bool ok;
+
+	core::u64 getInt(unsigned int bytes)
+	{
+		if (!ok || (unsigned int)(end - p) < bytes)
+		{
+			ok = false;
+			return 0;
+		}
+
+		core::u64 v = 0;
+		for (unsigned int i = 0; i < bytes; i++)
+			v |= (core::u64)p[i] << (i*8);
+		p += bytes;
+		return v;
+	}
+	std::string getString()
+	{
+		unsigned int len = getInt(2);
+		if (!ok || (unsigned int)(end - p) < len)
+		{
+			ok = false;
+			return std::string();
+		}
+
+		std::string s((const char*)p, len);
+		p += len;
+		return s;
+	}
+};
+
+bool Library::save(const std::string &indexPath) const
+{
+	std::vector<char> out;
+	out.insert(out.end(), INDEX_MAGIC, INDEX_MAGIC + sizeof(INDEX_MAGIC));
+	putInt(out, INDEX_VERSION, 4);
+	putInt(out, m_entries.size(), 4);
+
+	for (unsigned int i = 0; i < m_entries.size(); i++)
+	{
+		const LibraryEntry &e = m_entries[i];
+		putString(out, e.path);
+		putInt(out, e.mtime, 8);
+		putInt(out, e.size, 8);
+		putInt(out, e.checked, 8);
+		putInt(out, e.crc, 4);
+		putInt(out, e.valid, 1);
+		if (!e.valid)
+			continue;
+
+		putString(out, e.title);
+		putString(out, e.artist);
+		putString(out, e.copyright);
+		putInt(out, e.chip, 1);
+		putInt(out, e.machine, 1);
+		putInt(out, e.frameRate, 2);
+
+		putInt(out, e.tracks.size(), 1);
+		for (unsigned int j = 0; j < e.tracks.size(); j++)
+		{
+			const LibraryTrack &t = e.tracks[j];
+			putString(out, t.title);
+			putInt(out, t.frames, 2);
+			putInt(out, t.rows, 2);
+			putInt(out, t.speed, 2);
+			putInt(out, t.tempo, 2);
+			putInt(out, t.lengthMs, 4);
+		}
+
+		putInt(out, e.instruments.size(), 1);
+		for (unsigned int j = 0; j < e.instruments.size(); j++)
+		{
+			putInt(out, e.instruments[j].index, 1);
+			putString(out, e.instruments[j].name);
+		}
+	}
+
+	// Never leave a half written index behind
+	std::string tmp = indexPath + ".tmp";
+	{
+		core::FileIO io(tmp.c_str(), core::IO_WRITE);
+		if (!io.isWritable())
+			return false;
+		if (!io.write_e(&out[0], out.size()) || !io.flush())
+			return false;
+	}
+
+#ifdef WINDOWS
+	remove(indexPath.c_str());
+#endif
+	return rename(tmp.c_str(), indexPath.c_str()) == 0;
+}
+
+bool Library::load(const std::string &indexPath)
+{
+	m_entries.clear();
+
+	core::MappedIO io(indexPath.c_str());
+	if (!io.isReadable())
+		return false;
+
+	_library_reader r;
+	r.p = (const unsigned char*)io.map(io.size());
+	r.end = r.p + io.size();
+	r.ok = r.p != NULL && io.size() >= sizeof(INDEX_MAGIC)
+		&& memcmp(r.p, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0;
+	if (!r.ok)
+		return false;
+	r.p += sizeof(INDEX_MAGIC);
+
+	if (r.getInt(4) != INDEX_VERSION)
+		return false;
+
+	unsigned int count = r.getInt(4);
+	std::vector<LibraryEntry> entries;
+	for (unsigned int i = 0; i < count && r.ok; i++)
+	{
+		entries.push_back(LibraryEntry());
+		LibraryEntry &e = entries.back();
+		e.path = r.getString();
+		e.mtime = r.getInt(8);
+		e.size = r.getInt(8);
+		e.checked = r.getInt(8);
+		e.crc = r.getInt(4);
+		e.valid = r.getInt(1) != 0;
+		e.chip = e.machine = e.frameRate = 0;
+		if (!e.valid)
+			continue;
+
+		e.title = r.getString();
+		e.artist = r.getString();
+		e.copyright = r.getString();
+		e.chip = r.getInt(1);
+		e.machine = r.getInt(1);
+		e.frameRate = r.getInt(2);
+
+		e.tracks.resize(r.getInt(1));
+		for (unsigned int j = 0; j < e.tracks.size(); j++)
+		{
+			LibraryTrack &t = e.tracks[j];
+			t.title = r.getString();
+			t.frames = r.getInt(2);
+			t.rows = r.getInt(2);
+			t.speed = r.getInt(2);
+			t.tempo = r.getInt(2);
+			t.lengthMs = r.getInt(4);
+		}
+
+		e.instruments.resize(r.getInt(1));
+		for (unsigned int j = 0; j < e.instruments.size(); j++)
+		{
+			e.instruments[j].index = r.getInt(1);
+			e.instruments[j].name = r.getString();
+		}
+	}
+
+	if (!r.ok)
+		return false;
+
+	std::sort(entries.begin(), entries.end(), entryLess);
+	m_entries.swap(entries);
+	return true;
+}
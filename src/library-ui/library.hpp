@@ -0,0 +1,77 @@
+#ifndef LIBRARY_HPP
+#define LIBRARY_HPP
+
+#include <string>
+#include <vector>
+#include "core/types.hpp"
+
+struct LibraryTrack
+{
+	std::string title;
+	unsigned int frames;
+	unsigned int rows;		// per pattern
+	unsigned int speed;
+	unsigned int tempo;
+	unsigned int lengthMs;	// estimated, jumps and skips are not followed
+};
+
+struct LibraryInstrument
+{
+	unsigned int index;
+	std::string name;
+};
+
+struct LibraryEntry
+{
+	std::string path;
+
+	// the entry is up to date while these match the file. Times are in the
+	// units of the file system, nanoseconds since 1970 or FILETIME
+	core::s64 mtime;
+	core::u64 size;
+	core::u32 crc;
+	core::s64 checked;	// when the file was last looked at, on the same clock
+
+	bool valid;			// false if the file could not be read as a module
+	std::string title;
+	std::string artist;
+	std::string copyright;
+	unsigned int chip;
+	unsigned int machine;
+	unsigned int frameRate;
+
+	std::vector<LibraryTrack> tracks;
+	std::vector<LibraryInstrument> instruments;
+};
+
+// An index of the modules in one or more directories, kept in a compact
+// binary file. Rescanning only parses files whose modification time or
+// size changed, and of those only the ones whose contents did. Files written
+// around the time they were last looked at are always checked, since a
+// coarse time stamp can hide a second write
+class Library
+{
+public:
+	struct ScanStats
+	{
+		unsigned int files;
+		unsigned int unchanged;
+		unsigned int parsed;
+		unsigned int failed;
+		unsigned int removed;
+	};
+
+	// A missing or unreadable index loads as empty
+	bool load(const std::string &indexPath);
+	bool save(const std::string &indexPath) const;
+
+	// Brings the entries under dir up to date, parsing on up to
+	// maxThreads threads (0 = one per core)
+	ScanStats scan(const std::string &dir, unsigned int maxThreads = 0);
+
+	const std::vector<LibraryEntry> & entries() const{ return m_entries; }
+private:
+	std::vector<LibraryEntry> m_entries;	// sorted by path
+};
+
+#endif
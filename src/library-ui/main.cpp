@@ -0,0 +1,302 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "library.hpp"
+#include "core/time.hpp"
+#include "famitracker-core/APU/APU.h"
+#include "../parse_arguments.hpp"
+
+const char *default_index = "famitracker-library.idx";
+
+struct arguments_t
+{
+	bool help;
+	bool details;
+
+	std::string command;
+	std::string dir;
+	std::string index;
+	int threads;
+
+	std::string title;
+	std::string artist;
+	std::string instrument;
+	std::string chip;
+	int tracks;
+	int tempo;
+	int minLength;
+	int maxLength;
+};
+
+static void parse_arguments(int argc, char *argv[], arguments_t &a)
+{
+	ParseArguments pa;
+	const char *flagfields[] = {"-help", "-details"};
+	pa.setFlagFields(flagfields, 2);
+	pa.parse(argv, argc);
+
+	a.help = pa.flag("-help");
+
+	if (a.help)
+		return;
+
+	a.details = pa.flag("-details");
+	a.command = pa.string(0);
+	a.dir = pa.string(1);
+	a.index = pa.string("index", default_index);
+	a.threads = pa.integer("threads", 0);
+
+	a.title = pa.string("title", "");
+	a.artist = pa.string("artist", "");
+	a.instrument = pa.string("instrument", "");
+	a.chip = pa.string("chip", "");
+	a.tracks = pa.integer("tracks", -1);
+	a.tempo = pa.integer("tempo", -1);
+	a.minLength = pa.integer("min-length", -1);
+	a.maxLength = pa.integer("max-length", -1);
+}
+
+static void print_help()
+{
+	printf(
+"Usage: app scan DIR [-index FILE] [-threads N]\n"
+"       app query [-index FILE] [FILTERS] [--details]\n\n"
+"    scan DIR\n"
+"        Index the modules in DIR and its subdirectories. Only files\n"
+"        changed since the last scan are read again.\n"
+"    query\n"
+"        List the indexed modules that match every filter given.\n"
+"    -index FILE\n"
+"        The index to use. Default is famitracker-library.idx\n"
+"    -threads N\n"
+"        Read modules on at most N threads. Default is one per core.\n\n"
+"Filters:\n"
+"    -title TEXT         module or track title contains TEXT\n"
+"    -artist TEXT        artist contains TEXT\n"
+"    -instrument TEXT    an instrument name contains TEXT\n"
+"    -chip NAME          uses expansion chip NAME (vrc6, vrc7, fds, mmc5,\n"
+"                        n163, s5b), or 2a03 for none\n"
+"    -tracks N           has exactly N tracks\n"
+"    -tempo N            a track has tempo N\n"
+"    -min-length SEC\n"
+"    -max-length SEC     a track is estimated to last this long\n"
+"    --details\n"
+"        Also list tracks and instruments\n"
+"    --help\n"
+"        Print this message\n"
+	);
+}
+
+struct chipname_t
+{
+	const char *name;
+	unsigned int chip;
+};
+
+static const chipname_t chipnames[] = {
+	{"vrc6", SNDCHIP_VRC6},
+	{"vrc7", SNDCHIP_VRC7},
+	{"fds", SNDCHIP_FDS},
+	{"mmc5", SNDCHIP_MMC5},
+	{"n163", SNDCHIP_N106},
+	{"n106", SNDCHIP_N106},
+	{"s5b", SNDCHIP_S5B}
+};
+static const int chipname_count = sizeof(chipnames)/sizeof(chipnames[0]);
+
+static std::string chip_string(unsigned int chip)
+{
+	std::string s = "2a03";
+	for (int i = 0; i < chipname_count; i++)
+	{
+		// n106 is only an alias
+		if ((chip & chipnames[i].chip) && strcmp(chipnames[i].name, "n106") != 0)
+		{
+			s += "+";
+			s += chipnames[i].name;
+		}
+	}
+	return s;
+}
+
+static bool contains(const std::string &haystack, const std::string &needle)
+{
+	if (needle.size() > haystack.size())
+		return false;
+
+	for (unsigned int i = 0; i + needle.size() <= haystack.size(); i++)
+	{
+		unsigned int j = 0;
+		while (j < needle.size() && tolower((unsigned char)haystack[i+j]) == tolower((unsigned char)needle[j]))
+			j++;
+		if (j == needle.size())
+			return true;
+	}
+	return false;
+}
+
+static bool matches(const LibraryEntry &e, const arguments_t &a, unsigned int chipMask)
+{
+	if (!e.valid)
+		return false;
+
+	if (!a.artist.empty() && !contains(e.artist, a.artist))
+		return false;
+	if (a.tracks >= 0 && e.tracks.size() != (unsigned int)a.tracks)
+		return false;
+	if (!a.chip.empty() && (chipMask == 0 ? e.chip != 0 : (e.chip & chipMask) == 0))
+		return false;
+
+	if (!a.title.empty() && !contains(e.title, a.title))
+	{
+		bool found = false;
+		for (unsigned int i = 0; i < e.tracks.size() && !found; i++)
+			found = contains(e.tracks[i].title, a.title);
+		if (!found)
+			return false;
+	}
+
+	if (!a.instrument.empty())
+	{
+		bool found = false;
+		for (unsigned int i = 0; i < e.instruments.size() && !found; i++)
+			found = contains(e.instruments[i].name, a.instrument);
+		if (!found)
+			return false;
+	}
+
+	if (a.tempo >= 0 || a.minLength >= 0 || a.maxLength >= 0)
+	{
+		bool found = false;
+		for (unsigned int i = 0; i < e.tracks.size() && !found; i++)
+		{
+			const LibraryTrack &t = e.tracks[i];
+			found = (a.tempo < 0 || t.tempo == (unsigned int)a.tempo)
+				&& (a.minLength < 0 || t.lengthMs >= (unsigned int)a.minLength * 1000)
+				&& (a.maxLength < 0 || t.lengthMs <= (unsigned int)a.maxLength * 1000);
+		}
+		if (!found)
+			return false;
+	}
+
+	return true;
+}
+
+static void print_length(unsigned int ms)
+{
+	unsigned int s = (ms + 500) / 1000;
+	printf("%u:%02u", s / 60, s % 60);
+}
+
+static void print_entry(const LibraryEntry &e, bool details)
+{
+	printf("%s\n    %s - %s [%s, %s, %u track%s]\n", e.path.c_str(),
+		e.artist.empty() ? "?" : e.artist.c_str(), e.title.empty() ? "?" : e.title.c_str(),
+		chip_string(e.chip).c_str(), e.machine == MACHINE_PAL ? "PAL" : "NTSC",
+		(unsigned int)e.tracks.size(), e.tracks.size() == 1 ? "" : "s");
+
+	if (!details)
+		return;
+
+	for (unsigned int i = 0; i < e.tracks.size(); i++)
+	{
+		const LibraryTrack &t = e.tracks[i];
+		printf("    track %u: %s (~", i+1, t.title.c_str());
+		print_length(t.lengthMs);
+		printf(", %u frames, %u rows, speed %u, tempo %u)\n", t.frames, t.rows, t.speed, t.tempo);
+	}
+	for (unsigned int i = 0; i < e.instruments.size(); i++)
+	{
+		printf("    instrument %02X: %s\n", e.instruments[i].index, e.instruments[i].name.c_str());
+	}
+}
+
+static int scan(const arguments_t &a)
+{
+	if (a.dir.empty())
+	{
+		printf("Please specify a directory\n\n");
+		print_help();
+		return 1;
+	}
+
+	core::timestamp_t start, end;
+	start.gettime();
+
+	Library lib;
+	lib.load(a.index);
+	Library::ScanStats stats = lib.scan(a.dir, a.threads > 0 ? a.threads : 0);
+
+	if (!lib.save(a.index))
+	{
+		fprintf(stderr, "Could not write index: %s\n", a.index.c_str());
+		return 1;
+	}
+
+	end.gettime();
+	printf("%u modules: %u unchanged, %u read, %u unreadable, %u removed (%d ms)\n",
+		stats.files, stats.unchanged, stats.parsed, stats.failed, stats.removed, end.diff_ms(start));
+
+	return 0;
+}
+
+static int query(const arguments_t &a)
+{
+	unsigned int chipMask = 0;
+	if (!a.chip.empty() && C_strcasecmp(a.chip.c_str(), "2a03") != 0)
+	{
+		for (int i = 0; i < chipname_count; i++)
+		{
+			if (C_strcasecmp(a.chip.c_str(), chipnames[i].name) == 0)
+				chipMask = chipnames[i].chip;
+		}
+		if (chipMask == 0)
+		{
+			fprintf(stderr, "Unknown chip: %s\n", a.chip.c_str());
+			return 1;
+		}
+	}
+
+	Library lib;
+	if (!lib.load(a.index))
+	{
+		fprintf(stderr, "Could not read index: %s\n", a.index.c_str());
+		return 1;
+	}
+
+	const std::vector<LibraryEntry> &entries = lib.entries();
+	unsigned int found = 0;
+	for (unsigned int i = 0; i < entries.size(); i++)
+	{
+		if (!matches(entries[i], a, chipMask))
+			continue;
+
+		print_entry(entries[i], a.details);
+		found++;
+	}
+
+	printf("%u of %u modules\n", found, (unsigned int)entries.size());
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	arguments_t args;
+	parse_arguments(argc-1, argv+1, args);
+
+	if (args.help)
+	{
+		print_help();
+		return 0;
+	}
+
+	if (args.command == "scan")
+		return scan(args);
+	if (args.command == "query")
+		return query(args);
+
+	print_help();
+	return 1;
+}
@@ -675,7 +675,7 @@ int main(int argc, char *argv[])
 
 	FtmDocument doc;
 	{
-		core::FileIO ftm_io(song, core::IO_READ);
+		core::MappedIO ftm_io(song);
 		if (!ftm_io.isReadable())
 		{
 			printf("Cannot open file\n");
@@ -1,21 +1,31 @@
 #include <string.h>
 #include "famitracker-core/FtmDocument.hpp"
+#include "famitracker-core/FtmJournal.hpp"
+#include "famitracker-core/UndoHistory.hpp"
 #include "DocInfo.hpp"
 
 namespace gui
 {
 	DocInfo::DocInfo(FtmDocument *d)
-		: m_doc(d), m_currentChannel(0), m_currentFrame(0), m_currentRow(0),
+		: m_doc(d), m_journal(NULL), m_currentChannel(0), m_currentFrame(0), m_currentRow(0),
 		  m_currentChannelColumn(0), m_currentInstrument(0), m_currentOctave(3),
 		  m_step(1), m_keyrepetition(false),
 		  m_notesharps(true)
 	{
 		memset(m_vols, 0, sizeof(m_vols));
+		m_history = new UndoHistory(d);
 	}
 	void DocInfo::destroy()
 	{
+		delete m_history;
+		delete m_journal;
 		delete m_doc;
 	}
+	void DocInfo::setPath(const std::string &path)
+	{
+		delete m_journal;
+		m_journal = new FtmJournal(m_doc, path);
+	}
 	void DocInfo::setCurrentFrame(unsigned int frame)
 	{
 		doc()->lock();
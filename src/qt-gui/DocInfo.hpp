@@ -1,9 +1,12 @@
 #ifndef _DOCINFO_HPP_
 #define _DOCINFO_HPP_
 
+#include <string>
 #include "core/common.hpp"
 #include "famitracker-core/FamiTrackerTypes.h"
 class FtmDocument;
+class FtmJournal;
+class UndoHistory;
 
 namespace gui
 {
@@ -14,6 +17,11 @@ namespace gui
 	public:
 		DocInfo(FtmDocument *d);
 		FtmDocument * doc() const{ return m_doc; }
+		// autosave journal of the module file, NULL until the document has one
+		FtmJournal * journal() const{ return m_journal; }
+		void setPath(const std::string &path);
+		// call checkpoint() on it before each edit
+		UndoHistory * history() const{ return m_history; }
 		void setCurrentFrame(unsigned int frame);
 		void setCurrentChannel(unsigned int chan);
 		void setCurrentChannelColumn(unsigned int col);
@@ -46,6 +54,8 @@ namespace gui
 		void noteNotation(unsigned int note, char *out);
 	protected:
 		FtmDocument * m_doc;
+		FtmJournal * m_journal;
+		UndoHistory * m_history;
 		unsigned int m_currentFrame, m_currentChannel, m_currentRow;
 		unsigned int m_currentChannelColumn;
 		unsigned int m_currentInstrument;
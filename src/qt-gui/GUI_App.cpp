@@ -5,6 +5,7 @@
 #include "Settings.hpp"
 #include "famitracker-core/TrackerController.hpp"
 #include "famitracker-core/FtmDocument.hpp"
+#include "core/trace.hpp"
 
 namespace gui
 {
@@ -16,6 +17,8 @@ namespace gui
 
 	void App::init2(const char *sound_name)
 	{
+		core::Trace::setThreadName("gui");
+
 		threadPool = new ThreadPool(this);
 
 		active_doc_index = -1;
@@ -69,6 +72,8 @@ namespace gui
 	void App::trackerUpdate(const SoundGen::rowframe_t &rf, FtmDocument *doc)
 	{
 		// happens on non-gui thread
+		core::TraceScope trace("tracker update");
+
 		DocInfo *dinfo = activeDocInfo();
 
 		if (rf.tracker_running)
@@ -233,6 +238,7 @@ namespace gui
 		QApplication::postEvent(mw, event);
 
 		// wait until the gui is finished updating before resuming
+		core::TraceScope trace("wait for gui");
 		m_cond_updateEvent.wait(lock);
 	}
 
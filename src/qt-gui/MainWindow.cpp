@@ -1,4 +1,5 @@
 #include <QFileDialog>
+#include <QTimer>
 #include <QDebug>
 #include "GUI_App.hpp"
 #include "MainWindow.hpp"
@@ -9,7 +10,10 @@
 #include "Settings.hpp"
 #include "styles.hpp"
 #include "famitracker-core/FtmDocument.hpp"
+#include "famitracker-core/FtmJournal.hpp"
+#include "famitracker-core/UndoHistory.hpp"
 #include "InstrumentEditor.hpp"
+#include "core/trace.hpp"
 
 namespace gui
 {
@@ -37,12 +41,25 @@ namespace gui
 		QObject::connect(action_Save, SIGNAL(triggered()), this, SLOT(save()));
 		action_Save->setIcon(QIcon::fromTheme("document-save"));
 		QObject::connect(actionSave_As, SIGNAL(triggered()), this, SLOT(saveAs()));
+
+		{
+			// unsaved edits go to the module's journal every 30 seconds
+			QTimer *t = new QTimer(this);
+			QObject::connect(t, SIGNAL(timeout()), this, SLOT(autosave()));
+			t->start(30*1000);
+		}
+
 		QObject::connect(action_Create_NSF, SIGNAL(triggered()), this, SLOT(unimplemented()));
 		QObject::connect(actionCreate_WAV, SIGNAL(triggered()), this, SLOT(createWAV()));
 		QObject::connect(actionImport_MIDI, SIGNAL(triggered()), this, SLOT(unimplemented()));
 		QObject::connect(action_Configuration, SIGNAL(triggered()), this, SLOT(unimplemented()));
 		QObject::connect(actionE_xit, SIGNAL(triggered()), this, SLOT(quit()));
 
+		QObject::connect(action_Undo, SIGNAL(triggered()), this, SLOT(undo()));
+		action_Undo->setIcon(QIcon::fromTheme("edit-undo"));
+		QObject::connect(action_Redo, SIGNAL(triggered()), this, SLOT(redo()));
+		action_Redo->setIcon(QIcon::fromTheme("edit-redo"));
+
 		QObject::connect(actionModule_Properties, SIGNAL(triggered()), this, SLOT(moduleProperties()));
 
 		QObject::connect(action_ViewToolbar, SIGNAL(toggled(bool)), this, SLOT(viewToolbar(bool)));
@@ -251,6 +268,7 @@ namespace gui
 		if (event->type() == UPDATEEVENT)
 		{
 			UpdateEvent *e = (UpdateEvent*)event;
+			core::TraceScope trace("gui update");
 
 			e->mtx_updateEvent->lock();
 			updateFrameChannel();
@@ -431,12 +449,33 @@ namespace gui
 	void MainWindow::open_cb(MainWindow *mw, void *data)
 	{
 		mw->m_instrumenteditor->removedInstrument();
-		core::IO *io = (core::IO*)data;
-		if (mw->m_app->openDocument(io, true))
+		QString *path = (QString*)data;
+		core::IO *io = new core::MappedIO(path->toLocal8Bit());
+		bool opened = mw->m_app->openDocument(io, true);
+		delete io;
+		if (opened)
 		{
+			mw->openJournal(*path);
 			mw->updateDocument();
 		}
-		delete io;
+		delete path;
+	}
+	void MainWindow::openJournal(const QString &path)
+	{
+		DocInfo *dinfo = m_app->activeDocInfo();
+		dinfo->setPath(path.toLocal8Bit().constData());
+
+		// replay the edits a crash left in the journal
+		FtmJournal *journal = dinfo->journal();
+		if (journal->recover() > 0)
+		{
+			statusbar->showMessage(tr("Recovered unsaved changes from %1")
+				.arg(QString::fromLocal8Bit(journal->journalPath().c_str())));
+		}
+		else
+		{
+			journal->reset();
+		}
 	}
 
 	void MainWindow::newDoc()
@@ -467,9 +506,7 @@ namespace gui
 		QString ftmpath = QFileInfo(path).absoluteDir().absolutePath();
 		settings()->setValue(SETTINGS_FTMPATH, ftmpath);
 
-		core::FileIO *io = new core::FileIO(path.toLocal8Bit(), core::IO_READ);
-
-		gui::stopSongConcurrent(open_cb, io);
+		gui::stopSongConcurrent(open_cb, new QString(path));
 		gui::addRecentFile(path);
 		reloadRecentFiles();
 
@@ -518,6 +555,58 @@ namespace gui
 		m_dinfo->doc()->write(io);
 
 		delete io;
+
+		// the journal starts over from the saved module
+		m_dinfo->setPath(path.toLocal8Bit().constData());
+		m_dinfo->journal()->reset();
+	}
+	void MainWindow::autosave()
+	{
+		// only what changed since the last autosave is written
+		DocInfo *dinfo = m_app->activeDocInfo();
+		if (dinfo != NULL && dinfo->journal() != NULL)
+			dinfo->journal()->sync();
+	}
+	void MainWindow::undo_cb(MainWindow *mw, void *)
+	{
+		mw->stepHistory(false);
+	}
+	void MainWindow::redo_cb(MainWindow *mw, void *)
+	{
+		mw->stepHistory(true);
+	}
+	void MainWindow::stepHistory(bool redo)
+	{
+		DocInfo *dinfo = m_app->activeDocInfo();
+		FtmDocument *d = dinfo->doc();
+
+		d->lock();
+
+		// restore() keeps the instruments both steps have, the editor only
+		// has to let go of one the other step does not have
+		CInstrument *inst = d->GetInstrument(dinfo->currentInstrument());
+		bool changed = redo ? dinfo->history()->redo() : dinfo->history()->undo();
+		bool removed = d->GetInstrument(dinfo->currentInstrument()) != inst;
+
+		d->unlock();
+
+		if (!changed)
+			return;
+		if (removed)
+			m_instrumenteditor->removedInstrument();
+
+		// the step may have another expansion chip, track or frame count
+		updateDocument();
+		m_app->reloadAudio();
+		gui::updateFrameChannel(true);
+	}
+	void MainWindow::undo()
+	{
+		gui::stopSongConcurrent(undo_cb);
+	}
+	void MainWindow::redo()
+	{
+		gui::stopSongConcurrent(redo_cb);
 	}
 	void MainWindow::createwav_cb(MainWindow *mw, void *data)
 	{
@@ -857,6 +946,7 @@ namespace gui
 
 		d->lock();
 
+		m_dinfo->history()->checkpoint();
 		d->RemoveInstrument(inst);
 
 		int ni = -1;
@@ -77,6 +77,11 @@ namespace gui
 
 		static void newDoc_cb(MainWindow*, void*);
 		static void open_cb(MainWindow*, void*);
+		void openJournal(const QString &path);
+
+		static void undo_cb(MainWindow*, void*);
+		static void redo_cb(MainWindow*, void*);
+		void stepHistory(bool redo);
 
 		static void close_cb(MainWindow*, void*);
 
@@ -91,6 +96,9 @@ namespace gui
 		void openFile(const QString &path);
 		void save();
 		void saveAs();
+		void autosave();
+		void undo();
+		void redo();
 		void createWAV();
 		void quit();
 
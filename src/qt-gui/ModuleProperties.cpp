@@ -4,6 +4,7 @@
 #include "famitracker-core/App.hpp"
 #include "famitracker-core/FtmDocument.hpp"
 #include "famitracker-core/FamiTrackerTypes.h"
+#include "famitracker-core/UndoHistory.hpp"
 #include "GUI_App.hpp"
 #include "GUI.hpp"
 #include "MainWindow.hpp"
@@ -111,6 +112,7 @@ namespace gui
 	{
 		m_doc->lock();
 
+		m_app->activeDocInfo()->history()->checkpoint();
 		if (m_doc->AddTrack())
 		{
 			updateTracksList(m_doc->GetTrackCount()-1);
@@ -123,7 +125,7 @@ namespace gui
 		if (tracksList->count() < 2)
 			return;
 
-		int r = QMessageBox::warning(this, "", tr("Do you want to delete this track? There is no undo for this action."), QMessageBox::Yes, QMessageBox::No);
+		int r = QMessageBox::warning(this, "", tr("Do you want to delete this track?"), QMessageBox::Yes, QMessageBox::No);
 		if (r == QMessageBox::Yes)
 		{
 			int track = tracksList->currentRow();
@@ -142,9 +144,10 @@ namespace gui
 
 			m_mw->updateDocument();
 
-			// delete it
+			// delete it, Edit > Undo brings it back
 			m_doc->lock();
 
+			m_app->activeDocInfo()->history()->checkpoint();
 			m_doc->RemoveTrack(track);
 
 			m_doc->unlock();
@@ -175,6 +178,7 @@ namespace gui
 
 		int track = tracksList->currentRow();
 
+		m_app->activeDocInfo()->history()->checkpoint();
 		if (up)
 			m_doc->MoveTrackUp(track);
 		else
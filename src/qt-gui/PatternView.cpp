@@ -12,6 +12,7 @@
 #include "styles.hpp"
 #include "famitracker-core/FtmDocument.hpp"
 #include "famitracker-core/App.hpp"
+#include "famitracker-core/UndoHistory.hpp"
 #include "RowPages.hpp"
 #include "pixelfonts/vincent/vincent.h"
 
@@ -1367,6 +1368,7 @@ namespace gui
 		FtmDocument *doc = m_dinfo->doc();
 
 		doc->lock();
+		m_dinfo->history()->checkpoint();
 		doc->DeleteNote(m_dinfo->currentFrame(), m_dinfo->currentChannel(), m_dinfo->currentRow(), m_dinfo->currentChannelColumn());
 		doc->unlock();
 
@@ -1383,6 +1385,8 @@ namespace gui
 
 		doc->lock();
 
+		m_dinfo->history()->checkpoint();
+
 		stChanNote n;
 		doc->GetNoteData(m_dinfo->currentFrame(), m_dinfo->currentChannel(), m_dinfo->currentRow(), &n);
 
@@ -2,6 +2,7 @@
 #include <string.h>
 #include "GUI.hpp"
 #include "famitracker-core/App.hpp"
+#include "core/trace.hpp"
 #include "../parse_arguments.hpp"
 #include "../defaults.hpp"
 #ifdef WINDOWS
@@ -14,6 +15,7 @@ struct arguments_t
 {
 	bool help;
 	std::string sound;
+	std::string trace;
 };
 
 static void parse_arguments(int argc, char *argv[], arguments_t &a)
@@ -28,16 +30,21 @@ static void parse_arguments(int argc, char *argv[], arguments_t &a)
 		return;
 
 	a.sound = pa.string("sound", default_sound);
+	a.trace = pa.string("trace", "");
 }
 
 static void print_help()
 {
 	printf(
-"Usage: app [-sound ENGINE] [--help]\n\n"
+"Usage: app [-sound ENGINE] [-trace FILE] [--help]\n\n"
 "    -sound ENGINE\n"
 "        Specify which sound engine to use. This will load a module\n"
 "        in your PATH named " SOUNDSINKLIB_FORMAT ". Default is " DEFAULT_SOUND ".\n"
 "        (eg. -sound jack)\n"
+"    -trace FILE\n"
+"        Record what the audio and gui threads spend their time on and\n"
+"        write it to FILE on exit, in the Chrome trace format. Open it in\n"
+"        chrome://tracing or ui.perfetto.dev\n"
 "    --help\n"
 "        Print this message\n",
 
@@ -74,10 +81,20 @@ int CALLBACK WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLi
 
 	parse_arguments(argc, argv, args);
 
+	if (!args.trace.empty())
+		core::Trace::start();
+
 	gui::init_2(args.sound.c_str());
 
 	gui::spin();
 
+	if (!args.trace.empty())
+	{
+		core::Trace::stop();
+		if (!core::Trace::write(args.trace.c_str()))
+			fprintf(stderr, "Could not write trace to %s\n", args.trace.c_str());
+	}
+
 	gui::destroy();
 
 	for (int i = 0; i < argc; i++)
@@ -106,10 +123,20 @@ int main(int argc, char *argv[])
 	printf("Welcome to FamiTracker!\n");
 	fflush(stdout);
 
+	if (!args.trace.empty())
+		core::Trace::start();
+
 	gui::init_2(args.sound.c_str());
 
 	gui::spin();
 
+	if (!args.trace.empty())
+	{
+		core::Trace::stop();
+		if (!core::Trace::write(args.trace.c_str()))
+			fprintf(stderr, "Could not write trace to %s\n", args.trace.c_str());
+	}
+
 	gui::destroy();
 
 	return 0;
@@ -1,7 +1,10 @@
 #include <stdio.h>
+#include <errno.h>
+#include <poll.h>
 #include <boost/thread/mutex.hpp>
 #include "alsa.hpp"
 #include "core/time.hpp"
+#include "core/trace.hpp"
 
 core_api_SoundSink * sound_create()
 {
@@ -14,7 +17,11 @@ struct _alsasound_threading
 };
 
 AlsaSound::AlsaSound()
-	: m_handle(NULL), m_running(false)
+	: m_handle(NULL),
+	  m_req_buffer_size(0), m_req_period_size(0),
+	  m_buf(NULL),
+	  m_mmap(false), m_pollfds(NULL), m_pollfds_count(0),
+	  m_running(false)
 {
 	m_threading = new _alsasound_threading;
 }
@@ -38,8 +45,64 @@ void AlsaSound::callback_bootstrap(void *data)
 void AlsaSound::callback()
 {
 	int err;
-	core::u32 bufsz = m_buffer_size;
-	core::s16 *buf = new core::s16[bufsz];
+
+	if (m_mmap)
+		callback_mmap();
+	else
+		callback_rw();
+
+	finish();
+	ALSA_TRY(snd_pcm_prepare(m_handle));
+}
+
+bool AlsaSound::restartQueued()
+{
+	// the loop only ends once m_running is cleared. set again, it means
+	// setPlaying(true) is waiting in run() for this session to end
+	boost::mutex::scoped_lock lock(m_threading->mtx_running);
+	return m_running;
+}
+
+void AlsaSound::finish()
+{
+	// let the device play out what is queued, unless playback is started
+	// again meanwhile. then the rest is dropped, so the new session isn't
+	// held up behind the tail of the old one
+	static const unsigned int drain_poll_us = 5000;
+
+	int err;
+
+	if (restartQueued())
+	{
+		ALSA_TRY(snd_pcm_drop(m_handle));
+		return;
+	}
+
+	// a blocking drain would return only once the device is empty
+	ALSA_TRY(snd_pcm_nonblock(m_handle, 1));
+	err = snd_pcm_drain(m_handle);
+	if (err < 0 && err != -EAGAIN)
+	{
+		fprintf(stderr, "ERROR: %s\n", snd_strerror(err));
+	}
+
+	while (snd_pcm_state(m_handle) == SND_PCM_STATE_DRAINING)
+	{
+		if (restartQueued())
+		{
+			core::Trace::instant("alsa drop");
+			ALSA_TRY(snd_pcm_drop(m_handle));
+			break;
+		}
+		core::sleep_us(drain_poll_us);
+	}
+
+	ALSA_TRY(snd_pcm_nonblock(m_handle, 0));
+}
+
+void AlsaSound::callback_rw()
+{
+	core::s16 *buf = m_buf;
 
 	core::u32 sr = sampleRate();
 
@@ -71,7 +134,7 @@ void AlsaSound::callback()
 
 			if (frames < 0)
 			{
-				frames = snd_pcm_recover(m_handle, frames, 0);
+				frames = recover(frames);
 			}
 			if (frames < 0)
 			{
@@ -85,11 +148,107 @@ void AlsaSound::callback()
 			}
 		}
 	}
+}
 
-	delete[] buf;
+void AlsaSound::callback_mmap()
+{
+	core::u32 sr = sampleRate();
 
-	ALSA_TRY(snd_pcm_drain(m_handle));
-	ALSA_TRY(snd_pcm_prepare(m_handle));
+	core::u64 latency = m_buffer_size;
+	latency = latency * 1000000 / sr;
+
+	bool running = true;
+
+	while (running)
+	{
+		m_threading->mtx_running.lock();
+		running = m_running;
+		m_threading->mtx_running.unlock();
+		if (!running)
+			break;
+
+		snd_pcm_sframes_t avail = snd_pcm_avail_update(m_handle);
+		if (avail < 0)
+		{
+			if (recover(avail) < 0)
+			{
+				fprintf(stderr, "snd_pcm_avail_update failed: %s\n", snd_strerror(avail));
+			}
+			continue;
+		}
+
+		if ((snd_pcm_uframes_t)avail < m_period_size)
+		{
+			// the ring is full. make sure the device is running, then sleep
+			// until it has consumed at least a period
+			if (snd_pcm_state(m_handle) == SND_PCM_STATE_PREPARED)
+			{
+				snd_pcm_start(m_handle);
+			}
+			waitForPoll();
+			continue;
+		}
+
+		snd_pcm_uframes_t remaining = m_period_size;
+		while (remaining > 0)
+		{
+			const snd_pcm_channel_area_t *areas;
+			snd_pcm_uframes_t offset;
+			snd_pcm_uframes_t frames = remaining;
+
+			int err = snd_pcm_mmap_begin(m_handle, &areas, &offset, &frames);
+			if (err < 0)
+			{
+				recover(err);
+				break;
+			}
+
+			// interleaved access: all channels share the first area
+			core::s16 *buf = (core::s16*)((char*)areas[0].addr
+				+ (areas[0].first + offset * areas[0].step) / 8);
+
+			performSoundCallback(buf, frames);
+
+			snd_pcm_sframes_t committed = snd_pcm_mmap_commit(m_handle, offset, frames);
+			if (committed < 0 || (snd_pcm_uframes_t)committed != frames)
+			{
+				recover(committed < 0 ? committed : -EPIPE);
+				break;
+			}
+			remaining -= frames;
+		}
+
+		snd_pcm_sframes_t delayp;
+		if (snd_pcm_delay(m_handle, &delayp) < 0)
+			delayp = 0;
+
+		core::s64 d = delayp * 1000000 / sr;
+		d -= latency;
+
+		applyTime(d);
+	}
+}
+
+bool AlsaSound::waitForPoll()
+{
+	// time out every so often so that setPlaying(false) is noticed even
+	// when the device stalls
+	static const int poll_timeout_ms = 100;
+
+	if (poll(m_pollfds, m_pollfds_count, poll_timeout_ms) <= 0)
+		return false;
+
+	unsigned short revents;
+	snd_pcm_poll_descriptors_revents(m_handle, m_pollfds, m_pollfds_count, &revents);
+
+	// errors are picked up by the next snd_pcm_avail_update
+	return (revents & POLLOUT) != 0;
+}
+
+int AlsaSound::recover(int err)
+{
+	core::Trace::instant("alsa recover");
+	return snd_pcm_recover(m_handle, err, 0);
 }
 
 void AlsaSound::setPlaying(bool playing)
@@ -114,6 +273,83 @@ void AlsaSound::setPlaying(bool playing)
 	}
 }
 
+void AlsaSound::setRealtime(bool realtime)
+{
+	m_thread.setRealtime(realtime);
+}
+
+void AlsaSound::setBufferSize(unsigned int period_frames, unsigned int buffer_frames)
+{
+	m_req_period_size = period_frames;
+	m_req_buffer_size = buffer_frames;
+}
+
+int AlsaSound::setHwParams(snd_pcm_access_t access, unsigned int sampleRate, unsigned int channels, unsigned int latency_ms)
+{
+	int err;
+	snd_pcm_hw_params_t *params;
+	snd_pcm_hw_params_alloca(&params);
+
+	if ((err = snd_pcm_hw_params_any(m_handle, params)) < 0)
+		return err;
+	if ((err = snd_pcm_hw_params_set_rate_resample(m_handle, params, 1)) < 0)
+		return err;
+	if ((err = snd_pcm_hw_params_set_access(m_handle, params, access)) < 0)
+		return err;
+	if ((err = snd_pcm_hw_params_set_format(m_handle, params, SND_PCM_FORMAT_S16)) < 0)
+		return err;
+	if ((err = snd_pcm_hw_params_set_channels(m_handle, params, channels)) < 0)
+		return err;
+
+	unsigned int rate = sampleRate;
+	if ((err = snd_pcm_hw_params_set_rate_near(m_handle, params, &rate, 0)) < 0)
+		return err;
+
+	snd_pcm_uframes_t buffer_size = m_req_buffer_size;
+	snd_pcm_uframes_t period_size = m_req_period_size;
+	if (buffer_size == 0)
+	{
+		buffer_size = (snd_pcm_uframes_t)rate * latency_ms / 1000;
+	}
+	if (period_size == 0)
+	{
+		// same split as snd_pcm_set_params
+		period_size = buffer_size / 4;
+	}
+
+	if ((err = snd_pcm_hw_params_set_buffer_size_near(m_handle, params, &buffer_size)) < 0)
+		return err;
+	if ((err = snd_pcm_hw_params_set_period_size_near(m_handle, params, &period_size, 0)) < 0)
+		return err;
+	if ((err = snd_pcm_hw_params(m_handle, params)) < 0)
+		return err;
+
+	snd_pcm_hw_params_get_buffer_size(params, &m_buffer_size);
+	snd_pcm_hw_params_get_period_size(params, &m_period_size, 0);
+
+	m_sampleRate = rate;
+
+	return 0;
+}
+
+int AlsaSound::setSwParams()
+{
+	int err;
+	snd_pcm_sw_params_t *params;
+	snd_pcm_sw_params_alloca(&params);
+
+	if ((err = snd_pcm_sw_params_current(m_handle, params)) < 0)
+		return err;
+	// start once the ring has been filled with whole periods
+	if ((err = snd_pcm_sw_params_set_start_threshold(m_handle, params, (m_buffer_size / m_period_size) * m_period_size)) < 0)
+		return err;
+	// wake up from poll() as soon as a period can be rendered
+	if ((err = snd_pcm_sw_params_set_avail_min(m_handle, params, m_period_size)) < 0)
+		return err;
+
+	return snd_pcm_sw_params(m_handle, params);
+}
+
 void AlsaSound::initialize(unsigned int sampleRate, unsigned int channels, unsigned int latency_ms)
 {
 	AlsaSound::close();
@@ -124,25 +360,46 @@ void AlsaSound::initialize(unsigned int sampleRate, unsigned int channels, unsig
 	{
 		// error
 		fprintf(stderr, "Playback open error: %s\n", snd_strerror(err));
+		m_handle = NULL;
 		return;
 	}
 
-	if ((err = snd_pcm_set_params(m_handle,
-								  SND_PCM_FORMAT_S16,
-								  SND_PCM_ACCESS_RW_INTERLEAVED,
-								  channels,
-								  sampleRate,
-								  1,
-								  latency_ms*1000)) < 0)
+	m_mmap = true;
+	if ((err = setHwParams(SND_PCM_ACCESS_MMAP_INTERLEAVED, sampleRate, channels, latency_ms)) < 0)
+	{
+		// not every device can be mapped (eg. some plugins). copy with
+		// snd_pcm_writei instead
+		m_mmap = false;
+		if ((err = setHwParams(SND_PCM_ACCESS_RW_INTERLEAVED, sampleRate, channels, latency_ms)) < 0)
+		{
+			// error
+			fprintf(stderr, "Playback open error: %s\n", snd_strerror(err));
+			return;
+		}
+	}
+
+	if ((err = setSwParams()) < 0)
 	{
 		// error
-		fprintf(stderr, "Playback open error: %s\n", snd_strerror(err));
+		fprintf(stderr, "Playback setup error: %s\n", snd_strerror(err));
 		return;
 	}
 
-	snd_pcm_get_params(m_handle, &m_buffer_size, &m_period_size);
+	if (!m_mmap)
+	{
+		m_buf = new core::s16[m_buffer_size];
+	}
 
-	m_sampleRate = sampleRate;
+	m_pollfds_count = snd_pcm_poll_descriptors_count(m_handle);
+	if (m_pollfds_count > 0)
+	{
+		m_pollfds = new struct pollfd[m_pollfds_count];
+		snd_pcm_poll_descriptors(m_handle, m_pollfds, m_pollfds_count);
+	}
+	else
+	{
+		m_pollfds_count = 0;
+	}
 }
 
 void AlsaSound::close()
@@ -150,7 +407,13 @@ void AlsaSound::close()
 	if (m_handle != NULL)
 	{
 		snd_pcm_close(m_handle);
+		m_handle = NULL;
 	}
+	delete[] m_pollfds;
+	m_pollfds = NULL;
+	delete[] m_buf;
+	m_buf = NULL;
+	m_pollfds_count = 0;
 }
 
 int AlsaSound::sampleRate() const
@@ -19,13 +19,29 @@ public:
 	void initialize(unsigned int sampleRate, unsigned int channels, unsigned int latency_ms);
 	void close();
 	void setPlaying(bool playing);
+	void setBufferSize(unsigned int period_frames, unsigned int buffer_frames);
+	void setRealtime(bool realtime);
 
 	int sampleRate() const;
 private:
+	int setHwParams(snd_pcm_access_t access, unsigned int sampleRate, unsigned int channels, unsigned int latency_ms);
+	int setSwParams();
+	bool waitForPoll();
+	int recover(int err);
 	void callback();
+	bool restartQueued();
+	void finish();
+	void callback_rw();
+	void callback_mmap();
 	static void callback_bootstrap(void *);
 	snd_pcm_t * m_handle;
 	snd_pcm_uframes_t m_buffer_size, m_period_size;
+	snd_pcm_uframes_t m_req_buffer_size, m_req_period_size;
+	// render buffer for the writei path, sized on initialize
+	core::s16 * m_buf;
+	bool m_mmap;
+	struct pollfd * m_pollfds;
+	int m_pollfds_count;
 	int m_sampleRate;
 	SoundThread m_thread;
 	_alsasound_threading * m_threading;
@@ -12,14 +12,23 @@ core_api_SoundSink * sound_create()
 
 typedef jack_default_audio_sample_t sample_t;
 
+// same order as the engine splits its output
+static const int CHIP_OUTPUTS = 6;
+static const char * const chip_port_names[CHIP_OUTPUTS] = {
+	"2a03", "vrc6", "vrc7", "fds", "mmc5", "n163"
+};
+
 struct jacksound_info_t
 {
 	JackSound * sink;
 	jack_client_t * client;
 
 	jack_port_t * out;
+	jack_port_t * chip_out[CHIP_OUTPUTS];
 
-	core::s16 *buf;
+	// per chip ports. when set, buf holds CHIP_OUTPUTS interleaved samples per frame
+	bool split;
+	float *buf;
 };
 
 static int process(jack_nframes_t frames, void *arg)
@@ -33,22 +42,53 @@ static int process(jack_nframes_t frames, void *arg)
 
 	handle->sink->applyTime(latency_us);
 
+	sample_t *out = (sample_t*)jack_port_get_buffer(handle->out, frames);
+
+	if (!handle->split)
+	{
+		if (!handle->sink->isPlaying())
+		{
+			// don't play anything
+			memset(out, 0, frames*sizeof(sample_t));
+			return 0;
+		}
+
+		// render straight into the port
+		handle->sink->performSoundCallbackFloat(out, frames);
+		return 0;
+	}
+
+	sample_t *chips[CHIP_OUTPUTS];
+	for (int c = 0; c < CHIP_OUTPUTS; c++)
+	{
+		chips[c] = (sample_t*)jack_port_get_buffer(handle->chip_out[c], frames);
+	}
+
 	if (!handle->sink->isPlaying())
 	{
 		// don't play anything
-		sample_t *buf = (sample_t*)jack_port_get_buffer(handle->out, frames);
-		memset(buf, 0, frames*sizeof(sample_t));
+		memset(out, 0, frames*sizeof(sample_t));
+		for (int c = 0; c < CHIP_OUTPUTS; c++)
+		{
+			memset(chips[c], 0, frames*sizeof(sample_t));
+		}
 		return 0;
 	}
 
-	handle->sink->performSoundCallback(handle->buf, frames);
-
-	sample_t *buf = (sample_t*)jack_port_get_buffer(handle->out, frames);
+	handle->sink->performSoundCallbackFloat(handle->buf, frames);
 
-	// convert s16 to float
-	for (int i = 0; i < frames; i++)
+	// deinterleave the chips, the main output carries their sum
+	const float *in = handle->buf;
+	for (jack_nframes_t i = 0; i < frames; i++)
 	{
-		buf[i] = sample_t(handle->buf[i])/sample_t(32768.0);
+		sample_t sum = 0;
+		for (int c = 0; c < CHIP_OUTPUTS; c++)
+		{
+			chips[c][i] = in[c];
+			sum += in[c];
+		}
+		out[i] = sum;
+		in += CHIP_OUTPUTS;
 	}
 
 	return 0;
@@ -59,6 +99,8 @@ JackSound::JackSound()
 	m_handle = new jacksound_info_t;
 	m_handle->sink = this;
 	m_handle->client = NULL;
+	m_handle->split = false;
+	m_handle->buf = NULL;
 }
 JackSound::~JackSound()
 {
@@ -71,6 +113,12 @@ void JackSound::setPlaying(bool playing)
 	SoundSink::setPlaying(playing);
 }
 
+void JackSound::setSplitOutputs(bool split)
+{
+	// takes effect on the next initialize()
+	m_handle->split = split;
+}
+
 void JackSound::initialize(unsigned int sampleRate, unsigned int channels, unsigned int latency_ms)
 {
 	if (m_handle->client != NULL)
@@ -91,8 +139,19 @@ void JackSound::initialize(unsigned int sampleRate, unsigned int channels, unsig
 
 	m_handle->out = jack_port_register(m_handle->client, "output", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
 
-	jack_nframes_t bufsize = jack_get_buffer_size(m_handle->client);
-	m_handle->buf = new core::s16[bufsize];
+	delete[] m_handle->buf;
+	m_handle->buf = NULL;
+
+	if (m_handle->split)
+	{
+		for (int c = 0; c < CHIP_OUTPUTS; c++)
+		{
+			m_handle->chip_out[c] = jack_port_register(m_handle->client, chip_port_names[c], JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+		}
+
+		jack_nframes_t bufsize = jack_get_buffer_size(m_handle->client);
+		m_handle->buf = new float[bufsize * CHIP_OUTPUTS];
+	}
 
 	if (jack_activate(m_handle->client))
 	{
@@ -130,6 +189,14 @@ int JackSound::sampleRate() const
 {
 	return jack_get_sample_rate(m_handle->client);
 }
+bool JackSound::isFloat() const
+{
+	return true;
+}
+core::u32 JackSound::outputCount() const
+{
+	return m_handle->split ? CHIP_OUTPUTS : 1;
+}
 
 // useless
 void JackSound::flushBuffer(const core::s16 *Buffer, core::u32 Size)
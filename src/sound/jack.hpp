@@ -17,10 +17,13 @@ public:
 	void setPlaying(bool playing);
 	void initialize(unsigned int sampleRate, unsigned int channels, unsigned int latency_ms);
 	void close();
+	void setSplitOutputs(bool split);
 	void flushBuffer(const core::s16 *Buffer, core::u32 Size);
 	void flush();
 
 	int sampleRate() const;
+	bool isFloat() const;
+	core::u32 outputCount() const;
 private:
 	jacksound_info_t * m_handle;
 };
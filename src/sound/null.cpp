@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <boost/thread/mutex.hpp>
+#include "null.hpp"
+#include "core/time.hpp"
+
+core_api_SoundSink * sound_create()
+{
+	return new NullSound;
+}
+
+struct _nullsound_threading
+{
+	boost::mutex mtx_running;
+};
+
+NullSound::NullSound()
+	: m_sampleRate(0), m_period_size(0), m_req_period_size(0), m_speed(0), m_buf(NULL),
+	  m_frames(0), m_callbacks(0), m_callback_us(0), m_elapsed_us(0),
+	  m_callback_min_us(0), m_callback_max_us(0),
+	  m_running(false)
+{
+	m_threading = new _nullsound_threading;
+
+	const char *speed = getenv("FAMICX_NULL_SOUND_SPEED");
+	if (speed != NULL)
+	{
+		m_speed = atof(speed);
+	}
+}
+NullSound::~NullSound()
+{
+	setPlaying(false);
+	m_thread.wait();
+	NullSound::close();
+
+	delete m_threading;
+}
+
+void NullSound::callback_bootstrap(void *data)
+{
+	NullSound *ns = (NullSound*)data;
+	ns->callback();
+}
+
+void NullSound::callback()
+{
+	core::u32 sz = m_period_size;
+	core::s16 *buf = m_buf;
+
+	core::u32 sr = sampleRate();
+	core::s32 period_us = (core::s32)((core::u64)sz * 1000000 / sr);
+
+	core::timestamp_t start;
+	start.gettime();
+	core::u64 frames = 0;
+
+	bool running = true;
+
+	while (running)
+	{
+		m_threading->mtx_running.lock();
+		running = m_running;
+		m_threading->mtx_running.unlock();
+		if (!running)
+			break;
+
+		core::timestamp_t before, after;
+		before.gettime();
+		performSoundCallback(buf, sz);
+		after.gettime();
+
+		int us = after.diff_us(before);
+		if (m_callbacks == 0 || us < m_callback_min_us)
+			m_callback_min_us = us;
+		if (us > m_callback_max_us)
+			m_callback_max_us = us;
+		m_callback_us += us;
+		m_callbacks++;
+
+		frames += sz;
+
+		if (m_speed > 0)
+		{
+			// pace to the simulated rate. the period just rendered is
+			// "played" from now on, as with a device without latency
+			applyTime(0);
+
+			core::u64 due_us = (core::u64)(frames * 1000000 / sr / m_speed);
+			core::timestamp_t now;
+			now.gettime();
+			core::s64 ahead = (core::s64)due_us - now.diff_us(start);
+			if (ahead > 0)
+			{
+				core::sleep_us((unsigned int)ahead);
+			}
+		}
+		else
+		{
+			// nothing is played, every timestamp is already due
+			applyTime(-period_us);
+		}
+	}
+
+	core::timestamp_t end;
+	end.gettime();
+	m_elapsed_us += end.diff_us(start);
+	m_frames += frames;
+}
+
+void NullSound::setPlaying(bool playing)
+{
+	bool changed = playing != isPlaying();
+
+	if (!changed)
+		return;
+
+	m_threading->mtx_running.lock();
+	m_running = playing;
+	m_threading->mtx_running.unlock();
+
+	SoundSink::setPlaying(playing);
+
+	if (playing)
+	{
+		m_thread.run(callback_bootstrap, this);
+	}
+}
+
+void NullSound::setRealtime(bool realtime)
+{
+	// unpaced, the render loop never blocks and would starve everything
+	// else at realtime priority
+	m_thread.setRealtime(realtime && m_speed > 0);
+}
+
+void NullSound::setBufferSize(unsigned int period_frames, unsigned int)
+{
+	m_req_period_size = period_frames;
+}
+
+void NullSound::initialize(unsigned int sampleRate, unsigned int, unsigned int latency_ms)
+{
+	NullSound::close();
+
+	m_sampleRate = sampleRate;
+
+	m_period_size = m_req_period_size;
+	if (m_period_size == 0)
+	{
+		// same split as the alsa sink
+		m_period_size = sampleRate * latency_ms / 1000 / 4;
+	}
+	if (m_period_size == 0)
+	{
+		m_period_size = 1;
+	}
+
+	m_buf = new core::s16[m_period_size];
+}
+
+void NullSound::close()
+{
+	if (m_callbacks > 0)
+	{
+		printStats();
+	}
+
+	m_frames = 0;
+	m_callbacks = 0;
+	m_callback_us = 0;
+	m_elapsed_us = 0;
+	m_callback_min_us = 0;
+	m_callback_max_us = 0;
+
+	delete[] m_buf;
+	m_buf = NULL;
+}
+
+void NullSound::printStats() const
+{
+	double elapsed = m_elapsed_us / 1000000.0;
+	double audio = double(m_frames) / m_sampleRate;
+
+	fprintf(stderr, "null sound: %llu samples in %.3f s (%.0f samples/s, %.2fx real time)\n",
+			(unsigned long long)m_frames, elapsed,
+			elapsed > 0 ? m_frames / elapsed : 0.0,
+			elapsed > 0 ? audio / elapsed : 0.0);
+	fprintf(stderr, "null sound: %llu callbacks of %u samples, avg %.1f us, min %d us, max %d us\n",
+			(unsigned long long)m_callbacks, m_period_size,
+			double(m_callback_us) / m_callbacks,
+			m_callback_min_us, m_callback_max_us);
+}
+
+int NullSound::sampleRate() const
+{
+	return m_sampleRate;
+}
@@ -0,0 +1,53 @@
+#ifndef _NULL_HPP_
+#define _NULL_HPP_
+
+#include "core/soundsink.hpp"
+#include "soundthread.hpp"
+
+typedef core::SoundSink core_api_SoundSink;
+
+extern "C" core_api_SoundSink * sound_create();
+
+struct _nullsound_threading;
+
+// Pulls sound from the engine and discards it. Without a device to wait on,
+// it renders as fast as possible, or at FAMICX_NULL_SOUND_SPEED times real
+// time if that environment variable is set (eg. 1 for real time).
+// Throughput and callback timing are printed to stderr on close.
+class NullSound : public core::SoundSinkPlayback
+{
+public:
+	NullSound();
+	~NullSound();
+	void initialize(unsigned int sampleRate, unsigned int channels, unsigned int latency_ms);
+	void close();
+	void setPlaying(bool playing);
+	void setBufferSize(unsigned int period_frames, unsigned int buffer_frames);
+	void setRealtime(bool realtime);
+
+	int sampleRate() const;
+private:
+	void callback();
+	static void callback_bootstrap(void *);
+	void printStats() const;
+
+	int m_sampleRate;
+	unsigned int m_period_size;
+	unsigned int m_req_period_size;
+	double m_speed;
+	core::s16 * m_buf;
+
+	// statistics
+	core::u64 m_frames;
+	core::u64 m_callbacks;
+	core::u64 m_callback_us;
+	core::u64 m_elapsed_us;
+	int m_callback_min_us, m_callback_max_us;
+
+	SoundThread m_thread;
+	_nullsound_threading * m_threading;
+	bool m_running;
+};
+
+#endif
+
@@ -1,69 +1,167 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
 #include <boost/thread.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/condition.hpp>
 #include "soundthread.hpp"
+#include "core/trace.hpp"
+#ifdef UNIX
+#	include <pthread.h>
+#	include <sched.h>
+#	include <sys/mman.h>
+#endif
+
+struct _soundthread_threading
+{
+	boost::mutex mtx;
+	boost::condition cond;
+
+	SoundThread::callback_t job;
+	void *jobData;
+	bool busy;
+	bool quit;
+
+	bool realtime;
+	bool realtimeApplied;
+};
 
 SoundThread::SoundThread()
-	: m_thread(NULL), m_running(false)
+	: m_thread(NULL)
 {
+	m_threading = new _soundthread_threading;
+	m_threading->job = NULL;
+	m_threading->jobData = NULL;
+	m_threading->busy = false;
+	m_threading->quit = false;
+	m_threading->realtime = false;
+	m_threading->realtimeApplied = false;
 }
 SoundThread::~SoundThread()
 {
-	wait();
+	if (m_thread != NULL)
+	{
+		{
+			boost::unique_lock<boost::mutex> lock(m_threading->mtx);
+			_waitIdle(lock);
+			m_threading->quit = true;
+			m_threading->cond.notify_all();
+		}
+		m_thread->join();
+		delete m_thread;
+	}
+	delete m_threading;
 }
 
 void SoundThread::run(callback_t f, void *data)
 {
-	m_mtx_running.lock();
-	if (m_thread != NULL)
+	boost::unique_lock<boost::mutex> lock(m_threading->mtx);
+
+	if (m_thread == NULL)
 	{
-		if (m_running)
-		{
-			_wait_nomtx();
-		}
-		_delthread();
+		m_thread = new boost::thread(_worker, this);
+	}
+
+	// a job starting the next one from the worker itself can't wait on
+	// itself. it's picked up as soon as the current job returns
+	if (!_onWorker())
+	{
+		_waitIdle(lock);
 	}
 
-	m_running = true;
-	m_thread = new boost::thread(_job, this, f, data);
-	m_mtx_running.unlock();
+	m_threading->job = f;
+	m_threading->jobData = data;
+	m_threading->busy = true;
+	m_threading->cond.notify_all();
 }
 void SoundThread::wait()
 {
-	m_mtx_running.lock();
-	_wait_nomtx();
-	m_mtx_running.unlock();
+	boost::unique_lock<boost::mutex> lock(m_threading->mtx);
+
+	if (m_thread == NULL || _onWorker())
+	{
+		// waiting on the current thread will deadlock
+		return;
+	}
+
+	_waitIdle(lock);
 }
-void SoundThread::_wait_nomtx()
+
+void SoundThread::setRealtime(bool realtime)
 {
-	if (m_thread == NULL)
-		return;
+	boost::unique_lock<boost::mutex> lock(m_threading->mtx);
+	m_threading->realtime = realtime;
+}
 
-	if (m_running)
-	{
-		if (m_thread->get_id() == boost::this_thread::get_id())
-		{
-			// waiting on the current thread will deadlock
-			return;
-		}
+bool SoundThread::_onWorker() const
+{
+	return m_thread != NULL && m_thread->get_id() == boost::this_thread::get_id();
+}
 
-		// unlock the mutex because _job acquires it
-		m_mtx_running.unlock();
-		m_thread->join();
-		m_mtx_running.lock();
+void SoundThread::_waitIdle(boost::unique_lock<boost::mutex> &lock)
+{
+	while (m_threading->busy)
+	{
+		m_threading->cond.wait(lock);
 	}
-	_delthread();
 }
 
-void SoundThread::_job(SoundThread *t, callback_t f, void *data)
+void SoundThread::_applyRealtime()
 {
-	(*f)(data);
-	t->m_mtx_running.lock();
-	t->m_running = false;
-	t->m_mtx_running.unlock();
+	// only ever upgrades. dropping back would need the old policy kept around
+	if (!m_threading->realtime || m_threading->realtimeApplied)
+		return;
+
+	m_threading->realtimeApplied = true;
+
+#ifdef UNIX
+	struct sched_param param;
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = sched_get_priority_min(SCHED_FIFO) + 10;
+
+	int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if (err != 0)
+	{
+		fprintf(stderr, "Cannot use realtime priority for sound: %s\n", strerror(err));
+	}
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+	{
+		fprintf(stderr, "Cannot lock memory for sound: %s\n", strerror(errno));
+	}
+#endif
 }
 
-void SoundThread::_delthread()
+void SoundThread::_worker(SoundThread *t)
 {
-	delete m_thread;
-	m_thread = NULL;
+	_soundthread_threading *th = t->m_threading;
+
+	core::Trace::setThreadName("sound");
+
+	boost::unique_lock<boost::mutex> lock(th->mtx);
+
+	for (;;)
+	{
+		while (!th->quit && th->job == NULL)
+		{
+			th->cond.wait(lock);
+		}
+		if (th->quit)
+			break;
+
+		callback_t f = th->job;
+		void *data = th->jobData;
+		th->job = NULL;
+		t->_applyRealtime();
+
+		lock.unlock();
+		(*f)(data);
+		lock.lock();
+
+		if (th->job == NULL)
+		{
+			// nothing was queued from within the job
+			th->busy = false;
+			th->cond.notify_all();
+		}
+	}
 }
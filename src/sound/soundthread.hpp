@@ -7,24 +7,35 @@ namespace boost
 {
 	class thread;
 	class mutex;
+	template <typename Mutex> class unique_lock;
 }
 
+struct _soundthread_threading;
+
+// Runs jobs on a worker thread that is created on the first run() and kept
+// parked between jobs, so starting playback doesn't create a thread.
 class SoundThread
 {
 public:
 	typedef void (*callback_t)(void*);
 	SoundThread();
 	~SoundThread();
+	// waits for the previous job to finish, then hands f to the worker
 	void run(callback_t f, void *data);
+	// waits for the current job to finish. the worker stays parked
 	void wait();
+
+	// run jobs with SCHED_FIFO priority and locked memory where permitted.
+	// takes effect from the next job
+	void setRealtime(bool realtime);
 private:
 	boost::thread *m_thread;
-	boost::mutex m_mtx_running;
-	bool m_running;
+	_soundthread_threading *m_threading;
 
-	void _wait_nomtx();
-	static void _job(SoundThread *t, callback_t f, void *data);
-	void _delthread();
+	bool _onWorker() const;
+	void _waitIdle(boost::unique_lock<boost::mutex> &lock);
+	void _applyRealtime();
+	static void _worker(SoundThread *t);
 };
 
 #endif
@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <string>
+#include "famitracker-core/FtmDocument.hpp"
+#include "famitracker-core/FtmJournal.hpp"
+#include "famitracker-core/Instrument.h"
+#include "famitracker-core/Sequence.h"
+#include "core/io.hpp"
+
+// Journals edits to a module, cuts the last record in half as a crash
+// would, and checks that recovering into a newly loaded document gives
+// the module as it was before that record, byte for byte. Runs once with
+// the journal against the module and once against the autosave.
+// usage: journal-recover [edits] [seed]
+
+static const char MODULE_PATH[] = "journal-recover.ftm";
+
+static std::vector<char> readFile(const char *path)
+{
+	core::MappedIO io(path);
+	std::vector<char> data(io.size());
+	if (!data.empty())
+		io.read(&data[0], data.size());
+	return data;
+}
+
+static std::vector<char> documentBytes(const FtmDocument &doc)
+{
+	const char *path = "journal-recover.expected";
+	{
+		core::FileIO io(path, core::IO_WRITE);
+		doc.write(&io);
+	}
+	std::vector<char> data = readFile(path);
+	remove(path);
+	return data;
+}
+
+static void saveModule(const FtmDocument &doc)
+{
+	core::FileIO io(MODULE_PATH, core::IO_WRITE);
+	doc.write(&io);
+}
+
+static void loadModule(FtmDocument &doc)
+{
+	core::MappedIO io(MODULE_PATH);
+	doc.read(&io);
+}
+
+// A random note in one pattern, which the journal keeps in one record
+static void editPattern(FtmDocument &doc)
+{
+	stChanNote note;
+	memset(&note, 0, sizeof(note));
+	note.Note = 1 + rand() % 12;
+	note.Octave = rand() % 8;
+	note.Instrument = 0;
+	note.Vol = rand() % 16;
+	note.EffNumber[0] = rand() % 2 ? EF_VIBRATO : EF_NONE;
+	note.EffParam[0] = rand() % 256;
+	doc.SetDataAtPattern(doc.GetSelectedTrack(), rand() % 4, rand() % doc.GetAvailableChannels(),
+		rand() % doc.GetPatternLength(), &note);
+}
+
+// One random edit of a pattern, an instrument, a sequence or the song info
+static void edit(FtmDocument &doc)
+{
+	switch (rand() % 5)
+	{
+		case 0:
+		case 1:
+			editPattern(doc);
+			break;
+		case 2:
+		{
+			int inst = doc.AddInstrument("lead", SNDCHIP_NONE);
+			if (inst < 0)
+				break;
+			char name[32];
+			sprintf(name, "inst %d", rand() % 1000);
+			doc.SetInstrumentName(inst, name);
+			break;
+		}
+		case 3:
+		{
+			CSequence *seq = doc.GetSequence2A03(rand() % 4, SEQ_VOLUME);
+			seq->SetItemCount(1 + rand() % 16);
+			for (unsigned int i = 0; i < seq->GetItemCount(); i++)
+				seq->SetItem(i, rand() % 16);
+			seq->SetLoopPoint(rand() % seq->GetItemCount());
+			break;
+		}
+		case 4:
+		{
+			char name[32];
+			sprintf(name, "song %d", rand() % 1000);
+			doc.SetSongInfo(name, "artist", "copyright");
+			break;
+		}
+	}
+}
+
+// Makes the edits with a sync after each, keeps the document as it is
+// in expected, then syncs a pattern edit and cuts its record in half
+static bool journalEdits(FtmDocument &doc, FtmJournal &journal, int edits, std::vector<char> &expected)
+{
+	for (int i = 0; i < edits; i++)
+	{
+		edit(doc);
+		if (!journal.sync())
+		{
+			printf("sync %d failed\n", i);
+			return false;
+		}
+	}
+	expected = documentBytes(doc);
+
+	Quantity before = journal.journalSize();
+	editPattern(doc);
+	if (!journal.sync() || journal.journalSize() <= before)
+	{
+		printf("the last sync wrote nothing\n");
+		return false;
+	}
+
+	core::FileIO io(journal.journalPath().c_str(), core::IO_WRITE | core::IO_APPEND);
+	return io.truncate(before + (journal.journalSize() - before) / 2);
+}
+
+// Recovers into a document loaded from the module and compares it with
+// expected
+static bool checkRecover(const std::vector<char> &expected, const char *what)
+{
+	FtmDocument doc;
+	loadModule(doc);
+
+	FtmJournal journal(&doc, MODULE_PATH, 0);
+	int records = journal.recover();
+	if (records <= 0)
+	{
+		printf("%s: recover() returned %d\n", what, records);
+		return false;
+	}
+
+	std::vector<char> recovered = documentBytes(doc);
+	if (recovered != expected)
+	{
+		printf("%s: the recovered module is %u bytes, %u expected, or differs\n",
+			what, (unsigned int)recovered.size(), (unsigned int)expected.size());
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	int edits = argc > 1 ? atoi(argv[1]) : 50;
+	srand(argc > 2 ? atoi(argv[2]) : 1);
+
+	FtmDocument doc;
+	doc.createEmpty();
+	doc.SelectTrack(0);
+	doc.SetFrameCount(4);
+	doc.SetPatternLength(64);
+	doc.AddInstrument("first", SNDCHIP_NONE);
+	saveModule(doc);
+
+	FtmJournal journal(&doc, MODULE_PATH, 0);
+	std::vector<char> expected;
+	int failures = 0;
+
+	// Against the module
+	if (!journal.reset() || !journalEdits(doc, journal, edits, expected))
+		return 1;
+	if (!checkRecover(expected, "module"))
+		failures++;
+
+	// Against the autosave, recovery reads it in place of the module
+	if (!journal.reset())
+		return 1;
+	for (int i = 0; i < edits; i++)
+		edit(doc);
+	if (!journal.sync() || !journal.compact() || !journalEdits(doc, journal, edits, expected))
+		return 1;
+	if (!checkRecover(expected, "autosave"))
+		failures++;
+
+	remove(journal.journalPath().c_str());
+	remove(journal.autosavePath().c_str());
+	remove(MODULE_PATH);
+
+	if (failures > 0)
+		return 1;
+
+	printf("recovered %d edits from the module and the autosave\n", edits);
+	return 0;
+}
@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "famitracker-core/PatternData.h"
+
+// Makes random edits to a tune, some to copies sharing its storage, and
+// checks the cached frame play lengths against a scan of every row.
+// usage: play-length-fuzz [iterations] [seed]
+
+static const int FRAMES = 16;
+static const int CHANNELS = 8;
+static const int PATTERNS = 6;
+
+static unsigned int scanFramePlayLength(const CPatternData &tune, int frame, int channels)
+{
+	unsigned int length = MAX_PATTERN_LENGTH;
+	for (int c = 0; c < channels; c++)
+	{
+		int pattern = tune.GetFramePattern(frame, c);
+		for (unsigned int r = 0; r + 1 < length; r++)
+		{
+			const stChanNote *note = tune.GetPatternData(c, pattern, r);
+			for (int j = 0; j <= tune.GetEffectColumnCount(c); j++)
+			{
+				char effect = note->EffNumber[j];
+				if (effect == EF_JUMP || effect == EF_SKIP || effect == EF_HALT)
+				{
+					length = r + 1;
+					break;
+				}
+			}
+		}
+	}
+	return length > tune.GetPatternLength() ? tune.GetPatternLength() : length;
+}
+
+static void randomEdit(CPatternData *&tune)
+{
+	int op = rand() % 100;
+	int channel = rand() % CHANNELS;
+	int pattern = rand() % PATTERNS;
+
+	if (op < 70)
+	{
+		static const char effects[] = {EF_JUMP, EF_SKIP, EF_HALT, EF_VOLUME, EF_NONE, EF_NONE};
+
+		stChanNote note;
+		memset(&note, 0, sizeof(note));
+		note.Note = NONE;
+		note.Vol = 0x10;
+		note.Instrument = MAX_INSTRUMENTS;
+		note.EffNumber[rand() % MAX_EFFECT_COLUMNS] = effects[rand() % sizeof(effects)];
+		tune->SetPatternData(channel, pattern, rand() % MAX_PATTERN_LENGTH, &note);
+	}
+	else if (op < 85)
+		tune->SetFramePattern(rand() % FRAMES, channel, pattern);
+	else if (op < 90)
+		tune->SetEffectColumnCount(channel, rand() % MAX_EFFECT_COLUMNS);
+	else if (op < 93)
+		tune->ClearPattern(channel, pattern);
+	else if (op < 96)
+		tune->SetPatternLength(16 + rand() % (MAX_PATTERN_LENGTH - 16));
+	else if (op < 98)
+	{
+		// Go on editing a copy, the original keeps the shared storage
+		CPatternData *copy = new CPatternData(*tune);
+		tune->Release();
+		tune = copy;
+	}
+	else if (op < 99)
+		tune->ClearEverything();
+}
+
+int main(int argc, char *argv[])
+{
+	int iterations = argc > 1 ? atoi(argv[1]) : 200000;
+	srand(argc > 2 ? atoi(argv[2]) : 1);
+
+	CPatternData *tune = new CPatternData(64, 6, 150);
+	tune->SetFrameCount(FRAMES);
+
+	for (int it = 0; it < iterations; it++)
+	{
+		randomEdit(tune);
+
+		// Fewer channels when an expansion chip is turned off
+		int channels = rand() % 50 == 0 ? 1 + rand() % CHANNELS : CHANNELS;
+		int frame = rand() % FRAMES;
+
+		unsigned int cached = tune->getFramePlayLength(frame, channels);
+		unsigned int scanned = scanFramePlayLength(*tune, frame, channels);
+		if (cached != scanned)
+		{
+			printf("iteration %d, frame %d, %d channels: %u rows, should be %u\n",
+				it, frame, channels, cached, scanned);
+			tune->Release();
+			return 1;
+		}
+	}
+
+	tune->Release();
+	printf("%d frames match\n", iterations);
+	return 0;
+}
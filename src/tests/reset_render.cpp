@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "famitracker-core/FtmDocument.hpp"
+#include "famitracker-core/SoundGen.hpp"
+#include "famitracker-core/SoundGenPool.hpp"
+#include "famitracker-core/TrackerController.hpp"
+#include "famitracker-core/Instrument.h"
+#include "famitracker-core/Sequence.h"
+#include "famitracker-core/APU/APU.h"
+#include "core/soundsink.hpp"
+
+// Renders a tune on an engine from the pool that played another tune
+// before, and checks the output is the same as from a new engine. Also
+// checks that an engine's VRC7 levels are not those of another engine.
+// usage: reset-render [buffers]
+
+static const int BUFFER_FRAMES = 1024;
+
+// Pulled by hand, so rendering does not depend on a sound thread
+class CaptureSound : public core::SoundSinkPlayback
+{
+public:
+	CaptureSound() : m_sampleRate(0) {}
+	void initialize(unsigned int sampleRate, unsigned int, unsigned int) { m_sampleRate = sampleRate; }
+	void close() {}
+	int sampleRate() const { return m_sampleRate; }
+
+	void render(std::vector<core::s16> &out, int buffers)
+	{
+		core::s16 buf[BUFFER_FRAMES];
+		for (int i = 0; i < buffers; i++)
+		{
+			performSoundCallback(buf, BUFFER_FRAMES);
+			out.insert(out.end(), buf, buf + BUFFER_FRAMES);
+		}
+	}
+private:
+	int m_sampleRate;
+};
+
+// A tune on the 2A03 and chip, with notes and effects on every channel.
+// seed varies the notes
+static void makeDocument(FtmDocument &doc, int chip, int seed)
+{
+	doc.createEmpty();
+	doc.SelectExpansionChip(chip);
+
+	int inst = doc.AddInstrument("lead", SNDCHIP_NONE);
+	CInstrument2A03 *instrument = (CInstrument2A03*)doc.GetInstrument(inst);
+
+	CSequence *volume = doc.GetSequence2A03(0, SEQ_VOLUME);
+	volume->SetItemCount(8);
+	for (int i = 0; i < 8; i++)
+		volume->SetItem(i, 15 - i);
+	volume->SetLoopPoint(4);
+
+	CSequence *arpeggio = doc.GetSequence2A03(0, SEQ_ARPEGGIO);
+	arpeggio->SetItemCount(3);
+	arpeggio->SetItem(0, 0);
+	arpeggio->SetItem(1, 4 + seed % 3);
+	arpeggio->SetItem(2, 7);
+	arpeggio->SetLoopPoint(0);
+
+	instrument->SetSeqEnable(SEQ_VOLUME, 1);
+	instrument->SetSeqIndex(SEQ_VOLUME, 0);
+	instrument->SetSeqEnable(SEQ_ARPEGGIO, 1);
+	instrument->SetSeqIndex(SEQ_ARPEGGIO, 0);
+
+	int chipInst = chip != SNDCHIP_NONE ? doc.AddInstrument("chip", chip) : inst;
+
+	doc.SelectTrack(0);
+	doc.SetFrameCount(2);
+	doc.SetPatternLength(64);
+
+	unsigned int channels = doc.GetAvailableChannels();
+	for (unsigned int c = 0; c < channels; c++)
+	{
+		doc.SetEffColumns(c, 1);
+		for (int f = 0; f < 2; f++)
+		{
+			doc.SetPatternAtFrame(f, c, f);
+			for (int r = 0; r < 64; r++)
+			{
+				stChanNote note;
+				memset(&note, 0, sizeof(note));
+				note.Instrument = MAX_INSTRUMENTS;
+				note.Vol = 0x10;
+				if ((r + c + seed) % 4 == 0)
+				{
+					note.Note = 1 + (r + f + seed) % 12;
+					note.Octave = 3;
+					note.Instrument = c < 5 ? inst : chipInst;
+				}
+				if (r % 8 == 2)
+				{
+					note.EffNumber[0] = EF_VIBRATO;
+					note.EffParam[0] = 0x46;
+				}
+				if (r % 16 == 5)
+				{
+					note.EffNumber[0] = EF_ARPEGGIO;
+					note.EffParam[0] = 0x37;
+				}
+				doc.SetDataAtPattern(0, f, c, r, &note);
+			}
+		}
+	}
+}
+
+static void start(SoundGen *sg)
+{
+	sg->trackerController()->startAt(0, 0);
+	sg->startTracker();
+}
+
+// Renders doc on a new engine
+static void renderNew(FtmDocument *doc, int buffers, std::vector<core::s16> &out)
+{
+	CaptureSound sink;
+	sink.initialize(48000, 1, 150);
+
+	SoundGen *sg = new SoundGen;
+	sg->setSoundSink(&sink);
+	sg->setDocument(doc);
+	start(sg);
+	sink.render(out, buffers);
+	sg->setSoundSink(NULL);
+	delete sg;
+}
+
+// Renders a on an engine from pool, then b on the same engine after a reset
+static bool renderReused(SoundGenPool &pool, FtmDocument *a, FtmDocument *b, int buffers, std::vector<core::s16> &out)
+{
+	CaptureSound sinkA, sinkB;
+	sinkA.initialize(48000, 1, 150);
+	sinkB.initialize(48000, 1, 150);
+
+	SoundGen *first = pool.acquire(a, &sinkA);
+	start(first);
+	std::vector<core::s16> ignored;
+	sinkA.render(ignored, buffers / 3 + 7);
+	pool.release(first);
+
+	SoundGen *second = pool.acquire(b, &sinkB);
+	start(second);
+	sinkB.render(out, buffers);
+	pool.release(second);
+
+	return first == second;
+}
+
+static bool checkLevels(FtmDocument *vrc7, FtmDocument *other, int buffers)
+{
+	CaptureSound sinkA, sinkB;
+	sinkA.initialize(48000, 1, 150);
+	sinkB.initialize(48000, 1, 150);
+
+	SoundGen *a = new SoundGen, *b = new SoundGen;
+	a->setSoundSink(&sinkA);
+	b->setSoundSink(&sinkB);
+	a->setDocument(vrc7);
+	b->setDocument(other);
+	start(a);
+	start(b);
+
+	bool ok = true;
+	std::vector<core::s16> ignored;
+	for (int i = 0; i < buffers && ok; i++)
+	{
+		sinkA.render(ignored, 1);
+		sinkB.render(ignored, 1);
+		for (int c = CHANID_VRC7_CH1; c <= CHANID_VRC7_CH6; c++)
+		{
+			if (b->apu()->GetVol(c) != 0)
+			{
+				printf("buffer %d: VRC7 channel %d has a level in an engine without VRC7\n",
+					i, c - CHANID_VRC7_CH1 + 1);
+				ok = false;
+			}
+		}
+	}
+
+	a->setSoundSink(NULL);
+	b->setSoundSink(NULL);
+	delete a;
+	delete b;
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	int buffers = argc > 1 ? atoi(argv[1]) : 150;
+
+	static const int chips[] = {SNDCHIP_NONE, SNDCHIP_VRC6, SNDCHIP_VRC7, SNDCHIP_FDS};
+	static const char *names[] = {"2A03", "VRC6", "VRC7", "FDS"};
+	const int count = sizeof(chips) / sizeof(chips[0]);
+
+	FtmDocument docs[count];
+	std::vector<core::s16> fresh[count];
+	for (int i = 0; i < count; i++)
+	{
+		makeDocument(docs[i], chips[i], i);
+		renderNew(&docs[i], buffers, fresh[i]);
+	}
+
+	SoundGenPool pool(1);
+	int failures = 0;
+
+	for (int a = 0; a < count; a++)
+	{
+		for (int b = 0; b < count; b++)
+		{
+			std::vector<core::s16> reused;
+			if (!renderReused(pool, &docs[a], &docs[b], buffers, reused))
+			{
+				printf("%s after %s: the pool made a new engine\n", names[b], names[a]);
+				failures++;
+				continue;
+			}
+
+			unsigned int i = 0;
+			while (i < reused.size() && reused[i] == fresh[b][i])
+				i++;
+			if (i < reused.size())
+			{
+				printf("%s after %s: sample %u is %d, a new engine gives %d\n",
+					names[b], names[a], i, reused[i], fresh[b][i]);
+				failures++;
+			}
+		}
+	}
+
+	if (!checkLevels(&docs[2], &docs[1], buffers))
+		failures++;
+
+	if (failures > 0)
+		return 1;
+
+	printf("%d reused renders match\n", count * count);
+	return 0;
+}
@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "famitracker-core/Sequence.h"
+#include "famitracker-core/FamiTrackerTypes.h"
+
+// Runs random sequences through the compiled steps of CSequence::Run() and
+// through RunInterpreted(), which is the original player, and fails on the
+// first step where they differ.
+// usage: sequence-fuzz [iterations] [seed]
+
+static int randomPoint(int items)
+{
+	// Points past the items and way out of range come from broken files
+	switch (rand() % 4)
+	{
+	case 0:
+		return -1;
+	case 1:
+		return rand() % (items + 2);
+	case 2:
+		return rand() % 300;
+	default:
+		return rand() % (items > 0 ? items : 1);
+	}
+}
+
+static void randomize(CSequence &seq)
+{
+	int items = rand() % 8 == 0 ? rand() % (MAX_SEQUENCE_ITEMS + 1) : rand() % 12;
+	seq.SetItemCount(items);
+	for (int i = 0; i < MAX_SEQUENCE_ITEMS; i++)
+		seq.SetItem(i, (signed char)(rand() & 0xFF));
+
+	// Setting one point can clear the other, try both orders
+	if (rand() & 1)
+	{
+		seq.SetLoopPoint(randomPoint(items));
+		seq.SetReleasePoint(randomPoint(items));
+	}
+	else
+	{
+		seq.SetReleasePoint(randomPoint(items));
+		seq.SetLoopPoint(randomPoint(items));
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int iterations = argc > 1 ? atoi(argv[1]) : 200000;
+	srand(argc > 2 ? atoi(argv[2]) : 1);
+
+	CSequence edited, copied;
+	long steps = 0;
+	for (int it = 0; it < iterations; it++)
+	{
+		if (it == 0 || rand() % 4 == 0)
+			randomize(edited);
+		else if (rand() % 3 == 0 && edited.GetItemCount() > 0)
+			edited.SetItem(rand() % edited.GetItemCount(), (signed char)(rand() & 0xFF));
+
+		// Copies are compiled when made rather than on the first run
+		CSequence *seq = &edited;
+		if (rand() % 4 == 0)
+		{
+			copied.Copy(&edited);
+			seq = &copied;
+		}
+
+		int items = seq->GetItemCount();
+		int compiled = rand() % (items + 3);
+		if (compiled > MAX_SEQUENCE_ITEMS - 1)
+			compiled = MAX_SEQUENCE_ITEMS - 1;
+		int interpreted = compiled;
+
+		bool released = false;
+		for (int n = 0; n < 64; n++)
+		{
+			if (rand() % 16 == 0)
+				released = !released;
+
+			bool compiledEnd, interpretedEnd;
+			int a = seq->Run(compiled, released, compiledEnd);
+			int b = seq->RunInterpreted(interpreted, released, interpretedEnd);
+			steps++;
+
+			if (a != b || compiled != interpreted || compiledEnd != interpretedEnd)
+			{
+				printf("iteration %d, %d items, loop %d, release %d%s: "
+					"value %d/%d, next %d/%d, end %d/%d\n",
+					it, items, (int)seq->GetLoopPoint(), (int)seq->GetReleasePoint(),
+					released ? ", released" : "", a, b, compiled, interpreted,
+					compiledEnd, interpretedEnd);
+				return 1;
+			}
+
+			if (compiledEnd || compiled < 0 || compiled >= MAX_SEQUENCE_ITEMS)
+				break;
+		}
+	}
+
+	printf("%ld steps match\n", steps);
+	return 0;
+}
@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include "famitracker-core/FtmDocument.hpp"
+#include "famitracker-core/SoundGen.hpp"
+#include "famitracker-core/TrackerController.hpp"
+#include "famitracker-core/Instrument.h"
+#include "famitracker-core/Sequence.h"
+#include "core/time.hpp"
+#include "sound/null.hpp"
+
+// Counts the allocations made while starting and stopping playback, by
+// auditioning notes in a row and starting the tracker, on the null sink.
+// Starting playback is expected not to allocate at all.
+// usage: start-allocs [cycles]
+
+static volatile bool counting = false;
+static volatile long allocs = 0;
+
+static void *countedAlloc(size_t sz)
+{
+	if (counting)
+		__sync_fetch_and_add(&allocs, 1);
+
+	void *p = malloc(sz);
+	if (p == NULL)
+		throw std::bad_alloc();
+	return p;
+}
+
+void *operator new(size_t sz)
+{
+	return countedAlloc(sz);
+}
+
+void *operator new[](size_t sz)
+{
+	return countedAlloc(sz);
+}
+
+void operator delete(void *p) throw()
+{
+	free(p);
+}
+
+void operator delete[](void *p) throw()
+{
+	free(p);
+}
+
+void operator delete(void *p, size_t) throw()
+{
+	free(p);
+}
+
+void operator delete[](void *p, size_t) throw()
+{
+	free(p);
+}
+
+// A VRC6 tune with an instrument running volume and arpeggio sequences,
+// and notes with effects on every channel
+static void makeDocument(FtmDocument &doc)
+{
+	doc.createEmpty();
+	doc.SelectExpansionChip(SNDCHIP_VRC6);
+
+	int inst = doc.AddInstrument("lead", SNDCHIP_NONE);
+	CInstrument2A03 *instrument = (CInstrument2A03*)doc.GetInstrument(inst);
+
+	CSequence *volume = doc.GetSequence2A03(0, SEQ_VOLUME);
+	volume->SetItemCount(8);
+	for (int i = 0; i < 8; i++)
+		volume->SetItem(i, 15 - i);
+	volume->SetLoopPoint(4);
+
+	CSequence *arpeggio = doc.GetSequence2A03(0, SEQ_ARPEGGIO);
+	arpeggio->SetItemCount(3);
+	arpeggio->SetItem(0, 0);
+	arpeggio->SetItem(1, 4);
+	arpeggio->SetItem(2, 7);
+	arpeggio->SetLoopPoint(0);
+
+	instrument->SetSeqEnable(SEQ_VOLUME, 1);
+	instrument->SetSeqIndex(SEQ_VOLUME, 0);
+	instrument->SetSeqEnable(SEQ_ARPEGGIO, 1);
+	instrument->SetSeqIndex(SEQ_ARPEGGIO, 0);
+
+	doc.SelectTrack(0);
+	doc.SetFrameCount(2);
+	doc.SetPatternLength(64);
+
+	unsigned int channels = doc.GetAvailableChannels();
+	for (unsigned int c = 0; c < channels; c++)
+	{
+		doc.SetEffColumns(c, 1);
+		for (int f = 0; f < 2; f++)
+		{
+			doc.SetPatternAtFrame(f, c, f);
+			for (int r = 0; r < 64; r++)
+			{
+				stChanNote note;
+				memset(&note, 0, sizeof(note));
+				note.Instrument = MAX_INSTRUMENTS;
+				note.Vol = 0x10;
+				if ((r + c) % 4 == 0)
+				{
+					note.Note = 1 + (r + f) % 12;
+					note.Octave = 3;
+					note.Instrument = inst;
+				}
+				if (r % 8 == 2)
+				{
+					note.EffNumber[0] = EF_VIBRATO;
+					note.EffParam[0] = 0x46;
+				}
+				if (r % 16 == 5)
+				{
+					note.EffNumber[0] = EF_ARPEGGIO;
+					note.EffParam[0] = 0x37;
+				}
+				doc.SetDataAtPattern(0, f, c, r, &note);
+			}
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int cycles = argc > 1 ? atoi(argv[1]) : 20;
+
+	FtmDocument doc;
+	makeDocument(doc);
+
+	NullSound *sink = new NullSound;
+	sink->initialize(48000, 1, 150);
+
+	SoundGen *gen = new SoundGen;
+	gen->setSoundSink(sink);
+	gen->setDocument(&doc);
+
+	// the first session starts the worker thread, which is allowed to allocate
+	gen->auditionNote(3, 3, 0, 0);
+	core::sleep_us(20000);
+	gen->auditionHalt();
+	core::sleep_us(200000);
+
+	counting = true;
+	for (int i = 0; i < cycles; i++)
+	{
+		gen->auditionNote(i % 12, 3, 0, i % 2);
+		core::sleep_us(5000);
+		gen->auditionHalt();
+		core::sleep_us(5000);
+
+		gen->trackerController()->startAt(0, 0);
+		gen->startTracker();
+		core::sleep_us(5000);
+		gen->stopTracker();
+	}
+	counting = false;
+
+	sink->blockUntilStopped();
+	delete sink;
+	delete gen;
+
+	printf("%ld allocations in %d audition and tracker sessions\n", allocs, cycles);
+	return allocs == 0 ? 0 : 1;
+}
@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "famitracker-core/FtmDocument.hpp"
+#include "famitracker-core/UndoHistory.hpp"
+#include "famitracker-core/Instrument.h"
+#include "famitracker-core/Sequence.h"
+#include "core/io.hpp"
+
+// Makes random edits with a checkpoint before each, then undoes and
+// redoes them all. Every step must give the document as it was, byte for
+// byte, no more than depth steps may be undone, and the instrument and
+// sequence an editor holds must stay the ones in the document.
+// usage: undo-history [edits] [depth] [seed]
+
+static std::vector<char> documentBytes(const FtmDocument &doc)
+{
+	const char *path = "undo-history.ftm";
+	{
+		core::FileIO io(path, core::IO_WRITE);
+		doc.write(&io);
+	}
+
+	std::vector<char> data;
+	{
+		core::MappedIO io(path);
+		data.resize(io.size());
+		if (!data.empty())
+			io.read(&data[0], data.size());
+	}
+	remove(path);
+	return data;
+}
+
+// One random edit, the instrument and sequence are edited through the
+// pointers an editor would hold
+static void edit(FtmDocument &doc, CInstrument2A03 *inst, CSequence *seq)
+{
+	switch (rand() % 5)
+	{
+		case 0:
+		case 1:
+		{
+			stChanNote note;
+			memset(&note, 0, sizeof(note));
+			note.Note = 1 + rand() % 12;
+			note.Octave = rand() % 8;
+			note.Instrument = 0;
+			note.Vol = rand() % 16;
+			doc.SetDataAtPattern(doc.GetSelectedTrack(), rand() % 4, rand() % doc.GetAvailableChannels(),
+				rand() % doc.GetPatternLength(), &note);
+			break;
+		}
+		case 2:
+			inst->SetSeqIndex(SEQ_ARPEGGIO, rand() % 4);
+			inst->SetSeqEnable(SEQ_ARPEGGIO, rand() % 2);
+			break;
+		case 3:
+			if (seq->GetItemCount() > 0 && rand() % 2)
+			{
+				seq->SetItem(rand() % seq->GetItemCount(), rand() % 16);
+				break;
+			}
+			seq->SetItemCount(1 + rand() % 16);
+			for (unsigned int i = 0; i < seq->GetItemCount(); i++)
+				seq->SetItem(i, rand() % 16);
+			break;
+		case 4:
+		{
+			char name[32];
+			sprintf(name, "song %d", rand() % 1000);
+			doc.SetSongInfo(name, "artist", "copyright");
+			break;
+		}
+	}
+}
+
+static bool check(FtmDocument &doc, const std::vector<char> &expected, CInstrument *inst, CSequence *seq,
+	const char *what, int step)
+{
+	if (doc.GetInstrument(0) != inst || doc.GetSequence2A03_readonly(0, SEQ_VOLUME) != seq)
+	{
+		printf("%s %d: the instrument or sequence was replaced\n", what, step);
+		return false;
+	}
+	if (documentBytes(doc) != expected)
+	{
+		printf("%s %d: the document differs\n", what, step);
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	int edits = argc > 1 ? atoi(argv[1]) : 100;
+	int depth = argc > 2 ? atoi(argv[2]) : 64;
+	srand(argc > 3 ? atoi(argv[3]) : 1);
+
+	FtmDocument doc;
+	doc.createEmpty();
+	doc.SelectTrack(0);
+	doc.SetFrameCount(4);
+	doc.SetPatternLength(64);
+
+	CInstrument2A03 *inst = (CInstrument2A03*)doc.GetInstrument(doc.AddInstrument("lead", SNDCHIP_NONE));
+	CSequence *seq = doc.GetSequence2A03(0, SEQ_VOLUME);
+	inst->SetSeqEnable(SEQ_VOLUME, 1);
+	inst->SetSeqIndex(SEQ_VOLUME, 0);
+
+	UndoHistory history(&doc, depth);
+
+	std::vector< std::vector<char> > states;
+	states.push_back(documentBytes(doc));
+	for (int i = 0; i < edits; i++)
+	{
+		history.checkpoint();
+		edit(doc, inst, seq);
+		states.push_back(documentBytes(doc));
+	}
+
+	int undone = 0;
+	while (history.undo())
+	{
+		undone++;
+		if (!check(doc, states[edits - undone], inst, seq, "undo", undone))
+			return 1;
+	}
+
+	int expected = edits < depth ? edits : depth;
+	if (undone != expected)
+	{
+		printf("%d steps could be undone, %d expected\n", undone, expected);
+		return 1;
+	}
+
+	for (int i = undone - 1; i >= 0; i--)
+	{
+		if (!history.redo() || !check(doc, states[edits - i], inst, seq, "redo", undone - i))
+			return 1;
+	}
+	if (history.canRedo())
+	{
+		printf("redo went past the last edit\n");
+		return 1;
+	}
+
+	// An edit after an undo drops what could be redone
+	history.undo();
+	history.checkpoint();
+	edit(doc, inst, seq);
+	if (history.canRedo())
+	{
+		printf("an edit kept the redo steps\n");
+		return 1;
+	}
+
+	printf("undid and redid %d of %d edits\n", undone, edits);
+	return 0;
+}